@@ -0,0 +1,279 @@
+#include "bvh.h"
+#include "simd4.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cstring>
+
+namespace cpubake {
+
+using simd4::float4;
+
+static constexpr uint32_t MAX_LEAF_TRIANGLES = 4;
+static constexpr uint32_t SAH_BIN_COUNT = 12;
+static constexpr uint32_t MAX_TRAVERSE_DEPTH = 128;
+//SAH may produce unbalanced trees, fall back to median split when a branch goes too deep
+static constexpr uint32_t MAX_SAH_DEPTH = MAX_TRAVERSE_DEPTH / 2;
+
+static inline float
+box_area(const glm::vec3 &bmin, const glm::vec3 &bmax){
+    const auto e = bmax - bmin;
+    return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+void BVH::Build(const std::vector<Triangle> &triangles){
+    m_nodes.clear();
+    m_packets.clear();
+    m_triangles = triangles;
+    if (triangles.empty())
+        return;
+
+    std::vector<BuildItem> items(triangles.size());
+    for (uint32_t ii=0; ii<(uint32_t)triangles.size(); ++ii){
+        const auto &t = triangles[ii];
+        auto &it = items[ii];
+        it.bmin = glm::min(t.v0, glm::min(t.v1, t.v2));
+        it.bmax = glm::max(t.v0, glm::max(t.v1, t.v2));
+        it.center = (it.bmin + it.bmax) * 0.5f;
+        it.prim = ii;
+    }
+
+    m_nodes.reserve(triangles.size() * 2 / MAX_LEAF_TRIANGLES + 1);
+    m_packets.reserve(triangles.size() / 2 + 1);
+    BuildRecursive(items, 0, (uint32_t)items.size(), 0);
+}
+
+uint32_t BVH::BuildRecursive(std::vector<BuildItem> &items, uint32_t begin, uint32_t end, uint32_t depth){
+    const uint32_t nodeidx = (uint32_t)m_nodes.size();
+    m_nodes.emplace_back();
+
+    glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX), cmin(FLT_MAX), cmax(-FLT_MAX);
+    for (uint32_t ii=begin; ii<end; ++ii){
+        bmin = glm::min(bmin, items[ii].bmin);
+        bmax = glm::max(bmax, items[ii].bmax);
+        cmin = glm::min(cmin, items[ii].center);
+        cmax = glm::max(cmax, items[ii].center);
+    }
+
+    const uint32_t count = end - begin;
+    auto make_leaf = [&](){
+        Packet p;
+        memset(&p, 0, sizeof(p));
+        for (uint32_t ii=0; ii<count; ++ii){
+            const auto &t = m_triangles[items[begin+ii].prim];
+            const auto e1 = t.v1 - t.v0, e2 = t.v2 - t.v0;
+            for (int c=0; c<3; ++c){
+                p.v0[c][ii] = t.v0[c];
+                p.e1[c][ii] = e1[c];
+                p.e2[c][ii] = e2[c];
+            }
+            p.prim[ii] = items[begin+ii].prim;
+        }
+        //unused lanes keep zero edges, their determinant is 0 and they never hit
+        for (uint32_t ii=count; ii<4; ++ii){
+            p.prim[ii] = UINT32_MAX;
+        }
+        auto &n = m_nodes[nodeidx];
+        n.bmin = bmin; n.bmax = bmax;
+        n.first = (uint32_t)m_packets.size();
+        n.count = count;
+        n.axis = 0;
+        m_packets.push_back(p);
+        return nodeidx;
+    };
+
+    if (count <= MAX_LEAF_TRIANGLES)
+        return make_leaf();
+
+    // binned SAH on the longest centroid axis
+    const auto cextent = cmax - cmin;
+    uint32_t axis = 0;
+    if (cextent.y > cextent[axis]) axis = 1;
+    if (cextent.z > cextent[axis]) axis = 2;
+
+    uint32_t mid = begin + count / 2;
+    if (cextent[axis] > 0.f && depth < MAX_SAH_DEPTH){
+        struct Bin {
+            glm::vec3 bmin = glm::vec3(FLT_MAX);
+            glm::vec3 bmax = glm::vec3(-FLT_MAX);
+            uint32_t count = 0;
+        } bins[SAH_BIN_COUNT];
+
+        const float scale = SAH_BIN_COUNT / cextent[axis];
+        auto bin_index = [&](const BuildItem &it){
+            return std::min(SAH_BIN_COUNT-1, (uint32_t)((it.center[axis] - cmin[axis]) * scale));
+        };
+        for (uint32_t ii=begin; ii<end; ++ii){
+            auto &b = bins[bin_index(items[ii])];
+            b.bmin = glm::min(b.bmin, items[ii].bmin);
+            b.bmax = glm::max(b.bmax, items[ii].bmax);
+            ++b.count;
+        }
+
+        float rightcost[SAH_BIN_COUNT];
+        {
+            glm::vec3 rmin(FLT_MAX), rmax(-FLT_MAX);
+            uint32_t rcount = 0;
+            for (uint32_t ii=SAH_BIN_COUNT-1; ii>0; --ii){
+                rmin = glm::min(rmin, bins[ii].bmin);
+                rmax = glm::max(rmax, bins[ii].bmax);
+                rcount += bins[ii].count;
+                rightcost[ii] = rcount ? box_area(rmin, rmax) * rcount : 0.f;
+            }
+        }
+
+        float bestcost = FLT_MAX;
+        uint32_t bestsplit = 0;
+        glm::vec3 lmin(FLT_MAX), lmax(-FLT_MAX);
+        uint32_t lcount = 0;
+        for (uint32_t ii=0; ii<SAH_BIN_COUNT-1; ++ii){
+            lmin = glm::min(lmin, bins[ii].bmin);
+            lmax = glm::max(lmax, bins[ii].bmax);
+            lcount += bins[ii].count;
+            if (lcount == 0 || lcount == count)
+                continue;
+            const float cost = box_area(lmin, lmax) * lcount + rightcost[ii+1];
+            if (cost < bestcost){
+                bestcost = cost;
+                bestsplit = ii;
+            }
+        }
+
+        if (bestcost < FLT_MAX){
+            auto it = std::partition(items.begin()+begin, items.begin()+end, [&](const BuildItem &item){
+                return bin_index(item) <= bestsplit;
+            });
+            mid = (uint32_t)(it - items.begin());
+        }
+    }
+
+    if (mid == begin || mid == end){
+        mid = begin + count / 2;
+        std::nth_element(items.begin()+begin, items.begin()+mid, items.begin()+end, [axis](const auto &lhs, const auto &rhs){
+            return lhs.center[axis] < rhs.center[axis];
+        });
+    }
+
+    const uint32_t left = BuildRecursive(items, begin, mid, depth+1);
+    const uint32_t right = BuildRecursive(items, mid, end, depth+1);
+    assert(left == nodeidx + 1);
+    (void)left;
+
+    auto &n = m_nodes[nodeidx];
+    n.bmin = bmin; n.bmax = bmax;
+    n.first = right;
+    n.count = 0;
+    n.axis = axis;
+    return nodeidx;
+}
+
+static inline bool
+ray_box(const glm::vec3 &bmin, const glm::vec3 &bmax, const glm::vec3 &origin, const glm::vec3 &invdir, float tmin, float tmax, float &tnear){
+    const auto t0 = (bmin - origin) * invdir;
+    const auto t1 = (bmax - origin) * invdir;
+    const auto tsmall = glm::min(t0, t1);
+    const auto tbig = glm::max(t0, t1);
+    tnear = std::max(tmin, std::max(tsmall.x, std::max(tsmall.y, tsmall.z)));
+    const float tfar = std::min(tmax, std::min(tbig.x, std::min(tbig.y, tbig.z)));
+    return tnear <= tfar;
+}
+
+template<bool AnyHit>
+bool BVH::Traverse(const Ray &r, Hit &hit) const {
+    if (m_nodes.empty())
+        return false;
+
+    const glm::vec3 invdir = 1.f / r.dir;
+    const float4 ox = float4::splat(r.origin.x), oy = float4::splat(r.origin.y), oz = float4::splat(r.origin.z);
+    const float4 dx = float4::splat(r.dir.x),    dy = float4::splat(r.dir.y),    dz = float4::splat(r.dir.z);
+    const float4 zero = float4::splat(0.f), one = float4::splat(1.f), eps = float4::splat(1e-12f);
+    const float4 tmin4 = float4::splat(r.tmin);
+
+    float tmax = r.tmax;
+    bool found = false;
+
+    uint32_t stack[MAX_TRAVERSE_DEPTH];
+    uint32_t sp = 0;
+    stack[sp++] = 0;
+    while (sp > 0){
+        const uint32_t nodeidx = stack[--sp];
+        const auto &n = m_nodes[nodeidx];
+        float tnear;
+        if (!ray_box(n.bmin, n.bmax, r.origin, invdir, r.tmin, tmax, tnear))
+            continue;
+
+        if (n.count == 0){
+            // visit the near child first
+            const uint32_t left = nodeidx + 1, right = n.first;
+            if (r.dir[n.axis] < 0.f){
+                stack[sp++] = left;
+                stack[sp++] = right;
+            } else {
+                stack[sp++] = right;
+                stack[sp++] = left;
+            }
+            assert(sp < MAX_TRAVERSE_DEPTH);
+            continue;
+        }
+
+        const auto &p = m_packets[n.first];
+        const float4 e1x = float4::load(p.e1[0]), e1y = float4::load(p.e1[1]), e1z = float4::load(p.e1[2]);
+        const float4 e2x = float4::load(p.e2[0]), e2y = float4::load(p.e2[1]), e2z = float4::load(p.e2[2]);
+
+        // moller-trumbore, 4 triangles at once
+        const float4 px = dy * e2z - dz * e2y;
+        const float4 py = dz * e2x - dx * e2z;
+        const float4 pz = dx * e2y - dy * e2x;
+        const float4 det = e1x * px + e1y * py + e1z * pz;
+        const float4 invdet = one / det;
+
+        const float4 tx = ox - float4::load(p.v0[0]);
+        const float4 ty = oy - float4::load(p.v0[1]);
+        const float4 tz = oz - float4::load(p.v0[2]);
+        const float4 u = (tx * px + ty * py + tz * pz) * invdet;
+
+        const float4 qx = ty * e1z - tz * e1y;
+        const float4 qy = tz * e1x - tx * e1z;
+        const float4 qz = tx * e1y - ty * e1x;
+        const float4 v = (dx * qx + dy * qy + dz * qz) * invdet;
+        const float4 t = (e2x * qx + e2y * qy + e2z * qz) * invdet;
+
+        const float4 mask = cmpgt(abs4(det), eps)
+            & cmpge(u, zero) & cmpge(v, zero) & cmpge(one, u + v)
+            & cmpgt(t, tmin4) & cmplt(t, float4::splat(tmax));
+
+        int bits = movemask(mask);
+        if (bits == 0)
+            continue;
+        if constexpr (AnyHit) {
+            return true;
+        }
+
+        alignas(16) float tt[4], uu[4], vv[4];
+        store(tt, t); store(uu, u); store(vv, v);
+        for (int ii=0; ii<4; ++ii){
+            if ((bits & (1 << ii)) && tt[ii] < tmax){
+                tmax = tt[ii];
+                hit.t = tt[ii];
+                hit.u = uu[ii];
+                hit.v = vv[ii];
+                hit.prim = p.prim[ii];
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+bool BVH::Intersect(const Ray &r, Hit &hit) const {
+    hit.prim = UINT32_MAX;
+    return Traverse<false>(r, hit);
+}
+
+bool BVH::Occluded(const Ray &r) const {
+    Hit hit;
+    return Traverse<true>(r, hit);
+}
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace cpubake {
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 dir;
+    float tmin;
+    float tmax;
+};
+
+struct Hit {
+    float t;
+    float u, v;
+    uint32_t prim;  //UINT32_MAX means no hit
+};
+
+struct Triangle {
+    glm::vec3 v0, v1, v2;
+};
+
+// binary bvh built with binned SAH, every leaf owns one packet of up to 4 triangles
+// stored as structure of arrays, so a leaf is tested with one 4-lane intersection.
+class BVH {
+public:
+    void Build(const std::vector<Triangle> &triangles);
+    bool Intersect(const Ray &r, Hit &hit) const;
+    bool Occluded(const Ray &r) const;
+
+    const Triangle& GetTriangle(uint32_t prim) const { return m_triangles[prim]; }
+    glm::vec3 GetMin() const { return m_nodes.empty() ? glm::vec3(0.f) : m_nodes[0].bmin; }
+    glm::vec3 GetMax() const { return m_nodes.empty() ? glm::vec3(0.f) : m_nodes[0].bmax; }
+
+private:
+    struct Node {
+        glm::vec3 bmin;
+        uint32_t  first;    //right child index for inner node(left child is next to it), packet index for leaf
+        glm::vec3 bmax;
+        uint32_t  count;    //0 for inner node, triangle count for leaf
+        uint32_t  axis;
+    };
+
+    struct alignas(16) Packet {
+        float v0[3][4];
+        float e1[3][4];
+        float e2[3][4];
+        uint32_t prim[4];
+    };
+
+    struct BuildItem {
+        glm::vec3 bmin, bmax, center;
+        uint32_t prim;
+    };
+
+    uint32_t BuildRecursive(std::vector<BuildItem> &items, uint32_t begin, uint32_t end, uint32_t depth);
+    template<bool AnyHit>
+    bool Traverse(const Ray &r, Hit &hit) const;
+
+private:
+    std::vector<Node>       m_nodes;
+    std::vector<Packet>     m_packets;
+    std::vector<Triangle>   m_triangles;
+};
+
+}
@@ -0,0 +1,532 @@
+#include "cpu_baker.h"
+#include "bvh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <thread>
+
+namespace cpubake {
+
+static constexpr float PI = 3.14159265358979323846f;
+
+struct MeshInfo {
+    std::vector<glm::vec3>  positions;  //world space
+    std::vector<glm::vec3>  normals;    //world space
+    std::vector<glm::vec2>  lmuvs;
+    std::vector<uint32_t>   indices;
+    uint32_t                firstprim;
+    uint16_t                lmsize;
+    float                   texelworld; //average world size of one lightmap texel
+};
+
+struct Texel {
+    glm::vec3 pos;
+    glm::vec3 normal;
+    bool valid;
+};
+
+struct LightmapTarget {
+    uint32_t meshidx;
+    std::vector<Texel>      texels;
+    std::vector<glm::vec3>  direct;
+    std::vector<glm::vec3>  indirect;
+};
+
+static inline const char*
+src_ptr(const BufferData &b, size_t idx, size_t elemsize){
+    return b.data + b.offset + idx * (b.stride ? b.stride : elemsize);
+}
+
+static inline glm::vec3
+read_vec3(const BufferData &b, size_t idx){
+    assert(b.type == BT_Float);
+    const float *v = (const float*)src_ptr(b, idx, sizeof(float) * 3);
+    return glm::vec3(v[0], v[1], v[2]);
+}
+
+static inline glm::vec2
+read_vec2(const BufferData &b, size_t idx){
+    assert(b.type == BT_Float);
+    const float *v = (const float*)src_ptr(b, idx, sizeof(float) * 2);
+    return glm::vec2(v[0], v[1]);
+}
+
+static inline uint32_t
+read_index(const BufferData &b, size_t idx){
+    switch (b.type){
+    case BT_Uint16: return *(const uint16_t*)src_ptr(b, idx, sizeof(uint16_t));
+    case BT_Uint32: return *(const uint32_t*)src_ptr(b, idx, sizeof(uint32_t));
+    default: return (uint32_t)idx;
+    }
+}
+
+static inline glm::vec3
+transform_point(const glm::mat4 &m, const glm::vec3 &p){
+    return glm::vec3(m * glm::vec4(p, 1.f));
+}
+
+static inline glm::vec3
+transform_dir(const glm::mat4 &m, const glm::vec3 &d){
+    const auto r = glm::vec3(m * glm::vec4(d, 0.f));
+    const float len = glm::length(r);
+    return len > 0.f ? r / len : glm::vec3(0.f, 1.f, 0.f);
+}
+
+// deterministic per texel sequence: hammersley points with a cranley-patterson rotation,
+// so the result does not depend on which worker baked the texel
+static inline uint32_t
+hash_u32(uint32_t x){
+    x ^= x >> 16; x *= 0x7feb352dU;
+    x ^= x >> 15; x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+static inline float
+radical_inverse(uint32_t bits){
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return float(bits) * 2.3283064365386963e-10f;
+}
+
+struct Sampler {
+    uint32_t state;
+    float rotu, rotv;
+
+    Sampler(uint32_t seed) : state(hash_u32(seed)) {
+        rotu = Next();
+        rotv = Next();
+    }
+
+    float Next(){
+        state = state * 747796405u + 2891336453u;
+        return (hash_u32(state) >> 8) * (1.f / 16777216.f);
+    }
+
+    glm::vec2 Hammersley(uint32_t idx, uint32_t count){
+        float u = (idx + 0.5f) / count + rotu;
+        float v = radical_inverse(idx) + rotv;
+        return glm::vec2(u - std::floor(u), v - std::floor(v));
+    }
+};
+
+static inline void
+make_basis(const glm::vec3 &n, glm::vec3 &t, glm::vec3 &b){
+    // Duff et al. 2017, "Building an Orthonormal Basis, Revisited"
+    const float s = std::copysign(1.f, n.z);
+    const float a = -1.f / (s + n.z);
+    const float c = n.x * n.y * a;
+    t = glm::vec3(1.f + s * n.x * n.x * a, s * c, -s * n.x);
+    b = glm::vec3(c, s + n.y * n.y * a, -n.y);
+}
+
+static inline glm::vec3
+cosine_hemisphere(const glm::vec3 &n, const glm::vec2 &uv){
+    const float r = std::sqrt(uv.x);
+    const float phi = 2.f * PI * uv.y;
+    glm::vec3 t, b;
+    make_basis(n, t, b);
+    return t * (r * std::cos(phi)) + b * (r * std::sin(phi)) + n * std::sqrt(std::max(0.f, 1.f - uv.x));
+}
+
+static inline glm::vec3
+uniform_cone(const glm::vec3 &axis, float cosmax, const glm::vec2 &uv){
+    const float cost = 1.f - uv.x * (1.f - cosmax);
+    const float sint = std::sqrt(std::max(0.f, 1.f - cost * cost));
+    const float phi = 2.f * PI * uv.y;
+    glm::vec3 t, b;
+    make_basis(axis, t, b);
+    return t * (sint * std::cos(phi)) + b * (sint * std::sin(phi)) + axis * cost;
+}
+
+class CpuBaker {
+public:
+    CpuBaker(const Scene &scene, const BakeSettings &settings)
+        : m_scene(scene)
+        , m_settings(settings)
+    {}
+
+    void Bake(BakeResult *result);
+
+private:
+    void PrepareMeshes();
+    void RasterizeTexels(LightmapTarget &target) const;
+    void BakeRow(LightmapTarget &target, uint32_t row) const;
+    glm::vec3 DirectLighting(const glm::vec3 &pos, const glm::vec3 &normal, Sampler &s) const;
+    glm::vec3 TracePath(Ray r, Sampler &s) const;
+    void Denoise(LightmapTarget &target, std::vector<glm::vec3> &buffer) const;
+    void Dilate(LightmapTarget &target, std::vector<glm::vec4> &data) const;
+
+    glm::vec3 HitNormal(const Hit &hit, const glm::vec3 &dir) const {
+        const auto &t = m_bvh.GetTriangle(hit.prim);
+        auto n = glm::normalize(glm::cross(t.v1 - t.v0, t.v2 - t.v0));
+        return glm::dot(n, dir) > 0.f ? -n : n;
+    }
+
+private:
+    const Scene &m_scene;
+    const BakeSettings &m_settings;
+    std::vector<MeshInfo> m_meshes;
+    BVH m_bvh;
+    float m_bias = 1e-4f;
+};
+
+void CpuBaker::PrepareMeshes(){
+    std::vector<Triangle> triangles;
+    m_meshes.resize(m_scene.models.size());
+    for (size_t midx=0; midx<m_scene.models.size(); ++midx){
+        const auto &md = m_scene.models[midx];
+        auto &mi = m_meshes[midx];
+        mi.positions.resize(md.vertexCount);
+        mi.normals.resize(md.vertexCount);
+        mi.lmuvs.resize(md.vertexCount);
+        for (uint32_t vi=0; vi<md.vertexCount; ++vi){
+            mi.positions[vi] = transform_point(md.worldmat, read_vec3(md.positions, vi));
+            mi.normals[vi]   = transform_dir(md.normalmat, read_vec3(md.normals, vi));
+            mi.lmuvs[vi]     = read_vec2(md.texcoords1, vi);
+        }
+
+        const uint32_t numindices = md.indices.type == BT_None ? md.vertexCount : md.indexCount;
+        mi.indices.resize(numindices - numindices % 3);
+        for (uint32_t ii=0; ii<(uint32_t)mi.indices.size(); ++ii){
+            mi.indices[ii] = read_index(md.indices, ii);
+        }
+
+        mi.firstprim = (uint32_t)triangles.size();
+        mi.lmsize = md.lightmap.size;
+
+        double worldarea = 0.0, uvarea = 0.0;
+        for (uint32_t ii=0; ii<(uint32_t)mi.indices.size(); ii+=3){
+            const uint32_t i0 = mi.indices[ii], i1 = mi.indices[ii+1], i2 = mi.indices[ii+2];
+            triangles.push_back(Triangle{mi.positions[i0], mi.positions[i1], mi.positions[i2]});
+            worldarea += glm::length(glm::cross(mi.positions[i1] - mi.positions[i0], mi.positions[i2] - mi.positions[i0])) * 0.5f;
+            const auto e1 = mi.lmuvs[i1] - mi.lmuvs[i0], e2 = mi.lmuvs[i2] - mi.lmuvs[i0];
+            uvarea += std::fabs(e1.x * e2.y - e1.y * e2.x) * 0.5f;
+        }
+        const double texelarea = uvarea * double(mi.lmsize) * double(mi.lmsize);
+        mi.texelworld = texelarea > 0.0 ? (float)std::sqrt(worldarea / texelarea) : 0.f;
+    }
+
+    m_bvh.Build(triangles);
+    const float diag = glm::length(m_bvh.GetMax() - m_bvh.GetMin());
+    m_bias = std::max(1e-5f, diag * 1e-5f);
+}
+
+void CpuBaker::RasterizeTexels(LightmapTarget &target) const {
+    const auto &mi = m_meshes[target.meshidx];
+    const int size = mi.lmsize;
+    target.texels.assign(size * size, Texel{glm::vec3(0.f), glm::vec3(0.f), false});
+
+    for (uint32_t ii=0; ii<(uint32_t)mi.indices.size(); ii+=3){
+        const uint32_t idx[3] = {mi.indices[ii], mi.indices[ii+1], mi.indices[ii+2]};
+        const glm::vec2 uv[3] = {
+            mi.lmuvs[idx[0]] * float(size),
+            mi.lmuvs[idx[1]] * float(size),
+            mi.lmuvs[idx[2]] * float(size),
+        };
+
+        const float area = (uv[1].x - uv[0].x) * (uv[2].y - uv[0].y) - (uv[2].x - uv[0].x) * (uv[1].y - uv[0].y);
+        if (std::fabs(area) < 1e-12f)
+            continue;
+        const float invarea = 1.f / area;
+
+        const auto uvmin = glm::min(uv[0], glm::min(uv[1], uv[2]));
+        const auto uvmax = glm::max(uv[0], glm::max(uv[1], uv[2]));
+        const int x0 = std::max(0, (int)std::floor(uvmin.x)), x1 = std::min(size-1, (int)std::ceil(uvmax.x));
+        const int y0 = std::max(0, (int)std::floor(uvmin.y)), y1 = std::min(size-1, (int)std::ceil(uvmax.y));
+
+        for (int y=y0; y<=y1; ++y){
+            for (int x=x0; x<=x1; ++x){
+                const glm::vec2 p(x + 0.5f, y + 0.5f);
+                const float w0 = ((uv[1].x - p.x) * (uv[2].y - p.y) - (uv[2].x - p.x) * (uv[1].y - p.y)) * invarea;
+                const float w1 = ((uv[2].x - p.x) * (uv[0].y - p.y) - (uv[0].x - p.x) * (uv[2].y - p.y)) * invarea;
+                const float w2 = 1.f - w0 - w1;
+                constexpr float eps = -1e-4f;
+                if (w0 < eps || w1 < eps || w2 < eps)
+                    continue;
+
+                auto &t = target.texels[y * size + x];
+                if (t.valid)
+                    continue;
+                t.pos = mi.positions[idx[0]] * w0 + mi.positions[idx[1]] * w1 + mi.positions[idx[2]] * w2;
+                const auto n = mi.normals[idx[0]] * w0 + mi.normals[idx[1]] * w1 + mi.normals[idx[2]] * w2;
+                const float len = glm::length(n);
+                if (len <= 0.f)
+                    continue;
+                t.normal = n / len;
+                t.valid = true;
+            }
+        }
+    }
+}
+
+glm::vec3 CpuBaker::DirectLighting(const glm::vec3 &pos, const glm::vec3 &normal, Sampler &s) const {
+    // matches the punctual light model in shaders/pbr/lighting.sh: l.dir points from surface to light
+    glm::vec3 result(0.f);
+    const auto origin = pos + normal * m_bias;
+    for (const auto &l : m_scene.lights){
+        glm::vec3 L;
+        float attenuation = 1.f;
+        float maxdist = FLT_MAX;
+        switch (l.type){
+        case Light::LT_Directional:
+        case Light::LT_Area: {
+            L = glm::normalize(l.dir);
+            if (l.angular_radius > 0.f){
+                L = uniform_cone(L, std::cos(l.angular_radius), glm::vec2(s.Next(), s.Next()));
+            }
+            break;
+        }
+        case Light::LT_Point:
+        case Light::LT_Spot: {
+            L = l.pos - pos;
+            const float dist = glm::length(L);
+            if (dist <= 0.f || dist >= l.range)
+                continue;
+            L /= dist;
+            const float r = dist / l.range;
+            attenuation = glm::clamp(1.f - r * r * r * r, 0.f, 1.f) / (dist * dist);
+            if (l.type == Light::LT_Spot){
+                attenuation *= glm::smoothstep(l.outter_cutoff, l.inner_cutoff, glm::dot(glm::normalize(l.dir), L));
+            }
+            maxdist = dist - m_bias;
+            break;
+        }
+        default:
+            continue;
+        }
+
+        const float ndotl = glm::dot(normal, L);
+        if (ndotl <= 0.f || attenuation <= 0.f)
+            continue;
+
+        if (!m_bvh.Occluded(Ray{origin, L, 0.f, maxdist})){
+            result += l.color * (l.intensity * ndotl * attenuation);
+        }
+    }
+    return result;
+}
+
+glm::vec3 CpuBaker::TracePath(Ray r, Sampler &s) const {
+    // radiance arriving along r, lambertian surfaces with constant albedo
+    glm::vec3 radiance(0.f);
+    glm::vec3 throughput(1.f);
+    for (uint32_t bounce=0; bounce<m_settings.bounces; ++bounce){
+        Hit hit;
+        if (!m_bvh.Intersect(r, hit)){
+            radiance += throughput * m_scene.sky.skyColor;
+            break;
+        }
+
+        const auto pos = r.origin + r.dir * hit.t;
+        const auto n = HitNormal(hit, r.dir);
+        throughput *= m_settings.albedo;
+        radiance += throughput * DirectLighting(pos, n, s) * (1.f / PI);
+
+        r.origin = pos + n * m_bias;
+        r.dir = cosine_hemisphere(n, glm::vec2(s.Next(), s.Next()));
+        r.tmin = 0.f;
+        r.tmax = FLT_MAX;
+    }
+    return radiance;
+}
+
+void CpuBaker::BakeRow(LightmapTarget &target, uint32_t row) const {
+    const uint32_t size = m_meshes[target.meshidx].lmsize;
+    const uint32_t samples = std::max(1u, m_settings.samples);
+    for (uint32_t x=0; x<size; ++x){
+        const uint32_t ti = row * size + x;
+        const auto &t = target.texels[ti];
+        if (!t.valid)
+            continue;
+
+        Sampler s((target.meshidx * 0x9E3779B9u) ^ ti);
+        const auto origin = t.pos + t.normal * m_bias;
+        if (m_settings.mode == BakeSettings::BM_AO){
+            uint32_t occluded = 0;
+            for (uint32_t si=0; si<samples; ++si){
+                const auto dir = cosine_hemisphere(t.normal, s.Hammersley(si, samples));
+                if (m_bvh.Occluded(Ray{origin, dir, 0.f, m_settings.ao_distance}))
+                    ++occluded;
+            }
+            const float ao = 1.f - float(occluded) / samples;
+            target.indirect[ti] = glm::vec3(ao);
+            continue;
+        }
+
+        // stored value is the radiance leaving a white lambertian surface (E/pi),
+        // the material multiplies it with its base color
+        target.direct[ti] = DirectLighting(t.pos, t.normal, s) * (1.f / PI);
+        if (m_settings.bounces > 0){
+            glm::vec3 indirect(0.f);
+            for (uint32_t si=0; si<samples; ++si){
+                const auto dir = cosine_hemisphere(t.normal, s.Hammersley(si, samples));
+                indirect += TracePath(Ray{origin, dir, 0.f, FLT_MAX}, s);
+            }
+            target.indirect[ti] = indirect / float(samples);
+        }
+    }
+}
+
+void CpuBaker::Denoise(LightmapTarget &target, std::vector<glm::vec3> &buffer) const {
+    const int radius = (int)m_settings.denoise_radius;
+    const auto &mi = m_meshes[target.meshidx];
+    if (radius == 0 || mi.texelworld <= 0.f)
+        return;
+
+    // joint bilateral filter guided by texel position and normal, so light does not leak across
+    // uv seams or creases that are packed next to each other in the lightmap
+    const int size = mi.lmsize;
+    const float sigma_pos = mi.texelworld * radius;
+    const float inv_2sigma_pos2 = 1.f / (2.f * sigma_pos * sigma_pos);
+    const float inv_2sigma_space2 = 1.f / (2.f * radius * radius);
+    std::vector<glm::vec3> filtered(buffer.size());
+    for (int y=0; y<size; ++y){
+        for (int x=0; x<size; ++x){
+            const auto &c = target.texels[y * size + x];
+            if (!c.valid)
+                continue;
+            glm::vec3 sum(0.f);
+            float wsum = 0.f;
+            for (int dy=-radius; dy<=radius; ++dy){
+                const int yy = y + dy;
+                if (yy < 0 || yy >= size)
+                    continue;
+                for (int dx=-radius; dx<=radius; ++dx){
+                    const int xx = x + dx;
+                    if (xx < 0 || xx >= size)
+                        continue;
+                    const int ni = yy * size + xx;
+                    const auto &n = target.texels[ni];
+                    if (!n.valid)
+                        continue;
+                    const float ndotn = glm::dot(c.normal, n.normal);
+                    if (ndotn <= 0.f)
+                        continue;
+                    const auto dp = n.pos - c.pos;
+                    const float w = std::exp(-float(dx * dx + dy * dy) * inv_2sigma_space2 - glm::dot(dp, dp) * inv_2sigma_pos2)
+                        * std::pow(ndotn, 32.f);
+                    sum += buffer[ni] * w;
+                    wsum += w;
+                }
+            }
+            filtered[y * size + x] = wsum > 0.f ? sum / wsum : buffer[y * size + x];
+        }
+    }
+    buffer.swap(filtered);
+}
+
+void CpuBaker::Dilate(LightmapTarget &target, std::vector<glm::vec4> &data) const {
+    // push valid texels into the gutter so bilinear filtering and mipmaps do not pick up black
+    const int size = m_meshes[target.meshidx].lmsize;
+    std::vector<uint8_t> valid(data.size());
+    for (size_t ii=0; ii<data.size(); ++ii){
+        valid[ii] = target.texels[ii].valid ? 1 : 0;
+    }
+
+    std::vector<uint8_t> nextvalid;
+    for (uint32_t pass=0; pass<m_settings.dilate; ++pass){
+        nextvalid = valid;
+        bool changed = false;
+        for (int y=0; y<size; ++y){
+            for (int x=0; x<size; ++x){
+                const int ti = y * size + x;
+                if (valid[ti])
+                    continue;
+                glm::vec4 sum(0.f);
+                int count = 0;
+                for (int dy=-1; dy<=1; ++dy){
+                    for (int dx=-1; dx<=1; ++dx){
+                        const int xx = x + dx, yy = y + dy;
+                        if (xx < 0 || yy < 0 || xx >= size || yy >= size)
+                            continue;
+                        const int ni = yy * size + xx;
+                        if (valid[ni]){
+                            sum += data[ni];
+                            ++count;
+                        }
+                    }
+                }
+                if (count > 0){
+                    data[ti] = sum / float(count);
+                    nextvalid[ti] = 1;
+                    changed = true;
+                }
+            }
+        }
+        valid.swap(nextvalid);
+        if (!changed)
+            break;
+    }
+}
+
+void CpuBaker::Bake(BakeResult *result){
+    PrepareMeshes();
+
+    std::vector<LightmapTarget> targets(m_meshes.size());
+    struct RowJob {
+        uint32_t target;
+        uint32_t row;
+    };
+    std::vector<RowJob> jobs;
+    for (uint32_t midx=0; midx<(uint32_t)m_meshes.size(); ++midx){
+        auto &t = targets[midx];
+        t.meshidx = midx;
+        const uint32_t size = m_meshes[midx].lmsize;
+        RasterizeTexels(t);
+        t.direct.assign(size * size, glm::vec3(0.f));
+        t.indirect.assign(size * size, glm::vec3(0.f));
+        for (uint32_t row=0; row<size; ++row){
+            jobs.push_back(RowJob{midx, row});
+        }
+    }
+
+    uint32_t numthreads = m_settings.threads ? m_settings.threads : std::thread::hardware_concurrency();
+    numthreads = std::max(1u, std::min(numthreads, (uint32_t)jobs.size()));
+
+    std::atomic<uint32_t> nextjob = 0;
+    auto worker = [&](){
+        for (;;){
+            const uint32_t j = nextjob.fetch_add(1, std::memory_order_relaxed);
+            if (j >= jobs.size())
+                break;
+            BakeRow(targets[jobs[j].target], jobs[j].row);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(numthreads - 1);
+    for (uint32_t ii=1; ii<numthreads; ++ii){
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &t : threads){
+        t.join();
+    }
+
+    result->lightmaps.resize(targets.size());
+    for (auto &t : targets){
+        Denoise(t, t.indirect);
+
+        auto &lm = result->lightmaps[t.meshidx];
+        lm.size = m_meshes[t.meshidx].lmsize;
+        lm.data.resize(t.texels.size());
+        for (size_t ii=0; ii<t.texels.size(); ++ii){
+            lm.data[ii] = t.texels[ii].valid ? glm::vec4(t.direct[ii] + t.indirect[ii], 1.f) : glm::vec4(0.f);
+        }
+        Dilate(t, lm.data);
+    }
+}
+
+void BakeScene(const Scene &scene, const BakeSettings &settings, BakeResult *result){
+    CpuBaker baker(scene, settings);
+    baker.Bake(result);
+}
+
+}
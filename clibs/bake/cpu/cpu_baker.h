@@ -0,0 +1,27 @@
+#pragma once
+
+#include "../path_tracer/BakerInterface.h"
+
+namespace cpubake {
+
+struct BakeSettings {
+    enum BakeMode {
+        BM_Lighting = 0,    //direct + path traced indirect diffuse lighting
+        BM_AO,              //ambient occlusion only
+    };
+    BakeMode mode = BM_Lighting;
+    uint32_t samples = 64;          //hemisphere samples per texel
+    uint32_t bounces = 2;           //indirect bounces, only for BM_Lighting
+    float    ao_distance = 1.f;     //max occluder distance, only for BM_AO
+    glm::vec3 albedo = glm::vec3(0.7f); //constant surface albedo used for bounced light
+    uint32_t threads = 0;           //0 means hardware concurrency
+    uint32_t denoise_radius = 2;    //0 disable the edge-aware denoise pass
+    uint32_t dilate = 4;            //texel rings to extend into the gutter, 0 disable
+};
+
+// Baker that only needs the cpu: lightmap texels are rasterized from texcoords1,
+// then traced against a bvh of the whole scene by a pool of worker threads.
+// Output layout matches Bake() in BakerInterface.h: one RGBA32F lightmap per model.
+void BakeScene(const Scene &scene, const BakeSettings &settings, BakeResult *result);
+
+}
@@ -0,0 +1,394 @@
+#include <lua.hpp>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#include "cpu_baker.h"
+
+// scene table layout is the same one accepted by bake.create in path_tracer/lbake.cpp
+
+// input errors are thrown as bake_error and raised by lcpubake_bake, luaL_error would longjmp past Scene/BakeResult
+struct bake_error : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+[[noreturn]] static void
+bake_raise(const char *fmt, ...){
+    char msg[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    throw bake_error(msg);
+}
+
+static float
+check_number(lua_State *L, int idx, const char *name){
+    int isnum;
+    const lua_Number v = lua_tonumberx(L, idx, &isnum);
+    if (!isnum){
+        bake_raise("%s: number expected, got %s", name, luaL_typename(L, idx));
+    }
+    return (float)v;
+}
+
+static lua_Integer
+check_integer(lua_State *L, int idx, const char *name){
+    int isnum;
+    const lua_Integer v = lua_tointegerx(L, idx, &isnum);
+    if (!isnum){
+        bake_raise("%s: integer expected, got %s", name, luaL_typename(L, idx));
+    }
+    return v;
+}
+
+static const char*
+check_string(lua_State *L, int idx, const char *name, size_t *sz = nullptr){
+    if (lua_type(L, idx) != LUA_TSTRING){
+        bake_raise("%s: string expected, got %s", name, luaL_typename(L, idx));
+    }
+    return lua_tolstring(L, idx, sz);
+}
+
+static void
+check_table(lua_State *L, int idx, const char *name){
+    if (lua_type(L, idx) != LUA_TTABLE){
+        bake_raise("%s: table expected, got %s", name, luaL_typename(L, idx));
+    }
+}
+
+static float
+get_number(lua_State *L, int idx, const char *name, float def){
+    const float v = lua_getfield(L, idx, name) == LUA_TNIL ? def : check_number(L, -1, name);
+    lua_pop(L, 1);
+    return v;
+}
+
+static lua_Integer
+get_integer(lua_State *L, int idx, const char *name, lua_Integer def){
+    const lua_Integer v = lua_getfield(L, idx, name) == LUA_TNIL ? def : check_integer(L, -1, name);
+    lua_pop(L, 1);
+    return v;
+}
+
+static void
+to_floats(lua_State *L, int idx, const char *name, float *v, int n){
+    check_table(L, idx, name);
+    for (int ii=0; ii<n; ++ii){
+        lua_geti(L, idx, ii+1);
+        v[ii] = check_number(L, -1, name);
+        lua_pop(L, 1);
+    }
+}
+
+static glm::vec3
+get_vec3(lua_State *L, int idx, const char *name, const glm::vec3 &def){
+    glm::vec3 v = def;
+    if (lua_getfield(L, idx, name) != LUA_TNIL){
+        to_floats(L, lua_absindex(L, -1), name, &v.x, 3);
+    }
+    lua_pop(L, 1);
+    return v;
+}
+
+static glm::mat4
+get_mat4(lua_State *L, int idx, const char *name){
+    glm::mat4 m(1.f);
+    if (lua_getfield(L, idx, name) != LUA_TNIL){
+        to_floats(L, lua_absindex(L, -1), name, &m[0].x, 16);
+    }
+    lua_pop(L, 1);
+    return m;
+}
+
+static BufferData
+get_buffer(lua_State *L, int idx, const char *name, bool required, size_t &datasize){
+    BufferData b{nullptr, 0, 0, BT_None};
+    datasize = 0;
+    if (lua_getfield(L, idx, name) == LUA_TNIL){
+        if (required){
+            bake_raise("missing buffer field:%s", name);
+        }
+        lua_pop(L, 1);
+        return b;
+    }
+    const int bidx = lua_absindex(L, -1);
+    check_table(L, bidx, name);
+
+    // data string is kept alive by the scene table for the whole bake call
+    lua_getfield(L, bidx, "data");
+    b.data = check_string(L, -1, name, &datasize);
+    lua_pop(L, 1);
+    const lua_Integer offset = get_integer(L, bidx, "offset", 0);
+    const lua_Integer stride = get_integer(L, bidx, "stride", 0);
+    if (offset < 0 || offset > UINT32_MAX || stride < 0 || stride > UINT32_MAX){
+        bake_raise("%s: invalid offset:%d or stride:%d", name, (int)offset, (int)stride);
+    }
+    b.offset = (uint32_t)offset;
+    b.stride = (uint32_t)stride;
+
+    lua_getfield(L, bidx, "type");
+    const char *type = check_string(L, -1, name);
+    switch (type[0]){
+        case 'B': b.type = BT_Byte; break;
+        case 'H': b.type = BT_Uint16; break;
+        case 'I': b.type = BT_Uint32; break;
+        case 'f': b.type = BT_Float; break;
+        case '\0':b.type = BT_None; break;
+        default: bake_raise("invalid data type:%s", type);
+    }
+    lua_pop(L, 2);
+    return b;
+}
+
+// 'count' elements of 'elemsize' bytes (see src_ptr in cpu_baker.cpp) must be inside the data string
+static void
+check_buffer_range(const BufferData &b, size_t datasize, const char *name, uint32_t count, size_t elemsize){
+    if (count == 0)
+        return;
+    const uint64_t step = b.stride ? b.stride : elemsize;
+    const uint64_t last = (uint64_t)b.offset + (uint64_t)(count - 1) * step + elemsize;
+    if (last > datasize){
+        bake_raise("%s: buffer out of range, need %llu bytes, data has %llu", name, (unsigned long long)last, (unsigned long long)datasize);
+    }
+}
+
+static void
+check_float_buffer(const BufferData &b, size_t datasize, const char *name, uint32_t count, int components, bool required){
+    if (b.type == BT_None){
+        if (required){
+            bake_raise("%s: buffer type must not be empty", name);
+        }
+        return;
+    }
+    if (b.type != BT_Float){
+        bake_raise("%s: need float data", name);
+    }
+    check_buffer_range(b, datasize, name, count, sizeof(float) * components);
+}
+
+static void
+unpack_mesh(lua_State *L, int idx, MeshData &md){
+    check_table(L, idx, "model");
+    md.worldmat  = get_mat4(L, idx, "worldmat");
+    md.normalmat = get_mat4(L, idx, "normalmat");
+    size_t possize, nsize, tsize, btsize, uv0size, uv1size, isize;
+    md.positions = get_buffer(L, idx, "positions", true, possize);
+    md.normals   = get_buffer(L, idx, "normals", true, nsize);
+    md.tangents  = get_buffer(L, idx, "tangents", false, tsize);
+    md.bitangents= get_buffer(L, idx, "bitangents", false, btsize);
+    md.texcoords0= get_buffer(L, idx, "texcoords0", true, uv0size);
+    md.texcoords1= get_buffer(L, idx, "texcoords1", false, uv1size);
+    if (md.texcoords1.type == BT_None){
+        md.texcoords1 = md.texcoords0;
+        uv1size = uv0size;
+    }
+    md.indices   = get_buffer(L, idx, "indices", false, isize);
+
+    lua_getfield(L, idx, "vertexCount");
+    const lua_Integer vertexCount = check_integer(L, -1, "vertexCount");
+    lua_pop(L, 1);
+    const lua_Integer indexCount = get_integer(L, idx, "indexCount", 0);
+    if (vertexCount < 0 || vertexCount > UINT32_MAX || indexCount < 0 || indexCount > UINT32_MAX){
+        bake_raise("invalid vertexCount:%d or indexCount:%d", (int)vertexCount, (int)indexCount);
+    }
+    md.vertexCount = (uint32_t)vertexCount;
+    md.indexCount = (uint32_t)indexCount;
+    md.materialidx = (uint32_t)get_integer(L, idx, "materialidx", 1) - 1;
+
+    check_float_buffer(md.positions, possize, "positions", md.vertexCount, 3, true);
+    check_float_buffer(md.normals, nsize, "normals", md.vertexCount, 3, true);
+    check_float_buffer(md.tangents, tsize, "tangents", md.vertexCount, 3, false);
+    check_float_buffer(md.bitangents, btsize, "bitangents", md.vertexCount, 3, false);
+    check_float_buffer(md.texcoords0, uv0size, "texcoords0", md.vertexCount, 2, true);
+    check_float_buffer(md.texcoords1, uv1size, "texcoords1", md.vertexCount, 2, false);
+    switch (md.indices.type){
+    case BT_None:   // identity indices, numindices == vertexCount
+        break;
+    case BT_Uint16:
+    case BT_Uint32: {
+        const size_t elemsize = md.indices.type == BT_Uint16 ? sizeof(uint16_t) : sizeof(uint32_t);
+        check_buffer_range(md.indices, isize, "indices", md.indexCount, elemsize);
+        const size_t step = md.indices.stride ? md.indices.stride : elemsize;
+        for (uint32_t ii=0; ii<md.indexCount; ++ii){
+            const char *p = md.indices.data + md.indices.offset + ii * step;
+            uint32_t v;
+            if (md.indices.type == BT_Uint16){
+                uint16_t v16;
+                memcpy(&v16, p, sizeof(v16));
+                v = v16;
+            } else {
+                memcpy(&v, p, sizeof(v));
+            }
+            if (v >= md.vertexCount){
+                bake_raise("indices: index %u out of vertexCount:%u", v, md.vertexCount);
+            }
+        }
+        break;
+    }
+    default:
+        bake_raise("indices: need uint16 or uint32 data");
+    }
+
+    if (lua_getfield(L, idx, "lightmap") != LUA_TTABLE){
+        bake_raise("missing lightmap field");
+    }
+    const lua_Integer size = get_integer(L, -1, "size", 0);
+    if (size <= 0 || size > UINT16_MAX){
+        bake_raise("invalid lightmap size:%d", (int)size);
+    }
+    md.lightmap.size = (uint16_t)size;
+    lua_pop(L, 1);
+}
+
+static void
+unpack_light(lua_State *L, int idx, Light &l){
+    check_table(L, idx, "light");
+    l.dir   = get_vec3(L, idx, "dir", glm::vec3(0.f, 1.f, 0.f));
+    l.pos   = get_vec3(L, idx, "pos", glm::vec3(0.f));
+    l.color = get_vec3(L, idx, "color", glm::vec3(1.f));
+    l.intensity     = get_number(L, idx, "intensity", 1.f);
+    l.range         = get_number(L, idx, "range", 0.f);
+    l.inner_cutoff  = get_number(L, idx, "inner_cutoff", 0.f);
+    l.outter_cutoff = get_number(L, idx, "outter_cutoff", 0.f);
+    l.angular_radius= get_number(L, idx, "angular_radius", 0.f);
+
+    lua_getfield(L, idx, "type");
+    const char* type = check_string(L, -1, "type");
+    if (strcmp(type, "directional") == 0){
+        l.type = Light::LT_Directional;
+    } else if (strcmp(type, "point") == 0){
+        l.type = Light::LT_Point;
+        if (l.range == 0.f){
+            bake_raise("invalid point light, range must not be 0.0");
+        }
+    } else if (strcmp(type, "spot") == 0){
+        l.type = Light::LT_Spot;
+        if (l.range == 0.f){
+            bake_raise("invalid spot light, range must not be 0.0");
+        }
+        if (l.inner_cutoff == 0.f || l.outter_cutoff == 0.f){
+            bake_raise("invalid spot light, inner_cutoff and outter_cutoff must not be 0.0");
+        }
+    } else if (strcmp(type, "area") == 0){
+        l.type = Light::LT_Area;
+        if (l.angular_radius == 0.f){
+            bake_raise("invalid area light, angular_radius must not be 0.0");
+        }
+    } else {
+        bake_raise("invalid light type:%s", type);
+    }
+    lua_pop(L, 1);
+}
+
+static void
+unpack_scene(lua_State *L, int idx, Scene &s){
+    check_table(L, idx, "scene");
+    if (lua_getfield(L, idx, "models") == LUA_TTABLE){
+        const lua_Integer n = (lua_Integer)lua_rawlen(L, -1);
+        s.models.resize((size_t)n);
+        for (lua_Integer ii=0; ii<n; ++ii){
+            lua_geti(L, -1, ii+1);
+            unpack_mesh(L, lua_absindex(L, -1), s.models[ii]);
+            lua_pop(L, 1);
+        }
+    }
+    lua_pop(L, 1);
+
+    if (lua_getfield(L, idx, "lights") == LUA_TTABLE){
+        const lua_Integer n = (lua_Integer)lua_rawlen(L, -1);
+        s.lights.resize((size_t)n);
+        for (lua_Integer ii=0; ii<n; ++ii){
+            lua_geti(L, -1, ii+1);
+            unpack_light(L, lua_absindex(L, -1), s.lights[ii]);
+            lua_pop(L, 1);
+        }
+    }
+    lua_pop(L, 1);
+
+    s.sky.type = Sky::SimpleColor;
+    s.sky.skyColor = glm::vec3(0.f);
+    if (lua_getfield(L, idx, "sky") == LUA_TTABLE){
+        s.sky.skyColor = get_vec3(L, lua_absindex(L, -1), "color", s.sky.skyColor);
+    }
+    lua_pop(L, 1);
+}
+
+static void
+unpack_settings(lua_State *L, int idx, cpubake::BakeSettings &bs){
+    if (lua_isnoneornil(L, idx))
+        return;
+    check_table(L, idx, "settings");
+    if (lua_getfield(L, idx, "mode") == LUA_TSTRING){
+        const char *mode = lua_tostring(L, -1);
+        if (strcmp(mode, "lighting") == 0){
+            bs.mode = cpubake::BakeSettings::BM_Lighting;
+        } else if (strcmp(mode, "ao") == 0){
+            bs.mode = cpubake::BakeSettings::BM_AO;
+        } else {
+            bake_raise("invalid bake mode:%s", mode);
+        }
+    }
+    lua_pop(L, 1);
+    bs.samples          = (uint32_t)get_integer(L, idx, "samples", bs.samples);
+    bs.bounces          = (uint32_t)get_integer(L, idx, "bounces", bs.bounces);
+    bs.ao_distance      = get_number(L, idx, "ao_distance", bs.ao_distance);
+    bs.albedo           = get_vec3(L, idx, "albedo", bs.albedo);
+    bs.threads          = (uint32_t)get_integer(L, idx, "threads", bs.threads);
+    bs.denoise_radius   = (uint32_t)get_integer(L, idx, "denoise_radius", bs.denoise_radius);
+    bs.dilate           = (uint32_t)get_integer(L, idx, "dilate", bs.dilate);
+}
+
+static int
+bake(lua_State *L){
+    Scene s;
+    unpack_scene(L, 1, s);
+    cpubake::BakeSettings bs;
+    unpack_settings(L, 2, bs);
+
+    BakeResult br;
+    cpubake::BakeScene(s, bs, &br);
+
+    lua_createtable(L, (int)br.lightmaps.size(), 0);
+    for (size_t ii=0; ii<br.lightmaps.size(); ++ii){
+        lua_createtable(L, 0, 3);{
+            const auto &lm = br.lightmaps[ii];
+            const auto texelsize = sizeof(glm::vec4);
+            lua_pushlstring(L, (const char*)lm.data.data(), lm.data.size() * texelsize);
+            lua_setfield(L, -2, "data");
+
+            lua_pushinteger(L, lm.size);
+            lua_setfield(L, -2, "size");
+
+            lua_pushinteger(L, texelsize);
+            lua_setfield(L, -2, "texelsize");
+        }
+        lua_seti(L, -2, ii+1);
+    }
+    return 1;
+}
+
+static int
+lcpubake_bake(lua_State *L){
+    char msg[256];
+    try {
+        return bake(L);
+    } catch (const std::exception &e){
+        snprintf(msg, sizeof(msg), "%s", e.what());
+    }
+    return luaL_error(L, "%s", msg);
+}
+
+extern "C" {
+LUAMOD_API int
+luaopen_bake_cpu(lua_State* L) {
+    luaL_checkversion(L);
+    luaL_Reg lib[] = {
+        {"bake", lcpubake_bake},
+        { nullptr, nullptr },
+    };
+    luaL_newlib(L, lib);
+    return 1;
+}
+}
@@ -1,6 +1,19 @@
-do return end
-
 local lm = require "luamake"
+
+if lm.os ~= "ios" and lm.os ~= "android" then
+    lm:lua_src "bake" {
+        confs = { "glm" },
+        includes = {
+            lm.AntDir .. "/clibs/foundation",
+        },
+        sources = {
+            "cpu/*.cpp",
+        },
+    }
+end
+
+-- the path tracer below depends on the d3d11 BakingLab framework, it is not built
+do return end
 local fs = require "bee.filesystem"
 
 lm.defines = lm.mode ~= "release" and "_DEBUG"
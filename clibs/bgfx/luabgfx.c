@@ -730,6 +730,7 @@ push_supported(lua_State *L, uint64_t supported) {
 		CAPSNAME(COMPUTE)                  // Compute shaders are supported.
 		CAPSNAME(CONSERVATIVE_RASTER)      // Conservative rasterization is supported.
 		CAPSNAME(DRAW_INDIRECT)            // Draw indirect is supported.
+		CAPSNAME(DRAW_INDIRECT_COUNT)      // Draw indirect with indirect count is supported.
 		CAPSNAME(FRAGMENT_DEPTH)           // Fragment depth is available in fragment shader.
 		CAPSNAME(FRAGMENT_ORDERING)        // Fragment ordering is available in fragment shader.
 		CAPSNAME(GRAPHICS_DEBUGGER)        // Graphics debugger is present.
@@ -2824,6 +2825,7 @@ lcreateShader(lua_State *L) {
 	w BGFX_BUFFER_COMPUTE_WRITE
 	s BGFX_BUFFER_ALLOW_RESIZE ( for dynamic buffer )
 	d BGFX_BUFFER_INDEX32 ( for index buffer )
+	c BGFX_BUFFER_DRAW_INDIRECT ( for draw count buffer of submit_indirect_count )
 	[i/u/f][1/2/4][b/w/d] BGFX_BUFFER_COMPUTE_TYPE
  */
 static uint16_t
@@ -2847,6 +2849,9 @@ buffer_flags(lua_State *L, int index) {
 			case 'd':
 				flags |= BGFX_BUFFER_INDEX32;
 				break;
+			case 'c':
+				flags |= BGFX_BUFFER_DRAW_INDIRECT;
+				break;
 			case 'i':
 				flags |= BGFX_BUFFER_COMPUTE_TYPE_INT;
 				compute_type = 1;
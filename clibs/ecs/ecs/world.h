@@ -18,6 +18,8 @@ struct render_material;
 struct queue_container;
 struct submit_cache;
 struct mesh_container;
+struct light_container;
+struct scene_packed;
 
 struct bgfx_encoder_holder {
 	struct bgfx_encoder_s* encoder;
@@ -36,8 +38,8 @@ struct ecs_world {
 	struct queue_container*       Q;
 	struct submit_cache*          submit_cache;
 	struct mesh_container*        MESH;
-	uint64_t                      unused1;
-	uint64_t                      unused2;
+	struct light_container*       LIGHT;
+	struct scene_packed*          PACKED;
 };
 
 static inline struct ecs_world* getworld(lua_State* L) {
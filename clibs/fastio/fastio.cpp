@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <array>
 #include <optional>
+#include <thread>
 #include "memfile.h"
 
 #include <bee/nonstd/unreachable.h>
@@ -264,6 +265,92 @@ static int str2sha1(lua_State *L) {
     return 1;
 }
 
+// Content-defined chunking (FastCDC style gear hash). Chunk boundaries only depend on the
+// bytes around them, so an edit only changes the chunks it touches.
+namespace cdc {
+    constexpr size_t MinSize = 2 * 1024;
+    constexpr size_t AvgSize = 8 * 1024;
+    constexpr size_t MaxSize = 0x7000;      // fits in one network message (< 0x8000), see fileserver agent
+    constexpr size_t ReadSize = 1024 * 1024;
+    constexpr uint64_t MaskS = ~UINT64_C(0) << (64 - 15);
+    constexpr uint64_t MaskL = ~UINT64_C(0) << (64 - 11);
+
+    static constexpr std::array<uint64_t, 256> make_gear() {
+        std::array<uint64_t, 256> gear {};
+        uint64_t seed = 0;
+        for (auto& v : gear) {
+            // splitmix64
+            seed += UINT64_C(0x9E3779B97F4A7C15);
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+            z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+            v = z ^ (z >> 31);
+        }
+        return gear;
+    }
+    static constexpr std::array<uint64_t, 256> Gear = make_gear();
+
+    static void emit(luaL_Buffer* b, SHA1_CTX* ctx, size_t size) {
+        std::array<uint8_t, SHA1_DIGEST_SIZE> digest;
+        sat_SHA1_Final(ctx, digest.data());
+        char* p = luaL_prepbuffsize(b, SHA1_DIGEST_SIZE * 2);
+        for (size_t i = 0; i < SHA1_DIGEST_SIZE; ++i) {
+            auto u = digest[i];
+            p[2*i+0] = hex[u / 16];
+            p[2*i+1] = hex[u % 16];
+        }
+        luaL_addsize(b, SHA1_DIGEST_SIZE * 2);
+        lua_pushfstring(b->L, " %d\n", (int)size);
+        luaL_addvalue(b);
+        sat_SHA1_Init(ctx);
+    }
+}
+
+// returns the chunk manifest of a file: one "<sha1> <size>\n" line per chunk, in file order
+static int chunks(lua_State *L) {
+    auto filename = getfile(L);
+    lua_settop(L, 2);
+    FILE* f = fileutil::open(L, filename);
+    if (!f) {
+        return raise_error<true>(L, "open", getsymbol(L, filename));
+    }
+    uint8_t* buffer = (uint8_t*)lua_newuserdatauv(L, cdc::ReadSize, 0);
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    SHA1_CTX ctx;
+    sat_SHA1_Init(&ctx);
+    uint64_t h = 0;
+    size_t len = 0;
+    for (;;) {
+        size_t n = fileutil::read(f, buffer, cdc::ReadSize);
+        size_t start = 0;
+        for (size_t i = 0; i < n; ++i) {
+            h = (h << 1) + cdc::Gear[buffer[i]];
+            if (++len < cdc::MinSize) {
+                continue;
+            }
+            uint64_t mask = len < cdc::AvgSize ? cdc::MaskS : cdc::MaskL;
+            if ((h & mask) == 0 || len >= cdc::MaxSize) {
+                sat_SHA1_Update(&ctx, buffer + start, i + 1 - start);
+                cdc::emit(&b, &ctx, len);
+                start = i + 1;
+                h = 0;
+                len = 0;
+            }
+        }
+        sat_SHA1_Update(&ctx, buffer + start, n - start);
+        if (n != cdc::ReadSize) {
+            break;
+        }
+    }
+    fileutil::close(f);
+    if (len > 0) {
+        cdc::emit(&b, &ctx, len);
+    }
+    luaL_pushresult(&b);
+    return 1;
+}
+
 static int wrap(lua_State* L) {
     luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
     lua_settop(L, 1);
@@ -307,16 +394,18 @@ static const char* getS(lua_State *L, void *ud, size_t *size) {
     return ls->s;
 }
 
+// loadlua(mem, symbol, env, mode): mode is "t" by default, "b" loads a precompiled chunk (see bytecode cache in packagemanager)
 static int loadlua(lua_State* L) {
     luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
     memory_file* file = (memory_file*)lua_touserdata(L, 1);
     const char* symbol = luaL_checkstring(L, 2);
-    lua_settop(L, 3);
+    lua_settop(L, 4);
+    const char* mode = luaL_optstring(L, 4, "t");
     LoadS ls;
     ls.s = (const char*)file->data;
     ls.size = file->sz;
     lua_pushfstring(L, "@%s", symbol);
-    int status = lua_load(L, getS, &ls, lua_tostring(L, -1), "t");
+    int status = lua_load(L, getS, &ls, lua_tostring(L, -1), mode);
     memory_file_close(file);
     if (status != LUA_OK) {
         luaL_pushfail(L);
@@ -340,6 +429,12 @@ static int lmemfile(lua_State *L) {
 	return 1;
 }
 
+static int cpu_count(lua_State *L) {
+    unsigned n = std::thread::hardware_concurrency();
+    lua_pushinteger(L, n > 0 ? n : 1);
+    return 1;
+}
+
 extern "C" int
 luaopen_fastio(lua_State* L) {
     luaL_Reg l[] = {
@@ -351,11 +446,13 @@ luaopen_fastio(lua_State* L) {
         {"readall_s_noerr", readall_s<false>},
         {"sha1", sha1<true>},
         {"str2sha1", str2sha1},
+        {"chunks", chunks},
         {"wrap", wrap},
         {"tostring", tostring},
         {"free", free},
         {"loadlua", loadlua},
 		{"memfile", lmemfile},
+        {"cpu_count", cpu_count},
         {NULL, NULL},
     };
     luaL_newlib(L, l);
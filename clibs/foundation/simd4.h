@@ -0,0 +1,105 @@
+#pragma once
+
+// 4-lane float helper shared by the cpu baker (clibs/bake/cpu) and the batched noise kernels (clibs/noise).
+// It maps to SSE on x86, NEON on arm and falls back to plain scalar code elsewhere.
+// cmpgt/cmpge/cmplt return lane masks for '&' and movemask, gt01/ge01 return 1.0 or 0.0 per lane.
+
+#include <cmath>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define SIMD4_SSE 1
+#   include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#   define SIMD4_NEON 1
+#   include <arm_neon.h>
+#endif
+
+namespace simd4 {
+
+#if defined(SIMD4_SSE)
+struct float4 {
+    __m128 v;
+    float4() = default;
+    float4(__m128 vv) : v(vv) {}
+    static float4 splat(float f) { return _mm_set1_ps(f); }
+    static float4 load(const float *p) { return _mm_load_ps(p); }
+};
+static inline float4 operator+(float4 a, float4 b) { return _mm_add_ps(a.v, b.v); }
+static inline float4 operator-(float4 a, float4 b) { return _mm_sub_ps(a.v, b.v); }
+static inline float4 operator*(float4 a, float4 b) { return _mm_mul_ps(a.v, b.v); }
+static inline float4 operator/(float4 a, float4 b) { return _mm_div_ps(a.v, b.v); }
+static inline float4 operator&(float4 a, float4 b) { return _mm_and_ps(a.v, b.v); }
+static inline float4 cmpgt(float4 a, float4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+static inline float4 cmpge(float4 a, float4 b) { return _mm_cmpge_ps(a.v, b.v); }
+static inline float4 cmplt(float4 a, float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+static inline float4 min4(float4 a, float4 b) { return _mm_min_ps(a.v, b.v); }
+static inline float4 max4(float4 a, float4 b) { return _mm_max_ps(a.v, b.v); }
+static inline float4 abs4(float4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a.v); }
+static inline float4 gt01(float4 a, float4 b) { return _mm_and_ps(_mm_cmpgt_ps(a.v, b.v), _mm_set1_ps(1.f)); }
+static inline float4 ge01(float4 a, float4 b) { return _mm_and_ps(_mm_cmpge_ps(a.v, b.v), _mm_set1_ps(1.f)); }
+static inline float4 floor4(float4 a) {
+    const __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a.v), _mm_set1_ps(1.f)));
+}
+static inline int movemask(float4 a) { return _mm_movemask_ps(a.v); }
+static inline void store(float *p, float4 a) { _mm_store_ps(p, a.v); }
+#elif defined(SIMD4_NEON)
+struct float4 {
+    float32x4_t v;
+    float4() = default;
+    float4(float32x4_t vv) : v(vv) {}
+    static float4 splat(float f) { return vdupq_n_f32(f); }
+    static float4 load(const float *p) { return vld1q_f32(p); }
+};
+static inline float4 operator+(float4 a, float4 b) { return vaddq_f32(a.v, b.v); }
+static inline float4 operator-(float4 a, float4 b) { return vsubq_f32(a.v, b.v); }
+static inline float4 operator*(float4 a, float4 b) { return vmulq_f32(a.v, b.v); }
+static inline float4 operator/(float4 a, float4 b) { return vdivq_f32(a.v, b.v); }
+static inline float4 operator&(float4 a, float4 b) { return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a.v), vreinterpretq_u32_f32(b.v))); }
+static inline float4 cmpgt(float4 a, float4 b) { return vreinterpretq_f32_u32(vcgtq_f32(a.v, b.v)); }
+static inline float4 cmpge(float4 a, float4 b) { return vreinterpretq_f32_u32(vcgeq_f32(a.v, b.v)); }
+static inline float4 cmplt(float4 a, float4 b) { return vreinterpretq_f32_u32(vcltq_f32(a.v, b.v)); }
+static inline float4 min4(float4 a, float4 b) { return vminq_f32(a.v, b.v); }
+static inline float4 max4(float4 a, float4 b) { return vmaxq_f32(a.v, b.v); }
+static inline float4 abs4(float4 a) { return vabsq_f32(a.v); }
+static inline float4 gt01(float4 a, float4 b) { return vreinterpretq_f32_u32(vandq_u32(vcgtq_f32(a.v, b.v), vreinterpretq_u32_f32(vdupq_n_f32(1.f)))); }
+static inline float4 ge01(float4 a, float4 b) { return vreinterpretq_f32_u32(vandq_u32(vcgeq_f32(a.v, b.v), vreinterpretq_u32_f32(vdupq_n_f32(1.f)))); }
+static inline float4 floor4(float4 a) {
+    const float32x4_t t = vcvtq_f32_s32(vcvtq_s32_f32(a.v));
+    return vsubq_f32(t, vreinterpretq_f32_u32(vandq_u32(vcgtq_f32(t, a.v), vreinterpretq_u32_f32(vdupq_n_f32(1.f)))));
+}
+static inline int movemask(float4 a) {
+    const uint32x4_t m = vshrq_n_u32(vreinterpretq_u32_f32(a.v), 31);
+    return int(vgetq_lane_u32(m, 0) | (vgetq_lane_u32(m, 1) << 1) | (vgetq_lane_u32(m, 2) << 2) | (vgetq_lane_u32(m, 3) << 3));
+}
+static inline void store(float *p, float4 a) { vst1q_f32(p, a.v); }
+#else
+struct float4 {
+    float v[4];
+    static float4 splat(float f) { return float4{{f, f, f, f}}; }
+    static float4 load(const float *p) { return float4{{p[0], p[1], p[2], p[3]}}; }
+};
+#define SIMD4_LANEWISE(_EXPR) float4 r; for (int i=0; i<4; ++i) { r.v[i] = _EXPR; } return r
+static inline float4 operator+(float4 a, float4 b) { SIMD4_LANEWISE(a.v[i] + b.v[i]); }
+static inline float4 operator-(float4 a, float4 b) { SIMD4_LANEWISE(a.v[i] - b.v[i]); }
+static inline float4 operator*(float4 a, float4 b) { SIMD4_LANEWISE(a.v[i] * b.v[i]); }
+static inline float4 operator/(float4 a, float4 b) { SIMD4_LANEWISE(a.v[i] / b.v[i]); }
+static inline float4 operator&(float4 a, float4 b) { SIMD4_LANEWISE((a.v[i] != 0.f && b.v[i] != 0.f) ? 1.f : 0.f); }
+static inline float4 cmpgt(float4 a, float4 b) { SIMD4_LANEWISE(a.v[i] >  b.v[i] ? 1.f : 0.f); }
+static inline float4 cmpge(float4 a, float4 b) { SIMD4_LANEWISE(a.v[i] >= b.v[i] ? 1.f : 0.f); }
+static inline float4 cmplt(float4 a, float4 b) { SIMD4_LANEWISE(a.v[i] <  b.v[i] ? 1.f : 0.f); }
+static inline float4 min4(float4 a, float4 b) { SIMD4_LANEWISE(a.v[i] < b.v[i] ? a.v[i] : b.v[i]); }
+static inline float4 max4(float4 a, float4 b) { SIMD4_LANEWISE(a.v[i] > b.v[i] ? a.v[i] : b.v[i]); }
+static inline float4 abs4(float4 a) { SIMD4_LANEWISE(std::fabs(a.v[i])); }
+static inline float4 gt01(float4 a, float4 b) { SIMD4_LANEWISE(a.v[i] >  b.v[i] ? 1.f : 0.f); }
+static inline float4 ge01(float4 a, float4 b) { SIMD4_LANEWISE(a.v[i] >= b.v[i] ? 1.f : 0.f); }
+static inline float4 floor4(float4 a) { SIMD4_LANEWISE((float)(int)a.v[i] > a.v[i] ? (float)(int)a.v[i] - 1.f : (float)(int)a.v[i]); }
+#undef SIMD4_LANEWISE
+static inline int movemask(float4 a) {
+    return (a.v[0] != 0.f ? 1 : 0) | (a.v[1] != 0.f ? 2 : 0) | (a.v[2] != 0.f ? 4 : 0) | (a.v[3] != 0.f ? 8 : 0);
+}
+static inline void store(float *p, float4 a) { for (int i=0; i<4; ++i) p[i] = a.v[i]; }
+#endif
+
+}
@@ -0,0 +1,405 @@
+#include "ibl.h"
+
+#include <glm/ext/scalar_constants.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   define IBL_SIMD_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#   include <arm_neon.h>
+#   define IBL_SIMD_NEON 1
+#endif
+
+namespace ibl {
+
+static constexpr float const_pi = glm::pi<float>();
+
+// one RGBA texel in a simd register, the filters below only do weighted sums of texels
+struct rgba {
+#if defined(IBL_SIMD_SSE)
+    __m128 v;
+    static inline rgba zero()                           { return {_mm_setzero_ps()}; }
+    static inline rgba load(const glm::vec4 &c)         { return {_mm_loadu_ps(&c.x)}; }
+    inline void store(glm::vec4 &c) const               { _mm_storeu_ps(&c.x, v); }
+    inline rgba operator+(const rgba &o) const          { return {_mm_add_ps(v, o.v)}; }
+    inline rgba operator*(float s) const                { return {_mm_mul_ps(v, _mm_set1_ps(s))}; }
+    inline rgba madd(const rgba &c, float w) const      { return {_mm_add_ps(v, _mm_mul_ps(c.v, _mm_set1_ps(w)))}; }
+#elif defined(IBL_SIMD_NEON)
+    float32x4_t v;
+    static inline rgba zero()                           { return {vdupq_n_f32(0.f)}; }
+    static inline rgba load(const glm::vec4 &c)         { return {vld1q_f32(&c.x)}; }
+    inline void store(glm::vec4 &c) const               { vst1q_f32(&c.x, v); }
+    inline rgba operator+(const rgba &o) const          { return {vaddq_f32(v, o.v)}; }
+    inline rgba operator*(float s) const                { return {vmulq_n_f32(v, s)}; }
+    inline rgba madd(const rgba &c, float w) const      { return {vmlaq_n_f32(v, c.v, w)}; }
+#else
+    glm::vec4 v;
+    static inline rgba zero()                           { return {glm::vec4(0.f)}; }
+    static inline rgba load(const glm::vec4 &c)         { return {c}; }
+    inline void store(glm::vec4 &c) const               { c = v; }
+    inline rgba operator+(const rgba &o) const          { return {v + o.v}; }
+    inline rgba operator*(float s) const                { return {v * s}; }
+    inline rgba madd(const rgba &c, float w) const      { return {v + c.v * w}; }
+#endif
+    inline glm::vec4 get() const { glm::vec4 c; store(c); return c; }
+};
+
+static const QualityPreset s_presets[(int)Quality::Count] = {
+    {  64,   1 },   // Low
+    { 256,  16 },   // Medium
+    { 512,  64 },   // High, same sample count as the runtime compute shader
+    {1024, 256 },   // Ultra
+};
+
+const QualityPreset& GetQualityPreset(Quality q){
+    return s_presets[(int)q];
+}
+
+bool ParseQuality(const char* name, Quality &q){
+    static const char* names[(int)Quality::Count] = {"low", "medium", "high", "ultra"};
+    for (int ii=0; ii<(int)Quality::Count; ++ii){
+        if (strcmp(name, names[ii]) == 0){
+            q = Quality(ii);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ParallelFor(uint32_t count, uint32_t threads, const std::function<void (uint32_t)> &func){
+    if (threads == 0){
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = std::min(threads, count);
+    if (threads <= 1){
+        for (uint32_t ii=0; ii<count; ++ii){
+            func(ii);
+        }
+        return;
+    }
+
+    std::atomic<uint32_t> next{0};
+    auto worker = [&](){
+        for (uint32_t ii = next++; ii < count; ii = next++){
+            func(ii);
+        }
+    };
+    std::vector<std::thread> pool;
+    pool.reserve(threads-1);
+    for (uint32_t ii=1; ii<threads; ++ii){
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto &t : pool){
+        t.join();
+    }
+}
+
+void BuildMipChain(Cubemap &cm, uint32_t threads){
+    cm.resize(1);
+    while (cm.back().size > 1){
+        cm.emplace_back();
+        const CubemapLevel &src = cm[cm.size()-2];
+        CubemapLevel &dst = cm.back();
+        dst.Resize(src.size / 2);
+        const uint32_t s = dst.size;
+        ParallelFor(s * 6, threads, [&](uint32_t row){
+            const uint8_t face = uint8_t(row / s);
+            const uint32_t y = row % s;
+            const glm::vec4 *sf = src.Face(face);
+            glm::vec4 *df = dst.Face(face) + size_t(y) * s;
+            const glm::vec4 *r0 = sf + size_t(y*2) * src.size;
+            const glm::vec4 *r1 = r0 + src.size;
+            for (uint32_t x=0; x<s; ++x){
+                const rgba c = rgba::load(r0[x*2]) + rgba::load(r0[x*2+1]) + rgba::load(r1[x*2]) + rgba::load(r1[x*2+1]);
+                (c * 0.25f).store(df[x]);
+            }
+        });
+    }
+}
+
+static inline rgba
+sample_level(const CubemapLevel &level, const glm::vec3 &dir){
+    const auto addr = dir2uvface(dir);
+    const float fs = (float)level.size;
+    const float x = glm::clamp(addr.u * fs - 0.5f, 0.f, fs - 1.f);
+    const float y = glm::clamp(addr.v * fs - 0.5f, 0.f, fs - 1.f);
+    const uint32_t x0 = (uint32_t)x, y0 = (uint32_t)y;
+    const uint32_t x1 = std::min(x0+1, level.size-1), y1 = std::min(y0+1, level.size-1);
+    const float sx = x - x0, sy = y - y0;
+
+    const glm::vec4 *f = level.Face(addr.face);
+    const glm::vec4 *r0 = f + size_t(y0) * level.size;
+    const glm::vec4 *r1 = f + size_t(y1) * level.size;
+    return rgba::zero()
+        .madd(rgba::load(r0[x0]), (1.f-sx) * (1.f-sy))
+        .madd(rgba::load(r0[x1]), sx * (1.f-sy))
+        .madd(rgba::load(r1[x0]), (1.f-sx) * sy)
+        .madd(rgba::load(r1[x1]), sx * sy);
+}
+
+static inline rgba
+sample_lod(const Cubemap &cm, const glm::vec3 &dir, float lod){
+    const float maxlod = float(cm.size()-1);
+    lod = glm::clamp(lod, 0.f, maxlod);
+    const uint32_t l0 = (uint32_t)lod;
+    const float t = lod - l0;
+    const rgba c0 = sample_level(cm[l0], dir);
+    if (t == 0.f || l0 + 1 >= cm.size()){
+        return c0;
+    }
+    return (c0 * (1.f - t)).madd(sample_level(cm[l0+1], dir), t);
+}
+
+glm::vec4 SampleLevel(const CubemapLevel &level, const glm::vec3 &dir){
+    return sample_level(level, dir).get();
+}
+
+glm::vec4 SampleLod(const Cubemap &cm, const glm::vec3 &dir, float lod){
+    return sample_lod(cm, dir, lod).get();
+}
+
+static inline glm::vec3
+texel_dir(uint8_t face, uint32_t x, uint32_t y, float invsize){
+    return glm::normalize(uvface2dir(face, (x+0.5f) * invsize, (y+0.5f) * invsize));
+}
+
+// same basis as cs_build_prefiltermap.sc
+static inline void
+calc_TB(const glm::vec3 &N, glm::vec3 &T, glm::vec3 &B){
+    T = glm::cross(N, glm::vec3(0.f, 1.f, 0.f));
+    if (glm::dot(T, T) < 1e-7f){
+        T = glm::cross(N, glm::vec3(1.f, 0.f, 0.f));
+    }
+    T = glm::normalize(T);
+    B = glm::normalize(glm::cross(N, T));
+}
+
+struct ggx_sample {
+    glm::vec3 L;    // tangent space, N = +Z
+    float NdotL;
+    float lod;
+};
+
+// V == N, so the sample set is the same for every texel and only depends on roughness
+static std::vector<ggx_sample>
+ggx_samples(float roughness, uint32_t samples, uint32_t srcsize){
+    std::vector<ggx_sample> result;
+    result.reserve(samples);
+    const float alpha = roughness * roughness;
+    const float invN = 1.f / samples;
+    for (uint32_t ii=0; ii<samples; ++ii){
+        const glm::vec2 xi = hammersley(ii, invN);
+        const float cos_theta = glm::clamp(std::sqrt((1.f - xi.y) / (1.f + (alpha * alpha - 1.f) * xi.y)), 0.f, 1.f);
+        const float sin_theta = std::sqrt(1.f - cos_theta * cos_theta);
+        const float phi = 2.f * const_pi * xi.x;
+        const glm::vec3 H(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+
+        const glm::vec3 L = 2.f * cos_theta * H - glm::vec3(0.f, 0.f, 1.f);
+        if (L.z <= 0.f)
+            continue;
+
+        // D_GGX(NdotH) / 4, see GGX() in pbr/ibl/common.sh
+        const float a = cos_theta * alpha;
+        const float k = alpha / std::max(1.f - cos_theta * cos_theta + a * a, 1e-6f);
+        const float pdf = k * k * (1.f / const_pi) * 0.25f;
+
+        // Krivanek & Colbert: pick the source mip whose texel solid angle matches the sample's
+        const float lod = 0.5f * std::log2(6.f * float(srcsize) * float(srcsize) / (float(samples) * pdf));
+        result.push_back({L, L.z, std::max(lod, 0.f)});
+    }
+    return result;
+}
+
+void PrefilterGGX(const Cubemap &src, uint32_t size, uint32_t mipcount, uint32_t samples, uint32_t threads, Cubemap &dst){
+    const uint32_t srcsize = src[0].size;
+    dst.resize(mipcount);
+    for (uint32_t mip=0; mip<mipcount; ++mip){
+        CubemapLevel &level = dst[mip];
+        level.Resize(std::max(size >> mip, 1u));
+        const uint32_t s = level.size;
+        const float invsize = 1.f / s;
+        const float roughness = mipcount > 1 ? float(mip) / float(mipcount-1) : 0.f;
+
+        if (roughness == 0.f){
+            // mirror reflection, just resample from the source mip that matches the output size
+            const float lod = std::max(std::log2(float(srcsize) / float(s)), 0.f);
+            ParallelFor(s * 6, threads, [&](uint32_t row){
+                const uint8_t face = uint8_t(row / s);
+                const uint32_t y = row % s;
+                glm::vec4 *out = level.Face(face) + size_t(y) * s;
+                for (uint32_t x=0; x<s; ++x){
+                    sample_lod(src, texel_dir(face, x, y, invsize), lod).store(out[x]);
+                }
+            });
+            continue;
+        }
+
+        const auto table = ggx_samples(roughness, samples, srcsize);
+        ParallelFor(s * 6, threads, [&](uint32_t row){
+            const uint8_t face = uint8_t(row / s);
+            const uint32_t y = row % s;
+            glm::vec4 *out = level.Face(face) + size_t(y) * s;
+            for (uint32_t x=0; x<s; ++x){
+                const glm::vec3 N = texel_dir(face, x, y, invsize);
+                glm::vec3 T, B;
+                calc_TB(N, T, B);
+                rgba c = rgba::zero();
+                float weight = 0.f;
+                for (const auto &smp : table){
+                    const glm::vec3 L = T * smp.L.x + B * smp.L.y + N * smp.L.z;
+                    c = c.madd(sample_lod(src, L, smp.lod), smp.NdotL);
+                    weight += smp.NdotL;
+                }
+                (c * (weight > 0.f ? 1.f / weight : 0.f)).store(out[x]);
+            }
+        });
+    }
+}
+
+// area of the cube face quadrant (-1,1)-(x,y) projected onto the unit sphere
+static inline float
+sphere_quadrant_area(float x, float y){
+    return std::atan2(x * y, std::sqrt(x * x + y * y + 1.f));
+}
+
+static inline float
+solid_angle(float invsize, uint32_t x, uint32_t y){
+    const float s = (x + 0.5f) * 2.f * invsize - 1.f;
+    const float t = (y + 0.5f) * 2.f * invsize - 1.f;
+    const float x0 = s - invsize, y0 = t - invsize;
+    const float x1 = s + invsize, y1 = t + invsize;
+    return    sphere_quadrant_area(x0, y0)
+            - sphere_quadrant_area(x0, y1)
+            - sphere_quadrant_area(x1, y0)
+            + sphere_quadrant_area(x1, y1);
+}
+
+static constexpr uint32_t MAX_SH_COEFFS = 9;
+
+void IrradianceSH(const CubemapLevel &src, uint32_t bandnum, uint32_t threads, glm::vec3 *Eml){
+    assert(1 <= bandnum && bandnum <= 3);
+    const float inv_sqrtpi = 1.f / std::sqrt(const_pi);
+    const float L1_f  = 0.5f * inv_sqrtpi;
+    const float L2_f  = std::sqrt(3.f / (4.f * const_pi));
+    const float L3_f1 = std::sqrt(15.f) * inv_sqrtpi * 0.5f;
+    const float L3_f2 = std::sqrt(5.f)  * inv_sqrtpi * 0.25f;
+    const float L3_f3 = std::sqrt(15.f) * inv_sqrtpi * 0.25f;
+    const float SHb[MAX_SH_COEFFS] = {
+         L1_f,
+        -L2_f,  L2_f, -L2_f,
+         L3_f1, -L3_f1, L3_f2, -L3_f1, L3_f3,
+    };
+    const uint32_t numcoeffs = bandnum * bandnum;
+
+    // per row partial sums, reduced in order afterward so the result doesn't depend on the thread count
+    const uint32_t s = src.size;
+    const float invsize = 1.f / s;
+    std::vector<glm::vec3> partial(size_t(s) * 6 * MAX_SH_COEFFS, glm::vec3(0.f));
+    ParallelFor(s * 6, threads, [&](uint32_t row){
+        const uint8_t face = uint8_t(row / s);
+        const uint32_t y = row % s;
+        const glm::vec4 *in = src.Face(face) + size_t(y) * s;
+        glm::vec3 *Lml = partial.data() + size_t(row) * MAX_SH_COEFFS;
+        for (uint32_t x=0; x<s; ++x){
+            const glm::vec3 N = texel_dir(face, x, y, invsize);
+            const glm::vec3 radiance = glm::vec3(in[x]) * solid_angle(invsize, x, y);
+            const float Y[MAX_SH_COEFFS] = {
+                1.f,
+                N.y, N.z, N.x,
+                N.y * N.x, N.y * N.z, 3.f * N.z * N.z - 1.f, N.x * N.z, N.x * N.x - N.y * N.y,
+            };
+            for (uint32_t ii=0; ii<numcoeffs; ++ii){
+                Lml[ii] += radiance * (SHb[ii] * Y[ii]);
+            }
+        }
+    });
+
+    const float A[3] = { const_pi, const_pi * 2.f / 3.f, const_pi / 4.f };
+    for (uint32_t ii=0; ii<numcoeffs; ++ii){
+        glm::dvec3 sum(0.0);
+        for (uint32_t row=0; row < s * 6; ++row){
+            sum += glm::dvec3(partial[size_t(row) * MAX_SH_COEFFS + ii]);
+        }
+        const uint32_t l = ii == 0 ? 0 : (ii < 4 ? 1 : 2);
+        Eml[ii] = glm::vec3(sum) * (A[l] / const_pi * SHb[ii]);
+    }
+}
+
+void CubemapToEquirectangular(const CubemapLevel &src, uint32_t samples, uint32_t threads, Equirectangular &dst){
+    const uint32_t w = dst.width, h = dst.height;
+    dst.texels.resize(size_t(w) * h);
+    samples = std::max(samples, 1u);
+    const float invN = 1.f / samples;
+    ParallelFor(h, threads, [&](uint32_t ih){
+        glm::vec4 *out = dst.texels.data() + size_t(ih) * w;
+        for (uint32_t iw=0; iw<w; ++iw){
+            rgba c = rgba::zero();
+            for (uint32_t sample=0; sample<samples; ++sample){
+                const glm::vec2 u = samples == 1 ? glm::vec2(0.5f) : hammersley(sample, invN);
+                const float x = 2.f * (iw + u.x) / w - 1.f;
+                const float y = 1.f - 2.f * (ih + u.y) / h;
+                const float theta = x * const_pi;
+                const float phi = y * const_pi * 0.5f;
+                const glm::vec3 s(
+                    std::cos(phi) * std::sin(theta),
+                    std::sin(phi),
+                    std::cos(phi) * std::cos(theta));
+                c = c + sample_level(src, s);
+            }
+            (c * invN).store(out[iw]);
+        }
+    });
+}
+
+static inline rgba
+sample_equirectangular(const Equirectangular &e, const glm::vec2 &suv){
+    // wrap horizontally, clamp at the poles
+    float x = suv.x * e.width - 0.5f;
+    x -= std::floor(x / e.width) * e.width;
+    const float y = glm::clamp(suv.y * e.height - 0.5f, 0.f, float(e.height - 1));
+    const uint32_t x0 = std::min((uint32_t)x, e.width-1), y0 = (uint32_t)y;
+    const uint32_t x1 = (x0 + 1) % e.width, y1 = std::min(y0 + 1, e.height - 1);
+    const float sx = x - x0, sy = y - y0;
+    const glm::vec4 *r0 = e.texels.data() + size_t(y0) * e.width;
+    const glm::vec4 *r1 = e.texels.data() + size_t(y1) * e.width;
+    return rgba::zero()
+        .madd(rgba::load(r0[x0]), (1.f-sx) * (1.f-sy))
+        .madd(rgba::load(r0[x1]), sx * (1.f-sy))
+        .madd(rgba::load(r1[x0]), (1.f-sx) * sy)
+        .madd(rgba::load(r1[x1]), sx * sy);
+}
+
+void EquirectangularToCubemap(const Equirectangular &src, uint32_t samples, uint32_t threads, CubemapLevel &dst){
+    const uint32_t s = dst.size;
+    dst.Resize(s);
+    samples = std::max(samples, 1u);
+    const float invN = 1.f / samples;
+    const float invsize = 1.f / s;
+    ParallelFor(s * 6, threads, [&](uint32_t row){
+        const uint8_t face = uint8_t(row / s);
+        const uint32_t y = row % s;
+        glm::vec4 *out = dst.Face(face) + size_t(y) * s;
+        for (uint32_t x=0; x<s; ++x){
+            rgba c = rgba::zero();
+            for (uint32_t sample=0; sample<samples; ++sample){
+                const glm::vec2 h = samples == 1 ? glm::vec2(0.5f) : hammersley(sample, invN);
+                const glm::vec3 dir = glm::normalize(uvface2dir(face, (x + h.x) * invsize, (y + h.y) * invsize));
+                const glm::vec2 suv(
+                    0.5f + 0.5f * std::atan2(dir.z, dir.x) / const_pi,
+                    std::acos(glm::clamp(dir.y, -1.f, 1.f)) / const_pi);
+                c = c + sample_equirectangular(src, suv);
+            }
+            (c * invN).store(out[x]);
+        }
+    });
+}
+
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+#include <functional>
+
+// Offline image based lighting preprocess: cubemap resampling, GGX prefiltered mipmaps and
+// irradiance SH projection. All images are RGBA32F, every pass is split by rows over a thread pool.
+namespace ibl {
+
+enum class Quality : uint8_t { Low, Medium, High, Ultra, Count };
+
+struct QualityPreset {
+    uint32_t prefilter_samples;     // GGX importance samples per texel
+    uint32_t resample_samples;      // supersamples per texel when resampling between projections
+};
+
+const QualityPreset& GetQualityPreset(Quality q);
+bool ParseQuality(const char* name, Quality &q);
+
+// one mip level of a cubemap, faces are stored in order: +X, -X, +Y, -Y, +Z, -Z
+struct CubemapLevel {
+    uint32_t size = 0;
+    std::vector<glm::vec4> texels;
+
+    void Resize(uint32_t s) { size = s; texels.resize(size_t(s) * s * 6); }
+    glm::vec4* Face(uint8_t face) { return texels.data() + size_t(size) * size * face; }
+    const glm::vec4* Face(uint8_t face) const { return texels.data() + size_t(size) * size * face; }
+};
+
+// mip chain, [0] is the largest level
+using Cubemap = std::vector<CubemapLevel>;
+
+struct Equirectangular {
+    uint32_t width = 0, height = 0;
+    std::vector<glm::vec4> texels;
+};
+
+struct face_address {
+    uint8_t face;
+    float u, v;
+};
+
+static inline float n2s(float v){return v*2.f - 1.f;}
+static inline float s2n(float v){return (v+1.f)*0.5f;}
+
+static inline face_address
+dir2uvface(const glm::vec3 &dir){
+    const float x = dir.x, y = dir.y, z = dir.z;
+    const float ax = glm::abs(x), ay = glm::abs(y), az = glm::abs(z);
+    if (ax > ay){
+        if (ax > az){
+            return (x > 0) ? face_address{0, s2n(-z/ax), s2n(y/ax)}     // +X
+                           : face_address{1, s2n(z/ax), s2n(y/ax)};     // -X
+        }
+    } else {
+        if (ay > az){
+            return (y > 0) ? face_address{2, s2n(x/ay), s2n(z/ay)}      // +Y
+                           : face_address{3, s2n(x/ay), s2n(-z/ay)};    // -Y
+        }
+    }
+
+    return z > 0 ? face_address{4, s2n(x/az), s2n(y/az)}                // +Z
+                 : face_address{5, s2n(x/az), s2n(-y/az)};              // -Z
+}
+
+static inline glm::vec3
+uvface2dir(int face, float u, float v){
+    u = n2s(u), v = n2s(v);
+    switch (face){
+        case 0: return glm::vec3( 1.0, v,-u); break;
+        case 1: return glm::vec3(-1.0, v, u); break;
+        case 2: return glm::vec3( u, 1.0,-v); break;
+        case 3: return glm::vec3( u,-1.0, v); break;
+        case 4: return glm::vec3( u, v, 1.0); break;
+        case 5:
+        default: return glm::vec3(-u, v,-1.0); break;
+    }
+}
+
+static inline glm::vec2
+hammersley(uint32_t i, float iN) {
+    constexpr float tof = 0.5f / 0x80000000U;
+    uint32_t bits = i;
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return{ i * iN, bits * tof};
+}
+
+// threads == 0 means hardware concurrency
+void ParallelFor(uint32_t count, uint32_t threads, const std::function<void (uint32_t)> &func);
+
+// box filtered mip chain down to 1x1, cm[0] must be filled
+void BuildMipChain(Cubemap &cm, uint32_t threads);
+
+glm::vec4 SampleLevel(const CubemapLevel &level, const glm::vec3 &dir);
+glm::vec4 SampleLod(const Cubemap &cm, const glm::vec3 &dir, float lod);
+
+// prefiltered specular mip chain, roughness of mip i is i/(mipcount-1), same as ibl.lua
+void PrefilterGGX(const Cubemap &src, uint32_t size, uint32_t mipcount, uint32_t samples, uint32_t threads, Cubemap &dst);
+
+// irradiance SH coefficients Eml (bandnum * bandnum), with A(l)/pi baked in, see ant.sh/sh.lua
+void IrradianceSH(const CubemapLevel &src, uint32_t bandnum, uint32_t threads, glm::vec3 *Eml);
+
+void CubemapToEquirectangular(const CubemapLevel &src, uint32_t samples, uint32_t threads, Equirectangular &dst);
+void EquirectangularToCubemap(const Equirectangular &src, uint32_t samples, uint32_t threads, CubemapLevel &dst);
+
+}
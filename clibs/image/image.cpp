@@ -1,16 +1,14 @@
 #include <lua.hpp>
 #include <assert.h>
 #include <cstring>
+#include <cmath>
 #include <bimg/bimg.h>
 #include <bx/error.h>
 #include <bx/readerwriter.h>
 #include <bx/pixelformat.h>
 #include <bimg/decode.h>
-#include <numbers>
 
 #include <glm/glm.hpp>
-#include <glm/ext/scalar_constants.hpp>
-#include <glm/gtx/compatibility.hpp>
 
 #include "luabgfx.h"
 
@@ -18,8 +16,7 @@
 
 #include "lua2struct.h"
 #include "fastio.h"
-
-static constexpr auto const_pi = std::numbers::pi_v<float>;
+#include "ibl.h"
 
 namespace lua_struct {
     template <>
@@ -637,150 +634,78 @@ lpack2cubemap(lua_State *L){
     return 1;
 }
 
-static inline glm::vec2
-hammersley(uint32_t i, float iN) {
-    constexpr float tof = 0.5f / 0x80000000U;
-    uint32_t bits = i;
-    bits = (bits << 16u) | (bits >> 16u);
-    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
-    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
-    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
-    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
-    return{ i * iN, bits * tof};
-}
-
-struct face_address
-{
-    uint8_t face;
-    float u, v;
-};
-
-static float inline n2s(float v){return v*2.f - 1.f;}
-static float inline s2n(float v){return (v+1.f)*0.5f;}
-
-static inline face_address
-dir2uvface(const glm::vec3 &dir){
-    const float x = dir.x, y = dir.y, z = dir.z;
-    const float ax = glm::abs(x), ay = glm::abs(y), az = glm::abs(z);
-    if (ax > ay){
-        if (ax > az){
-            return (x > 0) ? face_address{0, s2n(-z/ax), s2n(y/ax)}     // +X
-                           : face_address{1, s2n(z/ax), s2n(y/ax)};     // -X
-        }
-    } else {
-        if (ay > az){
-            return (y > 0) ? face_address{2, s2n(x/ay), s2n(z/ay)}      // +Y
-                           : face_address{3, s2n(x/ay), s2n(-z/ay)};    // -Y
-        }
+static ibl::QualityPreset
+check_quality(lua_State *L, int idx, const char* def){
+    const char* name = luaL_optstring(L, idx, def);
+    ibl::Quality q;
+    if (!ibl::ParseQuality(name, q)){
+        luaL_error(L, "Invalid quality:%s, should be: low/medium/high/ultra", name);
     }
-
-    return z > 0 ? face_address{4, s2n(x/az), s2n(y/az)}                // +Z
-                 : face_address{5, s2n(x/az), s2n(-y/az)};              // -Z
+    return ibl::GetQualityPreset(q);
 }
 
-
-static inline glm::vec3
-uvface2dir(int face, float u, float v){
-    u = n2s(u), v = n2s(v);
-    switch (face){
-        case 0: return glm::vec3( 1.0, v,-u); break;
-        case 1: return glm::vec3(-1.0, v, u); break;
-        case 2: return glm::vec3( u, 1.0,-v); break;
-        case 3: return glm::vec3( u,-1.0, v); break;
-        case 4: return glm::vec3( u, v, 1.0); break;
-        case 5: 
-        default: return glm::vec3(-u, v,-1.0); break;
-    }
+static lua_Integer
+integer_from_field(lua_State *L, int idx, const char* fieldname, lua_Integer def){
+    const lua_Integer v = lua_getfield(L, idx, fieldname) == LUA_TNIL ? def : luaL_checkinteger(L, -1);
+    lua_pop(L, 1);
+    return v;
 }
 
-static inline glm::vec3
-filter_at(const bimg::ImageContainer &cm, const glm::vec3 &direction){
-    auto addr = dir2uvface(direction);
-    bimg::ImageMip cm_mip;
-    if (!bimg::imageGetRawData(cm, (uint8_t)addr.face, 0, cm.m_data, cm.m_size, cm_mip))
-        return glm::vec3(0.f);
-
-    const float maxwidth = (float)cm.m_width-1, maxheight = (float)cm.m_height-1;
-    const glm::vec2 xy(std::min(addr.u * maxwidth,  maxwidth),
-                 std::min(addr.v * maxheight, maxheight));
-
-    const glm::uvec2 uxy = glm::floor(xy);
-
-    auto read_texel = [&cm_mip](uint32_t x, uint32_t y){
-        return *((glm::vec4*)cm_mip.m_data + cm_mip.m_width * y + x);
-    };
-
-    const uint32_t x0 = uxy.x, y0 = uxy.y;
-    const uint32_t x1 = uxy.x+1, y1 = uxy.y+1;
-
-    const auto texel_x0y0 = read_texel(x0, y0);
-    const auto texel_x1y0 = read_texel(x1, y0);
-    const auto texel_x0y1 = read_texel(x0, y1);
-    const auto texel_x1y1 = read_texel(x1, y1);
-
-    const glm::vec2 st = glm::fract(xy);
+static const char*
+string_from_field(lua_State *L, int idx, const char* fieldname, const char* def){
+    const char* v = lua_getfield(L, idx, fieldname) == LUA_TNIL ? def : luaL_checkstring(L, -1);
+    lua_pop(L, 1);   // the string is kept alive by the config table
+    return v;
+}
 
-    return glm::vec3(
-            glm::lerp(
-                glm::lerp(texel_x0y0, texel_x1y0, st.s), 
-                glm::lerp(texel_x0y1, texel_x1y1, st.s), 
-                st.t));
+static void
+load_cubemap_level(const bimg::ImageContainer &ic, ibl::CubemapLevel &level){
+    level.Resize(ic.m_width);
+    for (uint8_t face=0; face<6; ++face){
+        bimg::ImageMip mip;
+        bimg::imageGetRawData(ic, face, 0, ic.m_data, ic.m_size, mip);
+        memcpy(level.Face(face), mip.m_data, sizeof(glm::vec4) * ic.m_width * ic.m_height);
+    }
 }
 
-template<class ImageType>
-static inline void
-write_at(ImageType &face, size_t iw, size_t ih, const glm::vec3 &v){
-    auto d = (glm::vec4*)face.m_data;
-    d[face.m_width * ih + iw] = glm::vec4(v, 0.f);
+// the arguments are all checked before parse_cubemap, luaL_error would leak the image container
+static bimg::ImageContainer*
+parse_cubemap(lua_State *L, int idx, bx::AllocatorI *allocator){
+    auto memory = getmemory(L, idx);
+    bx::Error err;
+    auto cm = bimg::imageParse(allocator, memory.data(), (uint32_t)memory.size(), bimg::TextureFormat::RGBA32F, &err);
+    if (cm == nullptr){
+        luaL_error(L, "Invalid cubemap texture");
+    }
+    if (!cm->m_cubeMap){
+        bimg::imageFree(cm);
+        luaL_error(L, "Texture is not a cubemap");
+    }
+    return cm;
 }
 
 static int
 lcubemap2equirectangular(lua_State *L){
-    size_t cmsize;
-    const char* cmdata = luaL_checklstring(L, 1, &cmsize);
     const char* fmt = luaL_checkstring(L, 2);
-    bx::DefaultAllocator allocator;
-    bx::Error err;
-    auto cm = bimg::imageParse(&allocator, cmdata, (uint32_t)cmsize, bimg::TextureFormat::RGBA32F, &err);
-    if (cm == nullptr){
-        return luaL_error(L, "Invalid cubemap texture");
-    }
+    const lua_Integer width  = luaL_optinteger(L, 3, 0);
+    const lua_Integer height = luaL_optinteger(L, 4, 0);
+    const auto preset = check_quality(L, 5, "high");
+    bx::DefaultAllocator defaultAllocator;
+    AlignedAllocator allocator(&defaultAllocator, 16);
+    auto cm = parse_cubemap(L, 1, &allocator);
 
-    const uint16_t w = (uint16_t)luaL_optinteger(L, 3, cm->m_width*2);
-    const uint16_t h = (uint16_t)luaL_optinteger(L, 4, cm->m_height);
-
-    auto equirectangular = bimg::imageAlloc(&allocator, bimg::TextureFormat::RGBA32F, w, h, 1, 1, false, false);
-
-    for (size_t ih = 0; ih < h; ++ih){
-        for (size_t iw = 0; iw < w; ++iw) {
-            glm::vec3 c(0.0);
-            // float x = 2.0f * (iw) / w - 1.0f;
-            // float y = 1.0f - 2.0f * (ih) / h;
-            // float theta = x * const_pi;
-            // float phi = y * const_pi * 0.5f;
-            // glm::vec3 s = {
-            //         std::cos(phi) * std::sin(theta),
-            //         std::sin(phi),
-            //         std::cos(phi) * std::cos(theta) };
-            // c += filter_at(*cm, s);
-            // write_at(*equirectangular, iw, ih, c);
-
-            const size_t numSamples = 64; // TODO: how to chose numsamples
-            for (size_t sample = 0; sample < numSamples; sample++) {
-                const glm::vec2 u = hammersley(uint32_t(sample), 1.0f / numSamples);
-                float x = 2.0f * (iw + u.x) / w - 1.0f;
-                float y = 1.0f - 2.0f * (ih + u.y) / h;
-                float theta = x * const_pi;
-                float phi = y * const_pi * 0.5f;
-                glm::vec3 s = {
-                        std::cos(phi) * std::sin(theta),
-                        std::sin(phi),
-                        std::cos(phi) * std::cos(theta) };
-                c += filter_at(*cm, s);
-            }
-            write_at(*equirectangular, iw, ih, c * (1.0f / numSamples));
-        }
-    }
+    ibl::Equirectangular e;
+    e.width  = (uint16_t)(width ? width : cm->m_width*2);
+    e.height = (uint16_t)(height ? height : cm->m_height);
+
+    ibl::CubemapLevel src;
+    load_cubemap_level(*cm, src);
+    bimg::imageFree(cm);
+
+    ibl::CubemapToEquirectangular(src, preset.resample_samples, 0, e);
+
+    auto equirectangular = bimg::imageAlloc(&allocator, bimg::TextureFormat::RGBA32F, (uint16_t)e.width, (uint16_t)e.height, 1, 1, false, false);
+    memcpy(equirectangular->m_data, e.texels.data(), e.texels.size() * sizeof(glm::vec4));
 
     bx::MemoryBlock mb(&allocator);
     write2memory(L, mb, equirectangular, fmt);
@@ -791,109 +716,154 @@ lcubemap2equirectangular(lua_State *L){
 
 static int
 lequirectangular2cubemap(lua_State *L) {
-    size_t esize;
-    const char* edata = luaL_checklstring(L, 1, &esize);
-    bx::DefaultAllocator allocator;
+    auto memory = getmemory(L, 1);
+    const lua_Integer size = luaL_optinteger(L, 2, 0);
+    const auto preset = check_quality(L, 3, "low");
+    bx::DefaultAllocator defaultAllocator;
+    AlignedAllocator allocator(&defaultAllocator, 16);
     bx::Error err;
-    auto equirectangular = bimg::imageParse(&allocator, edata, (uint32_t)esize, bimg::TextureFormat::RGBA32F, &err);
+    auto equirectangular = bimg::imageParse(&allocator, memory.data(), (uint32_t)memory.size(), bimg::TextureFormat::RGBA32F, &err);
     if (equirectangular == nullptr){
         return luaL_error(L, "Invalid cubemap texture");
     }
 
-    const size_t width = equirectangular->m_width;
-    const size_t height = equirectangular->m_height;
+    const uint32_t width = equirectangular->m_width;
+    const uint32_t height = equirectangular->m_height;
 
     if (height * 2 != width){
+        bimg::imageFree(equirectangular);
         return luaL_error(L, "Invalid equirectangular map, width:%d = 2 * height:%d", width, height);
     }
 
-    const uint16_t facesize = (uint16_t)luaL_optinteger(L, 2, height);
-
-    auto load_at = [](const auto equirectangular, size_t x, size_t y){
-        const glm::vec4 *d = (const glm::vec4*)(equirectangular->m_data);
-        return d[y*equirectangular->m_width+x];
-    };
+    const uint16_t facesize = (uint16_t)(size ? size : height);
 
-    // const float pioverone = 1.f / const_pi;
+    ibl::Equirectangular e;
+    e.width = width;
+    e.height = height;
+    e.texels.resize(size_t(width) * height);
+    memcpy(e.texels.data(), equirectangular->m_data, e.texels.size() * sizeof(glm::vec4));
+    bimg::imageFree(equirectangular);
 
-    // auto toRectilinear = [=](glm::vec3 s){
-    //     float xf = std::atan2(s.x, s.z) * pioverone;   // range [-1.0, 1.0]
-    //     float yf = std::asin(s.y) * (2 * pioverone);   // range [-1.0, 1.0]
-    //     xf = (xf + 1.0f) * 0.5f * (width  - 1);        // range [0, width [
-    //     yf = (1.0f - yf) * 0.5f * (height - 1);        // range [0, height[
-    //     return glm::vec2(xf, yf);
-    // };
+    ibl::CubemapLevel level;
+    level.size = facesize;
+    ibl::EquirectangularToCubemap(e, preset.resample_samples, 0, level);
 
     auto cm = bimg::imageAlloc(&allocator, bimg::TextureFormat::RGBA32F, facesize, facesize, 1, 1, true, false);
+    for (uint8_t face=0; face < 6; ++face){
+        bimg::ImageMip cmface;
+        bimg::imageGetRawData(*cm, face, 0, cm->m_data, cm->m_size, cmface);
+        memcpy((void*)cmface.m_data, level.Face(face), sizeof(glm::vec4) * facesize * facesize);
+    }
 
-    auto dir2spherecoord = [](const glm::vec3 &v)
-    {
-        return glm::vec2(
-            0.5f + 0.5f * atan2(v.z, v.x) / const_pi,
-            acos(v.y) / const_pi);
-    };
+    bx::MemoryBlock mb(&allocator);
+    write2memory(L, mb, cm, "KTX");
+    lua_pushlstring(L, (const char*)mb.more(), mb.getSize());
+    bimg::imageFree(cm);
+    return 1;
+}
 
-    const float invsize = 1.f / facesize;
+// prefilter_cubemap(content, {size=, quality=, samples=, threads=, format="RGBA16F", filetype="KTX"})
+static int
+lprefilter_cubemap(lua_State *L){
+    uint32_t size = 0, samples, threads = 0;   // size 0: the size of the source cubemap
+    const char* fmtname = "RGBA16F";
+    const char* filetype = "KTX";
+    ibl::QualityPreset preset = ibl::GetQualityPreset(ibl::Quality::High);
+    if (!lua_isnoneornil(L, 2)){
+        luaL_checktype(L, 2, LUA_TTABLE);
+        size    = (uint32_t)integer_from_field(L, 2, "size", 0);
+        lua_getfield(L, 2, "quality");
+        preset  = check_quality(L, -1, "high");
+        lua_pop(L, 1);
+        threads = (uint32_t)integer_from_field(L, 2, "threads", 0);
+        fmtname = string_from_field(L, 2, "format", fmtname);
+        filetype= string_from_field(L, 2, "filetype", filetype);
+    }
+    samples = (uint32_t)(lua_istable(L, 2) ? integer_from_field(L, 2, "samples", preset.prefilter_samples) : preset.prefilter_samples);
+    if ((size & (size-1)) != 0){
+        return luaL_error(L, "Invalid prefilter size:%d, should be power of 2", size);
+    }
+    const auto fmt = bimg::getFormat(fmtname);
+    if (fmt == bimg::TextureFormat::Unknown){
+        return luaL_error(L, "Unknown texture format: %s", fmtname);
+    }
 
-    auto remap_index = [=](float v){ return ((v+0.5f) * invsize);};
+    bx::DefaultAllocator defaultAllocator;
+    AlignedAllocator allocator(&defaultAllocator, 16);
+    auto cm = parse_cubemap(L, 1, &allocator);
+    if (size == 0){
+        size = cm->m_width;
+        if ((size & (size-1)) != 0){
+            bimg::imageFree(cm);
+            return luaL_error(L, "Invalid prefilter size:%d, should be power of 2", size);
+        }
+    }
 
-    for (uint8_t face=0; face < 6; ++face){
-        bimg::ImageMip cmface;
-        bimg::imageGetRawData(*cm, (uint8_t)face, 0, cm->m_data, cm->m_size, cmface);
-        for (uint16_t y=0; y<facesize; ++y){
-            for (uint16_t x=0 ; x<facesize ; ++x) {
-                const glm::vec3 dir = glm::normalize(uvface2dir(face, remap_index(x), remap_index(y)));
-                const glm::vec2 suv = dir2spherecoord(dir);
-                const glm::uvec2 uv = glm::uvec2(suv * glm::vec2(width, height));
-                auto c = load_at(equirectangular, uv.x, uv.y);
-                /////////////////////////////////////////////////////////////////////////////////////////////
-                // calculate how many samples we need based on dx, dy in the source
-                // x = cos(phi) sin(theta)
-                // y = sin(phi)
-                // z = cos(phi) cos(theta)
-
-                // here we try to figure out how many samples we need, by evaluating the surface
-                // (in pixels) in the equirectangular -- we take the bounding box of the
-                // projection of the cubemap texel's corners.
-
-                // auto pos0 = toRectilinear(glm::normalize(uvface2dir(face, remap_index(x + 0.0f), remap_index(y + 0.0f)))); // make sure to use the float version
-                // auto pos1 = toRectilinear(glm::normalize(uvface2dir(face, remap_index(x + 1.0f), remap_index(y + 0.0f)))); // make sure to use the float version
-                // auto pos2 = toRectilinear(glm::normalize(uvface2dir(face, remap_index(x + 0.0f), remap_index(y + 1.0f)))); // make sure to use the float version
-                // auto pos3 = toRectilinear(glm::normalize(uvface2dir(face, remap_index(x + 1.0f), remap_index(y + 1.0f)))); // make sure to use the float version
-                // const float minx = std::min(pos0.x, std::min(pos1.x, std::min(pos2.x, pos3.x)));
-                // const float maxx = std::max(pos0.x, std::max(pos1.x, std::max(pos2.x, pos3.x)));
-                // const float miny = std::min(pos0.y, std::min(pos1.y, std::min(pos2.y, pos3.y)));
-                // const float maxy = std::max(pos0.y, std::max(pos1.y, std::max(pos2.y, pos3.y)));
-                // const float dx = std::max(1.0f, maxx - minx);
-                // const float dy = std::max(1.0f, maxy - miny);
-                // const size_t numSamples = size_t(dx * dy);
-
-                // const float iNumSamples = 1.0f / numSamples;
-                // glm::vec3 c(0.f);
-                // for (size_t sample = 0; sample < numSamples; sample++) {
-                //     // Generate numSamples in our destination pixels and map them to input pixels
-                //     const glm::vec2 h = hammersley(uint32_t(sample), iNumSamples);
-                //     const glm::vec3 s(glm::normalize(uvface2dir(face, remap_index(x + h.x), remap_index(y + h.y))));
-                //     auto pos = toRectilinear(s);
-
-                //     // we can't use filterAt() here because it reads past the width/height
-                //     // which is okay for cubmaps but not for square images
-
-                //     // TODO: the sample should be weighed by the area it covers in the cubemap texel
-
-                //     c += glm::vec3(load_at(equirectangular, (uint32_t)pos.x, (uint32_t)pos.y));
-                // }
-                // c *= iNumSamples;
-                
-                write_at(cmface, x, y, glm::vec3(c));
-            }
+    ibl::Cubemap src(1);
+    load_cubemap_level(*cm, src[0]);
+    bimg::imageFree(cm);
+
+    ibl::BuildMipChain(src, threads);
+    const uint32_t mipcount = (uint32_t)std::log2(size) + 1;
+    ibl::Cubemap prefilter;
+    ibl::PrefilterGGX(src, size, mipcount, samples, threads, prefilter);
+
+    auto ic = bimg::imageAlloc(&allocator, bimg::TextureFormat::RGBA32F, (uint16_t)size, (uint16_t)size, 1, 1, true, mipcount > 1);
+    for (uint8_t face=0; face<6; ++face){
+        for (uint8_t lod=0; lod<mipcount; ++lod){
+            bimg::ImageMip mip;
+            bimg::imageGetRawData(*ic, face, lod, ic->m_data, ic->m_size, mip);
+            const auto &level = prefilter[lod];
+            memcpy((void*)mip.m_data, level.Face(face), sizeof(glm::vec4) * level.size * level.size);
         }
     }
+    if (fmt != ic->m_format){
+        auto new_ic = bimg::imageConvert(&allocator, fmt, *ic, true);
+        bimg::imageFree(ic);
+        ic = new_ic;
+    }
 
     bx::MemoryBlock mb(&allocator);
-    write2memory(L, mb, cm, "KTX");
+    write2memory(L, mb, ic, filetype);
     lua_pushlstring(L, (const char*)mb.more(), mb.getSize());
-    bimg::imageFree(cm);
+    bimg::imageFree(ic);
+    return 1;
+}
+
+// irradiance_sh(content, facesize, bandnum, threads), content is RGBA32F cubemap data without mipmap
+static int
+lirradiance_sh(lua_State *L){
+    auto memory = getmemory(L, 1);
+    const uint32_t facesize = (uint32_t)luaL_checkinteger(L, 2);
+    const uint32_t bandnum = (uint32_t)luaL_checkinteger(L, 3);
+    const uint32_t threads = (uint32_t)luaL_optinteger(L, 4, 0);
+    if (bandnum < 1 || bandnum > 3){
+        return luaL_error(L, "Invalid bandnum:%d, only support 1~3", bandnum);
+    }
+    const size_t need = sizeof(glm::vec4) * facesize * facesize * 6;
+    if (memory.size() < need){
+        return luaL_error(L, "Invalid cubemap data size:%d, need:%d", (int)memory.size(), (int)need);
+    }
+
+    ibl::CubemapLevel src;
+    src.Resize(facesize);
+    memcpy(src.texels.data(), memory.data(), need);
+
+    glm::vec3 Eml[9];
+    ibl::IrradianceSH(src, bandnum, threads, Eml);
+
+    const int numcoeffs = (int)(bandnum * bandnum);
+    lua_createtable(L, numcoeffs, 0);
+    for (int ii=0; ii<numcoeffs; ++ii){
+        lua_createtable(L, 4, 0);
+        for (int c=0; c<3; ++c){
+            lua_pushnumber(L, Eml[ii][c]);
+            lua_seti(L, -2, c+1);
+        }
+        lua_pushnumber(L, 0.0);
+        lua_seti(L, -2, 4);
+        lua_seti(L, -2, ii+1);
+    }
     return 1;
 }
 
@@ -1087,6 +1057,8 @@ luaopen_image(lua_State* L) {
         { "pack2cubemap",            lpack2cubemap},
         { "cubemap2equirectangular", lcubemap2equirectangular},
         { "equirectangular2cubemap", lequirectangular2cubemap},
+        { "prefilter_cubemap",       lprefilter_cubemap},
+        { "irradiance_sh",           lirradiance_sh},
         { "replace_debug_mipmap",    lreplace_debug_mipmap},
         { "pack3dfile",              lpack3dfile},
         { "unpack_hdr_format",       lunpack_hdr_format},
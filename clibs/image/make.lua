@@ -16,6 +16,7 @@ lm:lua_src "image" {
     },
     sources = {
         "image.cpp",
+        "ibl.cpp",
     },
     msvc = {
         flags =	"/Zc:preprocessor",
@@ -14,6 +14,9 @@
 struct RendererViewport {
 	int viewid = -1;
 	bgfx_frame_buffer_handle_t fb = BGFX_INVALID_HANDLE;
+	// fallback when the transient buffers are exhausted, per viewport because every viewport updates it in the same frame
+	bgfx_dynamic_vertex_buffer_handle_t dvb = BGFX_INVALID_HANDLE;
+	bgfx_dynamic_index_buffer_handle_t dib = BGFX_INVALID_HANDLE;
 };
 
 enum class RendererTextureType: uint16_t {
@@ -48,6 +51,94 @@ static uint16_t bgfxGetHandle(int id) {
 	return (uint16_t)(id & 0xffff);
 }
 
+static void ImGui_ImplBgfx_DestroyBuffers(RendererViewport* ud) {
+	if (BGFX_HANDLE_IS_VALID(ud->dvb)) {
+		BGFX(destroy_dynamic_vertex_buffer)(ud->dvb);
+		ud->dvb = BGFX_INVALID_HANDLE;
+	}
+	if (BGFX_HANDLE_IS_VALID(ud->dib)) {
+		BGFX(destroy_dynamic_index_buffer)(ud->dib);
+		ud->dib = BGFX_INVALID_HANDLE;
+	}
+}
+
+// all draw lists are packed into one vertex/index buffer in list order, indices stay relative to their list
+static void ImGui_ImplBgfx_PackDrawLists(const ImDrawData* drawData, ImDrawVert* verts, ImDrawIdx* indices) {
+	for (int ii = 0; ii < drawData->CmdListsCount; ++ii) {
+		const ImDrawList* drawList = drawData->CmdLists[ii];
+		memcpy(verts, drawList->VtxBuffer.Data, drawList->VtxBuffer.Size * sizeof(ImDrawVert));
+		memcpy(indices, drawList->IdxBuffer.Data, drawList->IdxBuffer.Size * sizeof(ImDrawIdx));
+		verts += drawList->VtxBuffer.Size;
+		indices += drawList->IdxBuffer.Size;
+	}
+}
+
+struct RendererBuffers {
+	bool transient;
+	bgfx_transient_vertex_buffer_t tvb;
+	bgfx_transient_index_buffer_t tib;
+	bgfx_dynamic_vertex_buffer_handle_t dvb;
+	bgfx_dynamic_index_buffer_handle_t dib;
+	uint32_t numVertices;
+};
+
+static bool ImGui_ImplBgfx_AllocBuffers(RendererViewport* ud, const ImDrawData* drawData, RendererBuffers& b) {
+	constexpr bool index32 = sizeof(ImDrawIdx) == 4;
+	const uint32_t numVertices = (uint32_t)drawData->TotalVtxCount;
+	const uint32_t numIndices = (uint32_t)drawData->TotalIdxCount;
+	b.numVertices = numVertices;
+	if (numVertices == BGFX(get_avail_transient_vertex_buffer)(numVertices, &g_ctx.layout)
+		&& numIndices == BGFX(get_avail_transient_index_buffer)(numIndices, index32)) {
+		b.transient = true;
+		BGFX(alloc_transient_vertex_buffer)(&b.tvb, numVertices, &g_ctx.layout);
+		BGFX(alloc_transient_index_buffer)(&b.tib, numIndices, index32);
+		ImGui_ImplBgfx_PackDrawLists(drawData, (ImDrawVert*)b.tvb.data, (ImDrawIdx*)b.tib.data);
+		return true;
+	}
+	b.transient = false;
+	if (!BGFX_HANDLE_IS_VALID(ud->dvb)) {
+		ud->dvb = BGFX(create_dynamic_vertex_buffer)(numVertices, &g_ctx.layout, BGFX_BUFFER_ALLOW_RESIZE);
+		ud->dib = BGFX(create_dynamic_index_buffer)(numIndices, BGFX_BUFFER_ALLOW_RESIZE | (index32 ? BGFX_BUFFER_INDEX32 : 0));
+		if (!BGFX_HANDLE_IS_VALID(ud->dvb) || !BGFX_HANDLE_IS_VALID(ud->dib)) {
+			ImGui_ImplBgfx_DestroyBuffers(ud);
+			return false;
+		}
+	}
+	const bgfx_memory_t* vmem = BGFX(alloc)(numVertices * sizeof(ImDrawVert));
+	const bgfx_memory_t* imem = BGFX(alloc)(numIndices * sizeof(ImDrawIdx));
+	ImGui_ImplBgfx_PackDrawLists(drawData, (ImDrawVert*)vmem->data, (ImDrawIdx*)imem->data);
+	BGFX(update_dynamic_vertex_buffer)(ud->dvb, 0, vmem);
+	BGFX(update_dynamic_index_buffer)(ud->dib, 0, imem);
+	b.dvb = ud->dvb;
+	b.dib = ud->dib;
+	return true;
+}
+
+static void ImGui_ImplBgfx_SetBuffers(bgfx_encoder_t* encoder, const RendererBuffers& b, uint32_t startVertex, uint32_t firstIndex, uint32_t numIndices) {
+	if (b.transient) {
+		BGFX(encoder_set_transient_vertex_buffer)(encoder, 0, &b.tvb, startVertex, b.numVertices - startVertex);
+		BGFX(encoder_set_transient_index_buffer)(encoder, &b.tib, firstIndex, numIndices);
+	}
+	else {
+		BGFX(encoder_set_dynamic_vertex_buffer)(encoder, 0, b.dvb, startVertex, b.numVertices - startVertex);
+		BGFX(encoder_set_dynamic_index_buffer)(encoder, b.dib, firstIndex, numIndices);
+	}
+}
+
+struct RendererScissor {
+	uint16_t x, y, w, h;
+	bool operator==(const RendererScissor& o) const {
+		return x == o.x && y == o.y && w == o.w && h == o.h;
+	}
+	bool operator!=(const RendererScissor& o) const {
+		return !(*this == o);
+	}
+};
+
+static uint16_t ImGui_ImplBgfx_ClampScissor(float v) {
+	return uint16_t(std::min(std::max(v, 0.0f), 65535.0f));
+}
+
 void ImGui_ImplBgfx_RenderDrawData(ImGuiViewport* viewport) {
 	RendererViewport* ud = (RendererViewport*)viewport->RendererUserData;
 	const ImDrawData* drawData = viewport->DrawData;
@@ -76,26 +167,45 @@ void ImGui_ImplBgfx_RenderDrawData(ImGuiViewport* viewport) {
 	const float fb_h = fb_y + clip_size.y * clip_scale.y;
 	BGFX(set_view_rect)(ud->viewid, uint16_t(fb_x), uint16_t(fb_y), uint16_t(fb_w), uint16_t(fb_h));
 
-	for (size_t ii = 0, num = drawData->CmdListsCount; ii < num; ++ii) {
-		const ImDrawList* drawList = drawData->CmdLists[(int)ii];
-		uint32_t numVertices = (uint32_t)drawList->VtxBuffer.size();
-		uint32_t numIndices = (uint32_t)drawList->IdxBuffer.size();
-
-		if (numVertices != BGFX(get_avail_transient_vertex_buffer)(numVertices, &g_ctx.layout)
-			|| numIndices != BGFX(get_avail_transient_index_buffer)(numIndices, false)) {
-			break;
-		}
-
-		bgfx_transient_vertex_buffer_t tvb;
-		bgfx_transient_index_buffer_t tib;
-		BGFX(alloc_transient_vertex_buffer)(&tvb, numVertices, &g_ctx.layout);
-		BGFX(alloc_transient_index_buffer)(&tib, numIndices, false);
-		ImDrawVert* verts = (ImDrawVert*)tvb.data;
-		memcpy(verts, drawList->VtxBuffer.begin(), numVertices * sizeof(ImDrawVert));
-		ImDrawIdx* indices = (ImDrawIdx*)tib.data;
-		memcpy(indices, drawList->IdxBuffer.begin(), numIndices * sizeof(ImDrawIdx));
+	RendererBuffers buffers;
+	if (drawData->TotalIdxCount == 0 || !ImGui_ImplBgfx_AllocBuffers(ud, drawData, buffers)) {
+		BGFX(encoder_end)(encoder);
+		return;
+	}
 
-		for (const ImDrawCmd& cmd : drawList->CmdBuffer) {
+	// Submit with BGFX_DISCARD_NONE, so state, texture and scissor carry over to the next draw and are only set when
+	// they change. Consecutive commands with the same texture and clip rect are merged into one draw.
+	constexpr uint64_t state = 0
+		| BGFX_STATE_WRITE_RGB
+		| BGFX_STATE_WRITE_A
+		| BGFX_STATE_MSAA
+		| BGFX_STATE_BLEND_FUNC(BGFX_STATE_BLEND_SRC_ALPHA, BGFX_STATE_BLEND_INV_SRC_ALPHA)
+		;
+	BGFX(encoder_set_state)(encoder, state, 0);
+	// the font texture (type 0) with handle 0 has id 0, so "nothing bound" can't be a sentinel id
+	RendererTexture lastTexture;
+	lastTexture.id = 0;
+	bool hasTexture = false;
+	RendererScissor lastScissor = { 0, 0, 0, 0 };
+	bool hasScissor = false;
+
+	uint32_t vtxBase = 0;
+	uint32_t idxBase = 0;
+	for (int ii = 0; ii < drawData->CmdListsCount; ++ii) {
+		const ImDrawList* drawList = drawData->CmdLists[ii];
+		const int numCmds = drawList->CmdBuffer.Size;
+		for (int jj = 0; jj < numCmds; ++jj) {
+			const ImDrawCmd& cmd = drawList->CmdBuffer[jj];
+			if (cmd.UserCallback) {
+				if (cmd.UserCallback != ImDrawCallback_ResetRenderState) {
+					cmd.UserCallback(drawList, &cmd);
+				}
+				// the callback may touch the encoder, set everything again
+				BGFX(encoder_set_state)(encoder, state, 0);
+				hasTexture = false;
+				hasScissor = false;
+				continue;
+			}
 			if (0 == cmd.ElemCount) {
 				continue;
 			}
@@ -104,37 +214,43 @@ void ImGui_ImplBgfx_RenderDrawData(ImGuiViewport* viewport) {
 			RendererTexture texture;
 			texture.id = texid;
 
-			const float x = (cmd.ClipRect.x - clip_offset.x) * clip_scale.x;
-			const float y = (cmd.ClipRect.y - clip_offset.y) * clip_scale.y;
-			const float w = (cmd.ClipRect.z - cmd.ClipRect.x) * clip_scale.x;
-			const float h = (cmd.ClipRect.w - cmd.ClipRect.y) * clip_scale.y;
-			
-			BGFX(encoder_set_scissor)(encoder
-				, uint16_t(std::min(std::max(x, 0.0f), 65535.0f))
-				, uint16_t(std::min(std::max(y, 0.0f), 65535.0f))
-				, uint16_t(std::min(std::max(w, 0.0f), 65535.0f))
-				, uint16_t(std::min(std::max(h, 0.0f), 65535.0f))
-				);
-
-			constexpr uint64_t state = 0
-				| BGFX_STATE_WRITE_RGB
-				| BGFX_STATE_WRITE_A
-				| BGFX_STATE_MSAA
-				| BGFX_STATE_BLEND_FUNC(BGFX_STATE_BLEND_SRC_ALPHA, BGFX_STATE_BLEND_INV_SRC_ALPHA)
-				;
-			BGFX(encoder_set_state)(encoder, state, 0);
-
-			BGFX(encoder_set_transient_vertex_buffer)(encoder, 0, &tvb, cmd.VtxOffset, numVertices);
-			BGFX(encoder_set_transient_index_buffer)(encoder, &tib, cmd.IdxOffset, cmd.ElemCount);
-			if (texture.s.type == RendererTextureType::Font) {
-				BGFX(encoder_set_texture)(encoder, 0, g_ctx.fontTex, texture.s.handle, UINT32_MAX);
-				BGFX(encoder_submit)(encoder, ud->viewid, g_ctx.fontProgram, 0, BGFX_DISCARD_STATE);
+			uint32_t elemCount = cmd.ElemCount;
+			while (jj + 1 < numCmds) {
+				const ImDrawCmd& next = drawList->CmdBuffer[jj + 1];
+				if (next.UserCallback
+					|| next.GetTexID() != texid
+					|| next.VtxOffset != cmd.VtxOffset
+					|| next.IdxOffset != cmd.IdxOffset + elemCount
+					|| memcmp(&next.ClipRect, &cmd.ClipRect, sizeof(ImVec4)) != 0) {
+					break;
+				}
+				elemCount += next.ElemCount;
+				++jj;
 			}
-			else {
-				BGFX(encoder_set_texture)(encoder, 0, g_ctx.imageTex, texture.s.handle, UINT32_MAX);
-				BGFX(encoder_submit)(encoder, ud->viewid, g_ctx.imageProgram, 0, BGFX_DISCARD_STATE);
+
+			const RendererScissor scissor = {
+				ImGui_ImplBgfx_ClampScissor((cmd.ClipRect.x - clip_offset.x) * clip_scale.x),
+				ImGui_ImplBgfx_ClampScissor((cmd.ClipRect.y - clip_offset.y) * clip_scale.y),
+				ImGui_ImplBgfx_ClampScissor((cmd.ClipRect.z - cmd.ClipRect.x) * clip_scale.x),
+				ImGui_ImplBgfx_ClampScissor((cmd.ClipRect.w - cmd.ClipRect.y) * clip_scale.y),
+			};
+			if (!hasScissor || scissor != lastScissor) {
+				BGFX(encoder_set_scissor)(encoder, scissor.x, scissor.y, scissor.w, scissor.h);
+				lastScissor = scissor;
+				hasScissor = true;
 			}
+
+			ImGui_ImplBgfx_SetBuffers(encoder, buffers, vtxBase + cmd.VtxOffset, idxBase + cmd.IdxOffset, elemCount);
+			const bool font = texture.s.type == RendererTextureType::Font;
+			if (!hasTexture || texture.id != lastTexture.id) {
+				BGFX(encoder_set_texture)(encoder, 0, font ? g_ctx.fontTex : g_ctx.imageTex, texture.s.handle, UINT32_MAX);
+				lastTexture = texture;
+				hasTexture = true;
+			}
+			BGFX(encoder_submit)(encoder, ud->viewid, font ? g_ctx.fontProgram : g_ctx.imageProgram, 0, BGFX_DISCARD_NONE);
 		}
+		vtxBase += (uint32_t)drawList->VtxBuffer.Size;
+		idxBase += (uint32_t)drawList->IdxBuffer.Size;
 	}
 	BGFX(encoder_discard)(encoder, BGFX_DISCARD_ALL);
 	BGFX(encoder_end)(encoder);
@@ -179,6 +295,7 @@ static void ImGui_ImplBgfx_CreateWindow(ImGuiViewport* viewport) {
 static void ImGui_ImplBgfx_DestroyWindow(ImGuiViewport* viewport) {
 	RendererViewport* ud = (RendererViewport*)viewport->RendererUserData;
 	if (ud) {
+		ImGui_ImplBgfx_DestroyBuffers(ud);
 		if (BGFX_HANDLE_IS_VALID(ud->fb)) {
 			BGFX(destroy_frame_buffer)(ud->fb);
 		}
@@ -271,6 +388,9 @@ void ImGui_ImplBgfx_Shutdown() {
 	ImGui::DestroyPlatformWindows();
 	ImGuiViewport* viewport = ImGui::GetMainViewport();
 	RendererViewport* ud = (RendererViewport*)viewport->RendererUserData;
+	if (ud) {
+		ImGui_ImplBgfx_DestroyBuffers(ud);
+	}
 	delete ud;
 	viewport->RendererUserData = nullptr;
 }
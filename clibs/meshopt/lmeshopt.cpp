@@ -0,0 +1,69 @@
+#include <lua.hpp>
+#include <cstring>
+#include <vector>
+
+#include "simplify.h"
+
+// meshopt.simplify(indices, indexsize, positions, stride, target_index_count, target_error)
+//  indices:    index buffer string, 2 or 4 bytes per index
+//  positions:  vertex buffer string, float3 position at the start of every vertex
+//  return simplified index buffer string (same index size) and the relative error
+static int
+lsimplify(lua_State *L){
+    size_t ibsize, vbsize;
+    const char *ib = luaL_checklstring(L, 1, &ibsize);
+    const lua_Integer indexsize = luaL_checkinteger(L, 2);
+    const char *vb = luaL_checklstring(L, 3, &vbsize);
+    const lua_Integer stride = luaL_checkinteger(L, 4);
+    const lua_Integer target = luaL_checkinteger(L, 5);
+    const float target_error = (float)luaL_optnumber(L, 6, 0.01);
+
+    if (indexsize != 2 && indexsize != 4)
+        return luaL_error(L, "invalid index size:%d", (int)indexsize);
+    if (stride < (lua_Integer)(sizeof(float) * 3))
+        return luaL_error(L, "invalid vertex stride:%d", (int)stride);
+
+    const size_t vertex_count = vbsize / (size_t)stride;
+    const size_t index_count = ibsize / (size_t)indexsize;
+    std::vector<uint32_t> indices(index_count);
+    for (size_t ii=0; ii<index_count; ++ii){
+        uint32_t idx;
+        if (indexsize == 2){
+            uint16_t v; memcpy(&v, ib + ii * 2, 2); idx = v;
+        } else {
+            memcpy(&idx, ib + ii * 4, 4);
+        }
+        if (idx >= vertex_count)
+            return luaL_error(L, "index out of range:%d, vertex count:%d", (int)idx, (int)vertex_count);
+        indices[ii] = idx;
+    }
+
+    std::vector<uint32_t> result(index_count);
+    const auto r = meshopt::Simplify(result.data(), indices.data(), index_count,
+        (const float*)vb, vertex_count, (size_t)stride,
+        target < 0 ? 0 : (size_t)target, target_error);
+
+    if (indexsize == 2){
+        std::vector<uint16_t> r16(r.index_count);
+        for (size_t ii=0; ii<r.index_count; ++ii)
+            r16[ii] = (uint16_t)result[ii];
+        lua_pushlstring(L, (const char*)r16.data(), r16.size() * sizeof(uint16_t));
+    } else {
+        lua_pushlstring(L, (const char*)result.data(), r.index_count * sizeof(uint32_t));
+    }
+    lua_pushnumber(L, r.error);
+    return 2;
+}
+
+extern "C" {
+LUAMOD_API int
+luaopen_meshopt(lua_State* L) {
+    luaL_checkversion(L);
+    luaL_Reg lib[] = {
+        {"simplify", lsimplify},
+        { nullptr, nullptr },
+    };
+    luaL_newlib(L, lib);
+    return 1;
+}
+}
@@ -0,0 +1,10 @@
+local lm = require "luamake"
+
+if lm.os ~= "ios" and lm.os ~= "android" then
+    lm:lua_src "meshopt" {
+        confs = { "glm" },
+        sources = {
+            "*.cpp",
+        },
+    }
+end
@@ -0,0 +1,284 @@
+#include "simplify.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace meshopt {
+
+struct Quadric {
+    double a2, ab, ac, ad;
+    double b2, bc, bd;
+    double c2, cd;
+    double d2;
+    double w;
+
+    void Add(const Quadric &q){
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+        b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd;
+        d2 += q.d2;
+        w  += q.w;
+    }
+
+    static Quadric Plane(const glm::dvec3 &n, double d, double w){
+        return Quadric{
+            n.x*n.x*w, n.x*n.y*w, n.x*n.z*w, n.x*d*w,
+            n.y*n.y*w, n.y*n.z*w, n.y*d*w,
+            n.z*n.z*w, n.z*d*w,
+            d*d*w,
+            w,
+        };
+    }
+
+    //squared distance to the planes, weighted average
+    double Error(const glm::vec3 &p) const {
+        const double x = p.x, y = p.y, z = p.z;
+        const double e =
+            a2*x*x + 2*ab*x*y + 2*ac*x*z + 2*ad*x
+                   +   b2*y*y + 2*bc*y*z + 2*bd*y
+                              +   c2*z*z + 2*cd*z
+                                         +   d2;
+        return w > 0 ? std::fabs(e) / w : 0;
+    }
+};
+
+struct Collapse {
+    uint32_t from;
+    uint32_t to;
+    double cost;
+};
+
+static inline uint64_t
+edge_key(uint32_t a, uint32_t b){
+    return (uint64_t(a) << 32) | b;
+}
+
+struct PositionHash {
+    size_t operator()(const glm::vec3 &p) const {
+        uint32_t h[3];
+        memcpy(h, &p.x, sizeof(h));
+        return (h[0] * 73856093u) ^ (h[1] * 19349663u) ^ (h[2] * 83492791u);
+    }
+};
+
+class Simplifier {
+public:
+    Simplifier(const float *positions, size_t vertex_count, size_t vertex_stride)
+        : m_positions(vertex_count), m_weld(vertex_count), m_locked(vertex_count, 0){
+        for (size_t ii=0; ii<vertex_count; ++ii){
+            const float *p = (const float*)((const uint8_t*)positions + ii * vertex_stride);
+            m_positions[ii] = glm::vec3(p[0], p[1], p[2]);
+        }
+
+        //vertices with the same position share one weld id, the first vertex use this position
+        std::unordered_map<glm::vec3, uint32_t, PositionHash> weld;
+        weld.reserve(vertex_count);
+        for (uint32_t ii=0; ii<(uint32_t)vertex_count; ++ii){
+            m_weld[ii] = weld.emplace(m_positions[ii], ii).first->second;
+        }
+    }
+
+    SimplifyResult Run(uint32_t *dst, const uint32_t *indices, size_t index_count, size_t target_index_count, float target_error){
+        m_triangles.assign(indices, indices + index_count);
+        LockBoundary();
+        BuildQuadrics();
+
+        glm::vec3 bmin(FLT_MAX), bmax(-FLT_MAX);
+        for (auto i : m_triangles){
+            bmin = glm::min(bmin, m_positions[i]);
+            bmax = glm::max(bmax, m_positions[i]);
+        }
+        const double extent = std::max(glm::length(bmax - bmin), FLT_EPSILON);
+        const double limit = (target_error * extent) * (target_error * extent);
+
+        double maxcost = 0;
+        while (m_triangles.size() > target_index_count){
+            if (!Pass(target_index_count, limit, maxcost))
+                break;
+        }
+
+        std::copy(m_triangles.begin(), m_triangles.end(), dst);
+        return SimplifyResult{ m_triangles.size(), float(std::sqrt(maxcost) / extent) };
+    }
+
+private:
+    void LockBoundary(){
+        //a position referenced by different vertices is an attribute seam (uv, normal split)
+        std::vector<uint32_t> owner(m_positions.size(), UINT32_MAX);
+        for (auto i : m_triangles){
+            auto &o = owner[m_weld[i]];
+            if (o == UINT32_MAX)
+                o = i;
+            else if (o != i)
+                m_locked[m_weld[i]] = 1;
+        }
+
+        //a welded edge without its opposite is on the open border
+        std::unordered_set<uint64_t> edges;
+        edges.reserve(m_triangles.size());
+        for (size_t t=0; t<m_triangles.size(); t+=3){
+            for (int e=0; e<3; ++e){
+                edges.insert(edge_key(m_weld[m_triangles[t+e]], m_weld[m_triangles[t+(e+1)%3]]));
+            }
+        }
+        for (size_t t=0; t<m_triangles.size(); t+=3){
+            for (int e=0; e<3; ++e){
+                const uint32_t a = m_weld[m_triangles[t+e]], b = m_weld[m_triangles[t+(e+1)%3]];
+                if (edges.find(edge_key(b, a)) == edges.end()){
+                    m_locked[a] = m_locked[b] = 1;
+                }
+            }
+        }
+    }
+
+    void BuildQuadrics(){
+        m_quadrics.assign(m_positions.size(), Quadric{});
+        for (size_t t=0; t<m_triangles.size(); t+=3){
+            const glm::dvec3 p0(m_positions[m_triangles[t]]), p1(m_positions[m_triangles[t+1]]), p2(m_positions[m_triangles[t+2]]);
+            const glm::dvec3 c = glm::cross(p1 - p0, p2 - p0);
+            const double len = glm::length(c);
+            if (len <= 0)
+                continue;
+            const glm::dvec3 n = c / len;
+            const Quadric q = Quadric::Plane(n, -glm::dot(n, p0), len * 0.5);
+            for (int ii=0; ii<3; ++ii){
+                m_quadrics[m_weld[m_triangles[t+ii]]].Add(q);
+            }
+        }
+    }
+
+    bool Flipped(uint32_t t, uint32_t from, const glm::vec3 &to) const {
+        glm::vec3 p[3], q[3];
+        for (int ii=0; ii<3; ++ii){
+            const uint32_t v = m_triangles[t+ii];
+            p[ii] = m_positions[v];
+            q[ii] = v == from ? to : p[ii];
+        }
+        const glm::vec3 n0 = glm::cross(p[1] - p[0], p[2] - p[0]);
+        const glm::vec3 n1 = glm::cross(q[1] - q[0], q[2] - q[0]);
+        return glm::dot(n0, n1) <= 0.f;
+    }
+
+    //one round of independent collapses, every vertex take part in at most one collapse
+    bool Pass(size_t target_index_count, double limit, double &maxcost){
+        const uint32_t vertex_count = (uint32_t)m_positions.size();
+        const size_t triangle_num = m_triangles.size() / 3;
+
+        //vertex -> triangles
+        std::vector<uint32_t> offsets(vertex_count + 1, 0);
+        for (auto i : m_triangles)
+            ++offsets[i+1];
+        for (uint32_t ii=0; ii<vertex_count; ++ii)
+            offsets[ii+1] += offsets[ii];
+        std::vector<uint32_t> adjacency(m_triangles.size());
+        {
+            std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t t=0; t<m_triangles.size(); t+=3){
+                for (int ii=0; ii<3; ++ii)
+                    adjacency[fill[m_triangles[t+ii]]++] = uint32_t(t);
+            }
+        }
+
+        std::vector<Collapse> collapses;
+        collapses.reserve(m_triangles.size() * 2);
+        for (size_t t=0; t<m_triangles.size(); t+=3){
+            for (int e=0; e<3; ++e){
+                const uint32_t a = m_triangles[t+e], b = m_triangles[t+(e+1)%3];
+                const uint32_t wa = m_weld[a], wb = m_weld[b];
+                if (wa == wb)
+                    continue;
+                Quadric q = m_quadrics[wa];
+                q.Add(m_quadrics[wb]);
+                if (!m_locked[wa])
+                    collapses.push_back(Collapse{a, b, q.Error(m_positions[b])});
+                if (!m_locked[wb])
+                    collapses.push_back(Collapse{b, a, q.Error(m_positions[a])});
+            }
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse &l, const Collapse &r){
+            return l.cost < r.cost;
+        });
+
+        std::vector<uint32_t> remap(vertex_count);
+        for (uint32_t ii=0; ii<vertex_count; ++ii)
+            remap[ii] = ii;
+        std::vector<uint8_t> touched(vertex_count, 0);
+
+        size_t remain = triangle_num;
+        size_t collapsed = 0;
+        for (const auto &c : collapses){
+            if (c.cost > limit || remain * 3 <= target_index_count)
+                break;
+            if (touched[c.from] || touched[c.to])
+                continue;
+
+            const glm::vec3 &to = m_positions[c.to];
+            bool valid = true;
+            size_t removed = 0;
+            for (uint32_t ii=offsets[c.from]; ii<offsets[c.from+1]; ++ii){
+                const uint32_t t = adjacency[ii];
+                const bool shared = m_triangles[t] == c.to || m_triangles[t+1] == c.to || m_triangles[t+2] == c.to;
+                if (shared){
+                    ++removed;
+                } else if (Flipped(t, c.from, to)){
+                    valid = false;
+                    break;
+                }
+            }
+            if (!valid)
+                continue;
+
+            remap[c.from] = c.to;
+            m_quadrics[m_weld[c.to]].Add(m_quadrics[m_weld[c.from]]);
+            for (uint32_t ii=offsets[c.from]; ii<offsets[c.from+1]; ++ii){
+                const uint32_t t = adjacency[ii];
+                touched[m_triangles[t]] = touched[m_triangles[t+1]] = touched[m_triangles[t+2]] = 1;
+            }
+            remain -= removed;
+            maxcost = std::max(maxcost, c.cost);
+            ++collapsed;
+        }
+
+        if (collapsed == 0)
+            return false;
+
+        size_t n = 0;
+        for (size_t t=0; t<m_triangles.size(); t+=3){
+            const uint32_t v0 = remap[m_triangles[t]], v1 = remap[m_triangles[t+1]], v2 = remap[m_triangles[t+2]];
+            if (v0 == v1 || v1 == v2 || v2 == v0)
+                continue;
+            m_triangles[n++] = v0;
+            m_triangles[n++] = v1;
+            m_triangles[n++] = v2;
+        }
+        m_triangles.resize(n);
+        return true;
+    }
+
+private:
+    std::vector<glm::vec3>  m_positions;
+    std::vector<uint32_t>   m_weld;
+    std::vector<uint8_t>    m_locked;       //indexed by weld id
+    std::vector<Quadric>    m_quadrics;     //indexed by weld id
+    std::vector<uint32_t>   m_triangles;
+};
+
+SimplifyResult Simplify(uint32_t *dst, const uint32_t *indices, size_t index_count,
+    const float *positions, size_t vertex_count, size_t vertex_stride,
+    size_t target_index_count, float target_error){
+    if (index_count <= target_index_count || index_count % 3 != 0){
+        std::copy(indices, indices + index_count, dst);
+        return SimplifyResult{ index_count, 0.f };
+    }
+    Simplifier s(positions, vertex_count, vertex_stride);
+    return s.Run(dst, indices, index_count, target_index_count, target_error);
+}
+
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Offline mesh simplification for LOD generation, quadric error metric with half edge collapse.
+// Vertices only collapse onto other existing vertices, so the simplified index buffer still works
+// with the original vertex buffer. Border vertices and attribute seams (different vertices sharing
+// one position) are locked.
+namespace meshopt {
+
+struct SimplifyResult {
+    size_t index_count;
+    float error;            // max collapse error, relative to the mesh extent
+};
+
+// dst must have space for index_count indices, positions are float3 at the start of every vertex
+SimplifyResult Simplify(uint32_t *dst, const uint32_t *indices, size_t index_count,
+    const float *positions, size_t vertex_count, size_t vertex_stride,
+    size_t target_index_count, float target_error);
+
+}
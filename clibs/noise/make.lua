@@ -2,6 +2,9 @@ local lm = require "luamake"
 
 lm:lua_src "noise" {
     confs = { "glm" },
+    includes = {
+        lm.AntDir .. "/clibs/foundation",
+    },
     sources = {
         "noise.cpp",
     },
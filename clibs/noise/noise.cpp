@@ -3,6 +3,15 @@
 //#include "meshbase/meshbase.h"
 #include <glm/glm.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "simd4.h"
+
 extern "C" {
 #include <lua.h>
 #include <lualib.h>
@@ -108,12 +117,426 @@ static int lperlin2d(lua_State *L) {
 	return 1;
 }
 
+// batched gradient noise, fill a whole 2d/3d grid in one call, see lgrid2d/lgrid3d
+namespace noise {
+
+using simd4::float4;
+
+static inline int perm(int i) {
+	return hash[i & 255];
+}
+
+static inline int hash2(int x, int y, int seed) {
+	return perm(perm(x + seed) + y);
+}
+
+static inline int hash3(int x, int y, int z, int seed) {
+	return perm(perm(perm(x + seed) + y) + z);
+}
+
+static const float GRAD2X[8] = { 1, -1,  1, -1, 1, -1, 0,  0 };
+static const float GRAD2Y[8] = { 1,  1, -1, -1, 0,  0, 1, -1 };
+
+// 12 cube edges, 4 of them repeated to make it 16
+static const float GRAD3X[16] = { 1, -1,  1, -1, 1, -1,  1, -1, 0,  0,  0,  0, 1, -1,  0,  0 };
+static const float GRAD3Y[16] = { 1,  1, -1, -1, 0,  0,  0,  0, 1, -1,  1, -1, 1,  1, -1, -1 };
+static const float GRAD3Z[16] = { 0,  0,  0,  0, 1,  1, -1, -1, 1,  1, -1, -1, 0,  0,  1, -1 };
+
+struct lattice {
+	alignas(16) int i[4];
+};
+
+static inline lattice to_lattice(float4 f) {
+	alignas(16) float t[4];
+	store(t, f);
+	lattice l;
+	for (int k=0; k<4; ++k)
+		l.i[k] = (int)t[k];
+	return l;
+}
+
+static inline float4 fade(float4 t) {
+	// 6t^5 - 15t^4 + 10t^3
+	return t * t * t * (t * (t * float4::splat(6.f) - float4::splat(15.f)) + float4::splat(10.f));
+}
+
+static inline float4 lerp4(float4 a, float4 b, float4 t) {
+	return a + t * (b - a);
+}
+
+static inline float4 grad2(const lattice &x, const lattice &y, int ox, int oy, int seed, float4 dx, float4 dy) {
+	alignas(16) float gx[4], gy[4];
+	for (int k=0; k<4; ++k) {
+		const int h = hash2(x.i[k] + ox, y.i[k] + oy, seed) & 7;
+		gx[k] = GRAD2X[h];
+		gy[k] = GRAD2Y[h];
+	}
+	return float4::load(gx) * dx + float4::load(gy) * dy;
+}
+
+static inline float4 grad3(const lattice &x, const lattice &y, const lattice &z, int ox, int oy, int oz, int seed, float4 dx, float4 dy, float4 dz) {
+	alignas(16) float gx[4], gy[4], gz[4];
+	for (int k=0; k<4; ++k) {
+		const int h = hash3(x.i[k] + ox, y.i[k] + oy, z.i[k] + oz, seed) & 15;
+		gx[k] = GRAD3X[h];
+		gy[k] = GRAD3Y[h];
+		gz[k] = GRAD3Z[h];
+	}
+	return float4::load(gx) * dx + float4::load(gy) * dy + float4::load(gz) * dz;
+}
+
+// simplex corners only need the lattice of the first corner, offsets are 0/1 per lane
+static inline float4 grad2v(const lattice &x, const lattice &y, float4 ox, float4 oy, int seed, float4 dx, float4 dy) {
+	const lattice lx = to_lattice(ox), ly = to_lattice(oy);
+	alignas(16) float gx[4], gy[4];
+	for (int k=0; k<4; ++k) {
+		const int h = hash2(x.i[k] + lx.i[k], y.i[k] + ly.i[k], seed) & 7;
+		gx[k] = GRAD2X[h];
+		gy[k] = GRAD2Y[h];
+	}
+	return float4::load(gx) * dx + float4::load(gy) * dy;
+}
+
+static inline float4 grad3v(const lattice &x, const lattice &y, const lattice &z, float4 ox, float4 oy, float4 oz, int seed, float4 dx, float4 dy, float4 dz) {
+	const lattice lx = to_lattice(ox), ly = to_lattice(oy), lz = to_lattice(oz);
+	alignas(16) float gx[4], gy[4], gz[4];
+	for (int k=0; k<4; ++k) {
+		const int h = hash3(x.i[k] + lx.i[k], y.i[k] + ly.i[k], z.i[k] + lz.i[k], seed) & 15;
+		gx[k] = GRAD3X[h];
+		gy[k] = GRAD3Y[h];
+		gz[k] = GRAD3Z[h];
+	}
+	return float4::load(gx) * dx + float4::load(gy) * dy + float4::load(gz) * dz;
+}
+
+// improved perlin noise, about [-1, 1]
+static float4 perlin2(float4 x, float4 y, int seed) {
+	const float4 fx = floor4(x), fy = floor4(y);
+	const lattice lx = to_lattice(fx), ly = to_lattice(fy);
+	const float4 one = float4::splat(1.f);
+	const float4 rx = x - fx, ry = y - fy;
+	const float4 n00 = grad2(lx, ly, 0, 0, seed, rx, ry);
+	const float4 n10 = grad2(lx, ly, 1, 0, seed, rx - one, ry);
+	const float4 n01 = grad2(lx, ly, 0, 1, seed, rx, ry - one);
+	const float4 n11 = grad2(lx, ly, 1, 1, seed, rx - one, ry - one);
+	const float4 u = fade(rx), v = fade(ry);
+	return lerp4(lerp4(n00, n10, u), lerp4(n01, n11, u), v);
+}
+
+static float4 perlin3(float4 x, float4 y, float4 z, int seed) {
+	const float4 fx = floor4(x), fy = floor4(y), fz = floor4(z);
+	const lattice lx = to_lattice(fx), ly = to_lattice(fy), lz = to_lattice(fz);
+	const float4 one = float4::splat(1.f);
+	const float4 rx = x - fx, ry = y - fy, rz = z - fz;
+	const float4 rx1 = rx - one, ry1 = ry - one, rz1 = rz - one;
+	const float4 n000 = grad3(lx, ly, lz, 0, 0, 0, seed, rx,  ry,  rz);
+	const float4 n100 = grad3(lx, ly, lz, 1, 0, 0, seed, rx1, ry,  rz);
+	const float4 n010 = grad3(lx, ly, lz, 0, 1, 0, seed, rx,  ry1, rz);
+	const float4 n110 = grad3(lx, ly, lz, 1, 1, 0, seed, rx1, ry1, rz);
+	const float4 n001 = grad3(lx, ly, lz, 0, 0, 1, seed, rx,  ry,  rz1);
+	const float4 n101 = grad3(lx, ly, lz, 1, 0, 1, seed, rx1, ry,  rz1);
+	const float4 n011 = grad3(lx, ly, lz, 0, 1, 1, seed, rx,  ry1, rz1);
+	const float4 n111 = grad3(lx, ly, lz, 1, 1, 1, seed, rx1, ry1, rz1);
+	const float4 u = fade(rx), v = fade(ry), w = fade(rz);
+	const float4 nx00 = lerp4(n000, n100, u), nx10 = lerp4(n010, n110, u);
+	const float4 nx01 = lerp4(n001, n101, u), nx11 = lerp4(n011, n111, u);
+	return lerp4(lerp4(nx00, nx10, v), lerp4(nx01, nx11, v), w);
+}
+
+static inline float4 simplex_falloff(float4 t) {
+	t = max4(t, float4::splat(0.f));
+	t = t * t;
+	return t * t;
+}
+
+// simplex noise, about [-1, 1]
+static float4 simplex2(float4 x, float4 y, int seed) {
+	const float F2 = 0.36602540378f;	// (sqrt(3)-1)/2
+	const float G2 = 0.21132486540f;	// (3-sqrt(3))/6
+	const float4 one = float4::splat(1.f);
+	const float4 s = (x + y) * float4::splat(F2);
+	const float4 i = floor4(x + s), j = floor4(y + s);
+	const float4 t = (i + j) * float4::splat(G2);
+	const float4 x0 = x - (i - t), y0 = y - (j - t);
+	const float4 i1 = gt01(x0, y0), j1 = one - i1;
+	const float4 x1 = x0 - i1 + float4::splat(G2), y1 = y0 - j1 + float4::splat(G2);
+	const float4 x2 = x0 - float4::splat(1.f - 2.f * G2), y2 = y0 - float4::splat(1.f - 2.f * G2);
+
+	const lattice li = to_lattice(i), lj = to_lattice(j);
+	const float4 half = float4::splat(0.5f);
+	const float4 n0 = simplex_falloff(half - x0 * x0 - y0 * y0) * grad2(li, lj, 0, 0, seed, x0, y0);
+	const float4 n1 = simplex_falloff(half - x1 * x1 - y1 * y1) * grad2v(li, lj, i1, j1, seed, x1, y1);
+	const float4 n2 = simplex_falloff(half - x2 * x2 - y2 * y2) * grad2(li, lj, 1, 1, seed, x2, y2);
+	return (n0 + n1 + n2) * float4::splat(70.f);
+}
+
+static float4 simplex3(float4 x, float4 y, float4 z, int seed) {
+	const float F3 = 1.f / 3.f;
+	const float G3 = 1.f / 6.f;
+	const float4 s = (x + y + z) * float4::splat(F3);
+	const float4 i = floor4(x + s), j = floor4(y + s), k = floor4(z + s);
+	const float4 t = (i + j + k) * float4::splat(G3);
+	const float4 x0 = x - (i - t), y0 = y - (j - t), z0 = z - (k - t);
+
+	// rank the coordinates to find the simplex, masks are 0/1, 'and' is min, 'or' is max
+	const float4 xy = ge01(x0, y0), xz = ge01(x0, z0), yz = ge01(y0, z0);
+	const float4 yx = gt01(y0, x0), zx = gt01(z0, x0), zy = gt01(z0, y0);
+	const float4 i1 = min4(xy, xz), j1 = min4(yx, yz), k1 = min4(zx, zy);
+	const float4 i2 = max4(xy, xz), j2 = max4(yx, yz), k2 = max4(zx, zy);
+
+	const float4 g3 = float4::splat(G3), g32 = float4::splat(2.f * G3), g33 = float4::splat(1.f - 3.f * G3);
+	const float4 x1 = x0 - i1 + g3, y1 = y0 - j1 + g3, z1 = z0 - k1 + g3;
+	const float4 x2 = x0 - i2 + g32, y2 = y0 - j2 + g32, z2 = z0 - k2 + g32;
+	const float4 x3 = x0 - g33, y3 = y0 - g33, z3 = z0 - g33;
+
+	const lattice li = to_lattice(i), lj = to_lattice(j), lk = to_lattice(k);
+	const float4 r2 = float4::splat(0.6f);
+	const float4 n0 = simplex_falloff(r2 - x0 * x0 - y0 * y0 - z0 * z0) * grad3(li, lj, lk, 0, 0, 0, seed, x0, y0, z0);
+	const float4 n1 = simplex_falloff(r2 - x1 * x1 - y1 * y1 - z1 * z1) * grad3v(li, lj, lk, i1, j1, k1, seed, x1, y1, z1);
+	const float4 n2 = simplex_falloff(r2 - x2 * x2 - y2 * y2 - z2 * z2) * grad3v(li, lj, lk, i2, j2, k2, seed, x2, y2, z2);
+	const float4 n3 = simplex_falloff(r2 - x3 * x3 - y3 * y3 - z3 * z3) * grad3(li, lj, lk, 1, 1, 1, seed, x3, y3, z3);
+	return (n0 + n1 + n2 + n3) * float4::splat(32.f);
+}
+
+enum class field_type {
+	basis,
+	fbm,
+	ridged,
+	warp,
+};
+
+enum class basis_type {
+	perlin,
+	simplex,
+};
+
+struct field_desc {
+	field_type	type	= field_type::basis;
+	basis_type	basis	= basis_type::perlin;
+	int			w		= 0;
+	int			h		= 0;
+	int			d		= 1;
+	bool		is3d	= false;
+	float		x		= 0;
+	float		y		= 0;
+	float		z		= 0;
+	float		step	= 1;
+	float		freq	= 1;
+	int			octaves	= 4;
+	float		lacunarity	= 2;
+	float		gain	= 0.5f;
+	float		warp	= 1;
+	int			seed	= 0;
+	int			threads	= 1;
+};
+
+static inline float4 basis(const field_desc &fd, float4 x, float4 y, float4 z, int seed) {
+	if (fd.is3d)
+		return fd.basis == basis_type::simplex ? simplex3(x, y, z, seed) : perlin3(x, y, z, seed);
+	return fd.basis == basis_type::simplex ? simplex2(x, y, seed) : perlin2(x, y, seed);
+}
+
+// octaves use different seeds, normalized by the sum of amplitudes
+static float4 fbm(const field_desc &fd, float4 x, float4 y, float4 z) {
+	float4 sum = float4::splat(0.f);
+	float amp = 1.f, ampsum = 0.f, f = 1.f;
+	for (int o=0; o<fd.octaves; ++o) {
+		const float4 ff = float4::splat(f);
+		sum = sum + basis(fd, x * ff, y * ff, z * ff, fd.seed + o) * float4::splat(amp);
+		ampsum += amp;
+		amp *= fd.gain;
+		f *= fd.lacunarity;
+	}
+	return sum * float4::splat(1.f / ampsum);
+}
+
+// [0, 1], sharp ridges where the basis cross zero
+static float4 ridged(const field_desc &fd, float4 x, float4 y, float4 z) {
+	const float4 one = float4::splat(1.f);
+	float4 sum = float4::splat(0.f);
+	float amp = 1.f, ampsum = 0.f, f = 1.f;
+	for (int o=0; o<fd.octaves; ++o) {
+		const float4 ff = float4::splat(f);
+		const float4 n = one - abs4(basis(fd, x * ff, y * ff, z * ff, fd.seed + o));
+		sum = sum + n * n * float4::splat(amp);
+		ampsum += amp;
+		amp *= fd.gain;
+		f *= fd.lacunarity;
+	}
+	return sum * float4::splat(1.f / ampsum);
+}
+
+// fbm of the position displaced by other fbm fields
+static float4 warp(const field_desc &fd, float4 x, float4 y, float4 z) {
+	const float4 s = float4::splat(fd.warp);
+	const float4 wx = fbm(fd, x + float4::splat(1.7f), y + float4::splat(9.2f), z + float4::splat(3.1f));
+	const float4 wy = fbm(fd, x + float4::splat(8.3f), y + float4::splat(2.8f), z + float4::splat(6.4f));
+	float4 wz = float4::splat(0.f);
+	if (fd.is3d)
+		wz = fbm(fd, x + float4::splat(4.6f), y + float4::splat(7.5f), z + float4::splat(1.9f));
+	return fbm(fd, x + wx * s, y + wy * s, z + wz * s);
+}
+
+static inline float4 sample(const field_desc &fd, float4 x, float4 y, float4 z) {
+	switch (fd.type) {
+	case field_type::fbm:		return fbm(fd, x, y, z);
+	case field_type::ridged:	return ridged(fd, x, y, z);
+	case field_type::warp:		return warp(fd, x, y, z);
+	default:					return basis(fd, x, y, z, fd.seed);
+	}
+}
+
+// one row of the grid, 4 samples each time
+static void fill_row(const field_desc &fd, int row, float *out) {
+	const int iy = row % fd.h, iz = row / fd.h;
+	const float4 freq = float4::splat(fd.freq);
+	const float4 y = float4::splat(fd.y + iy * fd.step) * freq;
+	const float4 z = float4::splat(fd.z + iz * fd.step) * freq;
+	alignas(16) static const float LANE[4] = { 0.f, 1.f, 2.f, 3.f };
+	const float4 lane = float4::load(LANE) * float4::splat(fd.step);
+	alignas(16) float result[4];
+	for (int ix=0; ix<fd.w; ix+=4) {
+		const float4 x = (float4::splat(fd.x + ix * fd.step) + lane) * freq;
+		store(result, sample(fd, x, y, z));
+		// the last one maybe less than 4 samples, output buffer is not aligned either
+		memcpy(out + ix, result, sizeof(float) * std::min(4, fd.w - ix));
+	}
+}
+
+static void fill(const field_desc &fd, float *out) {
+	const int rows = fd.h * fd.d;
+	int threads = fd.threads > 0 ? fd.threads : (int)std::max(1u, std::thread::hardware_concurrency());
+	threads = std::min(threads, rows);
+	if (threads <= 1) {
+		for (int r=0; r<rows; ++r)
+			fill_row(fd, r, out + (size_t)r * fd.w);
+		return;
+	}
+
+	std::atomic<int> next{0};
+	auto worker = [&]() {
+		for (int r = next++; r < rows; r = next++)
+			fill_row(fd, r, out + (size_t)r * fd.w);
+	};
+	std::vector<std::thread> pool;
+	pool.reserve(threads-1);
+	for (int i=1; i<threads; ++i)
+		pool.emplace_back(worker);
+	worker();
+	for (auto &t : pool)
+		t.join();
+}
+
+}
+
+static int get_int_field(lua_State *L, int idx, const char *name, int def) {
+	int v = def;
+	if (lua_getfield(L, idx, name) != LUA_TNIL)
+		v = (int)luaL_checkinteger(L, -1);
+	lua_pop(L, 1);
+	return v;
+}
+
+static float get_float_field(lua_State *L, int idx, const char *name, float def) {
+	float v = def;
+	if (lua_getfield(L, idx, name) != LUA_TNIL)
+		v = (float)luaL_checknumber(L, -1);
+	lua_pop(L, 1);
+	return v;
+}
+
+static void read_field_desc(lua_State *L, int idx, noise::field_desc &fd, bool is3d) {
+	luaL_checktype(L, idx, LUA_TTABLE);
+	static const char *const types[] = { "perlin", "simplex", "fbm", "ridged", "warp", nullptr };
+	static const char *const bases[] = { "perlin", "simplex", nullptr };
+
+	lua_getfield(L, idx, "type");
+	const int t = luaL_checkoption(L, -1, "perlin", types);
+	lua_pop(L, 1);
+	lua_getfield(L, idx, "basis");
+	const int b = luaL_checkoption(L, -1, "perlin", bases);
+	lua_pop(L, 1);
+	if (t < 2) {
+		fd.type = noise::field_type::basis;
+		fd.basis = noise::basis_type(t);
+	} else {
+		fd.type = noise::field_type(t - 1);
+		fd.basis = noise::basis_type(b);
+	}
+
+	fd.is3d		= is3d;
+	fd.w		= get_int_field(L, idx, "w", 0);
+	fd.h		= get_int_field(L, idx, "h", 0);
+	fd.d		= is3d ? get_int_field(L, idx, "d", 0) : 1;
+	if (fd.w <= 0 || fd.h <= 0 || fd.d <= 0)
+		luaL_error(L, "Invalid grid size: %dx%dx%d", fd.w, fd.h, fd.d);
+	fd.x		= get_float_field(L, idx, "x", 0);
+	fd.y		= get_float_field(L, idx, "y", 0);
+	fd.z		= get_float_field(L, idx, "z", 0);
+	fd.step		= get_float_field(L, idx, "step", 1);
+	fd.freq		= get_float_field(L, idx, "freq", 1);
+	fd.octaves	= std::max(1, get_int_field(L, idx, "octaves", 4));
+	fd.lacunarity= get_float_field(L, idx, "lacunarity", 2);
+	fd.gain		= get_float_field(L, idx, "gain", 0.5f);
+	fd.warp		= get_float_field(L, idx, "warp", 1);
+	fd.seed		= get_int_field(L, idx, "seed", 0);
+	fd.threads	= get_int_field(L, idx, "threads", 1);
+}
+
+// grid(desc [, buffer [, size]]): fill the float32 buffer with w*h(*d) samples, x first, then y, then z
+// buffer is a full userdata or a lightuserdata with its size in bytes, return a string when no buffer is given
+static int lgrid(lua_State *L, bool is3d) {
+	noise::field_desc fd;
+	read_field_desc(L, 1, fd, is3d);
+	const size_t bytes = (size_t)fd.w * fd.h * fd.d * sizeof(float);
+
+	switch (lua_type(L, 2)) {
+	case LUA_TNONE:
+	case LUA_TNIL: {
+		std::string s(bytes, '\0');
+		noise::fill(fd, (float*)s.data());
+		lua_pushlstring(L, s.data(), s.size());
+		return 1;
+	}
+	case LUA_TUSERDATA:
+	case LUA_TLIGHTUSERDATA: {
+		void *buffer = lua_touserdata(L, 2);
+		lua_Integer size;
+		if (lua_type(L, 2) == LUA_TUSERDATA) {
+			// the size of a full userdata is known, a larger one would write past its end
+			const lua_Integer rawlen = (lua_Integer)lua_rawlen(L, 2);
+			size = luaL_optinteger(L, 3, rawlen);
+			if (size > rawlen)
+				return luaL_error(L, "Invalid buffer size: %d, userdata has %d bytes", (int)size, (int)rawlen);
+		} else {
+			size = luaL_checkinteger(L, 3);
+		}
+		if (size < 0 || (size_t)size < bytes)
+			return luaL_error(L, "Buffer is too small: %d, need %d bytes", (int)size, (int)bytes);
+		noise::fill(fd, (float*)buffer);
+		return 0;
+	}
+	default:
+		return luaL_typeerror(L, 2, "userdata");
+	}
+}
+
+static int lgrid2d(lua_State *L) {
+	return lgrid(L, false);
+}
+
+static int lgrid3d(lua_State *L) {
+	return lgrid(L, true);
+}
+
 extern "C" {
 LUAMOD_API int
 	luaopen_noise(lua_State *L) {
 	luaL_checkversion(L);
 	luaL_Reg l[] = {
 		{ "perlin2d", lperlin2d },
+		{ "grid2d", lgrid2d },
+		{ "grid3d", lgrid3d },
 		{ nullptr, nullptr},
 	};
 	luaL_newlib(L, l);
@@ -0,0 +1,7 @@
+local lm = require "luamake"
+
+lm:lua_src "profiler" {
+    sources = {
+        "profiler.cpp",
+    },
+}
@@ -0,0 +1,350 @@
+#include "profiler.h"
+
+#include <lua.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+enum event_type : uint8_t {
+	ET_zone,
+	ET_counter,
+	ET_frame,
+};
+
+struct event {
+	const char* name;
+	uint64_t	ts;		// ns
+	uint64_t	dur;	// ns
+	double		value;
+	event_type	type;
+};
+
+static constexpr uint32_t RING_SIZE		= 1 << 15;
+// events close to the write position may be overwritten while exporting
+static constexpr uint32_t RING_GUARD	= 1024;
+static constexpr int MAX_DEPTH			= 64;
+static constexpr int MAX_COUNTER		= 256;
+
+struct thread_ring {
+	uint32_t				tid;
+	const char*				name = nullptr;
+	std::atomic<uint64_t>	head {0};
+	int						depth = 0;
+	struct {
+		const char* name;
+		uint64_t	ts;
+	} stack[MAX_DEPTH];
+	event					events[RING_SIZE];
+
+	void push(const event &e) {
+		const uint64_t h = head.load(std::memory_order_relaxed);
+		events[h % RING_SIZE] = e;
+		head.store(h + 1, std::memory_order_release);
+	}
+};
+
+struct counter {
+	const char*				name;
+	std::atomic<int64_t>	value;
+	bool					accumulate;
+};
+
+struct profiler {
+	std::atomic<bool>					enabled {false};
+	std::chrono::steady_clock::time_point	start = std::chrono::steady_clock::now();
+	std::mutex							mutex;
+	// rings are never freed, threads may exit before the export
+	std::vector<thread_ring*>			rings;
+	std::unordered_set<std::string>		names;
+	counter								counters[MAX_COUNTER];
+	std::atomic<int>					counter_num {0};
+};
+
+static profiler P;
+static thread_local thread_ring* T = nullptr;
+
+static inline uint64_t now() {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - P.start).count();
+}
+
+static thread_ring* ring() {
+	if (T == nullptr) {
+		T = new thread_ring;
+		std::lock_guard<std::mutex> lock(P.mutex);
+		T->tid = (uint32_t)P.rings.size();
+		P.rings.push_back(T);
+	}
+	return T;
+}
+
+static const char* intern(const char* name) {
+	std::lock_guard<std::mutex> lock(P.mutex);
+	return P.names.emplace(name).first->c_str();
+}
+
+}
+
+extern "C" void
+profiler_enable(int enable) {
+	P.enabled.store(enable != 0, std::memory_order_relaxed);
+}
+
+extern "C" int
+profiler_enabled(void) {
+	return P.enabled.load(std::memory_order_relaxed);
+}
+
+extern "C" void
+profiler_zone_begin(const char* name) {
+	if (!profiler_enabled())
+		return;
+	auto r = ring();
+	if (r->depth < MAX_DEPTH) {
+		r->stack[r->depth].name = name;
+		r->stack[r->depth].ts = now();
+	}
+	++r->depth;
+}
+
+extern "C" void
+profiler_zone_end(double alloc) {
+	auto r = T;
+	if (r == nullptr || r->depth == 0)
+		return;
+	if (--r->depth < MAX_DEPTH) {
+		const auto &s = r->stack[r->depth];
+		r->push(event{s.name, s.ts, now() - s.ts, alloc, ET_zone});
+	}
+}
+
+extern "C" const char*
+profiler_name(const char* name) {
+	return intern(name);
+}
+
+extern "C" void
+profiler_thread_name(const char* name) {
+	ring()->name = intern(name);
+}
+
+extern "C" int
+profiler_counter(const char* name, int accumulate) {
+	std::lock_guard<std::mutex> lock(P.mutex);
+	const int n = P.counter_num.load(std::memory_order_relaxed);
+	for (int i = 0; i < n; ++i) {
+		if (strcmp(P.counters[i].name, name) == 0)
+			return i;
+	}
+	if (n >= MAX_COUNTER)
+		return -1;
+	auto &c = P.counters[n];
+	c.name = P.names.emplace(name).first->c_str();
+	c.value.store(0, std::memory_order_relaxed);
+	c.accumulate = accumulate != 0;
+	P.counter_num.store(n + 1, std::memory_order_release);
+	return n;
+}
+
+extern "C" void
+profiler_counter_add(int id, int64_t v) {
+	if (id >= 0)
+		P.counters[id].value.fetch_add(v, std::memory_order_relaxed);
+}
+
+extern "C" void
+profiler_counter_set(int id, int64_t v) {
+	if (id >= 0)
+		P.counters[id].value.store(v, std::memory_order_relaxed);
+}
+
+extern "C" void
+profiler_frame(void) {
+	if (!profiler_enabled())
+		return;
+	auto r = ring();
+	const uint64_t ts = now();
+	r->push(event{"frame", ts, 0, 0, ET_frame});
+	const int n = P.counter_num.load(std::memory_order_acquire);
+	for (int i = 0; i < n; ++i) {
+		auto &c = P.counters[i];
+		const int64_t v = c.accumulate ? c.value.exchange(0, std::memory_order_relaxed) : c.value.load(std::memory_order_relaxed);
+		r->push(event{c.name, ts, 0, (double)v, ET_counter});
+	}
+}
+
+static void
+json_string(std::string &s, const char* str) {
+	s += '"';
+	for (; *str; ++str) {
+		const char c = *str;
+		if (c == '"' || c == '\\') {
+			s += '\\';
+			s += c;
+		} else if ((unsigned char)c < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			s += buf;
+		} else {
+			s += c;
+		}
+	}
+	s += '"';
+}
+
+static std::string
+trace_json() {
+	std::string s;
+	s.reserve(1024 * 1024);
+	s += "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool first = true;
+	auto sep = [&]() {
+		if (!first)
+			s += ",\n";
+		first = false;
+	};
+	char buf[256];
+
+	std::lock_guard<std::mutex> lock(P.mutex);
+	for (auto r : P.rings) {
+		if (r->name) {
+			sep();
+			snprintf(buf, sizeof(buf), "{\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":", r->tid);
+			s += buf;
+			json_string(s, r->name);
+			s += "}}";
+		}
+		const uint64_t head = r->head.load(std::memory_order_acquire);
+		const uint64_t count = RING_SIZE - RING_GUARD;
+		for (uint64_t i = head > count ? head - count : 0; i < head; ++i) {
+			const event &e = r->events[i % RING_SIZE];
+			sep();
+			s += "{\"name\":";
+			json_string(s, e.name);
+			switch (e.type) {
+			case ET_zone:
+				snprintf(buf, sizeof(buf), ",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f", r->tid, e.ts / 1000.0, e.dur / 1000.0);
+				s += buf;
+				if (e.value != 0) {
+					snprintf(buf, sizeof(buf), ",\"args\":{\"alloc\":%.0f}", e.value);
+					s += buf;
+				}
+				break;
+			case ET_counter:
+				snprintf(buf, sizeof(buf), ",\"ph\":\"C\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"args\":{\"value\":%.0f}", r->tid, e.ts / 1000.0, e.value);
+				s += buf;
+				break;
+			case ET_frame:
+				snprintf(buf, sizeof(buf), ",\"ph\":\"i\",\"s\":\"g\",\"pid\":0,\"tid\":%u,\"ts\":%.3f", r->tid, e.ts / 1000.0);
+				s += buf;
+				break;
+			}
+			s += "}";
+		}
+	}
+	s += "\n]}\n";
+	return s;
+}
+
+static const char*
+check_name(lua_State *L, int idx) {
+	if (lua_type(L, idx) == LUA_TLIGHTUSERDATA)
+		return (const char*)lua_touserdata(L, idx);
+	return intern(luaL_checkstring(L, idx));
+}
+
+static int
+lenable(lua_State *L) {
+	profiler_enable(lua_toboolean(L, 1));
+	return 0;
+}
+
+static int
+lenabled(lua_State *L) {
+	lua_pushboolean(L, profiler_enabled());
+	return 1;
+}
+
+static int
+lname(lua_State *L) {
+	lua_pushlightuserdata(L, (void*)intern(luaL_checkstring(L, 1)));
+	return 1;
+}
+
+static int
+lzone_begin(lua_State *L) {
+	if (profiler_enabled())
+		profiler_zone_begin(check_name(L, 1));
+	return 0;
+}
+
+static int
+lzone_end(lua_State *L) {
+	profiler_zone_end(luaL_optnumber(L, 1, 0));
+	return 0;
+}
+
+static int
+lthread_name(lua_State *L) {
+	profiler_thread_name(luaL_checkstring(L, 1));
+	return 0;
+}
+
+static int
+lcounter(lua_State *L) {
+	lua_pushinteger(L, profiler_counter(luaL_checkstring(L, 1), lua_toboolean(L, 2)));
+	return 1;
+}
+
+static int
+lcounter_add(lua_State *L) {
+	profiler_counter_add((int)luaL_checkinteger(L, 1), (int64_t)luaL_checkinteger(L, 2));
+	return 0;
+}
+
+static int
+lcounter_set(lua_State *L) {
+	profiler_counter_set((int)luaL_checkinteger(L, 1), (int64_t)luaL_checkinteger(L, 2));
+	return 0;
+}
+
+static int
+lframe(lua_State *L) {
+	profiler_frame();
+	return 0;
+}
+
+static int
+ltrace(lua_State *L) {
+	const std::string s = trace_json();
+	lua_pushlstring(L, s.data(), s.size());
+	return 1;
+}
+
+extern "C" int
+luaopen_profiler(lua_State *L) {
+	luaL_checkversion(L);
+	luaL_Reg l[] = {
+		{ "enable",			lenable },
+		{ "enabled",		lenabled },
+		{ "name",			lname },
+		{ "zone_begin",		lzone_begin },
+		{ "zone_end",		lzone_end },
+		{ "thread_name",	lthread_name },
+		{ "counter",		lcounter },
+		{ "counter_add",	lcounter_add },
+		{ "counter_set",	lcounter_set },
+		{ "frame",			lframe },
+		{ "trace",			ltrace },
+		{ nullptr,			nullptr },
+	};
+	luaL_newlib(L, l);
+	return 1;
+}
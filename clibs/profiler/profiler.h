@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+
+// Low overhead instrumentation, every thread writes its own ring buffer, no lock in zone_begin/zone_end.
+// Zones are exported as Chrome trace (chrome://tracing, https://ui.perfetto.dev) json.
+// All functions do nothing until profiler_enable(1).
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+void profiler_enable(int enable);
+int profiler_enabled(void);
+
+// name must be a string literal or the result of profiler_name
+void profiler_zone_begin(const char* name);
+// alloc: bytes allocated in this zone, 0 means unknown
+void profiler_zone_end(double alloc);
+
+// intern a dynamic string, the result is valid until the process exit
+const char* profiler_name(const char* name);
+void profiler_thread_name(const char* name);
+
+// counters are sampled by profiler_frame
+int profiler_counter(const char* name, int accumulate);
+void profiler_counter_add(int id, int64_t v);
+void profiler_counter_set(int id, int64_t v);
+
+// mark the frame end, sample and reset the accumulated counters
+void profiler_frame(void);
+
+#if defined(__cplusplus)
+}
+
+struct profiler_zone {
+	profiler_zone(const char* name) : active(profiler_enabled()) {
+		if (active)
+			profiler_zone_begin(name);
+	}
+	~profiler_zone() {
+		if (active)
+			profiler_zone_end(0);
+	}
+	bool active;
+};
+
+#define PROFILER_CONCAT_(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_(a, b)
+#define PROFILE_ZONE(_NAME) profiler_zone PROFILER_CONCAT(_profiler_zone_, __LINE__)(_NAME)
+#define PROFILE_COUNTER_ADD(_NAME, _V) do {\
+		if (profiler_enabled()) {\
+			static const int _id = profiler_counter(_NAME, 1);\
+			profiler_counter_add(_id, (int64_t)(_V));\
+		}\
+	} while (0)
+#define PROFILE_COUNTER_SET(_NAME, _V) do {\
+		if (profiler_enabled()) {\
+			static const int _id = profiler_counter(_NAME, 0);\
+			profiler_counter_set(_id, (int64_t)(_V));\
+		}\
+	} while (0)
+
+#endif
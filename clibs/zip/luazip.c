@@ -15,6 +15,7 @@
 
 #define ZLIB_UTF8_FLAG (1<<11)
 #define FILECHUNK (4096 * 4)
+#define BATCH_FILECHUNK (1024 * 256)
 
 static int
 lcompress(lua_State *L) {
@@ -410,22 +411,18 @@ zipread_readfile(lua_State *L) {
 		close_file(L, zf);
 		luaL_error(L, "Error: get file info %s", lua_tostring(L, 2));
 	}
-	void *buf = malloc(info.uncompressed_size);
-	if (buf == NULL) {
-		close_file(L, zf);
-		luaL_error(L, "Error: out of memory");
-	}
+	// inflate straight into the lua buffer, instead of a malloc buffer copied afterward
+	luaL_Buffer b;
+	char *buf = luaL_buffinitsize(L, &b, info.uncompressed_size);
 	if (info.uncompressed_size != 0) {
 		int bytes = unzReadCurrentFile(zf, buf, info.uncompressed_size);
 		if (bytes != info.uncompressed_size) {
-			free(buf);
 			close_file(L, zf);
 			luaL_error(L, "Error: read file %s (%d != %d)", lua_tostring(L, 2), bytes, (int)info.uncompressed_size);
 		}
 	}
-	lua_pushlstring(L, buf, info.uncompressed_size);
-	free(buf);
 	close_file(L, zf);
+	luaL_pushresultsize(&b, info.uncompressed_size);
 	return 1;
 }
 
@@ -578,6 +575,478 @@ zipread_filename(lua_State *L) {
 	return 1;
 }
 
+// Streaming reader, owns its own unzFile so it doesn't disturb the current file of the zip
+
+struct zipstream {
+	unzFile h;
+	size_t size;
+	size_t offset;
+};
+
+static const char *
+zip_filename(lua_State *L, int rzip) {
+	if (lua_getiuservalue(L, rzip, 1) != LUA_TTABLE)
+		luaL_error(L, "Invalid zip userdata");
+	if (lua_rawgeti(L, -1, 0) != LUA_TSTRING)
+		luaL_error(L, "No zip filename");
+	const char *filename = lua_tostring(L, -1);
+	lua_pop(L, 2);	// filename is kept alive by the uservalue table
+	return filename;
+}
+
+static lua_Integer
+file_pos(lua_State *L, int rzip, int filename) {
+	if (lua_getiuservalue(L, rzip, 1) != LUA_TTABLE)
+		luaL_error(L, "Invalid zip userdata");
+	lua_pushvalue(L, filename);
+	if (lua_rawget(L, -2) != LUA_TNUMBER) {
+		lua_pop(L, 2);
+		return -1;
+	}
+	lua_Integer pos = lua_tointeger(L, -1);
+	lua_pop(L, 2);
+	return pos;
+}
+
+static int
+zipstream_close(lua_State *L) {
+	struct zipstream *s = (struct zipstream *)luaL_checkudata(L, 1, "ZIP_STREAM");
+	if (s->h) {
+		unzCloseCurrentFile(s->h);
+		unzClose(s->h);
+		s->h = NULL;
+	}
+	return 0;
+}
+
+static struct zipstream *
+check_stream(lua_State *L) {
+	struct zipstream *s = (struct zipstream *)luaL_checkudata(L, 1, "ZIP_STREAM");
+	if (s->h == NULL)
+		luaL_error(L, "Error: closed");
+	return s;
+}
+
+static int
+zipstream_read(lua_State *L) {
+	struct zipstream *s = check_stream(L);
+	lua_Integer n = luaL_optinteger(L, 2, FILECHUNK);
+	if (n <= 0)
+		return luaL_error(L, "Error: read size = %d", (int)n);
+	if ((size_t)n > s->size - s->offset)
+		n = s->size - s->offset;
+	if (n == 0)
+		return 0;
+	luaL_Buffer b;
+	char *buf = luaL_buffinitsize(L, &b, (size_t)n);
+	int bytes = unzReadCurrentFile(s->h, buf, (unsigned)n);
+	if (bytes < 0)
+		return luaL_error(L, "Error: read file (%d)", bytes);
+	if (bytes == 0)	// truncated entry, don't yield "" forever
+		return luaL_error(L, "Error: unexpected end of file at %d/%d", (int)s->offset, (int)s->size);
+	s->offset += bytes;
+	luaL_pushresultsize(&b, bytes);
+	return 1;
+}
+
+static int
+zipstream_iter(lua_State *L) {
+	lua_settop(L, 1);
+	return zipstream_read(L);
+}
+
+static int
+zipstream_size(lua_State *L) {
+	struct zipstream *s = (struct zipstream *)luaL_checkudata(L, 1, "ZIP_STREAM");
+	lua_pushinteger(L, s->size);
+	return 1;
+}
+
+static int
+zipstream_tell(lua_State *L) {
+	struct zipstream *s = (struct zipstream *)luaL_checkudata(L, 1, "ZIP_STREAM");
+	lua_pushinteger(L, s->offset);
+	return 1;
+}
+
+static int
+zipread_stream(lua_State *L) {
+	luaL_checkudata(L, 1, "ZIP_READ");
+	lua_Integer pos = file_pos(L, 1, 2);
+	if (pos < 0)
+		return 0;
+	const char *zipname = zip_filename(L, 1);
+	struct zipstream *s = (struct zipstream *)lua_newuserdatauv(L, sizeof(*s), 0);
+	s->h = NULL;
+	s->size = 0;
+	s->offset = 0;
+	if (luaL_newmetatable(L, "ZIP_STREAM")) {
+		luaL_Reg l[] = {
+			{ "__index", NULL },
+			{ "__gc", zipstream_close },
+			{ "__close", zipstream_close },
+			{ "__call", zipstream_iter },
+			{ "close", zipstream_close },
+			{ "read", zipstream_read },
+			{ "size", zipstream_size },
+			{ "tell", zipstream_tell },
+			{ NULL, NULL },
+		};
+		luaL_setfuncs(L, l, 0);
+		lua_pushvalue(L, -1);
+		lua_setfield(L, -2, "__index");
+	}
+	lua_setmetatable(L, -2);
+	s->h = unzip_open(L, zipname);
+	if (s->h == NULL)
+		return luaL_error(L, "Error: open %s", zipname);
+	locate_file(L, s->h, pos);
+	if (unzOpenCurrentFile(s->h) != UNZ_OK)
+		return luaL_error(L, "Error: open file %s", lua_tostring(L, 2));
+	unz_file_info info;
+	if (unzGetCurrentFileInfo(s->h, &info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK)
+		return luaL_error(L, "Error: get file info %s", lua_tostring(L, 2));
+	s->size = info.uncompressed_size;
+	return 1;
+}
+
+// Batch extraction: every worker thread opens its own unzFile and inflates whole entries
+// straight into their destination (a file, a memory_file, or a buffer given by the caller).
+
+#ifdef _WIN32
+
+typedef CRITICAL_SECTION batch_mutex;
+typedef HANDLE batch_thread;
+#define batch_mutex_init(m) InitializeCriticalSection(m)
+#define batch_mutex_destroy(m) DeleteCriticalSection(m)
+#define batch_mutex_lock(m) EnterCriticalSection(m)
+#define batch_mutex_unlock(m) LeaveCriticalSection(m)
+
+static int
+cpu_count(void) {
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+}
+
+#else
+
+#include <pthread.h>
+#include <unistd.h>
+
+typedef pthread_mutex_t batch_mutex;
+typedef pthread_t batch_thread;
+#define batch_mutex_init(m) pthread_mutex_init(m, NULL)
+#define batch_mutex_destroy(m) pthread_mutex_destroy(m)
+#define batch_mutex_lock(m) pthread_mutex_lock(m)
+#define batch_mutex_unlock(m) pthread_mutex_unlock(m)
+
+static int
+cpu_count(void) {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+}
+
+#endif
+
+#define BATCH_MAXTHREAD 64
+
+enum batch_error {
+	BATCH_OK = 0,
+	BATCH_ERR_OPENZIP,
+	BATCH_ERR_LOCATE,
+	BATCH_ERR_OPEN,
+	BATCH_ERR_READ,
+	BATCH_ERR_CRC,
+	BATCH_ERR_OOM,
+	BATCH_ERR_WRITE,
+	BATCH_ERR_BUFFER,
+};
+
+static const char * batch_error_string[] = {
+	"ok",
+	"open zip",
+	"locate file",
+	"open file",
+	"read file",
+	"CRC",
+	"out of memory",
+	"write file",
+	"buffer too small",
+};
+
+struct batch_job {
+	unz_file_pos pos;
+	const char *outfile;		// extract to file if not NULL
+	char *buffer;			// caller provided buffer
+	size_t capacity;
+	struct memory_file *mf;		// otherwise inflate into a new memory_file
+	size_t bytes;
+	int err;
+};
+
+struct batch {
+	const char *zipname;
+	struct batch_job *jobs;
+	int n;
+	int next;
+	batch_mutex lock;
+};
+
+static int
+batch_read_all(unzFile zf, char *buf, size_t sz) {
+	while (sz > 0) {
+		unsigned n = sz > 0x40000000 ? 0x40000000 : (unsigned)sz;
+		int bytes = unzReadCurrentFile(zf, buf, n);
+		if (bytes <= 0)
+			return BATCH_ERR_READ;
+		buf += bytes;
+		sz -= bytes;
+	}
+	return BATCH_OK;
+}
+
+static int
+batch_extract_file(unzFile zf, struct batch_job *job, char *chunk) {
+	FILE *f = file_open(NULL, job->outfile, "wb");
+	if (f == NULL)
+		return BATCH_ERR_WRITE;
+	int bytes;
+	do {
+		bytes = unzReadCurrentFile(zf, chunk, BATCH_FILECHUNK);
+		if (bytes < 0) {
+			fclose(f);
+			return BATCH_ERR_READ;
+		}
+		if (bytes > 0 && fwrite(chunk, 1, bytes, f) != (size_t)bytes) {
+			fclose(f);
+			return BATCH_ERR_WRITE;
+		}
+		job->bytes += bytes;
+	} while (bytes > 0);
+	fclose(f);
+	return BATCH_OK;
+}
+
+static int
+batch_run_job(unzFile zf, struct batch_job *job, char *chunk) {
+	if (unzGoToFilePos(zf, &job->pos) != UNZ_OK)
+		return BATCH_ERR_LOCATE;
+	if (unzOpenCurrentFile(zf) != UNZ_OK)
+		return BATCH_ERR_OPEN;
+	unz_file_info info;
+	int err = BATCH_OK;
+	if (unzGetCurrentFileInfo(zf, &info, NULL, 0, NULL, 0, NULL, 0) != UNZ_OK) {
+		err = BATCH_ERR_OPEN;
+	} else if (job->outfile) {
+		err = batch_extract_file(zf, job, chunk);
+	} else if (job->buffer) {
+		if (info.uncompressed_size > job->capacity) {
+			err = BATCH_ERR_BUFFER;
+		} else {
+			err = batch_read_all(zf, job->buffer, info.uncompressed_size);
+			job->bytes = info.uncompressed_size;
+		}
+	} else {
+		job->mf = memory_file_alloc(info.uncompressed_size);
+		if (job->mf == NULL) {
+			err = BATCH_ERR_OOM;
+		} else {
+			err = batch_read_all(zf, (char *)job->mf->data, info.uncompressed_size);
+			job->bytes = info.uncompressed_size;
+		}
+	}
+	int cerr = unzCloseCurrentFile(zf);
+	if (err == BATCH_OK && cerr != UNZ_OK)
+		err = (cerr == UNZ_CRCERROR) ? BATCH_ERR_CRC : BATCH_ERR_READ;
+	return err;
+}
+
+static void
+batch_worker(struct batch *B) {
+	unzFile zf = unzOpen2(B->zipname, NULL);
+	char *chunk = (char *)malloc(BATCH_FILECHUNK);
+	for (;;) {
+		batch_mutex_lock(&B->lock);
+		int idx = B->next++;
+		batch_mutex_unlock(&B->lock);
+		if (idx >= B->n)
+			break;
+		struct batch_job *job = &B->jobs[idx];
+		if (zf == NULL) {
+			job->err = BATCH_ERR_OPENZIP;
+		} else if (chunk == NULL) {
+			job->err = BATCH_ERR_OOM;
+		} else {
+			job->err = batch_run_job(zf, job, chunk);
+		}
+	}
+	free(chunk);
+	if (zf)
+		unzClose(zf);
+}
+
+#ifdef _WIN32
+
+static DWORD WINAPI
+batch_thread_func(LPVOID ud) {
+	batch_worker((struct batch *)ud);
+	return 0;
+}
+
+static int
+batch_thread_create(batch_thread *t, struct batch *B) {
+	*t = CreateThread(NULL, 0, batch_thread_func, B, 0, NULL);
+	return *t != NULL;
+}
+
+static void
+batch_thread_wait(batch_thread t) {
+	WaitForSingleObject(t, INFINITE);
+	CloseHandle(t);
+}
+
+#else
+
+static void *
+batch_thread_func(void *ud) {
+	batch_worker((struct batch *)ud);
+	return NULL;
+}
+
+static int
+batch_thread_create(batch_thread *t, struct batch *B) {
+	return pthread_create(t, NULL, batch_thread_func, B) == 0;
+}
+
+static void
+batch_thread_wait(batch_thread t) {
+	pthread_join(t, NULL);
+}
+
+#endif
+
+// 2: jobs { { filename, target, capacity }, ... }
+//	target : nil -> memory_file (lightuserdata), string -> extract to this path, lightuserdata -> caller buffer of capacity bytes
+// 3: opt: threads
+// returns results (memory_file or bytes) or nil, error
+static int
+zipread_batch(lua_State *L) {
+	luaL_checkudata(L, 1, "ZIP_READ");
+	luaL_checktype(L, 2, LUA_TTABLE);
+	int n = (int)luaL_len(L, 2);
+	int nthread = (int)luaL_optinteger(L, 3, cpu_count());
+	const char *zipname = zip_filename(L, 1);
+
+	struct batch B;
+	B.zipname = zipname;
+	B.n = n;
+	B.next = 0;
+	B.jobs = (struct batch_job *)lua_newuserdatauv(L, sizeof(struct batch_job) * (n > 0 ? n : 1), 0);
+	int i;
+	for (i = 0; i < n; i++) {
+		struct batch_job *job = &B.jobs[i];
+		memset(job, 0, sizeof(*job));
+		if (lua_geti(L, 2, i+1) != LUA_TTABLE)
+			return luaL_error(L, "Invalid job %d", i+1);
+		int jobidx = lua_gettop(L);
+		lua_geti(L, jobidx, 1);
+		lua_Integer pos = file_pos(L, 1, lua_gettop(L));
+		if (pos < 0)
+			return luaL_error(L, "Error: no file %s", lua_tostring(L, -1));
+		luaint_to_file_pos(pos, &job->pos);
+		lua_pop(L, 1);
+		switch (lua_geti(L, jobidx, 2)) {
+		case LUA_TNIL:
+		case LUA_TBOOLEAN:
+			break;
+		case LUA_TSTRING:
+			job->outfile = lua_tostring(L, -1);	// kept alive by the jobs table
+			break;
+		case LUA_TLIGHTUSERDATA:
+			job->buffer = (char *)lua_touserdata(L, -1);
+			lua_geti(L, jobidx, 3);
+			job->capacity = (size_t)luaL_checkinteger(L, -1);
+			lua_pop(L, 1);
+			break;
+		default:
+			return luaL_error(L, "Invalid target of job %d", i+1);
+		}
+		lua_settop(L, jobidx - 1);
+	}
+
+	if (nthread > n)
+		nthread = n;
+	if (nthread > BATCH_MAXTHREAD)
+		nthread = BATCH_MAXTHREAD;
+	batch_mutex_init(&B.lock);
+	batch_thread threads[BATCH_MAXTHREAD];
+	int created = 0;
+	for (i = 1; i < nthread; i++) {
+		if (!batch_thread_create(&threads[created], &B))
+			break;
+		++created;
+	}
+	batch_worker(&B);
+	for (i = 0; i < created; i++) {
+		batch_thread_wait(threads[i]);
+	}
+	batch_mutex_destroy(&B.lock);
+
+	for (i = 0; i < n; i++) {
+		if (B.jobs[i].err != BATCH_OK) {
+			int err = B.jobs[i].err;
+			int j;
+			for (j = 0; j < n; j++) {
+				if (B.jobs[j].mf)
+					memory_file_close(B.jobs[j].mf);
+			}
+			lua_pushnil(L);
+			lua_geti(L, 2, i+1);
+			lua_geti(L, -1, 1);
+			lua_pushfstring(L, "Error: %s %s", batch_error_string[err], lua_tostring(L, -1));
+			return 2;
+		}
+	}
+	lua_createtable(L, n, 0);
+	for (i = 0; i < n; i++) {
+		if (B.jobs[i].mf) {
+			lua_pushlightuserdata(L, B.jobs[i].mf);
+		} else {
+			lua_pushinteger(L, B.jobs[i].bytes);
+		}
+		lua_rawseti(L, -2, i+1);
+	}
+	return 1;
+}
+
+// Inflate into a memory_file, without the copy into a lua string
+static int
+zipread_readfile_mem(lua_State *L) {
+	unzFile zf = open_file(L, 1, 2, NULL);
+	if (zf == NULL)
+		return 0;
+	unz_file_info info;
+	int err = unzGetCurrentFileInfo(zf, &info, NULL, 0, NULL, 0, NULL, 0);
+	if (err != UNZ_OK) {
+		close_file(L, zf);
+		return luaL_error(L, "Error: get file info %s", lua_tostring(L, 2));
+	}
+	struct memory_file *mf = memory_file_alloc(info.uncompressed_size);
+	if (mf == NULL) {
+		close_file(L, zf);
+		return luaL_error(L, "Error: out of memory");
+	}
+	if (batch_read_all(zf, (char *)mf->data, info.uncompressed_size) != BATCH_OK) {
+		memory_file_close(mf);
+		close_file(L, zf);
+		return luaL_error(L, "Error: read file %s", lua_tostring(L, 2));
+	}
+	close_file(L, zf);
+	lua_pushlightuserdata(L, mf);
+	return 1;
+}
+
 static int
 unzip(lua_State *L, const char *filename) {
 	unzFile zf = unzip_open(L, filename);
@@ -603,6 +1072,9 @@ unzip(lua_State *L, const char *filename) {
 			{ "read", zipread_read },
 			{ "size", zipread_size },
 			{ "filename", zipread_filename },
+			{ "stream", zipread_stream },
+			{ "batch", zipread_batch },
+			{ "readfile_mem", zipread_readfile_mem },
 			{ NULL, NULL },
 		};
 		luaL_setfuncs(L, l, 0);
@@ -6,6 +6,7 @@ end
 
 local ltask = require "ltask"
 local fastio = require "fastio"
+local fs = require "bee.filesystem"
 
 local repopath, AntEditor = ...
 __ANT_EDITOR__ = AntEditor
@@ -104,6 +105,40 @@ function S.READ(pathname)
 	end
 end
 
+local luacpath = repopath .. ".app/luac/"
+
+-- see S.READ_LUA in engine/firmware/io.lua, the repo here has no hash, so the source is hashed when it's read.
+-- The chunk keeps its chunkname, so the key includes the path as well.
+function S.READ_LUA(pathname)
+	local file = getfile(pathname)
+	if not file or not file.path then
+		return S.READ(pathname)
+	end
+	local key = fastio.str2sha1(fastio.sha1(file.path) .. pathname)
+	local bytecode = fastio.readall_v_noerr(luacpath .. key, pathname)
+	if bytecode then
+		return bytecode, file.path, key, true
+	end
+	local data = fastio.readall_v(file.path, pathname)
+	return data, file.path, key
+end
+
+function S.WRITE_LUA(key, bytecode)
+	fs.create_directories(luacpath)
+	local filename = luacpath .. key
+	local temp = filename .. ".tmp"
+	local f = io.open(temp, "wb")
+	if not f then
+		return
+	end
+	f:write(bytecode)
+	f:close()
+	if not os.rename(temp, filename) then
+		os.remove(filename)
+		os.rename(temp, filename)
+	end
+end
+
 function S.LIST(pathname)
 	local file = getfile(pathname)
 	if not file then
@@ -144,7 +144,7 @@ local function request_resolve(arg)
 	if not req then
 		return
 	end
-	connection.request[req] = nil
+	connection.request[arg] = nil
 	ltask.multi_wakeup(arg, true)
 end
 
@@ -232,7 +232,7 @@ function S.TYPE(fullpath)
 	end
 end
 
-function S.READ(fullpath)
+local function getfile(fullpath)
 	local path, name = fullpath:match "^(.*/)([^/]*)$"
 	local dir = getdir(path)
 	if not dir then
@@ -248,18 +248,55 @@ function S.READ(fullpath)
 		LOG("[ERROR]", "Not a file: " .. fullpath)
 		return
 	end
+	return v
+end
+
+local function readfile(hash)
 	while true do
-		local data = repo:open(v.hash)
+		local data = repo:open(hash)
 		if data then
-			return data, fullpath
+			return data
 		else
-			if not request_start("GET", v.hash) then
+			if not request_start("GET", hash) then
 				return
 			end
 		end
 	end
 end
 
+function S.READ(fullpath)
+	local v = getfile(fullpath)
+	if not v then
+		return
+	end
+	local data = readfile(v.hash)
+	if data then
+		return data, fullpath
+	end
+end
+
+-- returns the precompiled chunk of a lua file if it's cached (the 4th result is true), otherwise its source.
+-- the 3rd result is the cache key (see vfs:bytecode_key), for WRITE_LUA
+function S.READ_LUA(fullpath)
+	local v = getfile(fullpath)
+	if not v then
+		return
+	end
+	local key = repo:bytecode_key(v.hash, fullpath)
+	local bytecode = repo:open_bytecode(key, v.hash)
+	if bytecode then
+		return bytecode, fullpath, key, true
+	end
+	local data = readfile(v.hash)
+	if data then
+		return data, fullpath, key
+	end
+end
+
+function S.WRITE_LUA(key, bytecode)
+	repo:write_bytecode(key, bytecode)
+end
+
 function S.DIRECTORY(what)
 	return config.directory[what]
 end
@@ -335,6 +372,43 @@ function NETWORK.SLICE(hash, offset, data)
 	end
 end
 
+local function fetch_chunks(hash, mhash)
+	local list = repo:chunk_manifest(mhash)
+	if not list then
+		if not request_start("GET", mhash) then
+			request_reject(hash, "MISSING manifest "..mhash)
+			return
+		end
+		list = repo:chunk_manifest(mhash)
+	end
+	local missing = repo:missing_chunks(list)
+	LOG("[chunks]", hash, #list, "missing", #missing)
+	-- send all the requests first, the responses are pipelined
+	for _, chunkhash in ipairs(missing) do
+		if not connection.request[chunkhash] then
+			connection.request[chunkhash] = "GET"
+			request_send("GET", chunkhash)
+		end
+	end
+	for _, chunkhash in ipairs(missing) do
+		-- the request may be resolved while waiting for the previous ones
+		if connection.request[chunkhash] and not ltask.multi_wait(chunkhash) then
+			request_reject(hash, "MISSING chunk "..chunkhash)
+			return
+		end
+	end
+	if repo:assemble_chunks(hash, list) then
+		request_resolve(hash)
+	else
+		request_reject(hash, "INVALID chunks "..hash)
+	end
+end
+
+function NETWORK.CHUNKS(hash, mhash)
+	LOG("[response] CHUNKS", hash, mhash)
+	ltask.fork(fetch_chunks, hash, mhash)
+end
+
 function NETWORK.RESOURCE(fullpath, hash)
 	LOG("[response] RESOURCE", fullpath, hash)
 	repo:add_resource(fullpath, hash)
@@ -364,7 +438,7 @@ local function work_offline()
 end
 
 local function work_online()
-	request_send("SHAKEHANDS")
+	request_send("SHAKEHANDS", "chunk")
 	request_send("ROOT")
 end
 
@@ -14,6 +14,12 @@ vfs.send = send
 function vfs.read(path)
 	return call("READ", path)
 end
+function vfs.read_lua(path)
+	return call("READ_LUA", path)
+end
+function vfs.write_lua(key, bytecode)
+	return send("WRITE_LUA", key, bytecode)
+end
 function vfs.list(path)
 	return call("LIST", path)
 end
@@ -239,6 +239,22 @@ function vfs:write_blob(hash, data)
 	end
 end
 
+-- Precompiled lua chunks are written to the local cache the first time the source is loaded. They keep the
+-- chunkname, so the key is the hash of both the source and its path, identical files get their own chunks.
+-- The bundle may ship stripped chunks named "<hash>.luac" (see tools/filepack), they have no chunkname and
+-- are shared by content.
+function vfs:bytecode_key(hash, path)
+	return sha1(hash .. path)
+end
+
+function vfs:open_bytecode(key, hash)
+	return self:open(key .. ".luac") or self:open(hash .. ".luac")
+end
+
+function vfs:write_bytecode(key, data)
+	return writefile(self.localpath .. key .. ".luac", data)
+end
+
 function vfs:write_file(hash, size)
 	uncomplete[hash] = { size = tonumber(size), offset = 0 }
 end
@@ -288,4 +304,155 @@ function vfs:write_slice(hash, offset, data)
 	end
 end
 
+-- Chunked files: the local "chunks" index maps a chunk hash to a range of a file already
+-- downloaded, so a new version of a large file only needs the chunks that changed.
+
+local function chunk_index(self)
+	local index = self.chunk_index
+	if index then
+		return index
+	end
+	index = {}
+	local data = fastio.readall_s_noerr(self.localpath .. "chunks")
+	if data then
+		for chunkhash, filehash, offset, size in data:gmatch "(%x+) (%x+) (%x+) (%x+)\n" do
+			index[chunkhash] = { filehash, tonumber(offset, 16), tonumber(size, 16) }
+		end
+	end
+	self.chunk_index = index
+	return index
+end
+
+local function file_exists(filename)
+	local f = io.open(filename, "rb")
+	if f then
+		f:close()
+		return true
+	end
+end
+
+-- returns the chunk list { {hash, size}, ... } of a manifest, or nil if the manifest isn't local
+function vfs:chunk_manifest(mhash)
+	local data = self:open(mhash)
+	if not data then
+		return
+	end
+	local manifest = fastio.tostring(data)
+	local list = {}
+	for chunkhash, size in manifest:gmatch "(%x+) (%d+)\n" do
+		list[#list+1] = { chunkhash, tonumber(size) }
+	end
+	return list
+end
+
+function vfs:missing_chunks(list)
+	local index = chunk_index(self)
+	local missing = {}
+	local mark = {}
+	local exists = {}
+	for _, chunk in ipairs(list) do
+		local chunkhash = chunk[1]
+		if not mark[chunkhash] then
+			mark[chunkhash] = true
+			local c = index[chunkhash]
+			if c then
+				local filehash = c[1]
+				if exists[filehash] == nil then
+					exists[filehash] = file_exists(self.localpath .. filehash) or false
+				end
+				if not exists[filehash] then
+					index[chunkhash] = nil
+					c = nil
+				end
+			end
+			if not c and not file_exists(self.localpath .. chunkhash) then
+				missing[#missing+1] = chunkhash
+			end
+		end
+	end
+	return missing
+end
+
+local function read_chunk(self, chunkhash, files)
+	local c = self.chunk_index[chunkhash]
+	if c then
+		local filehash, offset, size = c[1], c[2], c[3]
+		local f = files[filehash]
+		if f == nil then
+			f = io.open(self.localpath .. filehash, "rb") or false
+			files[filehash] = f
+		end
+		if f then
+			f:seek("set", offset)
+			local data = f:read(size)
+			if data and #data == size then
+				return data
+			end
+		end
+	end
+	return fastio.readall_s_noerr(self.localpath .. chunkhash)
+end
+
+-- assembles a file from its chunks, all of them must be local (see missing_chunks)
+function vfs:assemble_chunks(hash, list)
+	local hashpath = self.localpath .. hash
+	local tempname = hashpath .. ".download"
+	local f = io.open(tempname, "wb")
+	if not f then
+		print("Can't write to", tempname)
+		return
+	end
+	local files = {}
+	local ok = true
+	for _, chunk in ipairs(list) do
+		local data = read_chunk(self, chunk[1], files)
+		if not data or #data ~= chunk[2] then
+			print("Missing chunk", chunk[1])
+			ok = false
+			break
+		end
+		f:write(data)
+	end
+	f:close()
+	for _, h in pairs(files) do
+		if h then
+			h:close()
+		end
+	end
+	if ok and fastio.sha1(tempname) ~= hash then
+		print("Invalid chunks", hash)
+		ok = false
+	end
+	if not ok then
+		os.remove(tempname)
+		return
+	end
+	if not os.rename(tempname, hashpath) then
+		os.remove(hashpath)
+		if not os.rename(tempname, hashpath) then
+			print("Can't rename", hashpath)
+			return
+		end
+	end
+	-- index the chunks of the new file, and remove the downloaded chunks
+	local index = self.chunk_index
+	local w = {}
+	local offset = 0
+	for _, chunk in ipairs(list) do
+		local chunkhash, size = chunk[1], chunk[2]
+		if not index[chunkhash] or index[chunkhash][1] ~= hash then
+			os.remove(self.localpath .. chunkhash)
+			index[chunkhash] = { hash, offset, size }
+			w[#w+1] = ("%s %s %x %x\n"):format(chunkhash, hash, offset, size)
+		end
+		offset = offset + size
+	end
+	local indexfile = io.open(self.localpath .. "chunks", "ab")
+	if indexfile then
+		indexfile:write(table.concat(w))
+		indexfile:close()
+	end
+	return true
+end
+
 return vfs
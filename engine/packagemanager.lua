@@ -20,6 +20,40 @@ end
 
 local registered = {}
 
+-- Lua files are loaded from the bytecode cache of the io service (keyed by the content hash and the path) when it's
+-- available, otherwise they are compiled from the source and the dump is sent back to fill the cache.
+-- Returns nil when the file doesn't exist, or the results of fastio.loadlua.
+local function loadlua(path, env)
+    if not vfs.read_lua then
+        -- io service itself
+        local mem, symbol = vfs.read(path)
+        if not mem then
+            return
+        end
+        return fastio.loadlua(mem, symbol, env)
+    end
+    local mem, symbol, key, bytecode = vfs.read_lua(path)
+    if not mem then
+        return
+    end
+    if bytecode then
+        local func = fastio.loadlua(mem, symbol, env, "b")
+        if func then
+            return func
+        end
+        -- the cache is built by another version of lua, fallback to the source
+        mem, symbol = vfs.read(path)
+        if not mem then
+            return
+        end
+    end
+    local func, err = fastio.loadlua(mem, symbol, env)
+    if func and key then
+        vfs.write_lua(key, string.dump(func))
+    end
+    return func, err
+end
+
 local function sandbox_env(packagename)
     local env = {}
     local _LOADED = {}
@@ -46,9 +80,8 @@ local function sandbox_env(packagename)
         local filename = name:gsub('%.', '/')
         local path = PATH:gsub('%?', filename)
         do
-            local mem, symbol = vfs.read(path)
-            if mem then
-                local func, err = fastio.loadlua(mem, symbol, env)
+            local func, err = loadlua(path, env)
+            if func or err then
                 if not func then
                     error(("error loading module '%s' from file '%s':\n\t%s"):format(name, path, err))
                 end
@@ -78,12 +111,11 @@ local function sandbox_env(packagename)
 
     function env.loadfile(path)
         local filename = "/pkg/"..packagename.."/"..path
-        local mem, symbol = vfs.read(filename)
-        if not mem then
-            return nil, ("file '%s' not found"):format(filename)
-        end
-        local func, err = fastio.loadlua(mem, symbol, env)
+        local func, err = loadlua(filename, env)
         if not func then
+            if not err then
+                return nil, ("file '%s' not found"):format(filename)
+            end
             return nil, ("error loading file '%s':\n\t%s"):format(filename, err)
         end
         return func
@@ -126,4 +158,5 @@ end
 
 return {
     loadenv = loadenv,
+    loadlua = loadlua,
 }
@@ -120,7 +120,7 @@ local function bake_animation_mesh(anio, mesho, bakenum)
 		ib = {
 			handle  = ib.handle,
 			memory  = true,	-- prevent entity delete this handle
-			start   = 0,
+			start   = ib.start,	-- not 0 when the ib is pooled
 			num     = ib.num,
 			flag    = ib.flag,
 		}
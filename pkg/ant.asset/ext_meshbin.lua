@@ -4,13 +4,86 @@ local setting   = import_package "ant.settings"
 local aio       = import_package "ant.io"
 local layoutmgr = import_package "ant.render".layoutmgr
 local serialize = import_package "ant.serialize"
+local mesh_pool = require "render.mesh_pool"
+local raycast   = require "objcontroller.raycast"
 
 local USE_CS_SKINNING <const> = setting:get "graphic/skinning/use_cs"
+local USE_POOL <const>      = setting:get "graphic/mesh_pool/enable"
+local POOL_VERTICES <const> = setting:get "graphic/mesh_pool/vertices" or 0x40000
+local POOL_INDICES <const>  = setting:get "graphic/mesh_pool/indices" or 0x100000
+local USE_RAYCAST <const>   = setting:get "graphic/pickup/raycast"
 
 local function is_cs_skinning_buffer(layoutname)
     return USE_CS_SKINNING and ("iw"):match(layoutname:sub(1, 1))
 end
 
+-- Loaded meshes are sub-allocated from shared dynamic buffers (pages), one page list per vertex layout
+-- or index type, so meshes with the same layout are bound with the same handles and differ only by start.
+-- A page is released when all its meshes are unloaded.
+-- vb and vb2 are allocated together from pages holding both buffers (keyed by both layouts), they must
+-- have the same start: indirect draws pass one base vertex for all the streams (see mesh_submit in render.cpp).
+local POOLS = {}
+
+local function pool_alloc(key, num, capacity, create)
+    local pages = POOLS[key]
+    if not pages then
+        pages = {}
+        POOLS[key] = pages
+    end
+    for _, page in ipairs(pages) do
+        local offset = page.allocator:alloc(num)
+        if offset then
+            return page, offset
+        end
+    end
+    capacity = math.max(capacity, num)
+    local page = {
+        key         = key,
+        allocator   = mesh_pool.allocator(capacity),
+    }
+    page.handle, page.handle2 = create(capacity)
+    pages[#pages+1] = page
+    return page, assert(page.allocator:alloc(num))
+end
+
+local function pool_free(page, offset)
+    if page.allocator:free(offset) then
+        local pages = POOLS[page.key]
+        for i, p in ipairs(pages) do
+            if p == page then
+                table.remove(pages, i)
+                break
+            end
+        end
+        bgfx.destroy(page.handle)
+        if page.handle2 then
+            bgfx.destroy(page.handle2)
+        end
+    end
+end
+
+local function can_pool_vb(vb)
+    return USE_POOL and vb.memory and vb.start == 0 and not is_cs_skinning_buffer(vb.declname)
+end
+
+local function pool_key_vb(vb, vb2)
+    if not can_pool_vb(vb) then
+        return
+    end
+    if not vb2 then
+        return vb.declname
+    end
+    if can_pool_vb(vb2) and vb2.num == vb.num then
+        return vb.declname .. "+" .. vb2.declname
+    end
+end
+
+local function pool_key_ib(ib)
+    if USE_POOL and ib.memory and ib.start == 0 and (ib.flag == nil or ib.flag == "d") then
+        return ib.flag == "d" and "i32" or "i16"
+    end
+end
+
 local proxy_vb = {}
 
 local function mem2str(obj)
@@ -41,7 +114,41 @@ local function mem2bgfx(obj)
     return bgfx.memory_buffer(data, offset, size)
 end
 
+-- vb2 is allocated with its vb (pool_primary), the page is owned and freed by the vb
+local function pool_vb(b)
+    local vb = rawget(b, "pool_primary") or b
+    local vb2 = rawget(vb, "pool_pair")
+    local layouthandle = layoutmgr.get(vb.declname).handle
+    local layouthandle2 = vb2 and layoutmgr.get(vb2.declname).handle
+    local page, offset = pool_alloc(vb.pool, vb.num, POOL_VERTICES, function (capacity)
+        return bgfx.create_dynamic_vertex_buffer(capacity, layouthandle),
+            vb2 and bgfx.create_dynamic_vertex_buffer(capacity, layouthandle2)
+    end)
+    bgfx.update(page.handle, offset, mem2bgfx(vb))
+    vb.page, vb.offset = page, offset
+    vb.handle, vb.start = page.handle, offset
+    if vb2 then
+        bgfx.update(page.handle2, offset, mem2bgfx(vb2))
+        vb2.handle, vb2.start = page.handle2, offset
+    end
+end
+
+local function pool_ib(ib)
+    local page, offset = pool_alloc(ib.pool, ib.num, POOL_INDICES, function (capacity)
+        return bgfx.create_dynamic_index_buffer(capacity, ib.flag)
+    end)
+    bgfx.update(page.handle, offset, mem2bgfx(ib))
+    ib.page, ib.offset = page, offset
+    ib.handle, ib.start = page.handle, offset
+end
+
+-- 'start' of a pooled buffer is unknown until it's allocated, so it's lazy like 'handle'
 function proxy_vb:__index(k)
+    if (k == "handle" or k == "start") and rawget(self, "pool") then
+        pool_vb(self)
+        return rawget(self, k)
+    end
+
     if k == "handle" then
         local membuf = mem2bgfx(self)
         local layoutname = self.declname
@@ -62,6 +169,11 @@ end
 
 local proxy_ib = {}
 function proxy_ib:__index(k)
+    if (k == "handle" or k == "start") and rawget(self, "pool") then
+        pool_ib(self)
+        return rawget(self, k)
+    end
+
     if k == "handle" then
         local membuf = mem2bgfx(self)
         local h = bgfx.create_index_buffer(membuf, self.flag)
@@ -76,15 +188,33 @@ function proxy_ib:__index(k)
     end
 end
 
-local function init(mesh)
+local function init_pool(b, key)
+    if key then
+        b.pool = key
+        b.start = nil
+    end
+end
+
+local function init(mesh, pooled)
     local vb = mesh.vb
-    setmetatable(vb, proxy_vb)
     local vb2 = mesh.vb2
+    if pooled then
+        local key = pool_key_vb(vb, vb2)
+        init_pool(vb, key)
+        if key and vb2 then
+            init_pool(vb2, key)
+            vb.pool_pair, vb2.pool_primary = vb2, vb
+        end
+    end
+    setmetatable(vb, proxy_vb)
     if vb2 then
         setmetatable(vb2, proxy_vb)
     end
     local ib = mesh.ib
     if ib then
+        if pooled then
+            init_pool(ib, pool_key_ib(ib))
+        end
         setmetatable(ib, proxy_ib)
     end
     return mesh
@@ -92,7 +222,13 @@ end
 
 local function destroy_handle(v)
 	if v then
-		if not v.memory then
+		if v.page then
+			pool_free(v.page, v.offset)
+			v.page, v.pool = nil, nil
+		elseif v.pool_primary then
+			-- the page is freed with its vb
+			v.pool = nil
+		elseif not v.memory then
 			bgfx.destroy(v.handle)
 		end
 		v.handle = nil
@@ -119,6 +255,38 @@ local function load_mem(buf, meshfile)
     end
 end
 
+local function is_skinning_layout(layout)
+    return layout:match "^[iw]" or layout:match "|[iw]"
+end
+
+-- triangle bvh for the cpu pickup, built before the memory is handed to bgfx.
+-- skinned meshes are deformed in runtime, they are left to the gpu pickup
+local function build_bvh(mesh)
+    local vb, vb2, ib = mesh.vb, mesh.vb2, mesh.ib
+    if is_skinning_layout(vb.declname) or (vb2 and is_skinning_layout(vb2.declname)) then
+        return
+    end
+    local stride, position = 0
+    for e in vb.declname:gmatch "[^|]+" do
+        if e:sub(1, 1) == 'p' then
+            if e:sub(2, 2) ~= '3' or e:sub(6, 6) ~= 'f' then
+                return
+            end
+            position = stride
+        end
+        stride = stride + layoutmgr.elem_size(e)
+    end
+    if position == nil then
+        return
+    end
+    local vm = vb.memory
+    if ib then
+        local im = ib.memory
+        return raycast.mesh(vm[1], vm[2], vb.num, stride, position, im[1], im[2], ib.num, ib.flag == "d")
+    end
+    return raycast.mesh(vm[1], vm[2], vb.num, stride, position)
+end
+
 local function loader(filename)
     local mesh = serialize.load(filename)
 
@@ -126,7 +294,12 @@ local function loader(filename)
     load_mem(mesh.vb2, filename)
     load_mem(mesh.ib, filename)
 
-    return init(mesh)
+    if USE_RAYCAST then
+        mesh.bvh = build_bvh(mesh)
+    end
+
+    -- only meshbin files are pooled, meshes built at runtime may use their own offsets in the buffers
+    return init(mesh, true)
 end
 
 local function unloader(res, obj)
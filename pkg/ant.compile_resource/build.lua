@@ -0,0 +1,90 @@
+local ltask = require "ltask"
+local fastio = require "fastio"
+
+-- compile jobs mostly wait on shaderc/texturec subprocesses, one worker per hardware thread keeps them all busy
+local DefaultWorkers <const> = fastio.cpu_count()
+
+-- Resources don't depend on each other's output, so the build graph is a flat set of jobs.
+-- glb/gltf are the longest ones (they compile their own materials and textures),
+-- schedule them first to keep them off the tail of the build.
+local Priority <const> = {
+    glb = 1,
+    gltf = 1,
+    material = 2,
+    texture = 3,
+}
+
+local function priority(vpath)
+    local ext = vpath:match "[^/]%.([%w*?_%-]*)$"
+    return Priority[ext] or 4
+end
+
+local m = {}
+
+-- args = {
+--     repopath = string,
+--     settings = { "windows-direct3d11", ... },
+--     names = { vpath, ... },
+--     paths = { lpath, ... },
+--     workers = integer?,      default to the hardware thread count
+--     cachepath = string?,     shared build cache, see build_cache.lua
+-- }
+-- returns the list of output paths, and the list of errors
+function m.compile_all(args)
+    local names, paths = args.names, args.paths
+    local order = {}
+    for i = 1, #names do
+        order[i] = i
+    end
+    table.sort(order, function (a, b)
+        local pa, pb = priority(names[a]), priority(names[b])
+        if pa ~= pb then
+            return pa < pb
+        end
+        return a < b
+    end)
+    local jobs = {}
+    for _, setting in ipairs(args.settings) do
+        for _, i in ipairs(order) do
+            jobs[#jobs+1] = { setting, names[i], paths[i] }
+        end
+    end
+    local nworker = math.min(args.workers or DefaultWorkers, #jobs)
+    local workers = {}
+    for i = 1, nworker do
+        workers[i] = ltask.spawn("ant.compile_resource|compile", args.repopath, args.cachepath)
+    end
+    local outputs = {}
+    local errors = {}
+    local next_job = 0
+    local function worker_loop(id)
+        while true do
+            next_job = next_job + 1
+            local job = jobs[next_job]
+            if not job then
+                return
+            end
+            local ok, res = ltask.call(id, "compile", job[1], job[2], job[3])
+            if ok then
+                outputs[#outputs+1] = res
+            else
+                errors[#errors+1] = res
+            end
+        end
+    end
+    local tasks = {}
+    for i, id in ipairs(workers) do
+        tasks[i] = { worker_loop, id }
+    end
+    for _, resp in ltask.parallel(tasks) do
+        if resp.error then
+            resp:rethrow()
+        end
+    end
+    for _, id in ipairs(workers) do
+        ltask.send(id, "quit")
+    end
+    return outputs, errors
+end
+
+return m
@@ -0,0 +1,179 @@
+local lfs       = require "bee.filesystem"
+local datalist  = require "datalist"
+local fastio    = require "fastio"
+local sha1      = require "sha1"
+local depends   = require "depends"
+
+-- Shared build cache, it can live in a local directory or a network share used by several machines.
+--
+--   <cachepath>/<setting>/<ext>/<sha1(vpath)>/<key>.deps   relocatable dependency list
+--   <cachepath>/<setting>/<ext>/<sha1(vpath)>/<key>/       compiled output
+--
+-- <key> is the sha1 of every dependency's relocatable name and content hash. Compiler versions
+-- are part of it because every compiler depends on its own version.lua.
+
+local m = {}
+
+local function writefile(filename, data)
+    local f <close> = assert(io.open(filename:string(), "wb"))
+    f:write(data)
+end
+
+local function readconfig(filename)
+    return datalist.parse(fastio.readall_f(filename:string()))
+end
+
+local function copy_dir(from, to)
+    lfs.create_directories(to)
+    for path, status in lfs.pairs(from) do
+        local target = to / path:filename()
+        if status:is_directory() then
+            copy_dir(path, target)
+        else
+            lfs.copy_file(path, target, lfs.copy_options.overwrite_existing)
+        end
+    end
+end
+
+local function slot_path(setting, ext, vpath)
+    return setting.cachepath / setting.name / ext / sha1(vpath:lower())
+end
+
+local function repo_relative(setting, lpath)
+    local root = setting.repopath
+    if lpath:sub(1, #root) == root then
+        return lpath:sub(#root + 1)
+    end
+end
+
+-- local absolute paths differ between machines, so dependencies are stored
+-- by virtual path when known, otherwise relative to the repo
+local function relocatable(setting, deps)
+    local r = {}
+    for _, dep in ipairs(deps) do
+        local path, timestamp = dep[1], dep[2]
+        if timestamp == 0 then
+            r[#r+1] = { "v", path }
+        else
+            local vname = deps.vname and deps.vname[path]
+            if vname then
+                r[#r+1] = { "v", vname }
+            else
+                local rel = repo_relative(setting, path)
+                if rel then
+                    r[#r+1] = { "r", rel }
+                else
+                    r[#r+1] = { "a", path }
+                end
+            end
+        end
+    end
+    table.sort(r, function (a, b)
+        if a[1] == b[1] then
+            return a[2] < b[2]
+        end
+        return a[1] < b[1]
+    end)
+    return r
+end
+
+local function resolve(setting, entry)
+    local kind, name = entry[1], entry[2]
+    if kind == "v" then
+        local lpath = setting.vfs.realpath(name)
+        return lpath and lfs.absolute(lpath):lexically_normal():string()
+    elseif kind == "r" then
+        return setting.repopath .. name
+    else
+        return name
+    end
+end
+
+-- computes the cache key from the current content of the dependencies,
+-- and the local dependency list to write into .dep on a cache hit
+local function build_key(setting, vpath, rdeps)
+    local lines = { setting.name, vpath:lower() }
+    local deps = depends.new()
+    for _, entry in ipairs(rdeps) do
+        local lpath = resolve(setting, entry)
+        local hash = "-"
+        if lpath and lfs.exists(lpath) then
+            local timestamp = lfs.last_write_time(lpath)
+            hash = depends.get_hash(lpath, timestamp)
+            deps[#deps+1] = { lpath, timestamp, hash }
+            deps.lpath[lpath] = true
+        elseif entry[1] == "v" and not lpath then
+            deps[#deps+1] = { entry[2], 0 }
+            deps.vpath[entry[2]] = true
+        else
+            deps[#deps+1] = { lpath, 1 }
+            deps.lpath[lpath] = true
+        end
+        lines[#lines+1] = ("%s|%s|%s"):format(entry[1], entry[2], hash)
+    end
+    return sha1(table.concat(lines, "\n")), deps
+end
+
+function m.init(setting, cachepath)
+    if cachepath then
+        setting.cachepath = lfs.absolute(lfs.path(cachepath)):lexically_normal()
+        lfs.create_directories(setting.cachepath)
+    end
+end
+
+function m.fetch(setting, ext, vpath, output)
+    if not setting.cachepath then
+        return false
+    end
+    local slot = slot_path(setting, ext, vpath)
+    if not lfs.is_directory(slot) then
+        return false
+    end
+    for file, status in lfs.pairs(slot) do
+        if not status:is_directory() and file:extension() == ".deps" then
+            local ok, rdeps = pcall(readconfig, file)
+            if ok then
+                local key, deps = build_key(setting, vpath, rdeps)
+                local cached = slot / key
+                if key == file:stem():string() and lfs.is_directory(cached) then
+                    lfs.remove_all(output)
+                    copy_dir(cached, output)
+                    depends.writefile(output / ".dep", deps)
+                    return true
+                end
+            end
+        end
+    end
+    return false
+end
+
+function m.store(setting, ext, vpath, output, deps)
+    if not setting.cachepath then
+        return
+    end
+    local rdeps = relocatable(setting, deps)
+    local key = build_key(setting, vpath, rdeps)
+    local slot = slot_path(setting, ext, vpath)
+    local cached = slot / key
+    if lfs.exists(cached) then
+        return
+    end
+    -- copy into a temporary directory first, other machines may read the slot at the same time
+    local tmp = slot / (key .. "." .. sha1(tostring(os.time()) .. tostring({})) .. ".tmp")
+    local ok, err = pcall(function ()
+        copy_dir(output, tmp)
+        lfs.remove(tmp / ".dep")
+        lfs.rename(tmp, cached)
+        local w = {}
+        for _, entry in ipairs(rdeps) do
+            w[#w+1] = ("{%q, %q}"):format(entry[1], entry[2])
+        end
+        writefile(slot / (key .. ".deps"), table.concat(w, "\n"))
+    end)
+    if not ok then
+        lfs.remove_all(tmp)
+        log.warn(("store `%s` into build cache failed: %s"):format(vpath, err))
+    end
+end
+
+return m
@@ -8,6 +8,7 @@ function m.new()
     return {
         vpath = {},
         lpath = {},
+        vname = {},
     }
 end
 
@@ -18,18 +19,36 @@ local function get_write_time(path)
     return lfs.last_write_time(path)
 end
 
+-- content hash of a local file, memoized by write time so shader includes
+-- shared by many materials are only hashed once per process
+local HashCache = {}
+
+local function get_hash(path, timestamp)
+    local c = HashCache[path]
+    if c and c[1] == timestamp then
+        return c[2]
+    end
+    local hash = fastio.sha1(path)
+    HashCache[path] = { timestamp, hash }
+    return hash
+end
+
+m.get_hash = get_hash
+
 function m.add_lpath(t, lpath)
     local abspath = lfs.absolute(lpath):lexically_normal():string()
     if not t.lpath[abspath] then
         t[#t+1] = {abspath, get_write_time(abspath)}
         t.lpath[abspath] = true
     end
+    return abspath
 end
 
 function m.add_vpath(t, setting, vpath)
     local lpath = setting.vfs.realpath(vpath)
     if lpath then
-        m.add_lpath(t, lpath)
+        local abspath = m.add_lpath(t, lpath)
+        t.vname[abspath] = vpath
         return
     end
     if not t.vpath[vpath] then
@@ -46,6 +65,11 @@ function m.append(t, a)
             t.vpath[v] = a.vpath[v]
         end
     end
+    if a.vname then
+        for k, v in pairs(a.vname) do
+            t.vname[k] = v
+        end
+    end
 end
 
 local function writefile(filename, data)
@@ -57,64 +81,110 @@ local function readconfig(filename)
     return datalist.parse(fastio.readall_f(filename:string()))
 end
 
+function m.hash(t)
+    for _, v in ipairs(t) do
+        local timestamp = v[2]
+        if timestamp > 1 and not v[3] then
+            v[3] = get_hash(v[1], timestamp)
+        end
+    end
+end
+
 function m.writefile(filename, t)
+    m.hash(t)
     local w = {}
     for _, v in ipairs(t) do
-        w[#w+1] = ("{%d, %q}"):format(v[2], v[1])
+        if v[3] then
+            w[#w+1] = ("{%d, %q, %q}"):format(v[2], v[1], v[3])
+        else
+            w[#w+1] = ("{%d, %q}"):format(v[2], v[1])
+        end
     end
     writefile(filename, table.concat(w, "\n"))
 end
 
+-- A dependency whose write time changed is still clean when its content hash
+-- is the same, e.g. after a branch switch touched it. Returns the dirty filename,
+-- or nil plus `true` when only the timestamps need to be refreshed.
+local function check_dep(setting, dep)
+    local timestamp, filename, hash = dep[1], dep[2], dep[3]
+    if timestamp == 0 then
+        local rp = setting.vfs.realpath(filename)
+        if rp then
+            return rp
+        end
+    elseif timestamp == 1 then
+        if lfs.exists(filename) then
+            return filename
+        end
+    else
+        if not lfs.exists(filename) then
+            return filename
+        end
+        local newtimestamp = lfs.last_write_time(filename)
+        if timestamp ~= newtimestamp then
+            if not hash or get_hash(filename, newtimestamp) ~= hash then
+                return filename
+            end
+            dep[1] = newtimestamp
+            return nil, true
+        end
+    end
+end
+
+local function refresh(path, deps)
+    local w = {}
+    for _, dep in ipairs(deps) do
+        if dep[3] then
+            w[#w+1] = ("{%d, %q, %q}"):format(dep[1], dep[2], dep[3])
+        else
+            w[#w+1] = ("{%d, %q}"):format(dep[1], dep[2])
+        end
+    end
+    writefile(path, table.concat(w, "\n"))
+end
+
 function m.dirty(setting, path)
     if not lfs.exists(path) then
         return true
     end
-    for _, dep in ipairs(readconfig(path)) do
-        local timestamp, filename = dep[1], dep[2]
-        if timestamp == 0 then
-            local rp = setting.vfs.realpath(filename)
-            if rp then
-                return rp
-            end
-        elseif timestamp == 1 then
-            if lfs.exists(filename) then
-                return filename
-            end
-        else
-            if not lfs.exists(filename) or timestamp ~= lfs.last_write_time(filename) then
-                return filename
-            end
+    local deps = readconfig(path)
+    local touched
+    for _, dep in ipairs(deps) do
+        local dirty, t = check_dep(setting, dep)
+        if dirty then
+            return dirty
         end
+        touched = touched or t
+    end
+    if touched then
+        refresh(path, deps)
     end
 end
 
 function m.read_if_not_dirty(setting, path)
     local i = 0
     local deps = m.new()
-    for _, dep in ipairs(readconfig(path)) do
-        local timestamp, filename = dep[1], dep[2]
-        if timestamp == 0 then
-            local rp = setting.vfs.realpath(filename)
-            if rp then
-                return nil, rp
-            end
-        elseif timestamp == 1 then
-            if lfs.exists(filename) then
-                return nil, filename
-            end
-        else
-            if not lfs.exists(filename) or timestamp ~= lfs.last_write_time(filename) then
-                return nil, filename
-            end
+    local config = readconfig(path)
+    local touched
+    for _, dep in ipairs(config) do
+        local dirty, t = check_dep(setting, dep)
+        if dirty then
+            return nil, dirty
         end
+        touched = touched or t
+        local timestamp, filename = dep[1], dep[2]
         i = i + 1
-        deps[i] = { filename, timestamp }
+        deps[i] = { filename, timestamp, dep[3] }
         if timestamp == 0 then
             deps.vpath[filename] = true
         else
             deps.lpath[filename] = true
         end
     end
+    if touched then
+        refresh(path, config)
+    end
     return deps
 end
 
@@ -0,0 +1,11 @@
+local fastio = require "fastio"
+
+-- Precompiled chunk of a lua file for the bytecode cache (see engine/packagemanager.lua).
+-- Shipped builds don't need the debug info, so it's stripped.
+return function (lpath)
+	local func, err = load(fastio.readall_s(lpath), "@"..lpath, "t")
+	if not func then
+		return nil, err
+	end
+	return string.dump(func, true)
+end
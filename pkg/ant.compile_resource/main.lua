@@ -8,10 +8,17 @@ local sha1    = require "sha1"
 local depends = require "depends"
 local ltask   = require "ltask"
 local lfs     = require "bee.filesystem"
+local cache   = require "build_cache"
 
-local function init_setting(vfs, setting)
+local DefaultCachePath <const> = os.getenv "ANT_RESOURCE_CACHE"
+
+local function init_setting(vfs, setting, cachepath)
     local os, renderer = setting:match "^(%w+)-(%w+)$"
     local rootpath = lfs.path(vfs.repopath())
+    local repopath = lfs.absolute(rootpath):lexically_normal():string()
+    if not repopath:match "[/\\]$" then
+        repopath = repopath .. "/"
+    end
     local respath = rootpath / "res" / setting
     local scpath = rootpath / ".app" / "build" / "sc"
     local shaderpath = rootpath / ".app" / "build" / "shader"
@@ -21,15 +28,19 @@ local function init_setting(vfs, setting)
     for _, ext in ipairs {"glb", "gltf", "texture", "material"} do
         lfs.create_directory(respath / ext)
     end
-    return {
+    local cfg = {
+        name = setting,
         compiling = {},
         vfs = vfs,
+        repopath = repopath,
         respath = respath,
         scpath = scpath,
         shaderpath = shaderpath,
         os = os,
         renderer = renderer,
     }
+    cache.init(cfg, cachepath or DefaultCachePath)
+    return cfg
 end
 
 local function get_filename(pathname)
@@ -54,13 +65,14 @@ local function compile_file(setting, vpath, lpath)
     local ext = vpath:match "[^/]%.([%w*?_%-]*)$"
     local output = setting.respath / ext / get_filename(vpath)
     local changed = depends.dirty(setting, output / ".dep")
-    if changed then
+    if changed and not cache.fetch(setting, ext, vpath, output) then
         local ok, deps = COMPILER[ext](lpath, vpath, output, setting, changed)
         if not ok then
             local err = deps
             error("compile failed: " .. lpath .. "\n" .. err)
         end
         depends.writefile(output / ".dep", deps)
+        cache.store(setting, ext, vpath, output, deps)
     end
     ltask.multi_wakeup(setting.compiling[lpath], output:string())
     setting.compiling[lpath] = nil
@@ -86,4 +98,6 @@ return {
     init_setting  = init_setting,
     compile_file = compile_file,
     verify_file = verify_file,
+    compile_all = require "build".compile_all,
+    compile_lua = require "luac",
 }
@@ -20,34 +20,24 @@ local function writefile(filename, data)
     f:write(data)
 end
 
+local ServiceLock = ltask.uniqueservice "ant.compile_resource|lock"
+
 local compiling = {}
 
 local function compile_finish(key, ...)
+    ltask.call(ServiceLock, "unlock", key)
     ltask.multi_wakeup(compiling[key], ...)
     compiling[key] = nil
     return ...
 end
 
-local function run(setting, commands, input, output)
-    local cmdstring = cmdtostr(commands)
-    local path = setting.shaderpath / get_filename(cmdstring, input)
-    local pathkey = path:string()
-
-    if compiling[pathkey] then
-        local ok, res = ltask.multi_wait(compiling[pathkey])
-        if ok then
-            clonefile(path / "bin", output)
-        end
-        return ok, res
-    end
-    compiling[pathkey] = {}
-
+local function compile(setting, commands, cmdstring, input, output, path)
     if lfs.exists(path) then
         if lfs.exists(path / "bin") and lfs.exists(path / ".dep")  then
-            local deps, dirty_path = depends.read_if_not_dirty(setting.vfs, path / ".dep")
+            local deps, dirty_path = depends.read_if_not_dirty(setting, path / ".dep")
             if deps then
                 clonefile(path / "bin", output)
-                return compile_finish(pathkey, true, deps)
+                return true, deps
             elseif dirty_path then
                 log.warn(("`%s` is dirty. reason: `%s`"):format(path, dirty_path))
             else
@@ -79,7 +69,7 @@ local function run(setting, commands, input, output)
         end
     end
     if not success then
-        return compile_finish(pathkey, false, errmsg)
+        return false, errmsg
     end
     local deps = depends.new()
     depends.add_lpath(deps, input:string())
@@ -97,7 +87,30 @@ local function run(setting, commands, input, output)
     depends.writefile(path / ".dep", deps)
     writefile(path / ".arguments", cmdstring)
     clonefile(path / "bin", output)
-    return compile_finish(pathkey, true, deps)
+    return true, deps
+end
+
+local function run(setting, commands, input, output)
+    local cmdstring = cmdtostr(commands)
+    local path = setting.shaderpath / get_filename(cmdstring, input)
+    local pathkey = path:string()
+
+    if compiling[pathkey] then
+        local ok, res = ltask.multi_wait(compiling[pathkey])
+        if ok then
+            clonefile(path / "bin", output)
+        end
+        return ok, res
+    end
+    compiling[pathkey] = {}
+    ltask.call(ServiceLock, "lock", pathkey)
+    -- the lock must be released and the waiters woken up even if compile raises
+    local ok, success, res = pcall(compile, setting, commands, cmdstring, input, output, path)
+    if not ok then
+        compile_finish(pathkey, false, success)
+        error(success, 0)
+    end
+    return compile_finish(pathkey, success, res)
 end
 
 return {
@@ -2,8 +2,17 @@ local gltfutil  = require "model.glTF.util"
 local utility   = require "model.utility"
 local meshutil	= require "model.meshutil"
 local packer 	= require "model.pack_vertex_data"
+local meshopt	= require "meshopt"
 local pack_vertex_data = packer.pack
 
+-- lod chain generated after lod0, every lod keeps about 'ratio' of lod0 triangles
+local LOD <const> = {
+	ratios		= {0.5, 0.25, 0.125},
+	max_error	= 0.05,		-- relative to mesh extent, simplification stop when error above this
+	min_triangles = 256,	-- mesh with less triangles than this will not generate lod
+	min_reduce	= 0.8,		-- next lod should have less than 'min_reduce' triangles of previous lod
+}
+
 local function get_layout(name, accessor)
 	local attribname, channel = name:match"(%w+)_(%d+)"
 	local shortname = meshutil.SHORT_NAMES[attribname or name]
@@ -78,6 +87,62 @@ end
 	return to_ib(indexbin, elemsize == 4 and 'd' or '', index_accessor.count)
 end
 
+local function fetch_positions(gltfscene, prim)
+	local acc = gltfscene.accessors[assert(prim.attributes.POSITION)+1]
+	local FLOAT <const> = 5126
+	if acc.componentType ~= FLOAT or acc.type ~= "VEC3" then
+		return
+	end
+	local bv = gltfscene.bufferViews[acc.bufferView+1]
+	local stride = bv.byteStride or 12
+	local offset = (bv.byteOffset or 0) + (acc.byteOffset or 0)
+	local bin = gltfscene.buffers[bv.buffer+1].bin
+	-- right hand to left hand is a mirror, it does not change the simplification result, use gltf data directly
+	return bin:sub(offset+1, offset+(acc.count-1)*stride+12), stride
+end
+
+-- lod index data append to lod0 in the same index buffer, ib.num is still lod0 index count
+-- lod.error is the geometry error in model space, used to select lod by projected error in runtime
+local function generate_lods(gltfscene, prim, ib, bounding)
+	local triangles = ib.num // 3
+	if bounding == nil or triangles < LOD.min_triangles then
+		return
+	end
+	local positions, stride = fetch_positions(gltfscene, prim)
+	if positions == nil then
+		return
+	end
+	local minv, maxv = bounding.aabb[1], bounding.aabb[2]
+	local dx, dy, dz = maxv[1]-minv[1], maxv[2]-minv[2], maxv[3]-minv[3]
+	local extent = math.sqrt(dx*dx+dy*dy+dz*dz)
+
+	local elemsize = ib.flag == 'd' and 4 or 2
+	local ib0 = ib.memory[1]
+	local bins = {ib0}
+	local lods = {}
+	local start, lastnum = ib.num, ib.num
+	for _, ratio in ipairs(LOD.ratios) do
+		local target = math.floor(triangles * ratio) * 3
+		if target // 3 < LOD.min_triangles // 2 then
+			break
+		end
+		local lodib, err = meshopt.simplify(ib0, elemsize, positions, stride, target, LOD.max_error)
+		local num = #lodib // elemsize
+		if num == 0 or num > lastnum * LOD.min_reduce then
+			break
+		end
+		bins[#bins+1] = lodib
+		lods[#lods+1] = {start = start, num = num, error = err * extent}
+		start, lastnum = start + num, num
+	end
+	if #lods == 0 then
+		return
+	end
+	local bin = table.concat(bins, "")
+	ib.memory = {bin, 1, #bin}
+	return lods
+end
+
 local function create_prim_bounding(math3d, meshscene, prim)
 	local posacc = meshscene.accessors[assert(prim.attributes.POSITION)+1]
 	local minv = posacc.min
@@ -505,6 +570,10 @@ end
 				end
 			end
 
+			if group.ib then
+				group.lods = generate_lods(gltfscene, prim, group.ib, group.bounding)
+			end
+
 			local stemname = ("%s_P%d"):format(meshname, primidx)
 
 			meshexport.meshbinfile = save_meshbin_files(status, stemname, group)
@@ -1 +1 @@
-return 28
+return 29
\ No newline at end of file
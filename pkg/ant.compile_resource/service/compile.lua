@@ -0,0 +1,25 @@
+local repopath, cachepath = ...
+
+local vfsrepo = import_package "ant.vfs"
+local cr = import_package "ant.compile_resource"
+local ltask = require "ltask"
+
+local tiny_vfs = vfsrepo.new_tiny(repopath)
+local settings = {}
+
+local S = {}
+
+function S.compile(setting, vpath, lpath)
+    local cfg = settings[setting]
+    if not cfg then
+        cfg = cr.init_setting(tiny_vfs, setting, cachepath)
+        settings[setting] = cfg
+    end
+    return xpcall(cr.compile_file, debug.traceback, cfg, vpath, lpath)
+end
+
+function S.quit()
+    ltask.quit()
+end
+
+return S
@@ -0,0 +1,24 @@
+local ltask = require "ltask"
+
+-- compile services share .app/build, so the same shader must not be built by two of them at once
+
+local locked = {}
+
+local S = {}
+
+function S.lock(key)
+    while locked[key] do
+        ltask.multi_wait(locked[key])
+    end
+    locked[key] = {}
+end
+
+function S.unlock(key)
+    local waiting = locked[key]
+    locked[key] = nil
+    if waiting then
+        ltask.multi_wakeup(waiting)
+    end
+end
+
+return S
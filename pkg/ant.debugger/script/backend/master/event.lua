@@ -106,4 +106,13 @@ function event.memory(body)
     }
 end
 
+function event.profile(body)
+    mgr.clientSend {
+        type = 'event',
+        seq = mgr.newSeq(),
+        event = 'profile',
+        body = body
+    }
+end
+
 return event
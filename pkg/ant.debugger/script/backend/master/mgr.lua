@@ -128,6 +128,13 @@ function mgr.setThreadName(w, name)
     threadName[w] = name
 end
 
+function mgr.threadName(w)
+    local name = (threadName[w] or "Thread (${id})"):gsub("%$%{([^}]*)%}", {
+        id = w
+    })
+    return name
+end
+
 function mgr.workers()
     return threadChannel
 end
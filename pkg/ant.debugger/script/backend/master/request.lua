@@ -644,6 +644,24 @@ function request.customRequestShowIntegerAsHex(req)
     }
 end
 
+-- sampling lua profiler of all the workers, interval in microseconds
+function request.customRequestProfileStart(req)
+    local args = req.arguments or {}
+    response.success(req)
+    mgr.workerBroadcast {
+        cmd = 'customRequestProfileStart',
+        interval = args.interval or 1000,
+    }
+end
+
+-- every worker sends a 'profile' event with its folded stacks
+function request.customRequestProfileStop(req)
+    response.success(req)
+    mgr.workerBroadcast {
+        cmd = 'customRequestProfileStop'
+    }
+end
+
 --function print(...)
 --    local n = select('#', ...)
 --    local t = {}
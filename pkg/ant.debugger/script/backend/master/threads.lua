@@ -43,6 +43,12 @@ function CMD.eventInvalidated(w, req)
     event.invalidated(req)
 end
 
+function CMD.eventProfile(w, req)
+    req.threadId = w
+    req.name = mgr.threadName(w)
+    event.profile(req)
+end
+
 function CMD.eventLoadedSource(w, req)
     if req.source and req.source.sourceReference then
         req.source.sourceReference = (w << 32) | req.source.sourceReference
@@ -567,6 +567,17 @@ function CMD.customRequestShowIntegerAsHex()
     }
 end
 
+function CMD.customRequestProfileStart(pkg)
+    hookmgr.profile_open(true, pkg.interval)
+end
+
+function CMD.customRequestProfileStop()
+    hookmgr.profile_open(false)
+    sendToMaster 'eventProfile' {
+        folded = hookmgr.profile_dump(),
+    }
+end
+
 local function runLoop(reason, level)
     baseL = hookmgr.gethost()
     --TODO: 只在lua栈帧时需要text？
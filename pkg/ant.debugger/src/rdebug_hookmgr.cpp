@@ -1,13 +1,18 @@
 #include <bee/utility/dynarray.h>
 
+#include <algorithm>
 #include <chrono>
 #include <cstdint>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "compat/internal.h"
 #include "rdebug_debughost.h"
 #include "rdebug_eventfree.h"
 #include "rdebug_lua.h"
+#include "symbolize/symbolize.h"
 #include "thunk/thunk.h"
 #include "util/flatmap.h"
 
@@ -368,6 +373,131 @@ struct hookmgr {
     }
 #endif
 
+    //
+    // profile
+    //
+    // Sampling profiler, the count hook checks the clock and records the whole stack when the
+    // interval elapsed. Time spent in C functions is charged to the next sample in lua code.
+    // The count hook only runs PROFILE_COUNT apart while the sampler is started, otherwise it stays
+    // at UPDATE_COUNT, and update_hook keeps that cadence while sampling.
+    static constexpr int UPDATE_COUNT      = 0xfffff;
+    static constexpr int PROFILE_COUNT     = 1000;
+    static constexpr int PROFILE_MAX_DEPTH = 128;
+    int profile_mask     = 0;
+    int profile_ticks    = 0;
+    int profile_interval = 1000;  // us
+    std::chrono::steady_clock::time_point profile_last;
+    luadebug::flatmap<intptr_t, uint32_t> profile_frames;  // Proto* or lua_CFunction -> name
+    std::vector<std::string> profile_names;
+    std::unordered_map<std::string, uint64_t> profile_stacks;  // frame names from leaf to root -> samples
+
+    void profile_open(lua_State* hL, bool enable, int interval) {
+        profile_mask     = enable ? LUA_MASKCOUNT : 0;
+        profile_interval = std::max(interval, 1);
+        profile_last     = std::chrono::steady_clock::now();
+        profile_ticks    = 0;
+        updatehookmask(hL);
+    }
+    void count_hook(lua_State* hL) {
+        if (profile_mask) {
+            profile_hook(hL);
+            if (++profile_ticks < UPDATE_COUNT / PROFILE_COUNT) {
+                return;
+            }
+            profile_ticks = 0;
+        }
+        if (update_mask) {
+            update_hook(hL);
+        }
+    }
+    uint32_t profile_name(std::string&& name) {
+        uint32_t id = (uint32_t)profile_names.size();
+        profile_names.emplace_back(std::move(name));
+        return id;
+    }
+    uint32_t profile_frame(lua_State* hL, lua_Debug* ar) {
+        const void* key = lua_ci2proto(lua_debug2ci(hL, ar));
+        const bool isc  = key == nullptr;
+        if (isc) {
+            if (!lua_getinfo(hL, "f", ar)) {
+                return profile_name("?");
+            }
+            key = lua_tocfunction_pointer(hL, -1);
+            lua_pop(hL, 1);
+            if (!key) {
+                key = &profile_frames;
+            }
+        }
+        if (auto id = profile_frames.find(reinterpret_cast<intptr_t>(key))) {
+            return *id;
+        }
+        std::string name;
+        if (key == &profile_frames) {
+            name = "?";
+        }
+        else if (isc) {
+            auto info = luadebug::symbolize(key);
+            if (info.function_name) {
+                name = *info.function_name;
+            }
+            else {
+                char buf[32];
+                snprintf(buf, sizeof(buf), "%p", key);
+                name = buf;
+            }
+            if (info.module_name) {
+                name += " [" + *info.module_name + "]";
+            }
+        }
+        else {
+            lua_getinfo(hL, "Sn", ar);
+            name = ar->name ? ar->name : "?";
+            name += " (";
+            name += ar->short_src;
+            name += ":" + std::to_string(ar->linedefined) + ")";
+        }
+        // ';' is the separator of folded stacks
+        std::replace(name.begin(), name.end(), ';', ':');
+        uint32_t id = profile_name(std::move(name));
+        profile_frames.insert_or_assign(reinterpret_cast<intptr_t>(key), id);
+        return id;
+    }
+    void profile_hook(lua_State* hL) {
+        auto now = std::chrono::steady_clock::now();
+        if (now - profile_last < std::chrono::microseconds(profile_interval)) {
+            return;
+        }
+        profile_last = now;
+        std::string key;
+        lua_Debug ar;
+        for (int level = 0; level < PROFILE_MAX_DEPTH && lua_getstack(hL, level, &ar); ++level) {
+            uint32_t id = profile_frame(hL, &ar);
+            key.append((const char*)&id, sizeof(id));
+        }
+        ++profile_stacks[key];
+    }
+    // folded stacks, one line for each stack: root;...;leaf samples
+    std::string profile_dump() {
+        std::string r;
+        for (auto const& [key, samples] : profile_stacks) {
+            const uint32_t* ids = (const uint32_t*)key.data();
+            for (size_t i = key.size() / sizeof(uint32_t); i > 0; --i) {
+                r += profile_names[ids[i - 1]];
+                if (i > 1) {
+                    r += ';';
+                }
+            }
+            r += ' ';
+            r += std::to_string(samples);
+            r += '\n';
+        }
+        profile_stacks.clear();
+        return r;
+    }
+    void profile_freeobj(Proto* p) {
+        profile_frames.erase(reinterpret_cast<intptr_t>(p));
+    }
+
     //
     // common
     //
@@ -452,7 +582,7 @@ struct hookmgr {
 #endif
             return;
         case LUA_HOOKCOUNT:
-            update_hook(hL);
+            count_hook(hL);
             return;
 #if defined(LUA_HOOKEXCEPTION)
         case LUA_HOOKEXCEPTION:
@@ -490,9 +620,11 @@ struct hookmgr {
     void idle_hook(lua_State* hL, lua_Debug* ar) {
         switch (ar->event) {
         case LUA_HOOKRET:
-        case LUA_HOOKCOUNT:
             update_hook(hL);
             return;
+        case LUA_HOOKCOUNT:
+            count_hook(hL);
+            return;
 #if defined(LUA_HOOKEXCEPTION)
         case LUA_HOOKEXCEPTION:
             exception_hook(hL, ar);
@@ -524,14 +656,15 @@ struct hookmgr {
         if (!stepL || stepL == hL) {
             mask |= step_mask;
         }
+        const int count = profile_mask ? PROFILE_COUNT : 0;
         if (mask) {
-            sethook(hL, (lua_Hook)sc_full_hook->data, mask | exception_mask | thread_mask, 0);
+            sethook(hL, (lua_Hook)sc_full_hook->data, mask | exception_mask | thread_mask | profile_mask, count);
         }
         else if (update_mask) {
-            sethook(hL, (lua_Hook)sc_idle_hook->data, update_mask | exception_mask | thread_mask, 0xfffff);
+            sethook(hL, (lua_Hook)sc_idle_hook->data, update_mask | exception_mask | thread_mask | profile_mask, profile_mask ? count : UPDATE_COUNT);
         }
-        else if (exception_mask | thread_mask) {
-            sethook(hL, (lua_Hook)sc_idle_hook->data, exception_mask | thread_mask, 0);
+        else if (exception_mask | thread_mask | profile_mask) {
+            sethook(hL, (lua_Hook)sc_idle_hook->data, exception_mask | thread_mask | profile_mask, count);
         }
         else {
             sethook(hL, 0, 0, 0);
@@ -594,6 +727,7 @@ struct hookmgr {
     }
     static void freeobj_callback(void* mgr, void* ptr) {
         ((hookmgr*)mgr)->break_freeobj((Proto*)ptr);
+        ((hookmgr*)mgr)->profile_freeobj((Proto*)ptr);
     }
 #if !defined(LUADEBUG_DISABLE_THUNK)
     static void full_hook_callback(hookmgr* mgr, lua_State* hL, lua_Debug* ar) {
@@ -697,6 +831,17 @@ static int update_open(luadbg_State* L) {
     return 0;
 }
 
+static int profile_open(luadbg_State* L) {
+    hookmgr::get_self(L)->profile_open(luadebug::debughost::get(L), luadbg_toboolean(L, 1), (int)luadbgL_optinteger(L, 2, 1000));
+    return 0;
+}
+
+static int profile_dump(luadbg_State* L) {
+    auto r = hookmgr::get_self(L)->profile_dump();
+    luadbg_pushlstring(L, r.data(), r.size());
+    return 1;
+}
+
 #if defined(LUA_HOOKEXCEPTION)
 static int exception_open(luadbg_State* L) {
     hookmgr::get_self(L)->exception_open(luadebug::debughost::get(L), luadbg_toboolean(L, 1));
@@ -755,6 +900,8 @@ int luaopen_luadebug_hookmgr(luadbg_State* L) {
         { "step_over", step_over },
         { "step_cancel", step_cancel },
         { "update_open", update_open },
+        { "profile_open", profile_open },
+        { "profile_dump", profile_dump },
 #if defined(LUA_HOOKEXCEPTION)
         { "exception_open", exception_open },
 #endif
@@ -155,6 +155,7 @@ end
 function efk_sys:init()
     init_efk_queue()
     init_efk()
+    RC.set_efk_transforms(EFKCTX:transforms())
     ServiceEfkUpdate = ltask.spawn("ant.efk|update", EFKCTX:handle(), EFKCTX.render)
     for _, n in ipairs{"play", "is_alive", "stop", "set_time", "pause", "set_speed", "set_visible", "set_texture"} do
         local f = EFKCTX[n] or error(("Invalid function name:%s"):format(n))
@@ -203,6 +204,7 @@ end
 
 function efk_sys:exit()
     ltask.call(ServiceEfkUpdate, "quit")
+    RC.set_efk_transforms()
     shutdown()
 end
 
@@ -359,16 +361,8 @@ local function efk_render()
     ltask.send(ServiceEfkUpdate, "update")
 end
 
-local function update_hitch_efks()
-    local num = w:count "efk_hitch"
-    if num > 0 then
-        local data = w:swap("efk_hitch", "efk_hitch_backbuffer")
-        EFKCTX:update_transforms(num, data)
-    end
-end
-
+-- the transforms of the hitch efks are published by render.cache, the efk service applies them before update
 function efk_sys:render_preprocess()
-    update_hitch_efks()
     efk_render()
 end
 
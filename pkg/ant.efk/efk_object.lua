@@ -14,16 +14,3 @@ function eo.init()
         worldmat    = mu.NULL,
     }
 end
-
-local function DEFINE_efk_hitch(name)
-    local eh = ecs.component(name)
-    function eh.init()
-        return {
-            handle = 0,
-            hitchmat = mu.NULL,
-        }
-    end
-end
-
-DEFINE_efk_hitch "efk_hitch"
-DEFINE_efk_hitch "efk_hitch_backbuffer"
@@ -1,6 +1,8 @@
 #include <lua.hpp>
 #include <cassert>
 #include <cstring>
+#include <algorithm>
+#include <thread>
 
 #include <bgfx/c99/bgfx.h>
 
@@ -9,6 +11,7 @@
 #include <Effekseer/Effekseer.DefaultEffectLoader.h>
 
 #include "fastio.h"
+#include "../ant.render/render/efk_transforms.h"
 extern "C" {
 	#include <textureman.h>
 }
@@ -39,13 +42,17 @@ public:
 	efk_ctx() = default;
 	~efk_ctx() = default;
 public:
-	bool init(EffekseerRendererBGFX::InitArgs &efkargs) {
+	bool init(EffekseerRendererBGFX::InitArgs &efkargs, uint32_t update_threads) {
 		renderer = EffekseerRendererBGFX::CreateRenderer(&efkargs);
 		if (renderer == nullptr){
 			return false;
 		}
 		manager = Effekseer::Manager::Create(efkargs.squareMaxCount);
 		manager->GetSetting()->SetCoordinateSystem(Effekseer::CoordinateSystem::LH);
+		// effect instances are updated by the worker threads, Update() waits them (see update())
+		if (update_threads > 0){
+			manager->LaunchWorkerThreads(update_threads);
+		}
 
 		manager->SetModelRenderer(CreateModelRenderer(renderer, &efkargs));
 		manager->SetSpriteRenderer(renderer->CreateSpriteRenderer());
@@ -75,7 +82,18 @@ public:
 		// for (int	i =	0; i < iterations; i++)	{
 		//	   ctx->manager->Update(advance);
 		// }
-		manager->Update();
+		Effekseer::Manager::UpdateParameter param;
+		param.SyncUpdate = true;
+		manager->Update(param);
+	}
+
+	// apply the hitch transforms published by render.cache, see efk_transforms.h
+	void update_hitch_transforms() {
+		for (const auto &t : transforms.acquire()) {
+			if (slot_valid(t.handle)) {
+				slot_update(effects[t.handle], *reinterpret_cast<const Effekseer::Matrix44*>(t.mat));
+			}
+		}
 	}
 
 	void render() {
@@ -285,6 +303,8 @@ public:
 
 	std::vector<efk_slot> 				effects;
 	int	freelist = -1;
+
+	efk_transforms						transforms;
 };
 
 static efk_ctx*
@@ -361,6 +381,7 @@ lefkctx_setstate(lua_State *L) {
 static int
 lefkctx_render(lua_State *L){
 	auto ctx = EC(L, 1);
+	ctx->update_hitch_transforms();
 	ctx->update();
 	ctx->render();
 	ctx->reset();
@@ -428,30 +449,9 @@ lefkctx_update_transform(lua_State *L) {
 }
 
 static int
-lefkctx_update_transforms(lua_State *L){
-	auto ctx = EC(L);
-	const uint32_t num = (uint32_t)luaL_checkinteger(L, 2);
-	constexpr uint32_t MAX_EFK_HITCH = 256;
-	if (num	== 0 || num >= MAX_EFK_HITCH){
-		return luaL_error(L, "Max hitch transform should lower than %d, %d provided", MAX_EFK_HITCH, num);
-	}
-	struct transform_data {
-		uint32_t handle;
-		float* data;
-	};
-
-	const transform_data* td = (const transform_data*)lua_touserdata(L, 3);
-	if (td == nullptr){
-		return luaL_error(L, "Invalid transform data");
-	}
-
-	for	(uint32_t ii=0; ii<num; ++ii){
-		const auto& t = td[ii];
-		ctx->slot_valid(L, t.handle);
-		ctx->slot_update(ctx->effects[t.handle], *reinterpret_cast<const Effekseer::Matrix44*>(t.data));
-	}
-
-	return 0;
+lefkctx_transforms(lua_State *L){
+	lua_pushlightuserdata(L, &EC(L)->transforms);
+	return 1;
 }
 
 static int
@@ -612,6 +612,15 @@ lefk_startup(lua_State *L){
 	EffekseerRendererBGFX::InitArgs	efkArgs;
 	fetch_efk_args(L, 2, efkArgs);
 
+	// update_threads: worker threads of Effekseer update, 0 to update in the efk service thread
+	uint32_t update_threads;
+	if (lua_getfield(L, 1, "update_threads") == LUA_TNUMBER){
+		update_threads = (uint32_t)lua_tointeger(L, -1);
+	} else {
+		update_threads = std::min(4u, std::thread::hardware_concurrency() / 4);
+	}
+	lua_pop(L, 1);
+
 	auto ctx = (efk_ctx*)lua_newuserdatauv(L, sizeof(efk_ctx), 0);
 	new	(ctx)efk_ctx();
 	if (luaL_newmetatable(L, "EFK_CTX")){
@@ -632,7 +641,7 @@ lefk_startup(lua_State *L){
 			{"set_speed",			lefkctx_set_speed},
 			{"set_texture",			lefkctx_set_texture},
 			{"update_transform",	lefkctx_update_transform},
-			{"update_transforms",	lefkctx_update_transforms},
+			{"transforms",			lefkctx_transforms},
 			{"is_alive",			lefkctx_is_alive},
 			{"set_light_direction",	lefkctx_set_light_direction},
 			{"set_light_color",		lefkctx_set_light_color},
@@ -646,7 +655,7 @@ lefk_startup(lua_State *L){
 
 	new	(ctx) efk_ctx();
 
-	if (!ctx->init(efkArgs)){
+	if (!ctx->init(efkArgs, update_threads)){
 		return luaL_error(L, "create efk_ctx init failed");
 	}
 	return 1;
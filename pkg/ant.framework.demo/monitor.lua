@@ -113,7 +113,8 @@ local function num2vec(v)
 	end
 end
 
-local function flush_material(w)
+local function flush_material(world)
+	local w = world.w
 	local dirty
 	local cache = {}
 	for list, obj in pairs(material_changes) do
@@ -142,12 +143,14 @@ local function flush_material(w)
 	end
 	w:clear "entity2d"
 	material_changes = {}
+	-- the visible tags are written directly (see irender.set_visible), the kept draw lists must be rebuilt
+	world:clibs "render.cache".invalidate()
 end
 
 local function flush(world)
 	local w = world.w
 	flush_scene(w)
-	flush_material(w)
+	flush_material(world)
 end
 
 return {
@@ -44,13 +44,16 @@ function hw.init(args)
 	local LOG_WARN  <const> = 3
 	local LOG_TRACE <const> = 4
 
+	local renderer = check_renderer(args.renderer)
 	init_args = {
 		nwh      = args.nwh,
 		ndt      = args.ndt,
 		context  = args.context,
 		width    = args.width,
 		height   = args.height,
-		renderer = check_renderer(args.renderer),
+		renderer = renderer,
+		-- NOOP renderer accepts any shader binary, use the shaders of the default renderer
+		shader_renderer = renderer == "NOOP" and default_renderer[platform.os]:lower() or nil,
 		loglevel = args.loglevel or LOG_WARN,
 		reset    = args.reset or cvt_flags {
 			s = true,
@@ -152,9 +152,16 @@ local function profile_print()
         add_text(format_text("draw|blit|compute|gpuLatency", (" | %d %d %d %dms"):format(bgfx_stat.numDraw, bgfx_stat.numBlit, bgfx_stat.numCompute, bgfx_stat.maxGpuLatency)))
         local rc = require "render.cache"
         local ss = rc.submit_stat()
-        if next(ss) then
-            add_text(format_text("simple|hitch|efk", (" | %d %d %d"):format(ss.simple_submit, ss.hitch_submit, ss.efk_hitch_submit)))
-            add_text(format_text("hitch_count", (" | %d"):format(ss.hitch_count)))
+        if ss.frame then
+            add_text(("--- queue (avg/peak of %d frames)"):format(ss.window))
+            add_text(format_text("queue", " | obj cull submit inst trans(hit) hitch"))
+            for i = 1, #ss do
+                local q = ss[i]
+                local avg, peak = q.avg, q.peak
+                add_text(format_text(q.name, (" | %.0f/%d %.0f/%d %.0f/%d %.0f %.0f(%.0f) %.0f"):format(
+                    avg.collected, peak.collected, avg.culled, peak.culled, avg.submitted, peak.submitted,
+                    avg.instances, avg.transforms, avg.transform_hits, avg.hitch_expanded)))
+            end
         end
     end
     for i = 1, profile_printtext.n do
@@ -416,10 +423,10 @@ local function init_args(args)
     args.pushlog_context = bgfx_context
 end
 
-local function init_resource()
+local function init_resource(args)
     local vfs = require "vfs"
     local caps = bgfx.get_caps()
-    local renderer = caps.rendererType:lower()
+    local renderer = args.shader_renderer or caps.rendererType:lower()
     vfs.resource_setting(("%s-%s"):format(platform.os, renderer))
 end
 
@@ -430,7 +437,7 @@ function S.init(args)
     else
         init_args(args)
         bgfx.init(args)
-        init_resource()
+        init_resource(args)
         fontmanager = require "font.fontmanager"
         initialized = true
         ltask.fork(mainloop)
@@ -26,6 +26,10 @@ end
 
 add_view "csm_fb"
 add_view "skinning"
+add_view "csm1_static"
+add_view "csm2_static"
+add_view "csm3_static"
+add_view "csm4_static"
 add_view "csm1"
 add_view "csm2"
 add_view "csm3"
@@ -64,14 +68,14 @@ add_view "taa"
 add_view "taa_copy"
 add_view "taa_present"
 add_view "fxaa"
-add_view "fsr_resolve"	--35
+add_view "fsr_resolve"	--41
 add_view "fsr_easu"
 add_view "fsr_rcas"
 add_view "swapchain"
 --end postprocess
 
 add_view "pickup"	
-add_view "pickup_blit"	--40
+add_view "pickup_blit"	--46
 add_view "mem_texture"
 add_view "uiruntime"
 add_view "uicanvas"
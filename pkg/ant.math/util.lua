@@ -549,11 +549,13 @@ function util.iter_m3darary(m3darray)
 	end, m3darray, 0
 end
 
+-- mark before unmark, so the new id never reuses the old one
 function util.M3D_mark(old, new)
+	local r = math3d.mark(new)
 	if old then
 		math3d.unmark(old)
 	end
-	return math3d.mark(new)
+	return r
 end
 
 return util
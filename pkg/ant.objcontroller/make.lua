@@ -0,0 +1,15 @@
+local lm = require "luamake"
+
+lm:lua_src "objcontroller" {
+    confs = { "glm" },
+    includes = {
+        lm.AntDir .. "/3rd/math3d",
+        lm.AntDir .. "/3rd/luaecs",
+        lm.AntDir .. "/clibs/ecs",
+        lm.AntDir .. "/clibs/foundation",
+    },
+    sources = {
+        "pickup/raycast.cpp",
+    },
+    objdeps = "compile_ecs",
+}
@@ -2,8 +2,10 @@ local ecs = ...
 local world = ecs.world
 local w = world.w
 
-local mu 		= import_package "ant.math".util
+local mathpkg	= import_package "ant.math"
+local mu, mc	= mathpkg.util, mathpkg.constant
 local R         = world:clibs "render.render_material"
+local RC		= world:clibs "objcontroller.raycast"
 local math3d	= require "math3d"
 local bgfx 		= require "bgfx"
 local icamera	= ecs.require "ant.camera|camera"
@@ -25,6 +27,7 @@ local hwi		= import_package "ant.hwi"
 local queuemgr  = ecs.require "ant.render|queue_mgr"
 
 local INV_Z<const> = setting:get "graphic/inv_z"
+local USE_RAYCAST<const> = setting:get "graphic/pickup/raycast"
 
 local function packeid_as_rgba(eid)
     return {(eid & 0x000000ff) / 0xff,
@@ -44,7 +47,8 @@ local function cvt_clickpt(pt, ratio)
 	}
 end
 
-local function update_camera(pu_camera_ref, clickpt)
+-- world space ray of the click point from the main camera, eye is on the near plane and at is on the far plane
+local function main_camera_ray(clickpt)
 	local mq = w:first "main_queue camera_ref:in render_target:in"
 	local main_vr = mq.render_target.view_rect
 
@@ -59,8 +63,11 @@ local function update_camera(pu_camera_ref, clickpt)
 	local maincamera = mqc.camera
 	local vp = maincamera.viewprojmat
 	local ivp = math3d.inverse(vp)
-	eye = math3d.transformH(ivp, eye, 1)
-	at = math3d.transformH(ivp, at, 1)
+	return math3d.transformH(ivp, eye, 1), math3d.transformH(ivp, at, 1)
+end
+
+local function update_camera(pu_camera_ref, clickpt)
+	local eye, at = main_camera_ray(clickpt)
 
 	local pqc<close> = world:entity(pu_camera_ref, "camera:in camera_changed?out")
 	pqc.camera_changed = true
@@ -350,8 +357,86 @@ function pickup_sys:entity_ready()
 	end
 end
 
+-- {bvh, worldmat, scene_aabb} triples for RC.intersect, bvh is false for the objects only the gpu pickup can resolve
+local OBJECTS = {}
+local OBJECT_EIDS = {}
+
+local function add_object(n, eid, bvh, worldmat, aabb)
+	local i = n * 3
+	OBJECTS[i+1], OBJECTS[i+2], OBJECTS[i+3] = bvh, worldmat, aabb
+	OBJECT_EIDS[n+1] = eid
+	return n + 1
+end
+
+local function clear_objects()
+	for i = #OBJECTS, 1, -1 do
+		OBJECTS[i] = nil
+	end
+	for i = #OBJECT_EIDS, 1, -1 do
+		OBJECT_EIDS[i] = nil
+	end
+end
+
+-- RC.intersect returns the index of the hit object, read its eid before the arrays are cleared
+local function take_hit_eid(idx)
+	local eid = idx and OBJECT_EIDS[idx]
+	clear_objects()
+	return eid
+end
+
 local ipu = {}
+
+-- Pick the nearest triangle under the click point with cpu, the result is available in this frame.
+-- return: nil when nothing is hit, false when the gpu pickup is needed (skinned, draw_indirect or hitch objects may be hit),
+-- or {eid, t, position, triangle, u, v}, triangle is 0-based index of lod0, u and v are barycentric coordinates
+function ipu.raycast(x, y)
+	local eye, at = main_camera_ray {x, y}
+	local dir = math3d.sub(at, eye)
+
+	local n = 0
+	for e in w:select "render_object_visible render_object:in bounding:in scene:in mesh_result:in eid:in draw_indirect?in" do
+		local aabb = e.bounding.scene_aabb
+		if aabb ~= mc.NULL and ivm.check_by_idx(e.render_object.visible_idx, "pickup_queue") then
+			local bvh = (not e.draw_indirect) and e.mesh_result.bvh or false
+			n = add_object(n, e.eid, bvh, e.scene.worldmat, aabb)
+		end
+	end
+	for e in w:select "hitch_visible bounding:in eid:in" do
+		local aabb = e.bounding.scene_aabb
+		if aabb ~= mc.NULL then
+			n = add_object(n, e.eid, false, mc.IDENTITY_MAT, aabb)
+		end
+	end
+
+	local idx, t, triangle, u, v = RC.intersect(eye, dir, OBJECTS)
+	local eid = take_hit_eid(idx)
+	if not idx then
+		return idx
+	end
+	return {
+		eid		= eid,
+		t		= t,
+		position= math3d.muladd(dir, t, eye),
+		triangle= triangle,
+		u		= u,
+		v		= v,
+	}
+end
+
 function ipu.pick(x, y, cb)
+	if USE_RAYCAST then
+		local hit = ipu.raycast(x, y)
+		if hit ~= false then
+			local eid = hit and hit.eid
+			if eid then
+				log.info("pick entity id: ", eid)
+			else
+				log.info("not found any eid")
+			end
+			world:pub {"pickup", eid, x, y, hit}
+			return
+		end
+	end
 	open_pickup(x, y, cb)
 end
 return ipu
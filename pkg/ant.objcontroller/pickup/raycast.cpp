@@ -0,0 +1,397 @@
+#include "ecs/world.h"
+
+extern "C"{
+	#include "math3d.h"
+	#include "math3dfunc.h"
+	#include "memfile.h"
+}
+
+#include "lua.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <vector>
+
+// Triangle BVH of a mesh for cpu picking, built from the meshbin data when it is loaded (see ant.asset/ext_meshbin.lua),
+// so a pick is answered in the same frame instead of waiting for the gpu id buffer readback.
+// Positions are kept in object space, the ray is moved into object space with the inverse world matrix.
+
+static constexpr uint32_t LEAF_SIZE = 4;
+static constexpr int MAX_DEPTH = 64;
+
+struct bvh_node {
+	glm::vec3	minv;
+	glm::vec3	maxv;
+	uint32_t	first;		// first triangle of a leaf, or the left child (right child is first+1)
+	uint32_t	count;		// 0 for an inner node
+};
+
+struct mesh_bvh {
+	std::vector<glm::vec3>	positions;
+	std::vector<uint32_t>	indices;	// 3 per triangle, reordered by the bvh
+	std::vector<uint32_t>	prims;		// original triangle index of the reordered triangles
+	std::vector<bvh_node>	nodes;
+};
+
+struct ray {
+	glm::vec3	o;
+	glm::vec3	d;
+	glm::vec3	invd;
+};
+
+struct hit {
+	float		t = FLT_MAX;
+	uint32_t	prim = 0;
+	float		u = 0;
+	float		v = 0;
+};
+
+static inline glm::vec3
+triangle_centroid(const mesh_bvh &b, uint32_t tri) {
+	const uint32_t *i = &b.indices[tri * 3];
+	return (b.positions[i[0]] + b.positions[i[1]] + b.positions[i[2]]) * (1.f / 3.f);
+}
+
+static void
+build_node(mesh_bvh &b, std::vector<glm::vec3> &centroids, std::vector<uint32_t> &order, uint32_t nodeidx, uint32_t first, uint32_t count) {
+	glm::vec3 minv(FLT_MAX), maxv(-FLT_MAX);
+	glm::vec3 cminv(FLT_MAX), cmaxv(-FLT_MAX);
+	for (uint32_t i = first; i < first + count; ++i) {
+		const uint32_t *idx = &b.indices[order[i] * 3];
+		for (int j = 0; j < 3; ++j) {
+			minv = glm::min(minv, b.positions[idx[j]]);
+			maxv = glm::max(maxv, b.positions[idx[j]]);
+		}
+		cminv = glm::min(cminv, centroids[order[i]]);
+		cmaxv = glm::max(cmaxv, centroids[order[i]]);
+	}
+	b.nodes[nodeidx].minv = minv;
+	b.nodes[nodeidx].maxv = maxv;
+
+	const glm::vec3 extent = cmaxv - cminv;
+	const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	if (count <= LEAF_SIZE || extent[axis] <= 0.f) {
+		b.nodes[nodeidx].first = first;
+		b.nodes[nodeidx].count = count;
+		return;
+	}
+
+	// median split on the longest centroid axis, the tree is balanced so the depth is bounded by log2(n)
+	const uint32_t half = count / 2;
+	std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count, [&](uint32_t l, uint32_t r) {
+		return centroids[l][axis] < centroids[r][axis];
+	});
+
+	const uint32_t left = (uint32_t)b.nodes.size();
+	b.nodes.resize(left + 2);
+	b.nodes[nodeidx].first = left;
+	b.nodes[nodeidx].count = 0;
+	build_node(b, centroids, order, left, first, half);
+	build_node(b, centroids, order, left + 1, first + half, count - half);
+}
+
+static void
+build(mesh_bvh &b) {
+	const uint32_t num = (uint32_t)(b.indices.size() / 3);
+	if (num == 0)
+		return;
+	std::vector<glm::vec3> centroids(num);
+	std::vector<uint32_t> order(num);
+	for (uint32_t i = 0; i < num; ++i) {
+		centroids[i] = triangle_centroid(b, i);
+		order[i] = i;
+	}
+	b.nodes.reserve(num * 2 / LEAF_SIZE + 1);
+	b.nodes.resize(1);
+	build_node(b, centroids, order, 0, 0, num);
+
+	std::vector<uint32_t> indices(b.indices.size());
+	for (uint32_t i = 0; i < num; ++i) {
+		memcpy(&indices[i * 3], &b.indices[order[i] * 3], sizeof(uint32_t) * 3);
+	}
+	b.indices.swap(indices);
+	b.prims.swap(order);
+}
+
+// slab test, return the entry distance or FLT_MAX
+static inline float
+ray_aabb(const ray &r, const glm::vec3 &minv, const glm::vec3 &maxv, float tmax) {
+	const glm::vec3 t0 = (minv - r.o) * r.invd;
+	const glm::vec3 t1 = (maxv - r.o) * r.invd;
+	const glm::vec3 tmin = glm::min(t0, t1);
+	const glm::vec3 tfar = glm::max(t0, t1);
+	const float tnear = std::max(std::max(tmin.x, tmin.y), std::max(tmin.z, 0.f));
+	const float tend = std::min(std::min(tfar.x, tfar.y), std::min(tfar.z, tmax));
+	return tnear <= tend ? tnear : FLT_MAX;
+}
+
+// Moller-Trumbore, both faces are hit
+static inline bool
+ray_triangle(const ray &r, const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, hit &h) {
+	const glm::vec3 e1 = v1 - v0;
+	const glm::vec3 e2 = v2 - v0;
+	const glm::vec3 p = glm::cross(r.d, e2);
+	const float det = glm::dot(e1, p);
+	if (std::fabs(det) < 1e-12f)
+		return false;
+	const float invdet = 1.f / det;
+	const glm::vec3 s = r.o - v0;
+	const float u = glm::dot(s, p) * invdet;
+	if (u < 0.f || u > 1.f)
+		return false;
+	const glm::vec3 q = glm::cross(s, e1);
+	const float v = glm::dot(r.d, q) * invdet;
+	if (v < 0.f || u + v > 1.f)
+		return false;
+	const float t = glm::dot(e2, q) * invdet;
+	if (t < 0.f || t >= h.t)
+		return false;
+	h.t = t;
+	h.u = u;
+	h.v = v;
+	return true;
+}
+
+static bool
+intersect(const mesh_bvh &b, const ray &r, hit &h) {
+	if (b.nodes.empty())
+		return false;
+	bool found = false;
+	uint32_t stack[MAX_DEPTH];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const bvh_node &n = b.nodes[stack[--top]];
+		if (ray_aabb(r, n.minv, n.maxv, h.t) == FLT_MAX)
+			continue;
+		if (n.count > 0) {
+			for (uint32_t i = n.first; i < n.first + n.count; ++i) {
+				const uint32_t *idx = &b.indices[i * 3];
+				if (ray_triangle(r, b.positions[idx[0]], b.positions[idx[1]], b.positions[idx[2]], h)) {
+					h.prim = b.prims[i];
+					found = true;
+				}
+			}
+		} else {
+			// visit the nearer child first, so the farther one is more likely to be rejected by h.t
+			const bvh_node &l = b.nodes[n.first];
+			const bvh_node &rn = b.nodes[n.first + 1];
+			const float tl = ray_aabb(r, l.minv, l.maxv, h.t);
+			const float tr = ray_aabb(r, rn.minv, rn.maxv, h.t);
+			if (tl <= tr) {
+				if (tr != FLT_MAX) stack[top++] = n.first + 1;
+				if (tl != FLT_MAX) stack[top++] = n.first;
+			} else {
+				if (tl != FLT_MAX) stack[top++] = n.first;
+				stack[top++] = n.first + 1;
+			}
+		}
+	}
+	return found;
+}
+
+static inline ray
+make_ray(const glm::vec3 &o, const glm::vec3 &d) {
+	ray r;
+	r.o = o;
+	r.d = d;
+	for (int i = 0; i < 3; ++i) {
+		r.invd[i] = d[i] != 0.f ? 1.f / d[i] : (std::signbit(d[i]) ? -FLT_MAX : FLT_MAX);
+	}
+	return r;
+}
+
+// string or memory_file (lightuserdata), with 1-based offset and size as meshbin 'memory' field
+static const char*
+check_data(lua_State *L, int idx, size_t offset, size_t size) {
+	size_t sz;
+	const char* data;
+	switch (lua_type(L, idx)) {
+	case LUA_TSTRING:
+		data = lua_tolstring(L, idx, &sz);
+		break;
+	case LUA_TLIGHTUSERDATA: {
+		auto mf = (struct memory_file*)lua_touserdata(L, idx);
+		data = mf->data;
+		sz = mf->sz;
+		break;
+	}
+	default:
+		luaL_typeerror(L, idx, "string or memory_file");
+		return nullptr;
+	}
+	if (offset < 1 || offset - 1 + size > sz)
+		luaL_error(L, "Invalid data range: %d, %d", (int)offset, (int)size);
+	return data + offset - 1;
+}
+
+static inline mesh_bvh*
+to_bvh(lua_State *L, int idx) {
+	return (mesh_bvh*)luaL_checkudata(L, idx, "ANT_RAYCAST_BVH");
+}
+
+static int
+lbvh_gc(lua_State *L) {
+	to_bvh(L, 1)->~mesh_bvh();
+	return 0;
+}
+
+// triangle number, node number
+static int
+lbvh_info(lua_State *L) {
+	auto b = to_bvh(L, 1);
+	lua_pushinteger(L, (lua_Integer)b->prims.size());
+	lua_pushinteger(L, (lua_Integer)b->nodes.size());
+	return 2;
+}
+
+// vbdata, vboffset, vbnum, stride, position offset [, ibdata, iboffset, ibnum, index32]
+// position must be float3, without index buffer the vertices are a triangle list
+static int
+lmesh(lua_State *L) {
+	const size_t vboffset	= (size_t)luaL_checkinteger(L, 2);
+	const uint32_t vnum		= (uint32_t)luaL_checkinteger(L, 3);
+	const uint32_t stride	= (uint32_t)luaL_checkinteger(L, 4);
+	const uint32_t posoffset= (uint32_t)luaL_checkinteger(L, 5);
+	luaL_argcheck(L, posoffset + sizeof(float) * 3 <= stride, 5, "invalid position offset");
+	const char* vb = check_data(L, 1, vboffset, (size_t)vnum * stride);
+
+	auto b = (mesh_bvh*)lua_newuserdatauv(L, sizeof(mesh_bvh), 0);
+	new (b) mesh_bvh;
+	if (luaL_newmetatable(L, "ANT_RAYCAST_BVH")) {
+		luaL_Reg l[] = {
+			{ "info",	lbvh_info },
+			{ nullptr,	nullptr },
+		};
+		luaL_newlib(L, l);
+		lua_setfield(L, -2, "__index");
+		lua_pushcfunction(L, lbvh_gc);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+
+	b->positions.resize(vnum);
+	for (uint32_t i = 0; i < vnum; ++i) {
+		memcpy(&b->positions[i], vb + (size_t)i * stride + posoffset, sizeof(float) * 3);
+	}
+
+	if (lua_isnoneornil(L, 6)) {
+		b->indices.resize(vnum / 3 * 3);
+		for (uint32_t i = 0; i < b->indices.size(); ++i) {
+			b->indices[i] = i;
+		}
+	} else {
+		const size_t iboffset	= (size_t)luaL_checkinteger(L, 7);
+		const uint32_t inum		= (uint32_t)luaL_checkinteger(L, 8) / 3 * 3;
+		const bool index32		= lua_toboolean(L, 9);
+		const char* ib = check_data(L, 6, iboffset, (size_t)inum * (index32 ? 4 : 2));
+		b->indices.resize(inum);
+		for (uint32_t i = 0; i < inum; ++i) {
+			uint32_t v;
+			if (index32) {
+				memcpy(&v, ib + i * 4, 4);
+			} else {
+				uint16_t v16;
+				memcpy(&v16, ib + i * 2, 2);
+				v = v16;
+			}
+			if (v >= vnum)
+				return luaL_error(L, "Invalid index %d, vertex number: %d", (int)v, (int)vnum);
+			b->indices[i] = v;
+		}
+	}
+	build(*b);
+	return 1;
+}
+
+static inline const float*
+check_value(lua_State *L, struct ecs_world *w, int idx, const char* what) {
+	const math_t m = math3d_from_lua_id(L, w->math3d, idx);
+	if (!math_valid(w->math3d->M, m)) {
+		luaL_error(L, "Invalid %s", what);
+	}
+	return math_value(w->math3d->M, m);
+}
+
+struct candidate {
+	float		tnear;
+	int			index;
+};
+
+// origin, dir, objects
+// objects is a flat array of {bvh, worldmat, scene_aabb} triples, bvh is false for the objects can't be picked by cpu.
+// return: object index (1-based triple index), t, triangle index (0-based), barycentric u, v
+// return nothing when nothing is hit, return false when an object without bvh may be nearer than the nearest hit
+static int
+lintersect(lua_State *L) {
+	auto w = getworld(L);
+	const float *o = check_value(L, w, 1, "ray origin");
+	const float *d = check_value(L, w, 2, "ray direction");
+	luaL_checktype(L, 3, LUA_TTABLE);
+	const int n = (int)lua_rawlen(L, 3) / 3;
+
+	const ray wr = make_ray(glm::vec3(o[0], o[1], o[2]), glm::vec3(d[0], d[1], d[2]));
+	std::vector<candidate> candidates;
+	candidates.reserve(n);
+	for (int i = 0; i < n; ++i) {
+		lua_rawgeti(L, 3, i * 3 + 3);
+		const float *aabb = check_value(L, w, -1, "scene aabb");
+		lua_pop(L, 1);
+		const float tnear = ray_aabb(wr, glm::vec3(aabb[0], aabb[1], aabb[2]), glm::vec3(aabb[4], aabb[5], aabb[6]), FLT_MAX);
+		if (tnear != FLT_MAX)
+			candidates.push_back({tnear, i});
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const candidate &l, const candidate &r) {
+		return l.tnear < r.tnear;
+	});
+
+	hit best;
+	int bestidx = -1;
+	for (const auto &c : candidates) {
+		if (c.tnear >= best.t)
+			break;
+		lua_rawgeti(L, 3, c.index * 3 + 1);
+		if (!lua_toboolean(L, -1)) {
+			lua_pushboolean(L, 0);
+			return 1;
+		}
+		const mesh_bvh *b = to_bvh(L, -1);
+		lua_pop(L, 1);
+		lua_rawgeti(L, 3, c.index * 3 + 2);
+		const glm::mat4 inv = glm::inverse(*(const glm::mat4*)check_value(L, w, -1, "world matrix"));
+		lua_pop(L, 1);
+
+		// affine transform keeps the ray parameter, t in object space is the same as in world space
+		const ray r = make_ray(glm::vec3(inv * glm::vec4(wr.o, 1.f)), glm::vec3(inv * glm::vec4(wr.d, 0.f)));
+		if (intersect(*b, r, best))
+			bestidx = c.index;
+	}
+	if (bestidx < 0)
+		return 0;
+	lua_pushinteger(L, bestidx + 1);
+	lua_pushnumber(L, best.t);
+	lua_pushinteger(L, best.prim);
+	lua_pushnumber(L, best.u);
+	lua_pushnumber(L, best.v);
+	return 5;
+}
+
+extern "C" int
+luaopen_objcontroller_raycast(lua_State *L) {
+	luaL_checkversion(L);
+	luaL_Reg l[] = {
+		{ "mesh",		lmesh },
+		{ "intersect",	lintersect },
+		{ nullptr,		nullptr },
+	};
+	luaL_newlibtable(L, l);
+	lua_pushnil(L);
+	luaL_setfuncs(L, l, 1);
+	return 1;
+}
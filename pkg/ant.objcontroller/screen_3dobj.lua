@@ -9,6 +9,7 @@ local irq = ecs.require "ant.render|renderqueue"
 local iom = ecs.require "ant.objcontroller|obj_motion"
 
 local math3d = require "math3d"
+local PACKED = world:clibs "scene.packed"
 
 local screen_3dobj_sys = ecs.system "screen_3dobj_system"
 
@@ -30,7 +31,7 @@ function screen_3dobj_sys:camera_usage()
         local ce <close> = world:entity(mq.camera_ref, "scene_changed?in camera:in")
         if ce.scene_changed then
             local camera = ce.camera
-            for e in w:select "screen_3dobj:in render_object:update eid:in scene:update" do
+            for e in w:select "screen_3dobj:in render_object:update eid:in scene:update bounding?in" do
                 local vp = camera.viewprojmat
                 local vr = irq.view_rect "main_queue"
     
@@ -41,8 +42,10 @@ function screen_3dobj_sys:camera_usage()
                 local scene = e.scene
                 assert(scene.parent == 0, "global_axes should not have any parent")
                 iom.set_position(e, posWS)
-                math3d.unmark(scene.worldmat)
-                scene.worldmat = math3d.marked_matrix(scene)
+                scene.worldmat = mu.M3D_mark(scene.worldmat, math3d.matrix(scene))
+                if e.bounding then
+                    PACKED.update_worldmat(e.bounding.slot, scene.worldmat)
+                end
                 e.render_object.worldmat = scene.worldmat
             end
         end
@@ -5,15 +5,19 @@ local w = world.w
 local bb_sys = ecs.system "billboard_system"
 
 local math3d = require "math3d"
+local mu = import_package "ant.math".util
+local PACKED = world:clibs "scene.packed"
 
 function bb_sys:camera_usage()
-    for e in w:select "billboard render_object:update scene:update" do
+    for e in w:select "billboard render_object:update scene:update bounding?in" do
         local mq = w:first("main_queue render_target:in camera_ref:in")
         local ce = world:entity(mq.camera_ref, "camera:in")
         local obj_world_nmat = math3d.set_index(math3d.inverse(ce.camera.viewmat), 4, math3d.index(e.scene.worldmat, 4))
 
-        math3d.unmark(e.scene.worldmat)
-        e.scene.worldmat=math3d.mark(obj_world_nmat)
+        e.scene.worldmat=mu.M3D_mark(e.scene.worldmat, obj_world_nmat)
+        if e.bounding then
+            PACKED.update_worldmat(e.bounding.slot, e.scene.worldmat)
+        end
 
         local ro=e.render_object
         ro.worldmat=e.scene.worldmat
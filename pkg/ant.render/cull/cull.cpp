@@ -8,6 +8,8 @@ extern "C"{
 }
 
 #include "../render/queue.h"
+#include "profiler.h"
+#include "scene_packed.h"
 
 #include <cassert>
 #include <cstring>
@@ -23,6 +25,7 @@ using cull_infos = std::unordered_map<uint64_t, tags>;
 struct cullqueue_info{
 	math_t	mid;
 	int 	Qidx;
+	float	planes[6][4];
 };
 
 struct cullqueue_cache {
@@ -48,6 +51,7 @@ struct cullqueue_cache {
 		struct cullqueue_info& q = cq[count++];
 		q.mid = mid;
 		q.Qidx = queue_alloc(w->Q);
+		memcpy(q.planes, math_value(w->math3d->M, mid), sizeof(q.planes));
 
 		return q;
 	}
@@ -70,6 +74,20 @@ struct cull_cached {
 	ecs::cached_context<component::hitch_visible, component::hitch, component::visible, component::bounding> hitch_obj;
 }; 
 
+// same as math3d_frustum_intersect_aabb() < 0: outside when the farthest corner along the plane normal is behind any plane
+static inline bool
+aabb_outside(const float planes[6][4], const packed_aabb &aabb) {
+	for (int i=0; i<6; ++i){
+		const float *p = planes[i];
+		const float x = p[0] > 0 ? aabb.maxv[0] : aabb.minv[0];
+		const float y = p[1] > 0 ? aabb.maxv[1] : aabb.minv[1];
+		const float z = p[2] > 0 ? aabb.maxv[2] : aabb.minv[2];
+		if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0)
+			return true;
+	}
+	return false;
+}
+
 template<typename ObjType>
 struct cull_operation{
 	template<typename EntityType>
@@ -78,9 +96,12 @@ struct cull_operation{
 
 		if (!math_isnull(b.scene_aabb)){
 			auto &o = e.template get<ObjType>();
+			const packed_aabb *aabb = (w->PACKED && b.slot >= 0) ? w->PACKED->aabb(b.slot, b.scene_aabb.idx) : nullptr;
 			for (uint8_t ii=0; ii<cc->count; ++ii){
 				struct cullqueue_info& q = cc->cq[ii];
-				const bool isculled = math3d_frustum_intersect_aabb(w->math3d->M, q.mid, b.scene_aabb) < 0;
+				const bool isculled = aabb ?
+					aabb_outside(q.planes, *aabb) :
+					math3d_frustum_intersect_aabb(w->math3d->M, q.mid, b.scene_aabb) < 0;
 				queue_set_by_index(w->Q, o.cull_idx, q.Qidx, isculled);
 			}
 		}
@@ -103,6 +124,7 @@ lexit(lua_State *L) {
 
 static int
 lcull(lua_State *L) {
+	PROFILE_ZONE("render.cull");
 	auto w = getworld(L);
 
 	cullqueue_cache cqc(w);
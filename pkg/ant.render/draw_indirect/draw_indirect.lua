@@ -3,12 +3,37 @@ local world = ecs.world
 local w     = world.w
 
 local bgfx  = require "bgfx"
+local math3d= require "math3d"
 local di_sys = ecs.system "draw_indirect_system"
 
 local layoutmgr = ecs.require "vertexlayout_mgr"
+local icompute  = ecs.require "ant.render|compute.compute"
+local assetmgr  = import_package "ant.asset"
+local hwi       = import_package "ant.hwi"
+local mc        = import_package "ant.math".constant
 
 local INVALID_HANDLE_VALUE<const> = 0xffffffff
 
+-- GPU cull for draw_indirect entities with 'draw_indirect_cull' policy:
+--  bounds(world space aabb of every draw) and draw args(di.handle, written by the producer compute shader) stay on gpu,
+--  all the cull queues are tested in one dispatch, the survived draws are compacted into one region per queue,
+--  and submitted by submit_indirect_count. The producer compute shader must dispatch before 'indirect_cull' view.
+-- same order as queue_type in render/render.cpp
+local CULL_QUEUES<const> = {
+    main_queue      = 0,
+    pre_depth_queue = 1,
+    csm1_queue      = 2,
+    csm2_queue      = 3,
+    csm3_queue      = 4,
+    csm4_queue      = 5,
+}
+local CULL_QUEUE_NUM<const> = 6
+local CULL_DISPATCH_SIZE<const> = 64
+local CULL_COUNT_ZERO<const> = {0, 0, 0, 0, 0, 0, 0, 0}
+
+local CULL_EID, CULL_CLEAR_EID
+local cull_viewid
+
 local function buffer_destroy(h)
     bgfx.destroy(h)
     return INVALID_HANDLE_VALUE
@@ -51,11 +76,151 @@ local function update_instance_buffer(e, instancememory, instancenum)
         iobj.draw_num = ib.num
     end
 
+    local dc = e.draw_indirect_cull
+    if dc then
+        dc.dirty = true
+    end
     return true
 end
 
+local function destroy_cull_buffers(dc, io)
+    dc.bounds_handle= buffer_destroy(dc.bounds_handle)
+    dc.idb          = buffer_destroy(dc.idb)
+    dc.count        = buffer_destroy(dc.count)
+    dc.capacity     = 0
+    io.cull_idb, io.cull_num, io.cull_mask = INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE, 0
+end
+
+local function check_create_cull_buffers(dc, ib, io)
+    if dc.capacity == ib.size then
+        return
+    end
+    if dc.capacity > 0 then
+        bgfx.destroy(dc.idb)
+        bgfx.destroy(dc.count)
+    end
+    dc.capacity = ib.size
+    dc.idb      = bgfx.create_indirect_buffer(ib.size * CULL_QUEUE_NUM)
+    dc.count    = bgfx.create_index_buffer(CULL_COUNT_ZERO, "drwc")
+    io.cull_idb, io.cull_num, io.cull_mask = dc.idb, dc.count, 0
+end
+
+local function update_cull_bounds(dc)
+    local bounds = dc.bounds
+    if dc.bounds_handle == INVALID_HANDLE_VALUE then
+        dc.bounds_handle = bgfx.create_dynamic_vertex_buffer(bounds, layoutmgr.get "t40".handle, "ra")
+    else
+        bgfx.update(dc.bounds_handle, 0, bounds)
+    end
+end
+
+local function cull_queues()
+    local mask, planes = 0, {}
+    for qe in w:select "visible queue_name:in cull_args:in" do
+        local q = CULL_QUEUES[qe.queue_name]
+        if q then
+            mask = mask | (1 << q)
+            local fp = qe.cull_args.frustum_planes
+            for i=1, 6 do
+                planes[q*6+i] = math3d.array_index(fp, i)
+            end
+        end
+    end
+    for i=1, CULL_QUEUE_NUM*6 do
+        planes[i] = planes[i] or mc.ZERO
+    end
+    return mask, math3d.array_vector(planes)
+end
+
+local function dispatch_cull(e, ce, cce, mask, planes)
+    local di, dc, io = e.draw_indirect, e.draw_indirect_cull, e.indirect_object
+    local num = io.draw_num
+    if num == 0 or di.handle == nil or dc.bounds == nil then
+        io.cull_mask = 0
+        return
+    end
+    check_create_cull_buffers(dc, di.instance_buffer, io)
+    if dc.bounds_dirty then
+        update_cull_bounds(dc)
+        dc.bounds_dirty = false
+    end
+
+    local clear = cce.dispatch
+    clear.material.b_cull_count = dc.count
+    icompute.dispatch(cull_viewid, clear)
+
+    local d = ce.dispatch
+    local m = d.material
+    m.b_draw_args       = di.handle
+    m.b_cull_bounds     = dc.bounds_handle
+    m.b_cull_draw_args  = dc.idb
+    m.b_cull_count      = dc.count
+    m.u_cull_params     = math3d.vector(num, mask, 0, 0)
+    m.u_cull_planes     = planes
+    d.size[1] = (num + CULL_DISPATCH_SIZE - 1) // CULL_DISPATCH_SIZE
+    icompute.dispatch(cull_viewid, d)
+
+    io.cull_mask = mask
+end
+
+local function create_cull_entity(material)
+    return world:create_entity {
+        policy = {
+            "ant.render|compute",
+        },
+        data = {
+            material    = material,
+            dispatch    = {
+                size    = {1, 1, 1},
+            },
+            on_ready    = function (e)
+                w:extend(e, "dispatch:in")
+                assetmgr.material_mark(e.dispatch.fx.prog)
+            end,
+        }
+    }
+end
+
+function di_sys:init()
+    if not bgfx.get_caps().supported.DRAW_INDIRECT_COUNT then
+        log.warn "DRAW_INDIRECT_COUNT is not supported, gpu cull for draw_indirect is disabled"
+        return
+    end
+    cull_viewid     = hwi.viewid_get "indirect_cull" or hwi.viewid_generate("indirect_cull", "skinning")
+    CULL_EID        = create_cull_entity "/pkg/ant.resources/materials/indirect/indirect_cull.material"
+    CULL_CLEAR_EID  = create_cull_entity "/pkg/ant.resources/materials/indirect/indirect_cull_clear.material"
+end
+
+function di_sys:render_preprocess()
+    if CULL_EID == nil then
+        return
+    end
+    local ce = world:entity(CULL_EID, "dispatch:in")
+    local cce = world:entity(CULL_CLEAR_EID, "dispatch:in")
+
+    -- dc.dirty is per buffer, so an instance buffer changed by any path is re-culled on the next frame
+    local recull = w:check "camera_changed" or w:check "scene_changed"
+    local mask, planes
+    for e in w:select "draw_indirect_cull:update draw_indirect:in indirect_object:update" do
+        local dc = e.draw_indirect_cull
+        if recull or dc.dirty then
+            if mask == nil then
+                mask, planes = cull_queues()
+            end
+            dispatch_cull(e, ce, cce, mask, planes)
+            dc.dirty = false
+        end
+    end
+end
+
 function di_sys.component_init()
-    for e in w:select "INIT draw_indirect:update indirect_object:update feature_set:in" do
+    for e in w:select "INIT draw_indirect_cull:update" do
+        local dc = e.draw_indirect_cull
+        dc.bounds_handle, dc.idb, dc.count = INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE
+        dc.capacity = 0
+        dc.dirty, dc.bounds_dirty = true, dc.bounds ~= nil
+    end
+    for e in w:select "INIT draw_indirect:update indirect_object:update feature_set:in draw_indirect_cull?in" do
         local ib = e.draw_indirect.instance_buffer
         update_instance_buffer(e, ib.memory, ib.num)
         e.feature_set.DRAW_INDIRECT = true
@@ -72,12 +237,15 @@ function di_sys:entity_remove()
         io.itb_handle, io.idb_handle = INVALID_HANDLE_VALUE, INVALID_HANDLE_VALUE
         io.draw_num = 0
     end
+    for e in w:select "REMOVED draw_indirect_cull:in indirect_object:update" do
+        destroy_cull_buffers(e.draw_indirect_cull, e.indirect_object)
+    end
 end
 
 local idi = {}
 
 function idi.update_instance_buffer(e, instancememory, instancenum)
-    w:extend(e, "draw_indirect:update indirect_object:update")
+    w:extend(e, "draw_indirect:update indirect_object:update draw_indirect_cull?in")
     if update_instance_buffer(e, instancememory, instancenum) then
         w:submit(e)
     end
@@ -88,4 +256,32 @@ function idi.instance_num(e)
     return e.draw_indirect.instance_buffer.num
 end
 
-return idi
\ No newline at end of file
+--bounds: world space aabb of every draw, packed as 2 vec4(minv, maxv) per draw, see idi.pack_bounds
+function idi.update_cull_bounds(e, bounds)
+    w:extend(e, "draw_indirect_cull:update")
+    local dc = e.draw_indirect_cull
+    dc.bounds = bounds
+    dc.dirty, dc.bounds_dirty = true, true
+    w:submit(e)
+end
+
+--draw args(di.handle) rewritten on gpu by the producer compute shader without an instance buffer update
+function idi.mark_cull_dirty(e)
+    w:extend(e, "draw_indirect_cull?in")
+    local dc = e.draw_indirect_cull
+    if dc then
+        dc.dirty = true
+    end
+end
+
+--aabbs: math3d aabb list in world space
+function idi.pack_bounds(aabbs)
+    local t = {}
+    for i, aabb in ipairs(aabbs) do
+        local minv, maxv = math3d.array_index(aabb, 1), math3d.array_index(aabb, 2)
+        t[i] = math3d.serialize(minv) .. math3d.serialize(maxv)
+    end
+    return table.concat(t, "")
+end
+
+return idi
@@ -7,5 +7,8 @@ function ido.init()
         idb_handle  = 0xffffffff,
         itb_handle  = 0xffffffff,
         draw_num    = 0,
+        cull_idb    = 0xffffffff,
+        cull_num    = 0xffffffff,
+        cull_mask   = 0,
     }
 end
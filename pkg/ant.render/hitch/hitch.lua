@@ -8,6 +8,7 @@ local mc, mu    = mathpkg.constant, mathpkg.util
 local ig        = ecs.require "ant.group|group"
 local irq       = ecs.require "renderqueue"
 local Q         = world:clibs "render.queue"
+local PACKED    = world:clibs "scene.packed"
 local hwi       = import_package "ant.hwi"
 local idi       = ecs.require "ant.render|draw_indirect.draw_indirect"
 local cs_material = "/pkg/ant.resources/materials/hitch/hitch_compute.material"
@@ -178,10 +179,12 @@ function hitch_sys:finish_scene_update()
         end
         ig.enable(gid, "hitch_tag", true)
         local objaabb = math3d.aabb()
-        for re in w:select "hitch_tag bounding:in skinning?in dynamic_mesh?in animation?in" do
+        for re in w:select "hitch_tag bounding:in skinning?in dynamic_mesh?in animation?in shadow_dynamic?out" do
             if re.skinning or re.dynamic_mesh or re.animation then
                 DIRECT_DRAW_GROUPS[gid] = true
             end
+            -- drawn at the hitch matrices, the cached shadow map can't follow the hitches
+            re.shadow_dynamic = true
             if re.bounding.scene_aabb ~= mc.NULL then
                 objaabb = math3d.aabb_merge(objaabb, re.bounding.scene_aabb)
             end
@@ -197,6 +200,7 @@ function hitch_sys:finish_scene_update()
             if math3d.aabb_isvalid(objaabb) then
                 he.bounding.aabb       = mu.M3D_mark(he.bounding.aabb, objaabb)
                 he.bounding.scene_aabb = mu.M3D_mark(he.bounding.scene_aabb, math3d.aabb_transform(he.scene.worldmat, objaabb))
+                PACKED.update_aabb(he.bounding.slot, he.bounding.scene_aabb)
             end
         end
         ::continue::
@@ -234,10 +238,12 @@ function hitch_sys:refine_camera()
             for re in w:select "hitch_tag mesh_result:in draw_indirect:update eid:in bounding?update" do
                 re.bounding.aabb       = mu.M3D_mark(re.bounding.aabb, math3d.aabb())
                 re.bounding.scene_aabb = mu.M3D_mark(re.bounding.scene_aabb, math3d.aabb())
+                PACKED.update_aabb(re.bounding.slot, re.bounding.scene_aabb)
                 glbs[#glbs+1] = { diid = re.eid, cid = re.draw_indirect.cid}
                 update_instance_buffer(re.eid, memory, draw_num)
                 idi.update_instance_buffer(re, memory, draw_num)
-                re.draw_indirect.instance_buffer.params =  {draw_num, 0, 0, re.mesh_result.ib.num}
+                local mr = re.mesh_result
+                re.draw_indirect.instance_buffer.params =  {draw_num, mr.vb.start, mr.ib.start, mr.ib.num}
             end
             indirect_draw_group.glbs = glbs
 
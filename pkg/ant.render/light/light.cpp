@@ -0,0 +1,571 @@
+#include "ecs/world.h"
+
+extern "C"{
+	#include "math3d.h"
+	#include "math3dfunc.h"
+}
+
+#include "lua.hpp"
+#include <bgfx/c99/bgfx.h>
+
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+// Light data is kept in SoA arrays indexed by slot, the gpu buffer is a packed copy of the visible lights:
+//	[0]:		the directional light (if any)
+//	[base, ...):	point/spot lights, culled by cluster shading
+// Only the slots changed since last update are repacked and uploaded, in contiguous runs.
+
+// same layout as light_info in shaders/common/lightdata.sh
+static constexpr uint32_t LIGHT_INFO_FLOATS	= 16;
+static constexpr uint32_t INVALID_INDEX		= UINT32_MAX;
+// dirty lights closer than this are uploaded in one run
+static constexpr uint32_t MERGE_GAP			= 4;
+
+enum light_type : uint8_t {
+	LT_directional = 0,
+	LT_point,
+	LT_spot,
+};
+
+struct cluster_aabb {
+	float minv[3];
+	float maxv[3];
+};
+
+struct view_light {
+	float pos[3];
+	float dir[3];
+	float range;
+	float intensity;
+	float inner_cutoff, outter_cutoff;
+	uint8_t type;
+	uint32_t index;
+};
+
+struct light_container {
+	// SoA, indexed by slot
+	std::vector<float>		px, py, pz, range;
+	std::vector<float>		dx, dy, dz;
+	std::vector<float>		cr, cg, cb;
+	std::vector<float>		intensity, inner_cutoff, outter_cutoff;
+	std::vector<uint8_t>	type, visible, dirty_mark;
+	std::vector<uint32_t>	order;			// slot -> index in punctual
+	std::vector<uint32_t>	freelist;
+
+	std::vector<uint32_t>	punctual;		// visible point/spot light slots, in gpu order
+	uint32_t				directional = INVALID_INDEX;
+	std::vector<uint32_t>	dirty;
+	bool					layout_dirty = true;
+
+	std::vector<float>		packed;			// mirror of the gpu buffer
+	uint32_t				capacity = 0;	// element count of the gpu buffer
+	float					exposure = 1.f;
+
+	// cpu cluster culling
+	std::vector<cluster_aabb>			clusters;
+	uint32_t							cluster_size[3] = {0};
+	float								slice_scale = 0.f, slice_bias = 0.f;
+	std::vector<uint32_t>				grids;
+	std::vector<uint32_t>				index_lists;
+	std::vector<std::vector<uint32_t>>	slice_lights;
+	std::vector<view_light>				view_lights;
+
+	uint32_t num() const { return (uint32_t)type.size(); }
+
+	uint32_t base() const { return directional == INVALID_INDEX ? 0 : 1; }
+
+	uint32_t count() const { return base() + (uint32_t)punctual.size(); }
+
+	uint32_t gpu_index(uint32_t slot) const {
+		if (type[slot] == LT_directional){
+			return slot == directional ? 0 : INVALID_INDEX;
+		}
+		return order[slot] == INVALID_INDEX ? INVALID_INDEX : base() + order[slot];
+	}
+
+	uint32_t alloc(light_type t){
+		uint32_t slot;
+		if (!freelist.empty()){
+			slot = freelist.back();
+			freelist.pop_back();
+		} else {
+			slot = num();
+			for (auto v : {&px, &py, &pz, &range, &dx, &dy, &dz, &cr, &cg, &cb, &intensity, &inner_cutoff, &outter_cutoff}){
+				v->push_back(0.f);
+			}
+			type.push_back(0);
+			visible.push_back(0);
+			dirty_mark.push_back(0);
+			order.push_back(INVALID_INDEX);
+		}
+		type[slot]		= t;
+		visible[slot]	= 0;
+		order[slot]		= INVALID_INDEX;
+		range[slot]		= 0.f;
+		return slot;
+	}
+
+	void dealloc(uint32_t slot){
+		set_visible(slot, false);
+		freelist.push_back(slot);
+	}
+
+	void mark_dirty(uint32_t slot){
+		if (!dirty_mark[slot]){
+			dirty_mark[slot] = 1;
+			dirty.push_back(slot);
+		}
+	}
+
+	void set_visible(uint32_t slot, bool v){
+		if ((visible[slot] != 0) == v)
+			return;
+		visible[slot] = v ? 1 : 0;
+		if (type[slot] == LT_directional){
+			if (v && directional == INVALID_INDEX){
+				directional = slot;
+				layout_dirty = true;
+			} else if (!v && directional == slot){
+				directional = INVALID_INDEX;
+				for (uint32_t ii=0; ii<num(); ++ii){
+					if (type[ii] == LT_directional && visible[ii]){
+						directional = ii;
+						break;
+					}
+				}
+				layout_dirty = true;
+			}
+			return;
+		}
+
+		if (v){
+			order[slot] = (uint32_t)punctual.size();
+			punctual.push_back(slot);
+			mark_dirty(slot);
+		} else {
+			const uint32_t idx = order[slot];
+			const uint32_t last = punctual.back();
+			punctual[idx] = last;
+			order[last] = idx;
+			punctual.pop_back();
+			order[slot] = INVALID_INDEX;
+			if (last != slot)
+				mark_dirty(last);
+		}
+	}
+
+	void pack(uint32_t slot, float *v) const {
+		const float enable = 1.f;
+		const float t[LIGHT_INFO_FLOATS] = {
+			px[slot], py[slot], pz[slot], range[slot],
+			dx[slot], dy[slot], dz[slot], enable,
+			cr[slot], cg[slot], cb[slot], 0.f,	// not use
+			(float)type[slot], intensity[slot] * exposure, inner_cutoff[slot], outter_cutoff[slot],
+		};
+		memcpy(v, t, sizeof(t));
+	}
+
+	void repack_all(){
+		if (directional != INVALID_INDEX){
+			pack(directional, &packed[0]);
+		}
+		const uint32_t b = base();
+		for (uint32_t ii=0; ii<(uint32_t)punctual.size(); ++ii){
+			pack(punctual[ii], &packed[(b+ii) * LIGHT_INFO_FLOATS]);
+		}
+	}
+
+	void clear_dirty(){
+		for (auto s : dirty)
+			dirty_mark[s] = 0;
+		dirty.clear();
+		layout_dirty = false;
+	}
+};
+
+static inline light_container*
+to_lights(lua_State *L){
+	auto w = getworld(L);
+	if (w->LIGHT == nullptr){
+		luaL_error(L, "light container is not initialized");
+	}
+	return w->LIGHT;
+}
+
+static inline uint32_t
+check_slot(lua_State *L, light_container *lc, int idx){
+	const lua_Integer slot = luaL_checkinteger(L, idx);
+	if (slot < 0 || slot >= (lua_Integer)lc->num()){
+		luaL_error(L, "Invalid light index:%d", (int)slot);
+	}
+	return (uint32_t)slot;
+}
+
+static inline const float*
+check_matrix(lua_State *L, struct ecs_world *w, int idx){
+	const math_t m = math3d_from_lua_id(L, w->math3d, idx);
+	if (!math_valid(w->math3d->M, m)){
+		luaL_error(L, "Invalid matrix");
+	}
+	return math_value(w->math3d->M, m);
+}
+
+static int
+linit(lua_State *L){
+	auto w = getworld(L);
+	if (w->LIGHT == nullptr){
+		w->LIGHT = new light_container;
+	}
+	return 0;
+}
+
+static int
+lexit(lua_State *L){
+	auto w = getworld(L);
+	delete w->LIGHT;
+	w->LIGHT = nullptr;
+	return 0;
+}
+
+static int
+lalloc(lua_State *L){
+	auto lc = to_lights(L);
+	const char* t = luaL_checkstring(L, 1);
+	light_type lt;
+	if (0 == strcmp(t, "directional")){
+		lt = LT_directional;
+	} else if (0 == strcmp(t, "point")){
+		lt = LT_point;
+	} else if (0 == strcmp(t, "spot")){
+		lt = LT_spot;
+	} else {
+		return luaL_error(L, "Invalid light type:%s", t);
+	}
+	lua_pushinteger(L, lc->alloc(lt));
+	return 1;
+}
+
+static int
+ldealloc(lua_State *L){
+	auto lc = to_lights(L);
+	lc->dealloc(check_slot(L, lc, 1));
+	return 0;
+}
+
+static int
+lset_visible(lua_State *L){
+	auto lc = to_lights(L);
+	lc->set_visible(check_slot(L, lc, 1), lua_toboolean(L, 2));
+	return 0;
+}
+
+// set(idx, r, g, b, intensity, range, inner_cutoff, outter_cutoff)
+static int
+lset(lua_State *L){
+	auto lc = to_lights(L);
+	const uint32_t slot = check_slot(L, lc, 1);
+	lc->cr[slot]			= (float)luaL_checknumber(L, 2);
+	lc->cg[slot]			= (float)luaL_checknumber(L, 3);
+	lc->cb[slot]			= (float)luaL_checknumber(L, 4);
+	lc->intensity[slot]		= (float)luaL_checknumber(L, 5);
+	lc->range[slot]			= (float)luaL_optnumber(L, 6, 0.0);
+	lc->inner_cutoff[slot]	= (float)luaL_optnumber(L, 7, 0.0);
+	lc->outter_cutoff[slot]	= (float)luaL_optnumber(L, 8, 0.0);
+	lc->mark_dirty(slot);
+	return 0;
+}
+
+// light direction is the inverse of z axis, position is the translation
+static int
+lset_transform(lua_State *L){
+	auto w = getworld(L);
+	auto lc = to_lights(L);
+	const uint32_t slot = check_slot(L, lc, 1);
+	const float *m = check_matrix(L, w, 2);
+	lc->dx[slot] = -m[8];	lc->dy[slot] = -m[9];	lc->dz[slot] = -m[10];
+	lc->px[slot] = m[12];	lc->py[slot] = m[13];	lc->pz[slot] = m[14];
+	lc->mark_dirty(slot);
+	return 0;
+}
+
+static int
+lset_exposure(lua_State *L){
+	auto lc = to_lights(L);
+	const float ev = (float)luaL_checknumber(L, 1);
+	if (ev != lc->exposure){
+		lc->exposure = ev;
+		lc->layout_dirty = true;
+	}
+	return 0;
+}
+
+static inline void
+update_buffer(struct ecs_world *w, bgfx_dynamic_vertex_buffer_handle_t h, const float *v, uint32_t start, uint32_t num){
+	const auto mem = w->bgfx->copy(v + start * LIGHT_INFO_FLOATS, num * LIGHT_INFO_FLOATS * sizeof(float));
+	w->bgfx->update_dynamic_vertex_buffer(h, start, mem);
+}
+
+// update(light_buffer) return all light count, culled light count and whether the buffer has changed
+static int
+lupdate(lua_State *L){
+	auto w = getworld(L);
+	auto lc = to_lights(L);
+	const auto h = bgfx_dynamic_vertex_buffer_handle_t{(uint16_t)luaL_checkinteger(L, 1)};
+
+	const uint32_t n = lc->count();
+	bool changed = lc->layout_dirty || !lc->dirty.empty();
+	if (n > 0 && changed){
+		if (lc->layout_dirty || n > lc->capacity){
+			// buffer created with 'a' flag, grows when the memory is larger than the buffer
+			if (n > lc->capacity){
+				lc->capacity = std::max(n, lc->capacity * 2);
+			}
+			lc->packed.assign(lc->capacity * LIGHT_INFO_FLOATS, 0.f);
+			lc->repack_all();
+			update_buffer(w, h, lc->packed.data(), 0, lc->capacity);
+		} else {
+			std::vector<uint32_t> indices;
+			indices.reserve(lc->dirty.size());
+			for (auto slot : lc->dirty){
+				const uint32_t gi = lc->gpu_index(slot);
+				if (gi != INVALID_INDEX && gi < n){
+					lc->pack(slot, &lc->packed[gi * LIGHT_INFO_FLOATS]);
+					indices.push_back(gi);
+				}
+			}
+			std::sort(indices.begin(), indices.end());
+			for (size_t ii=0; ii<indices.size();){
+				const uint32_t start = indices[ii];
+				uint32_t last = start;
+				for (++ii; ii<indices.size() && indices[ii] <= last + MERGE_GAP; ++ii){
+					last = indices[ii];
+				}
+				update_buffer(w, h, lc->packed.data(), start, last - start + 1);
+			}
+		}
+	}
+	lc->clear_dirty();
+
+	lua_pushinteger(L, n);
+	lua_pushinteger(L, lc->punctual.size());
+	lua_pushboolean(L, changed);
+	return 3;
+}
+
+// CPU cluster shading path, the same result as cs_cluster_aabb.sc and cs_lightcull.sc
+
+// cluster_build(inv_proj, viewwidth, viewheight, sizex, sizey, sizez, near, far, homogeneous_depth, origin_bottom_left)
+// inv_proj: inverse of the projection matrix without inverse z and infinite far
+static int
+lcluster_build(lua_State *L){
+	auto w = getworld(L);
+	auto lc = to_lights(L);
+	const float *ip = check_matrix(L, w, 1);
+	const float vw = (float)luaL_checknumber(L, 2), vh = (float)luaL_checknumber(L, 3);
+	uint32_t *cs = lc->cluster_size;
+	for (int ii=0; ii<3; ++ii){
+		cs[ii] = (uint32_t)luaL_checkinteger(L, 4+ii);
+	}
+	const float nearz = (float)luaL_checknumber(L, 7), farz = (float)luaL_checknumber(L, 8);
+	const float near_ndc = lua_toboolean(L, 9) ? -1.f : 0.f;
+	const bool obl = lua_toboolean(L, 10);
+
+	const float log_farnear = log2f(farz / nearz);
+	lc->slice_scale = cs[2] / log_farnear;
+	lc->slice_bias = -(cs[2] * log2f(nearz)) / log_farnear;
+
+	auto screen2view = [=](float sx, float sy, float out[3]){
+		float nx = sx / vw, ny = sy / vh;
+		if (!obl)
+			ny = 1.f - ny;
+		nx = nx * 2.f - 1.f; ny = ny * 2.f - 1.f;
+		float c[4];
+		for (int ii=0; ii<4; ++ii){
+			c[ii] = ip[ii] * nx + ip[4+ii] * ny + ip[8+ii] * near_ndc + ip[12+ii];
+		}
+		for (int ii=0; ii<3; ++ii)
+			out[ii] = c[ii] / c[3];
+	};
+
+	const float tx = vw / cs[0], ty = vh / cs[1];
+	lc->clusters.resize(cs[0] * cs[1] * cs[2]);
+	for (uint32_t y=0; y<cs[1]; ++y){
+		for (uint32_t x=0; x<cs[0]; ++x){
+			float corners[4][3];
+			screen2view(x * tx,		y * ty,		corners[0]);
+			screen2view((x+1) * tx,	y * ty,		corners[1]);
+			screen2view(x * tx,		(y+1) * ty,	corners[2]);
+			screen2view((x+1) * tx,	(y+1) * ty,	corners[3]);
+			for (uint32_t z=0; z<cs[2]; ++z){
+				const float zs[2] = {
+					nearz * powf(farz / nearz, z / float(cs[2])),
+					nearz * powf(farz / nearz, (z+1) / float(cs[2])),
+				};
+				cluster_aabb &a = lc->clusters[x + cs[0] * (y + cs[1] * z)];
+				for (int ii=0; ii<3; ++ii){
+					a.minv[ii] = FLT_MAX; a.maxv[ii] = -FLT_MAX;
+				}
+				// intersect the ray from eye to the corner with z plane
+				for (auto zz : zs){
+					for (auto &c : corners){
+						const float t = zz / c[2];
+						for (int ii=0; ii<3; ++ii){
+							a.minv[ii] = std::min(a.minv[ii], c[ii] * t);
+							a.maxv[ii] = std::max(a.maxv[ii], c[ii] * t);
+						}
+					}
+				}
+			}
+		}
+	}
+	lc->grids.assign(lc->clusters.size() * 2, 0);
+	return 0;
+}
+
+static constexpr float LIGHT_ATTENUATION_THRESHOLD = 0.008f;
+
+static inline float
+light_attenuation(const view_light &l, const cluster_aabb &a){
+	float d[3], dis2 = 0.f;
+	for (int ii=0; ii<3; ++ii){
+		d[ii] = (a.minv[ii] + a.maxv[ii]) * 0.5f - l.pos[ii];
+		dis2 += d[ii] * d[ii];
+	}
+	const float dis = sqrtf(dis2);
+	const float r = dis / l.range;
+	const float r4 = r * r * r * r;
+	float att = std::min(std::max(1.f - r4, 0.f), 1.f) / std::max(dis2, 1e-6f);
+	if (l.type == LT_spot){
+		const float cosv = (d[0]*l.dir[0] + d[1]*l.dir[1] + d[2]*l.dir[2]) / std::max(dis, 1e-6f);
+		const float t = std::min(std::max((cosv - l.outter_cutoff) / std::max(l.inner_cutoff - l.outter_cutoff, 1e-6f), 0.f), 1.f);
+		att *= t * t * (3.f - 2.f * t);
+	}
+	return att;
+}
+
+// same test as cs_lightcull.sc
+static inline bool
+light_intersect_cluster(const view_light &l, const cluster_aabb &a, uint32_t count, uint32_t maxlight){
+	if (count < uint32_t(maxlight * 0.3f) || l.intensity * light_attenuation(l, a) > LIGHT_ATTENUATION_THRESHOLD){
+		float sq = 0.f;
+		for (int ii=0; ii<3; ++ii){
+			const float c = std::max(a.minv[ii], std::min(l.pos[ii], a.maxv[ii])) - l.pos[ii];
+			sq += c * c;
+		}
+		return sq <= l.range * l.range;
+	}
+	return false;
+}
+
+// cluster_cull(viewmat, light_grids, light_index_lists, max_light)
+// Index lists are compacted instead of 'max_light' per cluster, only the used part is uploaded.
+static int
+lcluster_cull(lua_State *L){
+	auto w = getworld(L);
+	auto lc = to_lights(L);
+	if (lc->clusters.empty()){
+		return luaL_error(L, "need call cluster_build first");
+	}
+	const float *vm = check_matrix(L, w, 1);
+	const auto gh = bgfx_dynamic_index_buffer_handle_t{(uint16_t)luaL_checkinteger(L, 2)};
+	const auto ih = bgfx_dynamic_index_buffer_handle_t{(uint16_t)luaL_checkinteger(L, 3)};
+	const uint32_t maxlight = (uint32_t)luaL_checkinteger(L, 4);
+	const uint32_t *cs = lc->cluster_size;
+
+	// transform lights to view space, and put them into the depth slices they cover
+	lc->view_lights.clear();
+	lc->slice_lights.resize(cs[2]);
+	for (auto &s : lc->slice_lights)
+		s.clear();
+
+	const uint32_t b = lc->base();
+	for (uint32_t ii=0; ii<(uint32_t)lc->punctual.size(); ++ii){
+		const uint32_t slot = lc->punctual[ii];
+		view_light l;
+		const float p[3] = {lc->px[slot], lc->py[slot], lc->pz[slot]};
+		const float d[3] = {lc->dx[slot], lc->dy[slot], lc->dz[slot]};
+		for (int jj=0; jj<3; ++jj){
+			l.pos[jj] = vm[jj]*p[0] + vm[4+jj]*p[1] + vm[8+jj]*p[2] + vm[12+jj];
+			l.dir[jj] = vm[jj]*d[0] + vm[4+jj]*d[1] + vm[8+jj]*d[2];
+		}
+		l.range			= lc->range[slot];
+		l.intensity		= lc->intensity[slot] * lc->exposure;
+		l.inner_cutoff	= lc->inner_cutoff[slot];
+		l.outter_cutoff	= lc->outter_cutoff[slot];
+		l.type			= lc->type[slot];
+		l.index			= b + ii;
+
+		const float zmax = l.pos[2] + l.range;
+		if (zmax <= 0.f)
+			continue;
+
+		auto slice = [lc, cs](float z){
+			const float s = log2f(std::max(z, 1e-6f)) * lc->slice_scale + lc->slice_bias;
+			return (uint32_t)std::min(std::max(s, 0.f), float(cs[2]-1));
+		};
+		const uint32_t vidx = (uint32_t)lc->view_lights.size();
+		lc->view_lights.push_back(l);
+		for (uint32_t s=slice(l.pos[2] - l.range); s<=slice(zmax); ++s){
+			lc->slice_lights[s].push_back(vidx);
+		}
+	}
+
+	const uint32_t total_capacity = maxlight * (uint32_t)lc->clusters.size();
+	lc->index_lists.clear();
+	for (uint32_t z=0; z<cs[2]; ++z){
+		const auto &lights = lc->slice_lights[z];
+		for (uint32_t xy=0; xy<cs[0]*cs[1]; ++xy){
+			const uint32_t cidx = xy + cs[0] * cs[1] * z;
+			const auto &a = lc->clusters[cidx];
+			const uint32_t offset = (uint32_t)lc->index_lists.size();
+			uint32_t count = 0;
+			for (auto vidx : lights){
+				if (count >= maxlight || offset + count >= total_capacity)
+					break;
+				const auto &l = lc->view_lights[vidx];
+				if (light_intersect_cluster(l, a, count, maxlight)){
+					lc->index_lists.push_back(l.index);
+					++count;
+				}
+			}
+			lc->grids[cidx*2]	= offset;
+			lc->grids[cidx*2+1]	= count;
+		}
+	}
+
+	w->bgfx->update_dynamic_index_buffer(gh, 0, w->bgfx->copy(lc->grids.data(), (uint32_t)(lc->grids.size() * sizeof(uint32_t))));
+	if (!lc->index_lists.empty()){
+		w->bgfx->update_dynamic_index_buffer(ih, 0, w->bgfx->copy(lc->index_lists.data(), (uint32_t)(lc->index_lists.size() * sizeof(uint32_t))));
+	}
+	lua_pushinteger(L, lc->index_lists.size());
+	return 1;
+}
+
+extern "C" int
+luaopen_render_light(lua_State *L){
+	luaL_checkversion(L);
+	luaL_Reg l[] = {
+		{ "init",			linit},
+		{ "exit",			lexit},
+		{ "alloc",			lalloc},
+		{ "dealloc",		ldealloc},
+		{ "set",			lset},
+		{ "set_visible",	lset_visible},
+		{ "set_transform",	lset_transform},
+		{ "set_exposure",	lset_exposure},
+		{ "update",			lupdate},
+		{ "cluster_build",	lcluster_build},
+		{ "cluster_cull",	lcluster_cull},
+		{ nullptr,			nullptr},
+	};
+	luaL_newlibtable(L,l);
+	lua_pushnil(L);
+	luaL_setfuncs(L,l,1);
+	return 1;
+}
@@ -7,7 +7,6 @@ local layoutmgr	= renderpkg.layoutmgr
 
 local math3d	= require "math3d"
 local bgfx		= require "bgfx"
-local iom		= ecs.require "ant.objcontroller|obj_motion"
 local iexposure = ecs.require "ant.camera|exposure"
 local imaterial = ecs.require "ant.render|material"
 
@@ -34,18 +33,15 @@ local DEFAULT_LIGHT<const> = {
 	}
 }
 
-local changed = false
+local LIGHT		= world:clibs "render.light"
 
-local function setChanged()
-	changed = true
-end
-
-local function isChanged()
-	if changed then
-		changed = false
-		return true
+--light data is kept in native side, only the changed lights are repacked and uploaded
+local function sync_light(l)
+	local slot = l.slot
+	if slot then
+		local c = l.color
+		LIGHT.set(slot, c[1], c[2], c[3], l.intensity, l.range, l.inner_cutoff, l.outter_cutoff)
 	end
-	return w:check "scene_changed light"
 end
 
 local ilight = {}
@@ -108,7 +104,7 @@ end
 function ilight.set_color_rgb(e, r, g, b)
 	local c = e.light.color
 	c[1], c[2], c[3] = r, g, b
-	setChanged()
+	sync_light(e.light)
 end
 
 function ilight.intensity(e)
@@ -137,7 +133,7 @@ function ilight.set_intensity(e, i, unit)
 		local r = assert(l.outter_radian)
 		l.intensity = unit == "candela" and i / (2.0*math.pi*(1.0-math.cos(r*0.5))) or i
 	end
-	setChanged()
+	sync_light(l)
 end
 
 function ilight.intensity_unit(e)
@@ -153,7 +149,7 @@ function ilight.set_range(e, r)
 		error "directional light do not have 'range' property"
 	end
 	e.light.range = r
-	setChanged()
+	sync_light(e.light)
 end
 
 function ilight.inner_radian(e)
@@ -172,7 +168,7 @@ function ilight.set_inner_radian(e, r)
 	local l = e.light
 	l.inner_radian = math.min(l.outter_radian-spot_radian_threshold, r)
 	l.inner_cutoff = math.cos(l.inner_radian*0.5)
-	setChanged()
+	sync_light(l)
 end
 
 function ilight.outter_radian(e)
@@ -184,7 +180,7 @@ function ilight.set_outter_radian(e, r)
 	local l = e.light
 	l.outter_radian = math.max(r, l.inner_radian+spot_radian_threshold)
 	l.outter_cutoff = math.cos(l.outter_radian*0.5)
-	setChanged()
+	sync_light(l)
 end
 
 function ilight.inner_cutoff(e)
@@ -223,12 +219,6 @@ function ilight.set_angular_radius(e, ar)
 	e.light.angular_radius = ar
 end
 
-local lighttypes = {
-	directional = 0,
-	point = 1,
-	spot = 2,
-}
-
 local function count_visible_light()
 	local n = 0
 	for _ in w:select "light visible" do
@@ -239,51 +229,21 @@ end
 
 ilight.count_visible_light = count_visible_light
 
-local function create_light_buffers()
-	local lights = {}
-	local mq = w:first("main_queue camera_ref:in")
-    local camera <close> = world:entity(mq.camera_ref)
-	local ev = iexposure.exposure(camera)
-
-	local function pack_light(e)
-		local dir, pos = math3d.index(e.scene.worldmat, 3, 4)
-		dir = math3d.inverse(dir)
-		local dx, dy, dz = math3d.index(dir, 1, 2, 3)
-		local px, py, pz = math3d.index(pos, 1, 2, 3)
-		local c = e.light.color
-		local t	= e.light.type
-		local enable<const> = 1
-		return ('f'):rep(16):pack(
-			px, py, pz, e.light.range or math.maxinteger,
-			dx, dy, dz, enable,
-			c[1], c[2], c[3], 0.0,	-- not use
-			lighttypes[t],
-			e.light.intensity * ev,
-			e.light.inner_cutoff or 0,
-			e.light.outter_cutoff or 0
-		)
-	end
-
-	for e in w:select "directional_light light:in visible scene:in" do
-		lights[#lights+1] = pack_light(e)
-	end
-
-	local culledlightcount = 0
-	for e in w:select "light:in directional_light:absent visible scene:in" do
-		lights[#lights+1] = pack_light(e)
-		culledlightcount = culledlightcount + 1
-	end
-    return lights, culledlightcount
-end
-
 local light_buffer = bgfx.create_dynamic_vertex_buffer(1, layoutmgr.get "t40".handle, "ra")
+local light_count = {0, 0}
+local light_changed = false
 
 local function update_light_buffers()
-	local lights, culledlightcount = create_light_buffers()
-	if #lights ~= 0 then
-		bgfx.update(light_buffer, 0, bgfx.memory_buffer(table.concat(lights, "")))
+	local mq = w:first "main_queue camera_ref:in"
+	local camera <close> = world:entity(mq.camera_ref)
+	LIGHT.set_exposure(iexposure.exposure(camera))
+
+	local allcount, culledcount, changed = LIGHT.update(light_buffer)
+	if allcount ~= light_count[1] or culledcount ~= light_count[2] then
+		light_count[1], light_count[2] = allcount, culledcount
+		imaterial.system_attrib_update("u_light_count", math3d.vector(allcount, culledcount, CLUSTER_MAX_LIGHT_COUNT, 0))
 	end
-	imaterial.system_attrib_update("u_light_count", math3d.vector(#lights, culledlightcount, CLUSTER_MAX_LIGHT_COUNT, 0))
+	return changed
 end
 
 function ilight.light_buffer()
@@ -292,6 +252,9 @@ end
 
 local lightsys = ecs.system "light_system"
 
+lightsys.init = LIGHT.init
+lightsys.exit = LIGHT.exit
+
 function lightsys:component_init()
 	for e in w:select "INIT light:in" do
 		local t = e.light.type
@@ -303,7 +266,6 @@ end
 
 function lightsys:entity_init()
 	for e in w:select "INIT light:in" do
-		setChanged()
 		local l 		= e.light
 		local t 		= assert(l.type)
 		assert(l.color or l.intensity or l.intensity_unit or l.motion_type, "light's 'color' or 'intensity' or 'intensity_unit' must not be nil")
@@ -336,6 +298,8 @@ function lightsys:entity_init()
 			l.inner_cutoff = 0
 			l.outter_cutoff = 0
 		end
+		l.slot = LIGHT.alloc(t)
+		sync_light(l)
 	end
 end
 
@@ -346,16 +310,29 @@ function lightsys:init_world()
 end
 
 function lightsys:entity_remove()
-	for _ in w:select "REMOVED light" do
-		setChanged()
-		return
+	for e in w:select "REMOVED light:in" do
+		local l = e.light
+		if l.slot then
+			LIGHT.dealloc(l.slot)
+			l.slot = nil
+		end
 	end
 end
 
 function lightsys:update_system_properties()
-	if isChanged() then
-		update_light_buffers()
+	--native side ignores the unchanged visible state
+	for e in w:select "light:in visible?in" do
+		LIGHT.set_visible(e.light.slot, e.visible)
+	end
+	for e in w:select "scene_changed light:in scene:in" do
+		LIGHT.set_transform(e.light.slot, e.scene.worldmat)
 	end
+	light_changed = update_light_buffers()
+end
+
+--light buffer is updated in this frame, valid after 'update_system_properties'
+function ilight.light_changed()
+	return light_changed
 end
 
 return ilight
@@ -13,6 +13,8 @@ lm:lua_src "render_core" {
         lm.AntDir .. "/clibs/ecs",
         lm.AntDir .. "/pkg/ant.resource_manager/src",
         lm.AntDir .. "/pkg/ant.material",
+        lm.AntDir .. "/pkg/ant.scene",
+        lm.AntDir .. "/clibs/profiler",
     },
     defines = {
         lm.mode == "debug" and "RENDER_DEBUG" or nil,
@@ -23,6 +25,8 @@ lm:lua_src "render_core" {
         "render/hash.cpp",
         "render/queue.cpp",
         "render/mesh.cpp",
+        "render/mesh_pool.cpp",
+        "light/light.cpp",
     },
     msvc = {
         flags = "/Zc:preprocessor",
@@ -36,6 +40,8 @@ lm:lua_src "render" {
         lm.AntDir .. "/clibs/luabind",
         lm.AntDir .. "/3rd/luaecs",
         lm.AntDir .. "/clibs/ecs",
+        lm.AntDir .. "/pkg/ant.scene",
+        lm.AntDir .. "/clibs/profiler",
     },
     sources = {
         "cull/cull.cpp",
@@ -59,6 +59,11 @@ do
 	register_queue("csm2_queue", 			shadow_material_idx)
 	register_queue("csm3_queue", 			shadow_material_idx)
 	register_queue("csm4_queue", 			shadow_material_idx)
+	--static shadow casters, rendered into the cached shadow map only when it's invalid
+	register_queue("csm1_static_queue", 	shadow_material_idx)
+	register_queue("csm2_static_queue", 	shadow_material_idx)
+	register_queue("csm3_static_queue", 	shadow_material_idx)
+	register_queue("csm4_static_queue", 	shadow_material_idx)
 	register_queue("bake_lightmap_queue",	alloc_material())
 
 	m.alloc_material = alloc_material
@@ -79,4 +84,8 @@ function m.queue_mask(qn)
 	return assert(QUEUE_MASKS[qn])
 end
 
+function m.queues()
+	return next, QUEUE_INDICES
+end
+
 return m
\ No newline at end of file
@@ -10,6 +10,7 @@ local hwi			= import_package "ant.hwi"
 local sampler		= import_package "ant.render.core".sampler
 local setting		= import_package "ant.settings"
 local ED 			= world:clibs "entity.drawer"
+local RC			= world:clibs "render.cache"
 
 local ig			= ecs.require "ant.group|group"
 local ivm			= ecs.require "visible_mask"
@@ -90,11 +91,13 @@ end
 function irender.set_visible_by_eid(eid, visible)
 	local e <close> = world:entity(eid, "visible?out")
 	e.visible = visible
+	RC.invalidate()
 end
 
 function irender.set_visible(e, visible)
 	w:extend(e, "visible?out")
 	e.visible = visible
+	RC.invalidate()
 end
 
 function irender.is_visible(e)
@@ -225,6 +228,7 @@ local function group_filter_flush(go)
     go:filter("render_object_visible", "render_object")
     go:filter("hitch_visible", "hitch")
 	--go:filter("efk_visible", "efk")
+	RC.invalidate()
 end
 
 irender.group_flush = group_filter_flush
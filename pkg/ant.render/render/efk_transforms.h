@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Transforms of the efk objects hanging on hitch nodes, one for each hitch matrix.
+// render.cache writes them in the world thread when it collects the hitch groups, the efk update thread
+// reads them before Effekseer update. Writer and reader never share a buffer: the writer publishes its
+// buffer into 'pending', the reader swaps the latest pending buffer out, or keeps the last one if the
+// world didn't publish a new frame.
+struct efk_transform {
+	int32_t	handle;
+	float	mat[16];	// column major, the same layout as Effekseer::Matrix44
+};
+
+struct efk_transforms {
+	using buffer = std::vector<efk_transform>;
+
+	buffer& begin_write() {
+		write.clear();
+		return write;
+	}
+
+	void publish() {
+		std::lock_guard<std::mutex> lock(mutex);
+		std::swap(write, pending);
+		fresh = true;
+	}
+
+	const buffer& acquire() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (fresh) {
+			std::swap(read, pending);
+			fresh = false;
+		}
+		return read;
+	}
+
+private:
+	std::mutex	mutex;
+	buffer		write;
+	buffer		pending;
+	buffer		read;
+	bool		fresh = false;
+};
@@ -60,6 +60,16 @@ mesh_fetch(struct mesh_container* MESH, int Midx){
     return nullptr;
 }
 
+// only lod selection should modify the mesh node while rendering
+struct mesh_node*
+mesh_fetch_lod(struct mesh_container* MESH, int Midx){
+    if (MESH->isvalid(Midx)){
+        auto m = &(MESH->nodes[Midx]);
+        return m->lod_num > 1 ? m : nullptr;
+    }
+    return nullptr;
+}
+
 static int
 lmesh_dealloc(lua_State *L){
     auto w = getworld(L);
@@ -184,6 +194,42 @@ lmesh_fetch(lua_State *L){
     return 3;
 }
 
+// MESH.set_lods(midx, lods, cx, cy, cz, radius)
+//  lods: {{start=, num=, error=}, ...}, lods[1] is lod0, same range as 'ib'
+//  cx, cy, cz, radius: bounding sphere in model space
+static int
+lmesh_set_lods(lua_State *L){
+    auto w = getworld(L);
+    const int Midx = (int)luaL_checkinteger(L, 1);
+    if (!w->MESH->isvalid(Midx)){
+        luaL_error(L, "Invalid mesh index");
+    }
+    auto m = w->MESH->fetch(Midx);
+    m->lod_num = 0;
+    memset(m->lod_current, 0, sizeof(m->lod_current));
+    if (lua_isnoneornil(L, 2)){
+        return 0;
+    }
+
+    luaL_checktype(L, 2, LUA_TTABLE);
+    const int n = (int)lua_rawlen(L, 2);
+    for (int ii=0; ii<n && ii<MAX_MESH_LOD; ++ii){
+        lua_geti(L, 2, ii+1);
+        luaL_checktype(L, -1, LUA_TTABLE);
+        auto &lod = m->lods[ii];
+        lua_getfield(L, -1, "start");   lod.start = (uint32_t)luaL_checkinteger(L, -1);   lua_pop(L, 1);
+        lua_getfield(L, -1, "num");     lod.num = (uint32_t)luaL_checkinteger(L, -1);     lua_pop(L, 1);
+        lua_getfield(L, -1, "error");   lod.error = (float)luaL_optnumber(L, -1, 0);      lua_pop(L, 1);
+        lua_pop(L, 1);
+        ++m->lod_num;
+    }
+    for (int ii=0; ii<3; ++ii){
+        m->center[ii] = (float)luaL_checknumber(L, 3+ii);
+    }
+    m->radius = (float)luaL_checknumber(L, 6);
+    return 0;
+}
+
 extern "C" int
 luaopen_render_mesh(lua_State *L){
     luaL_checkversion(L);
@@ -199,6 +245,8 @@ luaopen_render_mesh(lua_State *L){
         { "fetch_range",lmesh_fetch_range},
         { "fetch_handle",lmesh_fetch_handle},
         { "fetch",      lmesh_fetch},
+
+        { "set_lods",   lmesh_set_lods},
         
 		{ nullptr, 	nullptr },
 	};
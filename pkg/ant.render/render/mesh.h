@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 
 struct buffer_node {
     uint32_t start;
@@ -23,16 +24,36 @@ enum BufferType : uint8_t {
     BT_count,
 };
 
+static constexpr uint8_t MAX_MESH_LOD = 4;
+// lod is selected per queue: main, csm1~csm4, see queue_type in render.cpp. pre_depth slot is unused, it draws the lod of main
+static constexpr uint8_t MESH_LOD_QUEUE = 6;
+
+// index range of one lod, lod0 is the range of 'ib' buffer
+// error is the geometry error in model space, generated by ant.compile_resource/model/export_meshbin.lua
+struct lod_node {
+    uint32_t start;
+    uint32_t num;
+    float error;
+};
+
 struct mesh_node {
     buffer_node buffers[BT_count];
+    lod_node lods[MAX_MESH_LOD];
+    uint8_t lod_num;
+    uint8_t lod_current[MESH_LOD_QUEUE];
+    float center[3];        // local bounding sphere
+    float radius;
     void clear() {
         for (auto &b :buffers){
             b.clear();
         }
+        lod_num = 0;
+        memset(lod_current, 0, sizeof(lod_current));
     }
 };
 
 struct mesh_container;
 struct mesh_container* mesh_create();
 void mesh_destroy(struct mesh_container *MESH);
-const struct mesh_node* mesh_fetch(struct mesh_container* MESH, int Midx);
\ No newline at end of file
+const struct mesh_node* mesh_fetch(struct mesh_container* MESH, int Midx);
+struct mesh_node* mesh_fetch_lod(struct mesh_container* MESH, int Midx);
@@ -0,0 +1,147 @@
+#include "lua.hpp"
+
+#include <cstdint>
+#include <map>
+#include <new>
+#include <unordered_map>
+
+// First fit range allocator of one shared mesh buffer page, see ant.asset/ext_meshbin.lua.
+// Free ranges are kept sorted by offset and coalesced with their neighbours when a range is freed,
+// so a page that all its meshes unloaded goes back to one free range and can be released.
+struct range_allocator {
+    uint32_t capacity;
+    uint32_t used = 0;
+    std::map<uint32_t, uint32_t> free_ranges;           // offset -> size
+    std::unordered_map<uint32_t, uint32_t> allocated;   // offset -> size
+
+    range_allocator(uint32_t c) : capacity(c) {
+        free_ranges.emplace(0, c);
+    }
+
+    bool alloc(uint32_t num, uint32_t &offset) {
+        for (auto it = free_ranges.begin(); it != free_ranges.end(); ++it) {
+            if (it->second < num)
+                continue;
+            offset = it->first;
+            const uint32_t remain = it->second - num;
+            free_ranges.erase(it);
+            if (remain > 0)
+                free_ranges.emplace(offset + num, remain);
+            allocated.emplace(offset, num);
+            used += num;
+            return true;
+        }
+        return false;
+    }
+
+    bool free(uint32_t offset) {
+        auto a = allocated.find(offset);
+        if (a == allocated.end())
+            return false;
+        uint32_t size = a->second;
+        allocated.erase(a);
+        used -= size;
+
+        auto next = free_ranges.lower_bound(offset);
+        if (next != free_ranges.end() && offset + size == next->first) {
+            size += next->second;
+            next = free_ranges.erase(next);
+        }
+        if (next != free_ranges.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == offset) {
+                prev->second += size;
+                return true;
+            }
+        }
+        free_ranges.emplace(offset, size);
+        return true;
+    }
+
+    uint32_t largest() const {
+        uint32_t l = 0;
+        for (auto &r : free_ranges) {
+            if (r.second > l)
+                l = r.second;
+        }
+        return l;
+    }
+};
+
+static inline range_allocator*
+to_allocator(lua_State *L) {
+    return (range_allocator*)luaL_checkudata(L, 1, "ANT_MESH_POOL_ALLOCATOR");
+}
+
+static int
+lalloc(lua_State *L) {
+    auto a = to_allocator(L);
+    const lua_Integer num = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, num > 0 && num <= (lua_Integer)UINT32_MAX, 2, "invalid range size");
+    uint32_t offset;
+    if (!a->alloc((uint32_t)num, offset))
+        return 0;
+    lua_pushinteger(L, offset);
+    return 1;
+}
+
+static int
+lfree(lua_State *L) {
+    auto a = to_allocator(L);
+    const uint32_t offset = (uint32_t)luaL_checkinteger(L, 2);
+    if (!a->free(offset))
+        return luaL_error(L, "Invalid range offset %d", (int)offset);
+    lua_pushboolean(L, a->used == 0);
+    return 1;
+}
+
+// used, capacity, largest free range, free range number
+static int
+linfo(lua_State *L) {
+    auto a = to_allocator(L);
+    lua_pushinteger(L, a->used);
+    lua_pushinteger(L, a->capacity);
+    lua_pushinteger(L, a->largest());
+    lua_pushinteger(L, (lua_Integer)a->free_ranges.size());
+    return 4;
+}
+
+static int
+lgc(lua_State *L) {
+    auto a = to_allocator(L);
+    a->~range_allocator();
+    return 0;
+}
+
+static int
+lallocator(lua_State *L) {
+    const lua_Integer capacity = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, capacity > 0 && capacity <= (lua_Integer)UINT32_MAX, 1, "invalid capacity");
+    auto a = (range_allocator*)lua_newuserdatauv(L, sizeof(range_allocator), 0);
+    new (a) range_allocator((uint32_t)capacity);
+    if (luaL_newmetatable(L, "ANT_MESH_POOL_ALLOCATOR")) {
+        luaL_Reg l[] = {
+            { "alloc",  lalloc },
+            { "free",   lfree },
+            { "info",   linfo },
+            { nullptr,  nullptr },
+        };
+        luaL_newlib(L, l);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, lgc);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+extern "C" int
+luaopen_render_mesh_pool(lua_State *L) {
+    luaL_checkversion(L);
+    luaL_Reg l[] = {
+        { "allocator",  lallocator },
+        { nullptr,      nullptr },
+    };
+    luaL_newlib(L, l);
+    return 1;
+}
@@ -42,6 +42,14 @@ struct queue_node {
         }
     }
 
+    bool equal(const queue_node &n) const {
+        for (uint8_t ii=0; ii<NUM_MASK; ++ii){
+            if (masks[ii] != n.masks[ii])
+                return false;
+        }
+        return true;
+    }
+
     void set(queue_node &n, bool value) {
         if (value){
             for(uint8_t ii=0; ii<NUM_MASK; ++ii){
@@ -72,8 +80,14 @@ struct queue_container : public node_container<queue_node>{
     }
 
     inline void set(int Qidx, int nextQidx, bool value) {
+        const queue_node old = nodes[Qidx];
         nodes[Qidx].set(nodes[nextQidx], value);
+        if (!old.equal(nodes[Qidx])){
+            ++version;
+        }
     }
+
+    uint64_t version = 0;
 };
 
 struct queue_container* queue_create(){
@@ -100,6 +114,10 @@ void queue_fetch(struct queue_container* Q, int Qidx, uint64_t *outmasks){
     return Q->fetch(Qidx, outmasks);
 }
 
+uint64_t queue_version(struct queue_container* Q){
+    return Q->version;
+}
+
 int
 queue_dealloc(struct queue_container* Q, int Qidx){
     if (Q->isvalid(Qidx)){
@@ -140,8 +158,11 @@ lqueue_set(lua_State *L){
     }
 
     const uint8_t queue = (uint8_t)luaL_checkinteger(L, 2);
-    const int value = lua_toboolean(L, 3);
-    queue_set(w->Q, Qidx, queue, value != 0);
+    const bool value = lua_toboolean(L, 3) != 0;
+    if (queue_check(w->Q, Qidx, queue) != value){
+        queue_set(w->Q, Qidx, queue, value);
+        ++w->Q->version;
+    }
     return 0;
 }
 
@@ -12,4 +12,6 @@ int queue_dealloc(struct queue_container* Q, int Qidx);
 bool queue_check(struct queue_container* Q, int Qidx, uint8_t queue);
 void queue_set(struct queue_container* Q, int Qidx, uint8_t queue, bool value);
 void queue_set_by_index(struct queue_container *Q, int Qidx, int nextQidx, bool value);
-void queue_fetch(struct queue_container* Q, int Qidx, uint64_t *outmasks);
\ No newline at end of file
+void queue_fetch(struct queue_container* Q, int Qidx, uint64_t *outmasks);
+// changed whenever the visible/cull masks of any object changed, scratch queues set by queue_set in C don't count
+uint64_t queue_version(struct queue_container* Q);
\ No newline at end of file
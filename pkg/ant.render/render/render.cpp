@@ -13,6 +13,9 @@ extern "C"{
 #include "queue.h"
 #include "hash.h"
 #include "mesh.h"
+#include "efk_transforms.h"
+#include "profiler.h"
+#include "scene_packed.h"
 
 #include "lua.hpp"
 #include "luabgfx.h"
@@ -26,6 +29,9 @@ extern "C"{
 #include <memory.h>
 #include <string.h>
 #include <algorithm>
+#include <cmath>
+#include <mutex>
+#include <cstdio>
 struct transform {
 	uint32_t tid;
 	uint32_t stride;
@@ -63,14 +69,23 @@ struct obj_transforms {
 
 	void clear(){
 		memset(keys, 0, sizeof(keys));
+		hits = allocs = 0;
 	}
+
+	// read by submit_stat, reset every frame
+	uint32_t	hits = 0;
+	uint32_t	allocs = 0;
 };
 
+// slot: bounding.slot, the world matrix is read from scene.packed when it's enabled and still matches ro->worldmat
 static inline transform
-update_transform(struct ecs_world* w, const component::render_object *ro, const math_t& hwm, obj_transforms &trans){
+update_transform(struct ecs_world* w, const component::render_object *ro, const math_t& hwm, obj_transforms &trans, int slot = -1){
 	auto key = obj_transforms::key{ro, hwm, obj_transforms::key::hash_idx(ro, hwm)};
 	transform t;
-	if (!trans.check(key, t)){
+	if (trans.check(key, t)){
+		++trans.hits;
+	} else {
+		++trans.allocs;
 		const math_t wm = ro->worldmat;
 		assert(math_valid(w->math3d->M, wm) && !math_isnull(wm) && "Invalid world mat");
 		const int num = math_size(w->math3d->M, wm);
@@ -78,8 +93,11 @@ update_transform(struct ecs_world* w, const component::render_object *ro, const
 		bgfx_transform_t bt;
 		t.tid = w->bgfx->encoder_alloc_transform(w->holder->encoder, &bt, (uint16_t)num);
 		t.stride = num;
+		PROFILE_COUNTER_ADD("render.transforms", num);
 		if(math_isnull(hwm)){
-			const float * v = math_value(w->math3d->M, wm);
+			const float * v = (w->PACKED && slot >= 0 && num == 1) ? w->PACKED->worldmat(slot, wm.idx) : nullptr;
+			if (v == nullptr)
+				v = math_value(w->math3d->M, wm);
 			memcpy(bt.data, v, sizeof(float)*16*num);
 		} else{
 			math_t r = math_ref(w->math3d->M, bt.data, MATH_TYPE_MAT, t.stride);
@@ -101,36 +119,141 @@ static bool obj_visible(struct queue_container* Q, const ObjType &o, uint8_t qid
 			!queue_check(Q, o.cull_idx, qidx);
 }
 
+enum queue_type : uint8_t{
+	main_queue = 0,
+	pre_depth_queue,
+	csm1_queue,
+	csm2_queue,
+	csm3_queue,
+	csm4_queue,
+	efk_queue,
+	UNKNOW_queue,
+	Count_queue = UNKNOW_queue,
+};
+
+// Per queue submit counters, always on. The render thread accumulates the counters of the current frame
+// and lrender_submit publishes them into a rolling window of WINDOW frames. render.cache.submit_stat
+// doesn't need the world, so other services (like the bgfx debug overlay) can read it.
+enum submit_counter : uint8_t {
+	SC_collected = 0,	// objects visible in the queue
+	SC_culled,			// objects visible in the queue, but culled
+	SC_submitted,		// objects submitted
+	SC_instances,		// instances of draw_indirect objects
+	SC_transforms,		// transforms allocated
+	SC_transform_hits,	// transforms found in obj_transforms
+	SC_hitch_expanded,	// extra draws of the hitch objects, one for each hitch matrix except the first one
+	SC_COUNT,
+};
+
+static const char* SUBMIT_COUNTER_NAMES[SC_COUNT] = {
+	"collected", "culled", "submitted", "instances", "transforms", "transform_hits", "hitch_expanded",
+};
+
+struct submit_stat {
+	static constexpr uint32_t WINDOW = 60;
+	using counters = std::array<uint32_t, SC_COUNT>;
+
+	// render thread only
+	counters	current[MAX_VISIBLE_QUEUE] = {};
+
+	std::mutex	mutex;
+	counters	history[WINDOW][MAX_VISIBLE_QUEUE] = {};
+	uint64_t	sum[MAX_VISIBLE_QUEUE][SC_COUNT] = {};
+	char		names[MAX_VISIBLE_QUEUE][32] = {};
+	uint64_t	used = 0;	// queues ever submitted
+	uint64_t	frame = 0;
+
+	void add(uint8_t qidx, submit_counter c, uint32_t v){
+		current[qidx][c] += v;
+	}
+
+	void set_name(uint8_t qidx, const char* name){
+		std::lock_guard<std::mutex> lock(mutex);
+		snprintf(names[qidx], sizeof(names[qidx]), "%s", name);
+	}
+
+	void publish(){
+		std::lock_guard<std::mutex> lock(mutex);
+		auto &h = history[frame % WINDOW];
+		for (uint8_t qidx=0; qidx<MAX_VISIBLE_QUEUE; ++qidx){
+			auto &c = current[qidx];
+			bool active = false;
+			for (uint8_t ic=0; ic<SC_COUNT; ++ic){
+				sum[qidx][ic] += c[ic];
+				sum[qidx][ic] -= h[qidx][ic];
+				active = active || c[ic] != 0;
+			}
+			h[qidx] = c;
+			if (active)
+				used |= (1ull << qidx);
+			c = {};
+		}
+		++frame;
+	}
+};
+
+static submit_stat SUBMIT_STAT;
+
+// queues culled by gpu for draw_indirect objects, see draw_indirect/draw_indirect.lua
+static constexpr uint8_t MAX_GPU_CULL_QUEUE = csm4_queue + 1;
+
+static_assert(MESH_LOD_QUEUE == MAX_GPU_CULL_QUEUE, "mesh lod queues should be: main, pre_depth, csm1~csm4");
+
+// pre_depth_queue draws with the lod selected by main_queue: the main pass depth test is EQUAL against
+// the prepass depth, so both passes must rasterize the same triangles
+static inline uint8_t
+mesh_lod(const struct mesh_node *mesh, queue_type qt){
+	if (qt == pre_depth_queue)
+		qt = main_queue;
+	return (qt < MESH_LOD_QUEUE && mesh->lod_num > 1) ? mesh->lod_current[qt] : 0;
+}
+
+static inline void
+vertex_buffer_submit(struct ecs_world* w, uint8_t stream, const buffer_node &vb, bool indirect){
+	// indirect draws carry the base vertex in the draw arguments, so the buffer is bound from vertex 0.
+	// backends don't agree on whether startVertex is added to it
+	const uint32_t start = indirect ? 0 : vb.start;
+	const uint32_t num = indirect ? vb.start + vb.num : vb.num;
+	switch (BUFFER_TYPE(vb.handle)){
+		case BGFX_HANDLE_VERTEX_BUFFER:	w->bgfx->encoder_set_vertex_buffer(w->holder->encoder, stream, bgfx_vertex_buffer_handle_t{(uint16_t)vb.handle}, start, num); break;
+		case BGFX_HANDLE_DYNAMIC_VERTEX_BUFFER_TYPELESS:	//walk through
+		case BGFX_HANDLE_DYNAMIC_VERTEX_BUFFER: w->bgfx->encoder_set_dynamic_vertex_buffer(w->holder->encoder, stream, bgfx_dynamic_vertex_buffer_handle_t{(uint16_t)vb.handle}, start, num); break;
+		default: assert(false && "Invalid vertex buffer type");
+	}
+}
+
+// qt: select the index range of the lod for this queue, UNKNOW_queue for lod0
+// meshes loaded from meshbin share pooled buffers (see ant.asset/ext_meshbin.lua), they differ only by start
 static bool
-mesh_submit(struct ecs_world* w, const component::render_object* ro,  int vid){
+mesh_submit(struct ecs_world* w, const component::render_object* ro,  int vid, queue_type qt, bool indirect = false){
 	auto mesh = mesh_fetch(w->MESH, ro->mesh_idx);
 	const auto& vb0 = mesh->buffers[BT_vertexbuffer0];
 	assert(vb0.isvalid());
-	const uint16_t vb_type = BUFFER_TYPE(vb0.handle);
-	
-	switch (vb_type){
-		case BGFX_HANDLE_VERTEX_BUFFER:	w->bgfx->encoder_set_vertex_buffer(w->holder->encoder, 0, bgfx_vertex_buffer_handle_t{(uint16_t)vb0.handle}, vb0.start, vb0.num); break;
-		case BGFX_HANDLE_DYNAMIC_VERTEX_BUFFER_TYPELESS:	//walk through
-		case BGFX_HANDLE_DYNAMIC_VERTEX_BUFFER: w->bgfx->encoder_set_dynamic_vertex_buffer(w->holder->encoder, 0, bgfx_dynamic_vertex_buffer_handle_t{(uint16_t)vb0.handle}, vb0.start, vb0.num); break;
-		default: assert(false && "Invalid vertex buffer type");
-	}
+	vertex_buffer_submit(w, 0, vb0, indirect);
 
 	const auto& vb1 = mesh->buffers[BT_vertexbuffer1];
 	if((vb1.isvalid())){
-		switch (BUFFER_TYPE(vb1.handle)){
-			case BGFX_HANDLE_VERTEX_BUFFER:	w->bgfx->encoder_set_vertex_buffer(w->holder->encoder, 1, bgfx_vertex_buffer_handle_t{(uint16_t)vb1.handle}, vb1.start, vb1.num); break;
-			case BGFX_HANDLE_DYNAMIC_VERTEX_BUFFER_TYPELESS:	//walk through
-			case BGFX_HANDLE_DYNAMIC_VERTEX_BUFFER: w->bgfx->encoder_set_dynamic_vertex_buffer(w->holder->encoder, 1, bgfx_dynamic_vertex_buffer_handle_t{(uint16_t)vb1.handle}, vb1.start, vb1.num); break;
-			default: assert(false && "Invalid vertex buffer type");
-		}
+		// one base vertex for both streams, pooled vb/vb2 are allocated at the same start
+		assert(!indirect || vb1.start == vb0.start);
+		vertex_buffer_submit(w, 1, vb1, indirect);
 	}
 
 	const auto& ib = mesh->buffers[BT_indexbuffer];
 	if (ib.num > 0){
+		uint32_t start = ib.start, num = ib.num;
+		const uint8_t lod = mesh_lod(mesh, qt);
+		if (lod > 0){
+			start	= mesh->lods[lod].start;
+			num		= mesh->lods[lod].num;
+		}
+		if (indirect){
+			num		= start + num;
+			start	= 0;
+		}
 		switch (BUFFER_TYPE(ib.handle)){
-			case BGFX_HANDLE_INDEX_BUFFER: w->bgfx->encoder_set_index_buffer(w->holder->encoder, bgfx_index_buffer_handle_t{(uint16_t)ib.handle}, ib.start, ib.num); break;
+			case BGFX_HANDLE_INDEX_BUFFER: w->bgfx->encoder_set_index_buffer(w->holder->encoder, bgfx_index_buffer_handle_t{(uint16_t)ib.handle}, start, num); break;
 			case BGFX_HANDLE_DYNAMIC_INDEX_BUFFER:	//walk through
-			case BGFX_HANDLE_DYNAMIC_INDEX_BUFFER_32: w->bgfx->encoder_set_dynamic_index_buffer(w->holder->encoder, bgfx_dynamic_index_buffer_handle_t{(uint16_t)ib.handle}, ib.start, ib.num); break;
+			case BGFX_HANDLE_DYNAMIC_INDEX_BUFFER_32: w->bgfx->encoder_set_dynamic_index_buffer(w->holder->encoder, bgfx_dynamic_index_buffer_handle_t{(uint16_t)ib.handle}, start, num); break;
 			default: assert(false && "Unknown index buffer type"); break;
 		}
 	}
@@ -148,17 +271,14 @@ get_material(struct render_material * R, uint32_t rmidx, size_t midx){
 
 using matrix_array = std::vector<math_t>;
 
-//TODO: maybe move to another c module
-static constexpr uint16_t MAX_EFK_HITCH = 256;
 static inline void
-submit_efk_obj(lua_State* L, struct ecs_world* w, const component::efk_object *eo, const matrix_array& mats){
+submit_efk_obj(struct ecs_world* w, const component::efk_object *eo, const matrix_array& mats, efk_transforms::buffer &b){
 	for (auto m : mats){
-		if (entity_count(w->ecs, ecs::component_id<component::efk_hitch>) >= MAX_EFK_HITCH){
-			luaL_error(L, "Too many 'efk_hitch' object");
-		}
-		auto *eh = (component::efk_hitch*)entity_component_temp(w->ecs, ecs::component_id<component::efk_hitch_tag>, ecs::component_id<component::efk_hitch>);
-		eh->handle		= eo->handle;
-		eh->hitchmat	= (uintptr_t)math_value(w->math3d->M, math3d_mul_matrix(w->math3d->M, m, eo->worldmat));
+		b.emplace_back();
+		auto &t = b.back();
+		t.handle = eo->handle;
+		math_t r = math_ref(w->math3d->M, t.mat, MATH_TYPE_MAT, 1);
+		math3d_mul_matrix_array(w->math3d->M, m, eo->worldmat, r);
 	}
 }
 
@@ -191,12 +311,13 @@ static inline void
 draw_indirect_obj(lua_State *L, struct ecs_world *w, bgfx_view_id_t viewid,
 	const component::render_object *ro, const component::indirect_object* io,
 	const struct material_instance *mi, uint32_t material_idx, bgfx_program_handle_t prog,
-	uint8_t discardflags, obj_transforms &trans){
+	queue_type qt, uint8_t discardflags, obj_transforms &trans){
 	if (io->draw_num == 0){
 		return ;
 	}
 	apply_material_instance(L, mi, w);
-	mesh_submit(w, ro, viewid);
+	// all instances share one mesh, use lod0
+	mesh_submit(w, ro, viewid, UNKNOW_queue, true);
 
 	const auto itb = bgfx_dynamic_vertex_buffer_handle_t{(uint16_t)io->itb_handle};
 	assert(BGFX_HANDLE_IS_VALID(itb));
@@ -204,6 +325,16 @@ draw_indirect_obj(lua_State *L, struct ecs_world *w, bgfx_view_id_t viewid,
 
 	transform t = update_transform(w, ro, MATH_NULL, trans);
 	w->bgfx->encoder_set_transform_cached(w->holder->encoder, t.tid, t.stride);
+	PROFILE_COUNTER_ADD("render.draws", 1);
+
+	if (qt < MAX_GPU_CULL_QUEUE && (io->cull_mask & (1 << qt))){
+		// survived draws of queue 'qt' are compacted into region 'qt', the draw number is read from cull_num[qt]
+		const auto cidb = bgfx_indirect_buffer_handle_t{(uint16_t)io->cull_idb};
+		const auto cnum = bgfx_index_buffer_handle_t{(uint16_t)io->cull_num};
+		assert(BGFX_HANDLE_IS_VALID(cidb) && BGFX_HANDLE_IS_VALID(cnum));
+		w->bgfx->encoder_submit_indirect_count(w->holder->encoder, viewid, prog, cidb, qt * io->draw_num, cnum, qt, io->draw_num, ro->render_layer, discardflags);
+		return ;
+	}
 
 	const auto idb = bgfx_indirect_buffer_handle_t{(uint16_t)io->idb_handle};
 	assert(BGFX_HANDLE_IS_VALID(idb));
@@ -214,11 +345,11 @@ static inline void
 draw_obj(lua_State *L, struct ecs_world *w, bgfx_view_id_t viewid,
 	const component::render_object *ro, 
 	const struct material_instance *mi, uint32_t material_idx, bgfx_program_handle_t prog,
-	const matrix_array *mats, uint8_t discardflags,
-	obj_transforms &trans){
+	const matrix_array *mats, queue_type qt, uint8_t discardflags,
+	obj_transforms &trans, int slot = -1){
 
 	apply_material_instance(L, mi, w);
-	mesh_submit(w, ro, viewid);
+	mesh_submit(w, ro, viewid, qt);
 	
 	transform t;
 	if (mats){
@@ -229,39 +360,47 @@ draw_obj(lua_State *L, struct ecs_world *w, bgfx_view_id_t viewid,
 		}
 		t = update_transform(w, ro, mats->back(), trans);
 	} else {
-		t = update_transform(w, ro, MATH_NULL, trans);
+		t = update_transform(w, ro, MATH_NULL, trans, slot);
 	}
 
 	w->bgfx->encoder_set_transform_cached(w->holder->encoder, t.tid, t.stride);
 	w->bgfx->encoder_submit(w->holder->encoder, viewid, prog, ro->render_layer, discardflags);
+	PROFILE_COUNTER_ADD("render.draws", mats ? mats->size() : 1);
 }
 
 //using group_queues = std::array<matrix_array, MAX_VISIBLE_QUEUE>;
 using group_collection = std::unordered_map<int, matrix_array>;
 
-static constexpr uint16_t MAX_SUBMIT_NUM = 4096;
-enum queue_type : uint8_t{
-	main_queue = 0,
-	pre_depth_queue,
-	csm1_queue,
-	csm2_queue,
-	csm3_queue,
-	csm4_queue,
-	efk_queue,
-	UNKNOW_queue,
-	Count_queue = UNKNOW_queue,
+// per queue lod selection parameters, set by render.cache.set_lod_view
+struct lod_view {
+	float eye[3];
+	float scale;	// pixels per world unit at distance 1 (perspective) or for any distance (ortho), divided by the allowed pixel error
+	bool ortho;
+	bool valid;
 };
 
+static constexpr uint16_t MAX_SUBMIT_NUM = 4096;
 struct submit_context {
 	lua_State *L = nullptr;
 	struct ecs_world* w = nullptr;
 	const component::render_args* ra[MAX_VISIBLE_QUEUE];
-	queue_type queue_types[MAX_VISIBLE_QUEUE] = {UNKNOW_queue};
+	queue_type queue_types[MAX_VISIBLE_QUEUE];
 	uint8_t ra_count = 0;
 
 	int Qidx = -1;
 	uint64_t queuemasks[MAX_VISIBLE_QUEUE/64];
 
+	lod_view lod_views[MESH_LOD_QUEUE];
+	float lod_hysteresis = 0.15f;
+
+	// owned by the efk context, set by render.cache.set_efk_transforms
+	struct efk_transforms *efk = nullptr;
+
+	submit_context(){
+		std::fill(std::begin(queue_types), std::end(queue_types), UNKNOW_queue);
+		memset(lod_views, 0, sizeof(lod_views));
+	}
+
 	void init_render_args(){
 		ra_count = 0;
 		if (Qidx == -1){
@@ -283,24 +422,61 @@ struct submit_context {
 	}
 };
 
+// Draw list of the simple objects, kept between frames. It has two levels:
+//  objects: selected from ecs, only rebuilt when the ecs structure or the render materials allocation changed
+//  queues: visible objects and their material of each render_args, rebuilt when the visible/cull masks,
+//          the render materials or the render_args changed
+// Transforms, mesh buffers and material properties are read at submit time, so they don't invalidate anything.
 struct obj_submitter {
 	struct obj {
 		const component::render_object *ro;
 		const component::indirect_object *io;
+		int slot;
 	#ifdef RENDER_DEBUG
 		component::eid eid;
 	#endif //RENDER_DEBUG
 	};
 
-	void add(const component::render_object *ro, const component::indirect_object *io){
-		assert(num < MAX_SUBMIT_NUM);
-		objects[num++] = obj_submitter::obj{ro, io};
+	struct draw_item {
+		const component::render_object *ro;
+		const component::indirect_object *io;
+		struct material_instance *mi;
+		int slot;
+	};
+
+	struct ecs_signature {
+		const void* ro_base;
+		const void* io_base;
+		size_t ro_num;
+		size_t io_num;
+		size_t ro_visible_num;
+		size_t visible_num;
+
+		bool operator==(const ecs_signature &o) const {
+			return 0 == memcmp(this, &o, sizeof(*this));
+		}
+
+		void fetch(struct ecs_context *ecs){
+			auto ros = ecs::array<component::render_object>(ecs);
+			auto ios = ecs::array<component::indirect_object>(ecs);
+			memset(this, 0, sizeof(*this));
+			ro_base			= ros.data();
+			io_base			= ios.data();
+			ro_num			= ros.size();
+			io_num			= ios.size();
+			ro_visible_num	= ecs::count<component::render_object_visible>(ecs);
+			visible_num		= ecs::count<component::visible>(ecs);
+		}
+	};
+
+	void add(const component::render_object *ro, const component::indirect_object *io, int slot){
+		objects.emplace_back(obj{ro, io, slot});
 	}
 
 	#ifdef RENDER_DEBUG
 	void append_eid(component::eid eid){
-		assert(num > 0);
-		objects[num-1].eid = eid;
+		assert(!objects.empty());
+		objects.back().eid = eid;
 	}
 	#endif //RENDER_DEBUG
 
@@ -308,60 +484,181 @@ struct obj_submitter {
 	void sort(){}
 
 	void submit(obj_transforms &trans){
-		
 		for (uint8_t ii=0; ii<ctx->ra_count; ++ii){
 			auto ra = ctx->ra[ii];
-			for (uint16_t is=0; is<num; ++is){
-				const obj& so = objects[is];
-				if (!obj_visible(ctx->w->Q, *so.ro, ra->queue_index))
-					continue;
-
-				auto mi = find_submit_material(ctx->L, ctx->w, ra, so.ro->rm_idx);
-				if (!mi)
+			const uint32_t hits = trans.hits, allocs = trans.allocs;
+			uint32_t submitted = 0, instances = 0;
+			for (const auto& di : queues[ii]){
+				if (!find_submit_mesh(ctx->w, di.ro, di.io))
 					continue;
 
-				const auto prog = material_prog(ctx->L, mi);
+				const auto prog = material_prog(ctx->L, di.mi);
 				if (!BGFX_HANDLE_IS_VALID(prog))
 					continue;
 
-				if (so.io){
-					draw_indirect_obj(ctx->L, ctx->w, ra->viewid, so.ro, so.io, mi, ra->material_index, prog, BGFX_DISCARD_ALL, trans);
+				if (di.io){
+					draw_indirect_obj(ctx->L, ctx->w, ra->viewid, di.ro, di.io, di.mi, ra->material_index, prog, ctx->queue_types[ra->queue_index], BGFX_DISCARD_ALL, trans);
+					instances += di.io->draw_num;
 				} else {
-					draw_obj(ctx->L, ctx->w, ra->viewid, so.ro, mi, ra->material_index, prog, nullptr, BGFX_DISCARD_ALL, trans);
+					draw_obj(ctx->L, ctx->w, ra->viewid, di.ro, di.mi, ra->material_index, prog, nullptr, ctx->queue_types[ra->queue_index], BGFX_DISCARD_ALL, trans, di.slot);
 				}
+				++submitted;
 			}
 			//ctx->w->bgfx->encoder_discard(w->holder->encoder, BGFX_DISCARD_ALL);
-		}
 
+			const uint8_t qidx = ra->queue_index;
+			SUBMIT_STAT.add(qidx, SC_collected,		collected[ii]);
+			SUBMIT_STAT.add(qidx, SC_culled,		culled[ii]);
+			SUBMIT_STAT.add(qidx, SC_submitted,		submitted);
+			SUBMIT_STAT.add(qidx, SC_instances,		instances);
+			SUBMIT_STAT.add(qidx, SC_transforms,	trans.allocs - allocs);
+			SUBMIT_STAT.add(qidx, SC_transform_hits,trans.hits - hits);
+		}
 	}
 
-	void collect(){
+	void collect_objects(){
+		objects.clear();
 		// draw simple objects
 		for (auto& e : ecs::select<component::render_object_visible, component::visible, component::render_object>(ctx->w->ecs)) {
 			const component::indirect_object* io = e.component<component::indirect_object>();
 			const auto ro = &e.get<component::render_object>();
-
-			if (!find_submit_mesh(ctx->w, ro, io))
-				continue;
-
-			add(ro, io);
+			const auto b = ctx->w->PACKED ? e.component<component::bounding>() : nullptr;
+			add(ro, io, b ? b->slot : -1);
 		#ifdef RENDER_DEBUG
 			append_eid(e.component<component::eid>());
 		#endif //RENDER_DEBUG
 		}
 	}
 
+	void collect_queues(){
+		for (uint8_t ii=0; ii<ctx->ra_count; ++ii){
+			auto ra = ctx->ra[ii];
+			auto &q = queues[ii];
+			q.clear();
+			collected[ii] = culled[ii] = 0;
+			for (const auto &o : objects){
+				if (!queue_check(ctx->w->Q, o.ro->visible_idx, ra->queue_index))
+					continue;
+				++collected[ii];
+				if (queue_check(ctx->w->Q, o.ro->cull_idx, ra->queue_index)){
+					++culled[ii];
+					continue;
+				}
+
+				auto mi = get_material(ctx->w->R, o.ro->rm_idx, ra->material_index);
+				if (mi){
+					q.emplace_back(draw_item{o.ro, o.io, mi, o.slot});
+				}
+			}
+		}
+	}
+
+	// Select lod by the projected error of the bounding sphere, 1 pixel error after lod_view::scale applied.
+	// Hysteresis keeps the lod until its error is clearly out of the range, so objects near the switch
+	// distance don't pop every frame.
+	uint8_t select_lod(const struct mesh_node *mesh, const float *wm, const lod_view &lv, uint8_t cur) const {
+		const float *c = mesh->center;
+		float maxscale2 = 0.f;
+		for (int ii=0; ii<3; ++ii){
+			const float *col = wm + ii*4;
+			maxscale2 = std::max(maxscale2, col[0]*col[0]+col[1]*col[1]+col[2]*col[2]);
+		}
+		const float maxscale = sqrtf(maxscale2);
+
+		float pixels = lv.scale * maxscale;
+		if (!lv.ortho){
+			float d2 = 0.f;
+			for (int ii=0; ii<3; ++ii){
+				const float wc = wm[ii]*c[0] + wm[4+ii]*c[1] + wm[8+ii]*c[2] + wm[12+ii];
+				const float d = wc - lv.eye[ii];
+				d2 += d * d;
+			}
+			const float dist = sqrtf(d2) - mesh->radius * maxscale;
+			if (dist <= 1e-3f)
+				return 0;
+			pixels /= dist;
+		}
+
+		const float h = ctx->lod_hysteresis;
+		uint8_t lod = std::min<uint8_t>(cur, mesh->lod_num-1);
+		while (lod+1 < mesh->lod_num && mesh->lods[lod+1].error * pixels <= 1.f - h)
+			++lod;
+		while (lod > 0 && mesh->lods[lod].error * pixels > 1.f + h)
+			--lod;
+		return lod;
+	}
+
+	void select_lods(){
+		for (uint8_t ii=0; ii<ctx->ra_count; ++ii){
+			const auto qt = ctx->queue_types[ctx->ra[ii]->queue_index];
+			if (qt >= MESH_LOD_QUEUE || qt == pre_depth_queue || !ctx->lod_views[qt].valid)
+				continue;
+			const auto &lv = ctx->lod_views[qt];
+			for (const auto &di : queues[ii]){
+				if (di.io)
+					continue;
+				auto mesh = mesh_fetch_lod(ctx->w->MESH, di.ro->mesh_idx);
+				if (mesh == nullptr || math_isnull(di.ro->worldmat))
+					continue;
+				const float *wm = (ctx->w->PACKED && di.slot >= 0) ? ctx->w->PACKED->worldmat(di.slot, di.ro->worldmat.idx) : nullptr;
+				if (wm == nullptr)
+					wm = math_value(ctx->w->math3d->M, di.ro->worldmat);
+				mesh->lod_current[qt] = select_lod(mesh, wm, lv, mesh->lod_current[qt]);
+			}
+		}
+	}
+
+	bool render_args_changed() const {
+		if (ra_count != ctx->ra_count)
+			return true;
+		for (uint8_t ii=0; ii<ra_count; ++ii){
+			if (0 != memcmp(&ra[ii], ctx->ra[ii], sizeof(component::render_args)))
+				return true;
+		}
+		return false;
+	}
+
+	void collect(uint64_t structure_version, uint64_t material_version){
+		ecs_signature sig;
+		sig.fetch(ctx->w->ecs);
+		bool queues_dirty = false;
+		if (!(sig == signature) || structure_version != cached_structure_version){
+			collect_objects();
+			signature = sig;
+			cached_structure_version = structure_version;
+			queues_dirty = true;
+		}
+
+		const uint64_t qv = queue_version(ctx->w->Q);
+		if (queues_dirty || qv != cached_queue_version || material_version != cached_material_version || render_args_changed()){
+			collect_queues();
+			cached_queue_version = qv;
+			cached_material_version = material_version;
+			ra_count = ctx->ra_count;
+			for (uint8_t ii=0; ii<ra_count; ++ii){
+				ra[ii] = *ctx->ra[ii];
+			}
+		}
+		select_lods();
+	}
+
 	void clear(){
 		ctx = nullptr;
-		num = 0;
 	}
 
 	submit_context *ctx = nullptr;
-	obj objects[MAX_SUBMIT_NUM];
-	uint16_t num = 0;
-
-	//TODO
-	//uint16_t submit_queues[MAX_VISIBLE_QUEUE][MAX_SUBMIT_NUM];
+	std::vector<obj> objects;
+	std::vector<draw_item> queues[MAX_VISIBLE_QUEUE];
+	// counted by collect_queues, for submit_stat
+	uint32_t collected[MAX_VISIBLE_QUEUE] = {};
+	uint32_t culled[MAX_VISIBLE_QUEUE] = {};
+
+	ecs_signature signature = {};
+	uint64_t cached_structure_version = UINT64_MAX;
+	uint64_t cached_queue_version = UINT64_MAX;
+	uint64_t cached_material_version = UINT64_MAX;
+	component::render_args ra[MAX_VISIBLE_QUEUE];
+	uint8_t ra_count = 0;
 };
 
 struct hitch_submitter {
@@ -383,19 +680,31 @@ struct hitch_submitter {
 		#endif //RENDER_DEBUG
 
 		void submit(submit_context *ctx, const component::render_args* ra, obj_transforms &trans) {
+			const uint32_t hits = trans.hits, allocs = trans.allocs;
+			uint32_t collected = 0, submitted = 0, expanded = 0;
 			for (uint16_t ih=0; ih<num; ++ih){
 				const obj& h = objects[ih];
 				if (h.g->empty() || !queue_check(ctx->w->Q, h.ro->visible_idx, ra->queue_index))
 					continue;
 
+				++collected;
 				auto mi = find_submit_material(ctx->L, ctx->w, ra, h.ro->rm_idx);
 				if (mi){
 					const auto prog = material_prog(ctx->L, mi);
 					if (BGFX_HANDLE_IS_VALID(prog)){
-						draw_obj(ctx->L, ctx->w, ra->viewid, h.ro, mi, ra->material_index, prog, h.g, BGFX_DISCARD_ALL, trans);
+						draw_obj(ctx->L, ctx->w, ra->viewid, h.ro, mi, ra->material_index, prog, h.g, UNKNOW_queue, BGFX_DISCARD_ALL, trans);
+						++submitted;
+						expanded += (uint32_t)h.g->size() - 1;
 					}
 				}
 			}
+
+			const uint8_t qidx = ra->queue_index;
+			SUBMIT_STAT.add(qidx, SC_collected,		collected);
+			SUBMIT_STAT.add(qidx, SC_submitted,		submitted);
+			SUBMIT_STAT.add(qidx, SC_hitch_expanded,expanded);
+			SUBMIT_STAT.add(qidx, SC_transforms,	trans.allocs - allocs);
+			SUBMIT_STAT.add(qidx, SC_transform_hits,trans.hits - hits);
 		}
 
 		void add(const component::render_object *ro, const matrix_array* g){
@@ -433,13 +742,17 @@ struct hitch_submitter {
 		}
 
 		void submit(const submit_context *ctx) {
-			ecs::clear_type<component::efk_hitch>(ctx->w->ecs);
+			if (ctx->efk == nullptr)
+				return;
+			auto &b = ctx->efk->begin_write();
 			for (uint16_t ie=0; ie<num; ++ie){
 				const obj& o = objects[ie];
 				if (!o.g->empty()){
-					submit_efk_obj(ctx->L, ctx->w, o.eo, *(o.g));
+					submit_efk_obj(ctx->w, o.eo, *(o.g), b);
 				}
 			}
+			// publish an empty list too, the efk thread hides the hitch efks not in the list
+			ctx->efk->publish();
 		}
 
 		void clear() {
@@ -524,6 +837,9 @@ struct hitch_submitter {
 						const auto eo = e.component<component::efk_object>();
 						if (eo && queue_check(ctx->w->Q, eo->visible_idx, efk_qidx)){
 							efks.add(eo, &g);
+							SUBMIT_STAT.add(efk_qidx, SC_collected, 1);
+							SUBMIT_STAT.add(efk_qidx, SC_submitted, 1);
+							SUBMIT_STAT.add(efk_qidx, SC_hitch_expanded, (uint32_t)g.size() - 1);
 							#ifdef RENDER_DEBUG
 							efks.append_eid(eid);
 							#endif //RENDER_DEBUG
@@ -558,21 +874,15 @@ struct hitch_submitter {
 struct submit_cache{
 	obj_transforms	transforms;
 
+	// bumped when render objects are allocated/deallocated, or by render.cache.invalidate
+	uint64_t		structure_version = 0;
+	// bumped when the material instances of render objects changed
+	uint64_t		material_version = 0;
+
 	submit_context		ctx;
 	obj_submitter		obj;
 	hitch_submitter		hitch;
 
-#ifdef RENDER_DEBUG
-	struct submit_stat{
-		uint32_t hitch_submit;
-		uint32_t simple_submit;
-		uint32_t efk_hitch_submit;
-		uint32_t hitch_count;
-	};
-
-	submit_stat stat;
-#endif //RENDER_DEBUG
-
 	void init(lua_State *L, struct ecs_world *w){
 		ctx.init(L, w);
 		obj.ctx = hitch.ctx = &ctx;
@@ -582,10 +892,6 @@ struct submit_cache{
 		transforms.clear();
 		obj.clear();
 		hitch.clear();
-
-#ifdef RENDER_DEBUG
-		memset(&stat, 0, sizeof(stat));
-#endif //RENDER_DEBUG
 	}
 };
 
@@ -595,9 +901,11 @@ struct submit_cache{
 
 static int
 lrender_submit(lua_State *L) {
+	PROFILE_ZONE("render.submit");
 	auto w = getworld(L);
 	w->submit_cache->obj.submit(w->submit_cache->transforms);
 	w->submit_cache->hitch.submit(w->submit_cache->transforms);
+	SUBMIT_STAT.publish();
 
 	w->submit_cache->clear();
 	return 0;
@@ -605,12 +913,13 @@ lrender_submit(lua_State *L) {
 
 static int
 lrender_correct(lua_State *L){
+	PROFILE_ZONE("render.collect");
 	auto w = getworld(L);
 	w->submit_cache->init(L, w);
 
-	w->submit_cache->obj.collect();
+	w->submit_cache->obj.collect(w->submit_cache->structure_version, w->submit_cache->material_version);
 	w->submit_cache->hitch.collect();
-	// submit efk here, to make efk thread can submit parallel with world render submit
+	// publish efk transforms here, to make efk thread can update parallel with world render submit
 	w->submit_cache->hitch.collect_submit_efks();
 	return 0;
 }
@@ -638,6 +947,7 @@ lrm_dealloc(lua_State *L){
 	auto w = getworld(L);
 	const int index = (int)luaL_checkinteger(L, 1);
 	render_material_dealloc(w->R, index);
+	++w->submit_cache->structure_version;
 	return 0;
 }
 
@@ -645,6 +955,7 @@ static int
 lrm_alloc(lua_State *L){
 	auto w = getworld(L);
 	lua_pushinteger(L, render_material_alloc(w->R));
+	++w->submit_cache->structure_version;
 	return 1;
 }
 
@@ -667,6 +978,7 @@ lrm_set(lua_State *L){
 	const auto m = lua_touserdata(L, 3);
 
 	render_material_set(w->R, index, type, m);
+	++w->submit_cache->material_version;
 	return 0;
 }
 
@@ -713,49 +1025,149 @@ lexit(lua_State *L){
 	return 0;
 }
 
+static void
+push_counters(lua_State *L, const uint64_t *v, uint32_t div, const char* name){
+	lua_createtable(L, 0, SC_COUNT);
+	for (uint8_t ic=0; ic<SC_COUNT; ++ic){
+		if (div > 1){
+			lua_pushnumber(L, (lua_Number)v[ic] / div);
+		} else {
+			lua_pushinteger(L, (lua_Integer)v[ic]);
+		}
+		lua_setfield(L, -2, SUBMIT_COUNTER_NAMES[ic]);
+	}
+	lua_setfield(L, -2, name);
+}
+
+// return {frame = n, window = frames in avg/peak, {name, index, last = {...}, avg = {...}, peak = {...}}, ...}
+// queues are sorted by queue index, the counters are named as SUBMIT_COUNTER_NAMES
 static int
 lsubmit_stat(lua_State *L){
-	lua_createtable(L, 0, 4);
-//TODO
-//#ifdef RENDER_DEBUG
-//	lua_pushinteger(L, cc.stat.hitch_submit);
-//	lua_setfield(L, -2, "hitch_submit");
-//
-//	lua_pushinteger(L, cc.stat.simple_submit);
-//	lua_setfield(L, -2, "simple_submit");
-//
-//	lua_pushinteger(L, cc.stat.efk_hitch_submit);
-//	lua_setfield(L, -2, "efk_hitch_submit");
-//
-//	lua_pushinteger(L, cc.stat.hitch_count);
-//	lua_setfield(L, -2, "hitch_count");
-//#endif //RENDER_DEBUG
+	auto &ss = SUBMIT_STAT;
+	std::lock_guard<std::mutex> lock(ss.mutex);
+	lua_createtable(L, 0, 2);
+	if (ss.frame == 0)
+		return 1;
+
+	const uint32_t window = (uint32_t)std::min<uint64_t>(ss.frame, submit_stat::WINDOW);
+	const auto &last = ss.history[(ss.frame-1) % submit_stat::WINDOW];
+	lua_pushinteger(L, (lua_Integer)ss.frame);
+	lua_setfield(L, -2, "frame");
+	lua_pushinteger(L, window);
+	lua_setfield(L, -2, "window");
+
+	int n = 0;
+	for (uint8_t qidx=0; qidx<MAX_VISIBLE_QUEUE; ++qidx){
+		if (0 == (ss.used & (1ull << qidx)))
+			continue;
+		lua_createtable(L, 0, 5);
+		if (ss.names[qidx][0]){
+			lua_pushstring(L, ss.names[qidx]);
+		} else {
+			lua_pushfstring(L, "queue%d", (int)qidx);
+		}
+		lua_setfield(L, -2, "name");
+		lua_pushinteger(L, qidx);
+		lua_setfield(L, -2, "index");
+
+		uint64_t v[SC_COUNT], peak[SC_COUNT] = {};
+		for (uint8_t ic=0; ic<SC_COUNT; ++ic){
+			v[ic] = last[qidx][ic];
+			for (uint32_t ih=0; ih<window; ++ih){
+				peak[ic] = std::max<uint64_t>(peak[ic], ss.history[ih][qidx][ic]);
+			}
+		}
+		push_counters(L, v, 1, "last");
+		push_counters(L, ss.sum[qidx], window, "avg");
+		push_counters(L, peak, 1, "peak");
+		lua_rawseti(L, -2, ++n);
+	}
 	return 1;
 }
 
+// name a queue in submit_stat, set_queue_type names the queue too. It doesn't need the world
+static int
+lset_queue_name(lua_State *L){
+	const auto qidx = luaL_checkinteger(L, 1);
+	luaL_argcheck(L, 0 <= qidx && qidx < MAX_VISIBLE_QUEUE, 1, "invalid queue index");
+	SUBMIT_STAT.set_name((uint8_t)qidx, luaL_checkstring(L, 2));
+	return 0;
+}
+
+// tags toggled in the same frame may keep the entity counts unchanged, the ecs signature can't see them
+static int
+linvalidate(lua_State *L){
+	auto w = getworld(L);
+	++w->submit_cache->structure_version;
+	return 0;
+}
+
+// the static queue of a cascade shares the camera of the cascade, so they share the lod view too
+static queue_type
+to_queue_type(const char* queuename){
+	if (0 == strcmp(queuename, "main_queue")){
+		return queue_type::main_queue;
+	} else if (0 == strcmp(queuename, "pre_depth_queue")){
+		return queue_type::pre_depth_queue;
+	} else if (0 == strcmp(queuename, "csm1_queue") || 0 == strcmp(queuename, "csm1_static_queue")){
+		return queue_type::csm1_queue;
+	} else if (0 == strcmp(queuename, "csm2_queue") || 0 == strcmp(queuename, "csm2_static_queue")){
+		return queue_type::csm2_queue;
+	} else if (0 == strcmp(queuename, "csm3_queue") || 0 == strcmp(queuename, "csm3_static_queue")){
+		return queue_type::csm3_queue;
+	} else if (0 == strcmp(queuename, "csm4_queue") || 0 == strcmp(queuename, "csm4_static_queue")){
+		return queue_type::csm4_queue;
+	} else if (0 == strcmp(queuename, "efk_queue")){
+		return queue_type::efk_queue;
+	}
+	return queue_type::UNKNOW_queue;
+}
+
 static int
 lset_queue_type(lua_State *L){
 	auto w = getworld(L);
 	auto queue_types = w->submit_cache->ctx.queue_types;
 	const char* queuename = lua_tostring(L, 1);
 	const uint8_t qidx = (uint8_t)lua_tointeger(L, 2);
-	if (0 == strcmp(queuename, "main_queue")){
-		queue_types[qidx] = queue_type::main_queue;
-	} else if (0 == strcmp(queuename, "pre_depth_queue")){
-		queue_types[qidx] = queue_type::pre_depth_queue;
-	} else if (0 == strcmp(queuename, "csm1_queue")){
-		queue_types[qidx] = queue_type::csm1_queue;
-	} else if (0 == strcmp(queuename, "csm2_queue")){
-		queue_types[qidx] = queue_type::csm2_queue;
-	} else if (0 == strcmp(queuename, "csm3_queue")){
-		queue_types[qidx] = queue_type::csm3_queue;
-	} else if (0 == strcmp(queuename, "csm4_queue")){
-		queue_types[qidx] = queue_type::csm4_queue;
-	} else if (0 == strcmp(queuename, "efk_queue")){
-		queue_types[qidx] = queue_type::efk_queue;
-	} else {
-		queue_types[qidx] = queue_type::UNKNOW_queue;
+	queue_types[qidx] = to_queue_type(queuename);
+	SUBMIT_STAT.set_name(qidx, queuename);
+	return 0;
+}
+
+// set_lod_view(queuename, eyex, eyey, eyez, scale, ortho), set_lod_view(queuename) to use lod0 in this queue
+static int
+lset_lod_view(lua_State *L){
+	auto w = getworld(L);
+	const auto qt = to_queue_type(luaL_checkstring(L, 1));
+	if (qt >= MESH_LOD_QUEUE){
+		return luaL_error(L, "queue:%s do not support lod", lua_tostring(L, 1));
+	}
+	auto &lv = w->submit_cache->ctx.lod_views[qt];
+	if (lua_isnoneornil(L, 2)){
+		lv.valid = false;
+		return 0;
 	}
+	for (int ii=0; ii<3; ++ii){
+		lv.eye[ii] = (float)luaL_checknumber(L, 2+ii);
+	}
+	lv.scale = (float)luaL_checknumber(L, 5);
+	lv.ortho = lua_toboolean(L, 6);
+	lv.valid = true;
+	return 0;
+}
+
+// set_efk_transforms(efk_transforms lightuserdata), set_efk_transforms() before the efk context destroyed
+static int
+lset_efk_transforms(lua_State *L){
+	auto w = getworld(L);
+	w->submit_cache->ctx.efk = (struct efk_transforms*)lua_touserdata(L, 1);
+	return 0;
+}
+
+static int
+lset_lod_hysteresis(lua_State *L){
+	auto w = getworld(L);
+	w->submit_cache->ctx.lod_hysteresis = (float)luaL_checknumber(L, 1);
 	return 0;
 }
 
@@ -765,6 +1177,11 @@ luaopen_render_cache(lua_State *L){
 	luaL_Reg l[] = {
 		{ "submit_stat",	lsubmit_stat},
 		{ "set_queue_type", lset_queue_type},
+		{ "set_queue_name", lset_queue_name},
+		{ "set_lod_view",	lset_lod_view},
+		{ "set_lod_hysteresis", lset_lod_hysteresis},
+		{ "set_efk_transforms", lset_efk_transforms},
+		{ "invalidate",		linvalidate},
 		{ nullptr, 			nullptr},
 	};
 	luaL_newlibtable(L,l);
@@ -818,7 +1235,7 @@ lentity_draw(lua_State *L){
 		const auto prog = material_prog(L, mi);
 		if (BGFX_HANDLE_IS_VALID(prog) && find_submit_mesh(w, ro, nullptr)){
 			apply_material_instance(L, mi, w);
-			mesh_submit(w, ro, ra->viewid);
+			mesh_submit(w, ro, ra->viewid, UNKNOW_queue);
 			set_world_transform(w, ro->worldmat);
 			
 			w->bgfx->encoder_submit(w->holder->encoder, ra->viewid, prog, ro->render_layer, BGFX_DISCARD_ALL);
@@ -29,6 +29,10 @@ local irq       = ecs.require "ant.render|renderqueue"
 local CLUSTER_SIZE<const>               = CLUSTER_SHADING.size
 local CLUSTER_COUNT<const>              = CLUSTER_SIZE[1] * CLUSTER_SIZE[2] * CLUSTER_SIZE[3]
 local CLUSTER_MAX_LIGHT_COUNT<const>    = CLUSTER_SHADING.max_light
+--build cluster aabb and cull lights in cpu, for the devices without compute shader support or few lights
+local CPU_CULL<const>                   = CLUSTER_SHADING.cpu_cull
+
+local LIGHT                             = world:clibs "render.light"
 
 --[[
     struct light_grids {
@@ -97,7 +101,6 @@ local CLUSTER_BUILDAABB_EID, CLUSTER_LIGHTCULL_EID
 
 local main_viewid<const> = hwi.viewid_get "main_view"
 
-local cr_camera_mb      = world:sub{"main_queue", "camera_changed"}
 
 local function create_compute_entity(material)
     return world:create_entity{
@@ -125,6 +128,9 @@ local function create_compute_entity(material)
 end
 
 function cfs:init()
+    if CPU_CULL then
+        return
+    end
     CLUSTER_BUILDAABB_EID = create_compute_entity "/pkg/ant.resources/materials/cluster_build.material"
     CLUSTER_LIGHTCULL_EID = create_compute_entity "/pkg/ant.resources/materials/cluster_light_cull.material"
 end
@@ -143,6 +149,10 @@ function cfs:init_world()
     --render
     update_scene_render_param()
 
+    if CPU_CULL then
+        return
+    end
+
     --build
     local be = world:entity(CLUSTER_BUILDAABB_EID, "dispatch:in")
     local bmi = be.dispatch.material
@@ -160,46 +170,64 @@ function cfs:init_world()
     --cmi.b_global_index_count        = create_buffer_property(cluster_buffers.global_index_count,   "cull")
 end
 
-local function cull_lights(viewid)
-    if true then --irq.main_camera_changed() then
-        local e = world:entity(CLUSTER_LIGHTCULL_EID, "dispatch:in")
-        icompute.dispatch(viewid, e.dispatch)
-    end
-end
+local cluster_aabb_key
 
+--cluster aabb only depend on the projection and the view rect
 local function check_rebuild_cluster_aabb()
-    local C
-    for _ in cr_camera_mb:each() do
-        C = irq.main_camera_entity()
+    local C = irq.main_camera_entity()
+    w:extend(C, "camera:in")
+    local f = C.camera.frustum
+    local mq = w:first "main_queue render_target:in"
+    local vr = mq.render_target.view_rect
+    local key = ("%s|%s|%s|%s|%s|%s|%s|%s|%s|%d|%d"):format(
+        f.ortho, f.n, f.f, f.fov, f.aspect, f.l, f.r, f.t, f.b, vr.w, vr.h)
+    if key == cluster_aabb_key then
+        return false
     end
+    cluster_aabb_key = key
+
+    local near, far = f.n, f.f
+    local num_depth_slices = CLUSTER_SIZE[3]
+    local log_farnear   = math.log(far/near, 2)
+    local log_near      = math.log(near, 2)
+
+    imaterial.system_attrib_update("u_cluster_shading_param", math3d.vector(
+        num_depth_slices / log_farnear, -num_depth_slices * log_near / log_farnear,
+        vr.w / CLUSTER_SIZE[1], vr.h/CLUSTER_SIZE[2]))
+
+    --no invz, no infinite far, could not use C.camera.projmat
+    local invproj = math3d.inverse(math3d.projmat(f))
+    if CPU_CULL then
+        local caps = bgfx.get_caps()
+        LIGHT.cluster_build(invproj, vr.w, vr.h,
+            CLUSTER_SIZE[1], CLUSTER_SIZE[2], CLUSTER_SIZE[3],
+            near, far, caps.homogeneousDepth, caps.originBottomLeft)
+    else
+        local be = world:entity(CLUSTER_BUILDAABB_EID, "dispatch:in")
+        be.dispatch.material["u_normal_inv_proj"] = invproj
+        icompute.dispatch(main_viewid, be.dispatch)
+    end
+    return true
+end
 
-    if not C then
-        C = irq.main_camera_changed()
+local function cull_lights(viewid, rebuilt)
+    if not (rebuilt or ilight.light_changed() or irq.main_camera_changed()) then
+        return
     end
-    if true then --C then
-        C = irq.main_camera_entity()
+    if CPU_CULL then
+        local C = irq.main_camera_entity()
         w:extend(C, "camera:in")
-        local f = C.camera.frustum
-        local near, far = f.n, f.f
-        local num_depth_slices = CLUSTER_SIZE[3]
-        local log_farnear   = math.log(far/near, 2)
-        local log_near      = math.log(near, 2)
-    
-        local mq = w:first "main_queue render_target:in"
-        local vr = mq.render_target.view_rect
-    
-        imaterial.system_attrib_update("u_cluster_shading_param", math3d.vector(
-            num_depth_slices / log_farnear, -num_depth_slices * log_near / log_farnear,
-            vr.w / CLUSTER_SIZE[1], vr.h/CLUSTER_SIZE[2]))
-
-        local be = world:entity(CLUSTER_BUILDAABB_EID, "dispatch:in")
-        --no invz, no infinite far, could not use C.camera.projmat
-        be.dispatch.material["u_normal_inv_proj"] = math3d.inverse(math3d.projmat(C.camera.frustum))
-        icompute.dispatch(main_viewid, be.dispatch)
+        LIGHT.cluster_cull(C.camera.viewmat,
+            cluster_buffers.light_grids.handle,
+            cluster_buffers.light_index_lists.handle,
+            CLUSTER_MAX_LIGHT_COUNT)
+    else
+        local e = world:entity(CLUSTER_LIGHTCULL_EID, "dispatch:in")
+        icompute.dispatch(viewid, e.dispatch)
     end
 end
 
 function cfs:render_preprocess()
-    check_rebuild_cluster_aabb()
-    cull_lights(main_viewid)
+    local rebuilt = check_rebuild_cluster_aabb()
+    cull_lights(main_viewid, rebuilt)
 end
@@ -5,6 +5,11 @@ local w = world.w
 local assetmgr  = import_package "ant.asset"
 local setting		= import_package "ant.settings"
 local ENABLE_PRE_DEPTH<const>	= not setting:get "graphic/disable_pre_z"
+local ENABLE_LOD<const>			= setting:get "graphic/lod/enable"
+local LOD_PIXEL_ERROR<const>	= setting:get "graphic/lod/pixel_error" or 1.0
+local LOD_SHADOW_SCALE<const>	= setting:get "graphic/lod/shadow_error_scale" or 1.0
+local LOD_HYSTERESIS<const>		= setting:get "graphic/lod/hysteresis" or 0.15
+local PACKED_STORAGE<const>		= setting:get "graphic/packed_storage"
 
 local L			= import_package "ant.render.core".layout
 
@@ -15,6 +20,7 @@ local math3d 	= require "math3d"
 
 local Q			= world:clibs "render.queue"
 local MESH		= world:clibs "render.mesh"
+local PACKED	= world:clibs "scene.packed"
 
 local queuemgr	= ecs.require "queue_mgr"
 
@@ -58,13 +64,32 @@ function render_sys:device_check()
 	end
 end
 
+-- must be enabled before any entity created, entities without a slot are never packed
+function render_sys:init()
+	PACKED.enable(PACKED_STORAGE)
+end
+
+function render_sys:exit()
+	PACKED.enable(false)
+end
+
 function render_sys:start_frame()
 	assetmgr.material_check()
 end
 
 function render_sys:post_init()
+	for qn, qidx in queuemgr.queues() do
+		RC.set_queue_name(qidx, qn)
+	end
 	RC.set_queue_type("main_queue", queuemgr.queue_index "main_queue")
 	RC.set_queue_type("pre_depth_queue", queuemgr.queue_index "pre_depth_queue")
+	for i=1, 4 do
+		local qn = ("csm%d_queue"):format(i)
+		RC.set_queue_type(qn, queuemgr.queue_index(qn))
+		local sqn = ("csm%d_static_queue"):format(i)
+		RC.set_queue_type(sqn, queuemgr.queue_index(sqn))
+	end
+	RC.set_lod_hysteresis(LOD_HYSTERESIS)
 end
 
 local function update_ro(ro, m)
@@ -80,6 +105,24 @@ local function update_ro(ro, m)
 	if ib then
 		MESH.set(ro.mesh_idx, "ib", ib.start, ib.num, ib.handle)
 	end
+
+	local lods = m.lods
+	if lods and ib and m.bounding then
+		local aabb = m.bounding.aabb
+		local minv, maxv = aabb[1], aabb[2]
+		local cx, cy, cz = (minv[1]+maxv[1])*0.5, (minv[2]+maxv[2])*0.5, (minv[3]+maxv[3])*0.5
+		local dx, dy, dz = maxv[1]-minv[1], maxv[2]-minv[2], maxv[3]-minv[3]
+		local l = {{start=ib.start, num=ib.num, error=0}}
+		-- lods are generated relative to the ib, a pooled ib starts at 'offset' in the shared buffer
+		local offset = ib.offset or 0
+		for i = 1, #lods do
+			local lod = lods[i]
+			l[i+1] = {start=lod.start+offset, num=lod.num, error=lod.error}
+		end
+		MESH.set_lods(ro.mesh_idx, l, cx, cy, cz, math.sqrt(dx*dx+dy*dy+dz*dz)*0.5)
+	else
+		MESH.set_lods(ro.mesh_idx)
+	end
 end
 
 local RENDER_ARGS = setmetatable({}, {__index = function (t, k)
@@ -311,11 +354,49 @@ function render_sys:follow_scene_update()
 	end
 end
 
+local LOD_QUEUES<const> = {
+	main_queue		= 1.0,
+	-- pre_depth_queue reuses the lod of main_queue, see mesh_lod in render.cpp
+	csm1_queue		= LOD_SHADOW_SCALE,
+	csm2_queue		= LOD_SHADOW_SCALE,
+	csm3_queue		= LOD_SHADOW_SCALE,
+	csm4_queue		= LOD_SHADOW_SCALE,
+	csm1_static_queue	= LOD_SHADOW_SCALE,
+	csm2_static_queue	= LOD_SHADOW_SCALE,
+	csm3_static_queue	= LOD_SHADOW_SCALE,
+	csm4_static_queue	= LOD_SHADOW_SCALE,
+}
+
+-- lod is selected in render_collect with the projected size of the mesh bounding, shadow queues allow larger error
+local function update_lod_view(qe)
+	local errorscale = LOD_QUEUES[qe.queue_name]
+	if not errorscale then
+		return
+	end
+	w:extend(qe, "camera_ref?in")
+	local ce = qe.camera_ref and world:entity(qe.camera_ref, "camera:in")
+	if not ce then
+		RC.set_lod_view(qe.queue_name)
+		return
+	end
+	local camera = ce.camera
+	local vr = qe.render_target.view_rect
+	-- projmat[2][2] maps view space y to ndc, half of the viewport height is ndc 1
+	local pixels = math3d.index(math3d.index(camera.projmat, 2), 2) * vr.h * 0.5
+	local scale = pixels / (LOD_PIXEL_ERROR * errorscale)
+	local eye = math3d.index(math3d.inverse_fast(camera.viewmat), 4)
+	local ex, ey, ez = math3d.index(eye, 1, 2, 3)
+	RC.set_lod_view(qe.queue_name, ex, ey, ez, scale, camera.frustum.ortho)
+end
+
 function render_sys:update_render_args()
 	w:clear "render_args"
 	if not irender.stop_draw() then
 		for qe in w:select "submit_queue visible queue_name:in render_target:in render_args:new" do
 			add_render_arg(qe)
+			if ENABLE_LOD then
+				update_lod_view(qe)
+			end
 		end
 	end
 end
@@ -56,6 +56,25 @@ local TEXTURE_BIAS_MATRIX<const> = mu.texture_bias_matrix
 
 local SHADOW_PARAM<const>	= math3d.ref(math3d.vector(NORMAL_OFFSET, 1.0/SM_SIZE, ics.split_num, 0.0))
 
+-- Static casters are rendered into a cached shadow map by the csmN_static queues, only when a cascade is invalid:
+-- its snapped projection changed, or the static caster set changed. Every frame the cached layers are blit into the
+-- shadow map, and only the dynamic casters are rendered on top of them by the csmN queues.
+local STATIC_CACHE<const>	= setting:get "graphic/shadow/static_cache" and bgfx.get_caps().supported.TEXTURE_BLIT
+-- a caster must keep still in these frames before it's moved into the cache
+local STATIC_FRAMES<const>	= setting:get "graphic/shadow/static_frames" or 30
+
+local CACHE = {
+	handle		= nil,	-- cached depth, a texture array as the shadow map
+	sm_handle	= nil,
+	valid		= {},	-- [index] = true when the cached layer matches the cascade
+	viewproj	= {},	-- [index] = serialized viewproj matrix of the cached layer
+	rendering	= {},	-- [index] = true when the static queue is visible
+}
+local CANDIDATES	= {}	-- eid -> true, casters could be cached
+local PENDING		= {}	-- eid -> frame of its last change, candidates not cached yet
+local FRAME			= 0
+local cache_mb
+
 local function calc_focus_matrix(aabb)
 	local center, extents = math3d.aabb_center_extents(aabb)
 
@@ -105,6 +124,37 @@ local function create_csm_entity(index, vr, fbidx)
 			render_target = {
 				viewid = hwi.viewid_get(csmname),
 				view_rect = {x=vr.x, y=vr.y, w=vr.w, h=vr.h},
+				clear_state = {
+					--the cached layer is blit into the shadow map instead of clear
+					clear = STATIC_CACHE and "" or "D",
+					depth = CLEAR_DEPTH_VALUE,
+				},
+				fb_idx = fbidx,
+			},
+			visible = false,
+			queue_name = queuename,
+			submit_queue = true,
+			[queuename] = true,
+		},
+	}
+	return camera_ref
+end
+
+local function create_csm_static_entity(index, vr, fbidx, camera_ref)
+	local queuename = ("csm%d_static_queue"):format(index)
+	world:create_entity {
+		policy = {
+			"ant.render|render_queue",
+			"ant.render|csm_static_queue",
+		},
+		data = {
+			csm_static = {
+				index = index,
+			},
+			camera_ref = camera_ref,
+			render_target = {
+				viewid = hwi.viewid_get(("csm%d_static"):format(index)),
+				view_rect = {x=vr.x, y=vr.y, w=vr.w, h=vr.h},
 				clear_state = {
 					clear = "D",
 					depth = CLEAR_DEPTH_VALUE,
@@ -147,9 +197,30 @@ function shadow_sys:init()
 			V="BORDER",
 			COMPARE="COMPARE_GEQUAL",
 			BOARD_COLOR="0",
+			BLIT=STATIC_CACHE and "BLIT_AS_DST" or nil,
 		},
 	}
 
+	local cache_rb
+	if STATIC_CACHE then
+		cache_rb = fbmgr.create_rb{
+			format = "D16",
+			w=SM_SIZE,
+			h=SM_SIZE,
+			layers=math.max(2, ics.split_num),
+			flags=sampler{
+				RT="RT_ON",
+				MIN="POINT",
+				MAG="POINT",
+				U="CLAMP",
+				V="CLAMP",
+			},
+		}
+		CACHE.handle = fbmgr.get_rb(cache_rb).handle
+		CACHE.sm_handle = fbmgr.get_rb(rb_arrays).handle
+		cache_mb = world:sub {"shadow_cache"}
+	end
+
 	local function create_fb(rb, refidx)
 		return fbmgr.create{
 				rbidx = rb,
@@ -162,7 +233,10 @@ function shadow_sys:init()
 
 	for ii=1, ics.split_num do
 		local vr = {x=0, y=0, w=SM_SIZE, h=SM_SIZE}
-		create_csm_entity(ii, vr, create_fb(rb_arrays, ii))
+		local camera_ref = create_csm_entity(ii, vr, create_fb(rb_arrays, ii))
+		if STATIC_CACHE then
+			create_csm_static_entity(ii, vr, create_fb(cache_rb, ii), camera_ref)
+		end
 		fg.register_pass("csm" .. ii, {
 			init = function () end,	--TODO
 			run = function () end,	--TODO
@@ -173,10 +247,30 @@ function shadow_sys:init()
 	imaterial.system_attrib_update("u_shadow_param1",	SHADOW_PARAM)
 end
 
+local function invalidate_cache()
+	for k in pairs(CACHE.valid) do
+		CACHE.valid[k] = false
+	end
+end
+
+local function set_static_queue_visible(e, enable)
+	local index = e.csm_static.index
+	if (CACHE.rendering[index] or false) ~= enable then
+		CACHE.rendering[index] = enable
+		irender.set_visible(e, enable)
+	end
+end
+
 local function set_csm_visible(enable)
 	for v in w:select "csm" do
 		irender.set_visible(v, enable)
 	end
+	if STATIC_CACHE then
+		for v in w:select "csm_static:in" do
+			set_static_queue_visible(v, false)
+		end
+		invalidate_cache()
+	end
 end
 
 function shadow_sys:entity_init()
@@ -193,6 +287,15 @@ function shadow_sys:entity_remove()
 	for _ in w:select "REMOVED csm_directional_light" do
 		set_csm_visible(false)
 	end
+
+	if STATIC_CACHE then
+		for e in w:select "REMOVED cast_shadow eid:in shadow_static?in" do
+			CANDIDATES[e.eid], PENDING[e.eid] = nil, nil
+			if e.shadow_static then
+				invalidate_cache()
+			end
+		end
+	end
 end
 
 local function mark_camera_changed(e)
@@ -240,6 +343,13 @@ local function move_camera_to_origin(li, intersectpointsLS, n, f)
 	return 0.0, f - n, intersectpointsLS
 end
 
+-- the cached layer is only valid with the same projection, snap the depth range to a power of 2 step,
+-- so it keeps still when the view moves a little
+local function snap_depth_range(n, f)
+	local step = 2 ^ math.ceil(math.log(math.max(f - n, 1e-3) / 8, 2))
+	return math.floor(n / step) * step, math.ceil(f / step) * step
+end
+
 local function update_shadow_matrices(si, li, c, viewfrustum)
 	local sp = math3d.projmat(viewfrustum)
 	local Lv2Ndc = math3d.mul(sp, li.Lv2Cv)
@@ -252,6 +362,9 @@ local function update_shadow_matrices(si, li, c, viewfrustum)
 		if moveCameraToOrigin then
 			n, f, intersectpointsLS = move_camera_to_origin(li, intersectpointsLS, n, f)
 		end
+		if STATIC_CACHE then
+			n, f = snap_depth_range(n, f)
+		end
 		c.frustum.n, c.frustum.f = n, f
 		si.nearLS, si.farLS = n, f
 		li.Lp = math3d.projmat(c.frustum, INV_Z)
@@ -269,6 +382,10 @@ local function init_light_info(C, D, li)
 	local Cv = C.camera.viewmat
 
 	local rightdir, viewdir, camerapos = math3d.index(C.scene.worldmat, 1, 3, 4)
+	if STATIC_CACHE then
+		--light view must not rotate with the camera, or the cached layers are invalid whenever the camera turns
+		rightdir = math.abs(math3d.dot(lightdirWS, mc.XAXIS)) < 0.99 and mc.XAXIS or mc.ZAXIS
+	end
 
 	local Lv = math3d.lookto(mc.ZERO_PT, lightdirWS, rightdir)
 	local Lw = math3d.inverse_fast(Lv)
@@ -336,7 +453,97 @@ local function shadow_changed()
 	end
 end
 
-function shadow_sys:update_camera_depend()
+local function set_static(e, static)
+	local vidx = e.render_object.visible_idx
+	if static then
+		if not ivm.check_by_idx(vidx, "cast_shadow") then
+			return
+		end
+		ivm.set_masks_by_idx(vidx, "cast_shadow", false)
+		ivm.set_masks_by_idx(vidx, "cast_static_shadow", true)
+	elseif ivm.check_by_idx(vidx, "cast_static_shadow") then
+		--cast_static_shadow is cleared when 'cast_shadow' mask is changed, keep it off
+		ivm.set_masks_by_idx(vidx, "cast_static_shadow", false)
+		ivm.set_masks_by_idx(vidx, "cast_shadow", true)
+	end
+	e.shadow_static = static
+	invalidate_cache()
+end
+
+local function update_static_casters()
+	FRAME = FRAME + 1
+	for _ in cache_mb:each() do
+		invalidate_cache()
+	end
+
+	local demoted = {}
+	for e in w:select "scene_changed shadow_static eid:in" do
+		demoted[#demoted+1] = e.eid
+	end
+	for e in w:select "shadow_static visible:absent eid:in" do
+		demoted[#demoted+1] = e.eid
+	end
+	for e in w:select "shadow_dynamic shadow_static eid:in" do
+		CANDIDATES[e.eid] = nil
+		demoted[#demoted+1] = e.eid
+	end
+	for _, eid in ipairs(demoted) do
+		local e <close> = world:entity(eid, "render_object:in shadow_static?update")
+		if e.shadow_static then
+			set_static(e, false)
+		end
+		PENDING[eid] = CANDIDATES[eid] and FRAME or nil
+	end
+
+	for e in w:select "scene_changed cast_shadow shadow_static:absent eid:in" do
+		if CANDIDATES[e.eid] then
+			PENDING[e.eid] = FRAME
+		end
+	end
+
+	for eid, f in pairs(PENDING) do
+		if FRAME - f >= STATIC_FRAMES then
+			local e <close> = world:entity(eid, "visible?in render_object:in shadow_dynamic?in shadow_static?out")
+			if not e or e.shadow_dynamic then
+				CANDIDATES[eid] = nil
+				PENDING[eid] = nil
+			elseif e.visible then
+				set_static(e, true)
+				PENDING[eid] = nil
+			end
+		end
+	end
+end
+
+local function check_cascade_cache(index, viewprojmat)
+	local vp = math3d.serialize(viewprojmat)
+	if CACHE.viewproj[index] ~= vp then
+		CACHE.viewproj[index] = vp
+		CACHE.valid[index] = false
+	end
+end
+
+-- render the invalid cascades into the cache in this frame, and blit all the cached layers into the shadow map
+local function submit_cache()
+	local active = w:first "csm visible"
+	for e in w:select "csm_static:in camera_ref:in" do
+		local index = e.csm_static.index
+		local render = active ~= nil and not CACHE.valid[index]
+		set_static_queue_visible(e, render)
+		if render then
+			-- update the view transform and cull result of the static queue
+			mark_camera_changed(world:entity(e.camera_ref, "camera:in"))
+			CACHE.valid[index] = true
+		end
+	end
+
+	for e in w:select "csm:in visible render_target:in" do
+		local layer = e.csm.index-1
+		bgfx.blit(e.render_target.viewid, CACHE.sm_handle, 0, 0, 0, layer, CACHE.handle, 0, 0, 0, layer, SM_SIZE, SM_SIZE, 1)
+	end
+end
+
+local function update_csm_cameras()
 	local changed, C, D, sb = shadow_changed()
 	if not changed then
 		return
@@ -370,11 +577,24 @@ function shadow_sys:update_camera_depend()
 
 		csm_matrices[csm.index].m = math3d.mul(TEXTURE_BIAS_MATRIX, c.viewprojmat)
 		split_distances_VS[csm.index] = viewfrustum.f
+		if STATIC_CACHE then
+			check_cascade_cache(csm.index, c.viewprojmat)
+		end
     end
 
 	commit_csm_matrices_attribs()
 end
 
+function shadow_sys:update_camera_depend()
+	if STATIC_CACHE then
+		update_static_casters()
+	end
+	update_csm_cameras()
+	if STATIC_CACHE then
+		submit_cache()
+	end
+end
+
 function shadow_sys:camera_usage()
 	w:clear "scene_bounding_changed"
 end
@@ -426,8 +646,14 @@ local function update_shadow_alpha_mask(e, mi)
 	end
 end
 
+-- skinned, animated and indirect drawn objects change every frame, they are never cached
+local function is_cache_candidate(e)
+	w:extend(e, "skinning?in draw_indirect?in animation?in dynamic_mesh?in shadow_dynamic?in")
+	return not (e.skinning or e.draw_indirect or e.animation or e.dynamic_mesh or e.shadow_dynamic)
+end
+
 function shadow_sys:entity_ready()
-    for e in w:select "filter_result render_object:in material:in bounding:in cast_shadow?out receive_shadow?out" do
+    for e in w:select "filter_result render_object:in material:in bounding:in eid:in cast_shadow?out receive_shadow?out" do
 		local mt = assetmgr.resource(e.material)
 		local hasaabb = e.bounding.aabb ~= mc.NULL
 		local receiveshadow = hasaabb and mt.fx.setting.receive_shadow == "on"
@@ -455,6 +681,11 @@ function shadow_sys:entity_ready()
 		end
 		e.cast_shadow		= castshadow
 		e.receive_shadow	= receiveshadow
+
+		if STATIC_CACHE and castshadow and is_cache_candidate(e) then
+			CANDIDATES[e.eid] = true
+			PENDING[e.eid] = FRAME
+		end
 	end
 end
 
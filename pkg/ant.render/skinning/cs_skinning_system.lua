@@ -17,6 +17,7 @@ local renderpkg = import_package "ant.render"
 local layoutmgr = renderpkg.layoutmgr
 
 local RM        = ecs.require "ant.material|material"
+local PACKED    = world:clibs "scene.packed"
 
 local hwi		= import_package "ant.hwi"
 local sk_viewid = hwi.viewid_get "skinning"
@@ -197,8 +198,10 @@ function cs_skinning_sys:skin_mesh()
             do_skinning_compute(skininfo)
 
 			if mc.NULL ~= e.bounding.aabb then
-				math3d.unmark(e.bounding.scene_aabb)
+				local old = e.bounding.scene_aabb
 				e.bounding.scene_aabb = math3d.mark(math3d.aabb_transform(worldmat, e.bounding.aabb))
+				math3d.unmark(old)
+				PACKED.update_aabb(e.bounding.slot, e.bounding.scene_aabb)
 			end
 		end
 	end
@@ -31,12 +31,32 @@ local MASK_MAPPER<const> = {
 			Q.set(vidx, queuemgr.queue_index "csm2_queue", v)
 			Q.set(vidx, queuemgr.queue_index "csm3_queue", v)
 			Q.set(vidx, queuemgr.queue_index "csm4_queue", v)
+			-- a static caster leaves the cached shadow map, shadow_system will cache it again when it keeps still
+			if Q.check(vidx, queuemgr.queue_index "csm1_static_queue") then
+				Q.set(vidx, queuemgr.queue_index "csm1_static_queue", false)
+				Q.set(vidx, queuemgr.queue_index "csm2_static_queue", false)
+				Q.set(vidx, queuemgr.queue_index "csm3_static_queue", false)
+				Q.set(vidx, queuemgr.queue_index "csm4_static_queue", false)
+				world:pub {"shadow_cache", "invalidate"}
+			end
 		end,
 		check = function (vidx)
-			return	Q.check(vidx, queuemgr.queue_index "csm1_queue") and
+			return	(Q.check(vidx, queuemgr.queue_index "csm1_queue") and
 					Q.check(vidx, queuemgr.queue_index "csm2_queue") and
 					Q.check(vidx, queuemgr.queue_index "csm3_queue") and
-					Q.check(vidx, queuemgr.queue_index "csm4_queue")
+					Q.check(vidx, queuemgr.queue_index "csm4_queue")) or
+					Q.check(vidx, queuemgr.queue_index "csm1_static_queue")
+		end,
+	},
+	cast_static_shadow = {
+		set = function (vidx, v)
+			Q.set(vidx, queuemgr.queue_index "csm1_static_queue", v)
+			Q.set(vidx, queuemgr.queue_index "csm2_static_queue", v)
+			Q.set(vidx, queuemgr.queue_index "csm3_static_queue", v)
+			Q.set(vidx, queuemgr.queue_index "csm4_static_queue", v)
+		end,
+		check = function (vidx)
+			return Q.check(vidx, queuemgr.queue_index "csm1_static_queue")
 		end,
 	},
 	outline = {
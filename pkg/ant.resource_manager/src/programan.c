@@ -10,7 +10,16 @@
 #define PROGRAM_MAX 0x8000
 #define REMOVE_MAX 1024
 #define INVALID_HANDLE 0xffff
+#define INVALID_ID 0xffff
+#define DEFAULT_BUDGET 8
 
+#define FLAG_LINKED 1
+#define FLAG_PINNED 2
+
+// Live programs are kept in an intrusive lru list (head is the most recent used).
+// program_get is called from the client threads, so it only writes the timestamp and the request flag, like before.
+// The list is only changed by the server: remove_old gives the programs touched since they were linked (timestamp != linkstamp)
+// a second chance by moving them to the head, and program_request returns at most .budget of the requested ids per frame.
 struct program_manager {
 	int max;
 	int n;
@@ -18,11 +27,19 @@ struct program_manager {
 	int threshold_reserved;
 	int id;
 	int removed_n;
+	int budget;
 	int request;
+	uint16_t lru_head;
+	uint16_t lru_tail;
 	uint32_t frame;
 	uint16_t map[PROGRAM_MAX];
+	uint16_t prev[PROGRAM_MAX];
+	uint16_t next[PROGRAM_MAX];
+	uint8_t flags[PROGRAM_MAX];
+	uint16_t removed_id[REMOVE_MAX];
 	uint16_t removed[REMOVE_MAX];
 	uint32_t timestamp[PROGRAM_MAX];
+	uint32_t linkstamp[PROGRAM_MAX];
 };
 
 static struct program_manager g_man;
@@ -35,11 +52,52 @@ checkid(lua_State *L, int index) {
 	return id;
 }
 
+static void
+lru_unlink(struct program_manager *M, int id) {
+	if (!(M->flags[id] & FLAG_LINKED))
+		return;
+	uint16_t p = M->prev[id];
+	uint16_t n = M->next[id];
+	if (p == INVALID_ID)
+		M->lru_head = n;
+	else
+		M->next[p] = n;
+	if (n == INVALID_ID)
+		M->lru_tail = p;
+	else
+		M->prev[n] = p;
+	M->flags[id] &= ~FLAG_LINKED;
+}
+
+static void
+lru_link(struct program_manager *M, int id) {
+	if (M->flags[id] & FLAG_PINNED)
+		return;
+	M->prev[id] = INVALID_ID;
+	M->next[id] = M->lru_head;
+	if (M->lru_head == INVALID_ID)
+		M->lru_tail = (uint16_t)id;
+	else
+		M->prev[M->lru_head] = (uint16_t)id;
+	M->lru_head = (uint16_t)id;
+	M->linkstamp[id] = M->timestamp[id];
+	M->flags[id] |= FLAG_LINKED;
+}
+
+// client side, see struct program_manager
+static inline void
+touch(struct program_manager *M, int id) {
+	M->timestamp[id] = M->frame;
+	if (M->map[id] == INVALID_HANDLE)
+		M->request = 1;
+}
+
 /*
 	{
 		max = bgfx.get_caps().limits.maxPrograms - bgfx.get_stats("n").numPrograms,
 		threshold = nil, -- default is max * 2 / 3,
 		reserved = nil, -- default is max / 2,
+		budget = nil, -- programs recreated per frame, default is 8
 	}
 */
 static int
@@ -47,6 +105,7 @@ lprogram_init(lua_State *L) {
 	luaL_checktype(L, 1, LUA_TTABLE);
 	int threshold_removed = 0;
 	int threshold_reserved = 0;
+	int budget = DEFAULT_BUDGET;
 	if (lua_getfield(L, 1, "max") != LUA_TNUMBER) {
 		return luaL_error(L, "Need program .max");
 	}
@@ -72,6 +131,12 @@ lprogram_init(lua_State *L) {
 	if (threshold_reserved > threshold_removed)
 		return luaL_error(L, ".reserved %d > .threshold %d", threshold_reserved, threshold_removed);
 	lua_pop(L, 1);
+	if (lua_getfield(L, 1, "budget") == LUA_TNUMBER) {
+		budget = (int)lua_tointeger(L, -1);
+		if (budget < 1)
+			return luaL_error(L, ".budget %d is too small", budget);
+	}
+	lua_pop(L, 1);
 	g_man.max = pmax;
 	g_man.n = 0;
 	g_man.threshold_removed = threshold_removed;
@@ -79,7 +144,10 @@ lprogram_init(lua_State *L) {
 	g_man.id = 0;
 	g_man.frame = 0;
 	g_man.removed_n = 0;
+	g_man.budget = budget;
 	g_man.request = 0;
+	g_man.lru_head = INVALID_ID;
+	g_man.lru_tail = INVALID_ID;
 	return 0;
 }
 
@@ -89,46 +157,33 @@ lprogram_new(lua_State *L) {
 		return luaL_error(L, "Too many program id");
 	int id = g_man.id++;
 	g_man.map[id] = INVALID_HANDLE;
+	g_man.flags[id] = 0;
 	g_man.timestamp[id] = g_man.frame;
 	lua_pushinteger(L, id+1);
 	return 1;
 }
 
-struct timehandle {
-	uint32_t life;
-	int id;
-};
-
-static int
-compar_timehandle(const void *a, const void *b) {
-	const struct timehandle *aa = (const struct timehandle *)a;
-	const struct timehandle *bb = (const struct timehandle *)b;
-	return (int)(bb->life - aa->life);
-}
-
+// evict from the lru tail until reserved, programs used in the current frame are kept
 static void
 remove_old(struct program_manager *M) {
-	int n = 0;
-	struct timehandle array[PROGRAM_MAX];
-	int i;
-	uint32_t current = M->frame;
-	for (i=0;i<M->id;i++) {
-		if (M->map[i] != INVALID_HANDLE) {
-			struct timehandle *h = &array[n++];
-			h->life = current - M->timestamp[i];
-			h->id = i;
-		}
-	}
-	qsort(array, n, sizeof(struct timehandle), compar_timehandle);
-	for (i=0;i<n;i++) {
-		if (M->n <= M->threshold_reserved)
+	while (M->n > M->threshold_reserved && M->removed_n < REMOVE_MAX) {
+		uint16_t id = M->lru_tail;
+		if (id == INVALID_ID)
 			return;
-		if (M->removed_n >= REMOVE_MAX)
+		uint32_t ts = M->timestamp[id];
+		if (ts != M->linkstamp[id]) {
+			// touched after it was linked, it's more recent than the programs in front of it
+			lru_unlink(M, id);
+			lru_link(M, id);
+			continue;
+		}
+		if (ts == M->frame)
 			return;
-		int id = array[i].id;
-		uint16_t h = M->map[id];
+		lru_unlink(M, id);
+		M->removed_id[M->removed_n] = id;
+		M->removed[M->removed_n] = M->map[id];
+		++M->removed_n;
 		M->map[id] = INVALID_HANDLE;
-		M->removed[M->removed_n++] = h;
 		--M->n;
 	}
 }
@@ -143,8 +198,10 @@ lprogram_set(lua_State *L) {
 	if (g_man.map[id] != INVALID_HANDLE)
 		return luaL_error(L, "Program id %d is already set", id + 1);
 	g_man.map[id] = handle;
+	g_man.timestamp[id] = g_man.frame;
+	lru_link(&g_man, id);
 	++g_man.n;
-	if (g_man.n > g_man.threshold_reserved)
+	if (g_man.n > g_man.threshold_removed)
 		remove_old(&g_man);
 	if (g_man.n + g_man.removed_n > g_man.max)
 		return luaL_error(L, "Too many programs in memory");
@@ -157,12 +214,30 @@ lprogram_reset(lua_State *L) {
 	--id;
 	if (g_man.map[id] == INVALID_HANDLE)
 		return 0;
+	lru_unlink(&g_man, id);
 	--g_man.n;
 	lua_pushinteger(L, g_man.map[id]);
 	g_man.map[id] = INVALID_HANDLE;
 	return 1;
 }
 
+// pinned programs are never evicted
+static int
+lprogram_pin(lua_State *L) {
+	int id = checkid(L, 1);
+	--id;
+	if (lua_toboolean(L, 2)) {
+		lru_unlink(&g_man, id);
+		g_man.flags[id] |= FLAG_PINNED;
+	} else if (g_man.flags[id] & FLAG_PINNED) {
+		g_man.flags[id] &= ~FLAG_PINNED;
+		if (g_man.map[id] != INVALID_HANDLE)
+			lru_link(&g_man, id);
+	}
+	return 0;
+}
+
+// returns { id1, handle1, id2, handle2, ... }, the handles are evicted from the map and should be destroyed
 static int
 lprogram_remove(lua_State *L) {
 	if (g_man.removed_n == 0)
@@ -170,25 +245,28 @@ lprogram_remove(lua_State *L) {
 	lua_settop(L, 1);
 	if (lua_isnil(L, 1)) {
 		lua_settop(L, 0);
-		lua_createtable(L, g_man.removed_n, 0);
+		lua_createtable(L, g_man.removed_n * 2, 0);
 	} else {
 		luaL_checktype(L, 1, LUA_TTABLE);
 	}
 	int n = (int)lua_rawlen(L, 1);
 	int i;
 	for (i=0;i<g_man.removed_n;i++) {
+		lua_pushinteger(L, g_man.removed_id[i] + 1);
+		lua_seti(L, 1, n + i * 2 + 1);
 		lua_pushinteger(L, g_man.removed[i]);
-		lua_seti(L, 1, n + i + 1);
+		lua_seti(L, 1, n + i * 2 + 2);
 	}
 	g_man.removed_n = 0;
 	return 1;
 }
 
+// the ids over .budget are still used, so they are requested again in the next frame
 static int
 lprogram_request(lua_State *L) {
 	if (!g_man.request) {
 		++g_man.frame;
-		return 0;		
+		return 0;
 	}
 	g_man.request = 0;
 	lua_settop(L, 1);
@@ -201,7 +279,7 @@ lprogram_request(lua_State *L) {
 	int i;
 	uint32_t frame = g_man.frame++;
 	int idx = 0;
-	for (i=0;i<g_man.id;i++) {
+	for (i=0;i<g_man.id && idx < g_man.budget;i++) {
 		if (g_man.timestamp[i] == frame && g_man.map[i] == INVALID_HANDLE) {
 			lua_pushinteger(L, i+1);
 			lua_seti(L, 1, ++idx);
@@ -214,12 +292,10 @@ static int
 lprogram_get(lua_State *L) {
 	int id = checkid(L, 1);
 	--id;
+	touch(&g_man, id);
 	uint16_t h = g_man.map[id];
-	g_man.timestamp[id] = g_man.frame;
 	int luahandle = (BGFX_HANDLE_PROGRAM << 16) | h;
 	lua_pushinteger(L, luahandle);
-	if (h != INVALID_HANDLE)
-		g_man.request = 1;
 	return 1;
 }
 
@@ -229,11 +305,8 @@ program_get(int id) {
 	if (id <= 0 || id > g_man.id)
 		return handle;
 	--id;
-	uint16_t h = g_man.map[id];
-	g_man.timestamp[id] = g_man.frame;
-	handle.idx = h;
-	if (h != INVALID_HANDLE)
-		g_man.request = 1;
+	touch(&g_man, id);
+	handle.idx = g_man.map[id];
 	return handle;
 }
 
@@ -257,6 +330,7 @@ luaopen_programan_server(lua_State *L) {
 		{ "program_new", lprogram_new },
 		{ "program_set", lprogram_set },
 		{ "program_reset", lprogram_reset },
+		{ "program_pin", lprogram_pin },
 		{ "program_remove", lprogram_remove },
 		{ "program_request", lprogram_request },
 		{ NULL, NULL },
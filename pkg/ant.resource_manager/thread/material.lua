@@ -173,8 +173,6 @@ end
 
 local MATERIALS = {}
 
-local MATERIAL_MARKED = {}
-
 local function build_fxcfg(filename, fx)
     local function stage_filename(stage)
         if fx[stage] then
@@ -282,23 +280,24 @@ function S.material_create(filename)
     return material, attribute
 end
 
+-- marked programs are pinned in PM, they are never evicted
 function S.material_mark(pid)
-    MATERIAL_MARKED[pid] = true
+    PM.program_pin(pid, true)
 end
 
 function S.material_unmark(pid)
-    MATERIAL_MARKED[pid] = nil
+    PM.program_pin(pid, false)
 end
 
-local function material_destroy(fx)
-    -- why? PM only keep 16 bit data(it's bgfx handle data), but program type in high 16 bit with int32 data, we need to recover the type for handle when destroy
-    local function make_prog_handle(h)
-        assert(h ~= 0xffff)
-        --handle type, see: luabgfx.h:7, with enum BGFX_HANDLE
-        local PROG_TYPE<const> = 1
-        return (PROG_TYPE<<16)|h
-    end
+-- why? PM only keep 16 bit data(it's bgfx handle data), but program type in high 16 bit with int32 data, we need to recover the type for handle when destroy
+local function make_prog_handle(h)
+    assert(h ~= 0xffff)
+    --handle type, see: luabgfx.h:7, with enum BGFX_HANDLE
+    local PROG_TYPE<const> = 1
+    return (PROG_TYPE<<16)|h
+end
 
+local function material_destroy(fx)
     --DO NOT clean fx.prog to nil
     local h = PM.program_reset(fx.prog)
     if h then
@@ -328,36 +327,40 @@ function S.material_destroy(material)
     end
 end
 
--- local REMOVED_PROGIDS = {}
--- local REQUEST_PROGIDS = {}
+-- evicted programs only destroy the program handle, the shader handles of fx are kept,
+-- so recreating a program doesn't read and create the shaders again
+local function recreate_program(fx)
+    if fx.cs then
+        return bgfx.create_program(fx.cs, false)
+    elseif fx.fs then
+        return bgfx.create_program(fx.vs, fx.fs, false)
+    else
+        return bgfx.create_program(fx.vs, false)
+    end
+end
 
 function S.material_check()
     local removed = PM.program_remove()
     if removed then
-        for _, removeid in ipairs(removed) do
-            if nil == MATERIAL_MARKED[removeid] then
-                local mi = assert(MATERIALS[removeid])
-                local fx = get_fx(mi.material.fx, mi.type)
-                log.info(("Remove prog:%d, from file:%s"):format(removeid, mi.filename))
-                -- we just destroy bgfx program handle and shader handles, but not remove 'material' from cpu side
-                
-                material_destroy(fx)
-            end
+        for i = 1, #removed, 2 do
+            local removeid, h = removed[i], removed[i+1]
+            local mi = MATERIALS[removeid]
+            log.info(("Remove prog:%d, from file:%s"):format(removeid, mi and mi.filename or "?"))
+            bgfx.destroy(make_prog_handle(h))
         end
     end
 
+    -- PM returns at most 'budget' programs per frame, the others are requested again next frame
     local requested = PM.program_request()
     if requested then
         for _, requestid in ipairs(requested) do
             local mi = MATERIALS[requestid]
             if mi then
-                assert(not MATERIAL_MARKED[requestid])
                 log.info(("Recreate prog:%d, from file:%s"):format(requestid, mi.filename))
-                local newfx = create_fx(mi.cfg)
-                local sub_oldfx = get_fx(mi.material.fx, mi.type)
-                local sub_newfx = get_fx(newfx, mi.type)
-                PM.program_set(requestid, sub_newfx.prog)
-                sub_oldfx.prog = requestid
+                local prog = recreate_program(get_fx(mi.material.fx, mi.type))
+                if prog then
+                    PM.program_set(requestid, prog)
+                end
             else
                 log.info(("Can not create prog:%d, it have been fully remove by 'S.material_destroy'"):format(requestid))
             end
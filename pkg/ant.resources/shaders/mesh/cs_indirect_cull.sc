@@ -1,45 +1,79 @@
 #include <bgfx_compute.sh>
 #include <bgfx_shader.sh>
 
-BUFFER_WO(b_visiblity_buffer, vec4, 0);
-BUFFER_RO(b_obj_buffer, vec4, 1);
-BUFFER_RO(b_plane_buffer, vec4, 2);
+// cull queues, same order as queue_type in ant.render/render/render.cpp: main, pre_depth, csm1, csm2, csm3, csm4
+#define CULL_QUEUE_NUM 6
 
-vec3 negativeVertex(vec3 bmin, vec3 bmax, vec3 n)
+#ifdef INDIRECT_CULL_CLEAR
+
+BUFFER_WO(b_cull_count,	uint, 0);
+
+NUM_THREADS(8, 1, 1)
+void main()
 {
-	bvec3 b = greaterThan(n, vec3(0.0, 0.0, 0.0));
-	return mix(bmin, bmax, b);
+	const uint tid = uint(gl_GlobalInvocationID.x);
+	if (tid < CULL_QUEUE_NUM)
+		b_cull_count[tid] = 0u;
 }
 
-uint cull(vec3 aabb_min, vec3 aabb_max)
+#else //!INDIRECT_CULL_CLEAR
+
+BUFFER_RO(b_draw_args,		uvec4,	0);	// source draw commands, written by the producer compute shader
+BUFFER_RO(b_cull_bounds,	vec4,	1);	// world space aabb per draw: minv, maxv
+BUFFER_WO(b_cull_draw_args,	uvec4,	2);	// CULL_QUEUE_NUM regions, each region has u_draw_num commands
+BUFFER_RW(b_cull_count,		uint,	3);	// survived command number of each region
+
+uniform vec4 u_cull_params;
+uniform vec4 u_cull_planes[CULL_QUEUE_NUM*6];
+
+#define u_draw_num	u_cull_params.x
+#define u_cull_mask	u_cull_params.y
+
+vec3 positive_vertex(vec3 bmin, vec3 bmax, vec3 n)
 {
-	uint queue_visible = 0;
-	for(uint i = 0; i < 2; ++i)
+	return mix(bmin, bmax, step(vec3_splat(0.0), n));
+}
+
+bool intersect_frustum(uint queue, vec3 bmin, vec3 bmax)
+{
+	for (uint ii = 0; ii < 6; ++ii)
 	{
-		int r = 1;
- 		for (int ii = 0; ii < 6 && r >= 0; ++ii)
-		{
-			vec3 n = negativeVertex(aabb_min, aabb_max, b_plane_buffer[i*6+ii].xyz);
-			r = dot(vec4(n, 1.0f), b_plane_buffer[i*6+ii]);
-		}	 
-		if(r < 0)
-		{
-			queue_visible &=  ~(1 << i); // is_culled
-		}
-		else{
-			queue_visible |= (1 << i);
-		}
+		const vec4 p = u_cull_planes[queue*6+ii];
+		if (dot(positive_vertex(bmin, bmax, p.xyz), p.xyz) + p.w < 0.0)
+			return false;
 	}
-	return queue_visible;
+	return true;
 }
 
 NUM_THREADS(64, 1, 1)
 void main()
 {
-	int tid = int(gl_GlobalInvocationID.x);
-	vec4 aabb_min = b_obj_buffer[2*tid];
-	vec4 aabb_max = b_obj_buffer[2*tid+1];
-	uint queue_visible = cull(aabb_min.xyz, aabb_max.xyz);
-	b_visiblity_buffer[tid] = vec4((float)queue_visible, 0, 0, 0);
+	const uint drawnum = uint(u_draw_num);
+	const uint tid = uint(gl_GlobalInvocationID.x);
+	if (tid >= drawnum)
+		return ;
+
+	const uvec4 cmd0 = b_draw_args[tid*2];
+	const uvec4 cmd1 = b_draw_args[tid*2+1];
+	// instance count is 0, producer has disabled this draw
+	if (cmd0.y == 0u)
+		return ;
+
+	const vec3 bmin = b_cull_bounds[tid*2].xyz;
+	const vec3 bmax = b_cull_bounds[tid*2+1].xyz;
+	const uint mask = uint(u_cull_mask);
+
+	for (uint q = 0; q < CULL_QUEUE_NUM; ++q)
+	{
+		if ((mask & (1u << q)) != 0u && intersect_frustum(q, bmin, bmax))
+		{
+			uint idx;
+			atomicFetchAndAdd(b_cull_count[q], 1u, idx);
+			const uint dst = q * drawnum + idx;
+			b_cull_draw_args[dst*2]		= cmd0;
+			b_cull_draw_args[dst*2+1]	= cmd1;
+		}
+	}
 }
- 
+
+#endif //INDIRECT_CULL_CLEAR
@@ -16,6 +16,7 @@ function b.init(v)
 		v.aabb = mc.NULL
 		v.scene_aabb = mc.NULL
 	end
+	v.slot = -1
 	return v
 end
 
@@ -38,5 +39,6 @@ function b.unmarshal(v)
 	local bounding = serialization.unpack(v)
 	bounding.aabb = math3d.mark(bounding.aabb)
 	bounding.scene_aabb = math3d.mark(bounding.scene_aabb)
+	bounding.slot = -1
 	return bounding
 end
\ No newline at end of file
@@ -7,6 +7,7 @@ lm:lua_src "scene" {
         lm.AntDir .. "/3rd/math3d",
         lm.AntDir .. "/3rd/bee.lua",
         lm.AntDir .. "/3rd/luaecs",
+        lm.AntDir .. "/clibs/profiler",
     },
     sources = {
         "scene.cpp"
@@ -6,6 +6,9 @@
 #include <glm/gtc/quaternion.hpp>
 #include <cstdio>
 
+#include "profiler.h"
+#include "scene_packed.h"
+
 extern "C" {
 	#include "math3d.h"
 	#include "math3dfunc.h"
@@ -76,6 +79,12 @@ entity_init(lua_State *L) {
 		e.enable_tag<component::scene_mutable>();
 		e.enable_tag<component::scene_needchange>();
 	}
+	if (w->PACKED) {
+		for (auto& e : ecs::select<component::INIT, component::bounding>(w->ecs)) {
+			auto& b = e.get<component::bounding>();
+			b.slot = w->PACKED->alloc();
+		}
+	}
 	return 0;
 }
 
@@ -107,6 +116,7 @@ rebuild_mutable_set(struct ecs_world *w, bee::flatset<component::eid> &changed)
 
 static int
 scene_changed(lua_State *L) {
+	PROFILE_ZONE("scene.changed");
 	auto w = getworld(L);
 	auto math3d = w->math3d->M;
 	math3d_checkpoint cp(math3d);
@@ -148,6 +158,13 @@ scene_changed(lua_State *L) {
 				return luaL_error(L, "entity(%d)'s parent(%d) cannot be found.", id, s.parent);
 			}
 			s.movement = w->frame;
+			PROFILE_COUNTER_ADD("scene.worldmat", 1);
+			if (w->PACKED) {
+				auto b = e.component<component::bounding>();
+				if (b && b->slot >= 0) {
+					w->PACKED->set_worldmat(b->slot, s.worldmat.idx, math_value(math3d, s.worldmat));
+				}
+			}
 			if (!selfchanged){
 				changed.insert(id);
 			}
@@ -173,6 +190,16 @@ static int
 scene_remove(lua_State *L) {
 	auto w = getworld(L);
 
+	if (w->PACKED) {
+		for (auto& e : ecs::select<component::REMOVED, component::bounding>(w->ecs)) {
+			auto& b = e.get<component::bounding>();
+			if (b.slot >= 0) {
+				w->PACKED->dealloc(b.slot);
+				b.slot = -1;
+			}
+		}
+	}
+
 	auto selector = ecs::select<component::REMOVED, component::scene>(w->ecs);
 	auto it = selector.begin();
 	if (it == selector.end()) {
@@ -196,6 +223,9 @@ bounding_update(lua_State *L){
 		const auto &s = e.get<component::scene>();
 		const math_t aabb = math3d_aabb_transform(math3d, s.worldmat, b.aabb);
 		math3d_update(math3d, b.scene_aabb, aabb);
+		if (w->PACKED && b.slot >= 0) {
+			w->PACKED->set_aabb(b.slot, b.scene_aabb.idx, math_value(math3d, b.scene_aabb));
+		}
 	}
 	return 0;
 }
@@ -216,3 +246,80 @@ luaopen_system_scene(lua_State *L) {
 	luaL_setfuncs(L,l,1);
 	return 1;
 }
+
+// scene.packed.enable(true) before the entities created, see scene_packed.h
+static int
+lpacked_enable(lua_State *L) {
+	auto w = getworld(L);
+	if (lua_toboolean(L, 1)) {
+		if (w->PACKED == nullptr) {
+			w->PACKED = new scene_packed;
+		}
+	} else {
+		delete w->PACKED;
+		w->PACKED = nullptr;
+	}
+	return 0;
+}
+
+static int
+lpacked_count(lua_State *L) {
+	auto w = getworld(L);
+	if (w->PACKED == nullptr) {
+		return 0;
+	}
+	lua_pushinteger(L, (lua_Integer)(w->PACKED->worldmats.size() - w->PACKED->freelist.size()));
+	return 1;
+}
+
+// update_worldmat(bounding.slot, scene.worldmat), update_aabb(bounding.slot, bounding.scene_aabb),
+// must be called after Lua replaced them: math3d recycles the ids, the old id kept by the slot could match later
+static int
+lpacked_update_worldmat(lua_State *L) {
+	auto w = getworld(L);
+	const lua_Integer slot = luaL_checkinteger(L, 1);
+	if (w->PACKED == nullptr || slot < 0) {
+		return 0;
+	}
+	luaL_argcheck(L, slot < (lua_Integer)w->PACKED->worldmats.size(), 1, "invalid slot");
+	const math_t m = math3d_from_lua_id(L, w->math3d, 2);
+	if (math_isnull(m)) {
+		w->PACKED->invalidate_worldmat((int)slot);
+	} else {
+		w->PACKED->set_worldmat((int)slot, m.idx, math_value(w->math3d->M, m));
+	}
+	return 0;
+}
+
+static int
+lpacked_update_aabb(lua_State *L) {
+	auto w = getworld(L);
+	const lua_Integer slot = luaL_checkinteger(L, 1);
+	if (w->PACKED == nullptr || slot < 0) {
+		return 0;
+	}
+	luaL_argcheck(L, slot < (lua_Integer)w->PACKED->aabbs.size(), 1, "invalid slot");
+	const math_t aabb = math3d_from_lua_id(L, w->math3d, 2);
+	if (math_isnull(aabb)) {
+		w->PACKED->invalidate_aabb((int)slot);
+	} else {
+		w->PACKED->set_aabb((int)slot, aabb.idx, math_value(w->math3d->M, aabb));
+	}
+	return 0;
+}
+
+extern "C" int
+luaopen_scene_packed(lua_State *L) {
+	luaL_checkversion(L);
+	luaL_Reg l[] = {
+		{ "enable", lpacked_enable },
+		{ "count", lpacked_count },
+		{ "update_worldmat", lpacked_update_worldmat },
+		{ "update_aabb", lpacked_update_aabb },
+		{ NULL, NULL },
+	};
+	luaL_newlibtable(L,l);
+	lua_pushnil(L);
+	luaL_setfuncs(L,l,1);
+	return 1;
+}
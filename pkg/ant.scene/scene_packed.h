@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Opt-in packed storage of the hot scene data (scene.packed.enable), indexed by bounding.slot.
+// World matrices and world aabbs are mirrored into contiguous 16 bytes aligned arrays when scene.cpp
+// updates them, the math3d handles in scene/bounding stay the owners, so Lua code is not affected.
+// Cull and transform upload read the arrays instead of dereferencing math3d handles one by one.
+struct alignas(16) packed_matrix {
+	float v[16];
+};
+
+struct alignas(16) packed_aabb {
+	float minv[4];
+	float maxv[4];
+};
+
+struct scene_packed {
+	std::vector<packed_matrix>	worldmats;
+	std::vector<packed_aabb>	aabbs;
+	// math_t.idx of scene.worldmat/bounding.scene_aabb when they're written, a render_object with
+	// another worldmat (skinning matrices for example) doesn't match it. math3d recycles the ids, so
+	// Lua code replacing them must call scene.packed.update_worldmat/update_aabb, or a stale slot may match
+	std::vector<uint64_t>		worldmat_ids;
+	std::vector<uint64_t>		aabb_ids;
+	std::vector<int>			freelist;
+
+	int alloc() {
+		if (!freelist.empty()) {
+			const int slot = freelist.back();
+			freelist.pop_back();
+			return slot;
+		}
+		const int slot = (int)worldmats.size();
+		worldmats.emplace_back();
+		aabbs.emplace_back();
+		worldmat_ids.push_back(0);
+		aabb_ids.push_back(0);
+		return slot;
+	}
+
+	void dealloc(int slot) {
+		worldmat_ids[slot] = 0;
+		aabb_ids[slot] = 0;
+		freelist.push_back(slot);
+	}
+
+	void set_worldmat(int slot, uint64_t id, const float *v) {
+		worldmat_ids[slot] = id;
+		memcpy(worldmats[slot].v, v, sizeof(packed_matrix));
+	}
+
+	void set_aabb(int slot, uint64_t id, const float *v) {
+		aabb_ids[slot] = id;
+		memcpy(&aabbs[slot], v, sizeof(packed_aabb));
+	}
+
+	void invalidate_worldmat(int slot) {
+		worldmat_ids[slot] = 0;
+	}
+
+	void invalidate_aabb(int slot) {
+		aabb_ids[slot] = 0;
+	}
+
+	const float* worldmat(int slot, uint64_t id) const {
+		return worldmat_ids[slot] == id ? worldmats[slot].v : nullptr;
+	}
+
+	const packed_aabb* aabb(int slot, uint64_t id) const {
+		return aabb_ids[slot] == id ? &aabbs[slot] : nullptr;
+	}
+};
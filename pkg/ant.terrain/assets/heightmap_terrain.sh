@@ -0,0 +1,62 @@
+#ifndef _HEIGHTMAP_TERRAIN_SH_
+#define _HEIGHTMAP_TERRAIN_SH_
+
+// heightmap terrain patch, see ant.terrain/heightmap_terrain.lua
+// a_position.xz:   [0, 1] grid position in the patch, a_position.y = 1 for skirt vertices
+// i_data2:         (x, z, size, lod) of the patch in terrain local space
+// u_terrain_param/u_terrain_tile should be declared before this file
+
+SAMPLER2D(s_terrain_coarse,         0);
+SAMPLER2DARRAY(s_terrain_tiles,     1);
+SAMPLER2D(s_terrain_page,           2);
+
+#define u_terrain_size          u_terrain_param.x
+#define u_terrain_max_height    u_terrain_param.y
+#define u_terrain_range0        u_terrain_param.z
+#define u_terrain_grid          u_terrain_param.w
+
+#define u_terrain_tile_num      u_terrain_tile.x
+#define u_terrain_tile_res      u_terrain_tile.y
+#define u_terrain_coarse_res    u_terrain_tile.z
+
+// morph to parent lod from 70% of the lod range
+#define MORPH_START_RATIO       0.7
+#define SKIRT_CELLS             4.0
+
+// streamed tile if the page table has it, otherwise the coarse heightmap, samples are on the texel centers
+float sample_terrain_height(vec2 xz)
+{
+    vec2 uv = clamp(xz / u_terrain_size, 0.0, 1.0);
+    vec2 tile = min(floor(uv * u_terrain_tile_num), u_terrain_tile_num - 1.0);
+    float page = texture2DLod(s_terrain_page, (tile + 0.5) / u_terrain_tile_num, 0.0).r * 255.0;
+    if (page > 0.5)
+    {
+        vec2 tuv = uv * u_terrain_tile_num - tile;
+        tuv = (tuv * (u_terrain_tile_res - 1.0) + 0.5) / u_terrain_tile_res;
+        return texture2DArrayLod(s_terrain_tiles, vec3(tuv, floor(page + 0.5) - 1.0), 0.0).r * u_terrain_max_height;
+    }
+    vec2 cuv = (uv * (u_terrain_coarse_res - 1.0) + 0.5) / u_terrain_coarse_res;
+    return texture2DLod(s_terrain_coarse, cuv, 0.0).r * u_terrain_max_height;
+}
+
+// terrain local position of the patch vertex, odd vertices move to their even neighbours in the morph range,
+// at the end of the lod range the patch is the same as its parent lod
+vec3 terrain_position(vec4 node, vec3 position, mat4 worldmat)
+{
+    float grid = u_terrain_grid;
+    vec2 xz = node.xy + position.xz * node.z;
+
+    float range_end = u_terrain_range0 * exp2(node.w);
+    float range_start = range_end * MORPH_START_RATIO;
+    vec3 approxWS = mul(worldmat, vec4(xz.x, sample_terrain_height(xz), xz.y, 1.0)).xyz;
+    float k = saturate((distance(u_eyepos.xyz, approxWS) - range_start) / (range_end - range_start));
+
+    vec2 cell = floor(position.xz * grid + 0.5);
+    vec2 odd = cell - 2.0 * floor(cell * 0.5);
+    xz -= odd * (node.z / grid) * k;
+
+    float h = sample_terrain_height(xz) - position.y * SKIRT_CELLS * node.z / grid;
+    return vec3(xz.x, h, xz.y);
+}
+
+#endif //_HEIGHTMAP_TERRAIN_SH_
@@ -0,0 +1,34 @@
+#include "common/transform.sh"
+#include "common/common.sh"
+
+// material properties samplers are only declared in fragment shader, heightmap_terrain.sh declare them for vertex shader
+#include "heightmap_terrain.sh"
+
+mat4 LOAD_WORLDMAT(VSInput vsinput)
+{
+    return u_model[0];
+}
+
+void CUSTOM_VS(mat4 worldmat, VSInput vsinput, inout Varyings varyings)
+{
+}
+
+vec4 CUSTOM_VS_POSITION(VSInput vsinput, inout Varyings varyings, mat4 worldmat)
+{
+    vec4 node = vsinput.data2;
+    vec3 posLS = terrain_position(node, vsinput.position, worldmat);
+
+#ifndef POSITION_ONLY
+    float d = node.z / u_terrain_grid;
+    float hl = sample_terrain_height(posLS.xz - vec2(d, 0.0));
+    float hr = sample_terrain_height(posLS.xz + vec2(d, 0.0));
+    float hb = sample_terrain_height(posLS.xz - vec2(0.0, d));
+    float ht = sample_terrain_height(posLS.xz + vec2(0.0, d));
+    varyings.normal     = normalize(mul((mat3)worldmat, vec3(hl - hr, 2.0 * d, hb - ht)));
+    varyings.texcoord0  = posLS.xz / u_terrain_size;
+#endif //POSITION_ONLY
+
+    vec4 posCS;
+    varyings.posWS = transform_worldpos(worldmat, posLS, posCS);
+    return posCS;
+}
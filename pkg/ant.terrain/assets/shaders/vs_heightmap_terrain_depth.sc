@@ -0,0 +1,15 @@
+$input a_position i_data2
+
+#include <bgfx_shader.sh>
+#include "common/transform.sh"
+
+uniform vec4 u_terrain_param;
+uniform vec4 u_terrain_tile;
+
+#include "heightmap_terrain.sh"
+
+void main()
+{
+	mat4 wm = u_model[0];
+	transform_worldpos(wm, terrain_position(i_data2, a_position, wm), gl_Position);
+}
@@ -0,0 +1,483 @@
+local ecs   = ...
+local world = ecs.world
+local w     = world.w
+
+local bgfx      = require "bgfx"
+local math3d    = require "math3d"
+local ltask     = require "ltask"
+local cdlod     = require "terrain.cdlod"
+local aio       = import_package "ant.io"
+local assetmgr  = import_package "ant.asset"
+local hwi       = import_package "ant.hwi"
+local renderpkg = import_package "ant.render"
+local layoutmgr = renderpkg.layoutmgr
+local sampler   = import_package "ant.render.core".sampler
+
+local imaterial = ecs.require "ant.render|material"
+local icompute  = ecs.require "ant.render|compute.compute"
+local idi       = ecs.require "ant.render|draw_indirect.draw_indirect"
+local util      = ecs.require "ant.render|postprocess.util"
+local queuemgr  = ecs.require "ant.render|queue_mgr"
+
+--[[
+    heightmap terrain, drawn with CDLOD(continuous distance-dependent level of detail):
+    terrain.cdlod select quadtree nodes with the main camera, every selected node(or its quadrants) is one patch instance of a shared
+    grid mesh, all the patches are drawn with one draw_indirect entity, the vertex shader sample the height and morph the patch
+    vertices to its parent lod at the end of the lod range, skirts on the patch edges hide the cracks.
+
+    heights come from two sources:
+        coarse_path:    a coarse_res x coarse_res heightmap of the whole terrain, loaded when the terrain is created
+        tile_path:      tile_num x tile_num detail tiles, every tile is tile_res x tile_res and share the edge samples with its neighbours,
+                        tiles near the camera are streamed into a texture array with 'cache_size' layers, the page table map tile to layer
+    both are raw little-endian uint16, scaled to [0, max_height].
+]]
+
+local hts_sys = ecs.system "heightmap_terrain_system"
+
+local CS_MATERIAL<const>        = "/pkg/ant.resources/materials/hitch/hitch_compute.material"
+local DEFAULT_MATERIAL<const>   = "/pkg/ant.terrain/assets/heightmap_terrain.material"
+local INSTANCE_SIZE<const>      = 64
+
+local DEFAULT_CONFIG<const> = {
+    origin          = {0, 0, 0},
+    grid            = 16,   --quads on one side of a patch
+    lod_num         = 6,
+    pixel_error     = 2,
+    cache_size      = 64,
+    stream_budget   = 2,    --max tile reads in flight
+    cast_shadow     = false,
+    material        = DEFAULT_MATERIAL,
+}
+
+-- patches are selected by the main camera, dispatch before the shadow views
+local dispatch_viewid<const> = hwi.viewid_get "csm_fb"
+
+local layout<const> = layoutmgr.get "p3"
+
+local TERRAIN_QUEUES<const> = {
+    "main_queue",
+    "pre_depth_queue",
+    "csm1_queue",
+    "csm2_queue",
+    "csm3_queue",
+    "csm4_queue",
+}
+
+local TILE_SAMPLER<const> = sampler {
+    MIN = "LINEAR",
+    MAG = "LINEAR",
+    U   = "CLAMP",
+    V   = "CLAMP",
+}
+
+local PAGE_SAMPLER<const> = sampler {
+    MIN = "POINT",
+    MAG = "POINT",
+    U   = "CLAMP",
+    V   = "CLAMP",
+}
+
+--[[
+    patch mesh: (grid+1) x (grid+1) vertices in [0, 1] on xz, vertices with y=1 are skirts, the vertex shader pull them down
+    v1---v3
+    |    |
+    v0---v2
+]]
+local VBFMT<const> = "fff"
+local function create_patch_mesh(grid)
+    assert(grid >= 2 and grid % 2 == 0 and grid <= 128, "patch grid should be even number in [2, 128]")
+    local vb, ib = {}, {}
+    local n = grid + 1
+    for z=0, grid do
+        for x=0, grid do
+            vb[#vb+1] = VBFMT:pack(x/grid, 0, z/grid)
+        end
+    end
+
+    local function add_quad(v0, v1, v2, v3)
+        ib[#ib+1] = v0; ib[#ib+1] = v1; ib[#ib+1] = v2
+        ib[#ib+1] = v1; ib[#ib+1] = v3; ib[#ib+1] = v2
+    end
+
+    for z=0, grid-1 do
+        for x=0, grid-1 do
+            local v0 = z*n+x
+            add_quad(v0, v0+n, v0+1, v0+n+1)
+        end
+    end
+
+    local function add_skirt(edge)
+        local base = #vb
+        for _, vi in ipairs(edge) do
+            vb[#vb+1] = VBFMT:pack((vi % n)/grid, 1, (vi // n)/grid)
+        end
+        for i=1, #edge-1 do
+            local t0, t1 = edge[i], edge[i+1]
+            local b0, b1 = base+i-1, base+i
+            -- skirt can be seen from both side
+            add_quad(t0, b0, t1, b1)
+            add_quad(t1, b1, t0, b0)
+        end
+    end
+
+    local bottom, top, left, right = {}, {}, {}, {}
+    for i=0, grid do
+        bottom[#bottom+1]   = i
+        top[#top+1]         = grid*n+i
+        left[#left+1]       = i*n
+        right[#right+1]     = i*n+grid
+    end
+    add_skirt(bottom)
+    add_skirt(top)
+    add_skirt(left)
+    add_skirt(right)
+
+    return {
+        vb = {
+            start   = 0,
+            num     = #vb,
+            handle  = bgfx.create_vertex_buffer(bgfx.memory_buffer(table.concat(vb, "")), layout.handle),
+        },
+        ib = {
+            start   = 0,
+            num     = #ib,
+            handle  = bgfx.create_index_buffer(bgfx.memory_buffer("w", ib)),
+        },
+    }
+end
+
+local function read_heights(path, res)
+    local c = aio.readall_s(path)
+    if #c ~= res * res * 2 then
+        error(("Invalid heightmap:%s, size:%d, need %dx%d uint16"):format(path, #c, res, res))
+    end
+    return c
+end
+
+local function init_config(config)
+    local t = {}
+    for k, v in pairs(DEFAULT_CONFIG) do
+        t[k] = v
+    end
+    for k, v in pairs(config) do
+        t[k] = v
+    end
+    assert(t.size and t.max_height, "Need 'size' and 'max_height'")
+    assert(t.coarse_path and t.coarse_res, "Need coarse heightmap")
+    assert(t.tile_path and t.tile_num and t.tile_res, "Need heightmap tiles")
+    assert(t.cache_size > 0 and t.cache_size < 256, "'cache_size' should in [1, 255], page table is R8 texture")
+    t.leaf_size = t.size / (1 << (t.lod_num-1))
+    t.tile_size = t.size / t.tile_num
+    return t
+end
+
+local function set_terrain_property(e, name, value)
+    w:extend(e, "filter_material:in")
+    local fm = e.filter_material
+    for _, qn in ipairs(TERRAIN_QUEUES) do
+        local midx = queuemgr.material_index(qn)
+        if midx and fm[midx] then
+            imaterial.set_property(e, name, value, midx)
+        end
+    end
+end
+
+local function create_textures(t, coarse)
+    t.coarse = bgfx.create_texture2d(t.coarse_res, t.coarse_res, false, 1, "R16", TILE_SAMPLER, coarse)
+    t.tiles = bgfx.create_texture2d(t.tile_res, t.tile_res, false, t.cache_size, "R16", TILE_SAMPLER)
+    -- a texture created with memory is immutable, page table is updated tile by tile in set_page
+    t.page_table = bgfx.create_texture2d(t.tile_num, t.tile_num, false, 1, "R8", PAGE_SAMPLER)
+    bgfx.update_texture2d(t.page_table, 0, 0, 0, 0, t.tile_num, t.tile_num, bgfx.memory_buffer(("\0"):rep(t.tile_num * t.tile_num)))
+end
+
+local function create_cache(t)
+    local slots = {}
+    for i=1, t.cache_size do
+        slots[i] = {layer = i-1}
+    end
+    t.cache = {
+        slots   = slots,
+        tiles   = {},   --tile index -> slot
+        pending = {},   --tile index -> true, read in flight (or failed, it won't be read again)
+        loaded  = {},   --tiles read by request_tile, uploaded in the next stream_tiles
+        inflight= 0,
+    }
+end
+
+local function dispatch_indirect(t)
+    if not (t.compute_ready and t.render_ready) then
+        return
+    end
+    local ce <close> = world:entity(t.compute, "dispatch:update")
+    local re <close> = world:entity(t.render, "draw_indirect:in")
+    local di = re.draw_indirect
+    local num = di.instance_buffer.num
+    if num > 0 then
+        local dis = ce.dispatch
+        dis.size[1] = (num+63) // 64
+        local m = dis.material
+        m.u_mesh_params = math3d.vector(num, 0, 0, t.mesh.ib.num)
+        m.b_indirect_buffer = {
+            type    = "b",
+            access  = "w",
+            value   = di.handle,
+            stage   = 0,
+        }
+        icompute.dispatch(dispatch_viewid, dis)
+    end
+end
+
+local function create_entities(t)
+    t.mesh = create_patch_mesh(t.grid)
+    local o = t.origin
+    t.render = world:create_entity {
+        policy = {
+            "ant.render|simplerender",
+            "ant.render|draw_indirect",
+        },
+        data = {
+            scene           = {t = o},
+            mesh_result     = t.mesh,
+            material        = t.material,
+            visible         = true,
+            visible_masks   = t.cast_shadow and "main_view|cast_shadow|selectable" or "main_view|selectable",
+            draw_indirect   = {
+                instance_buffer = {
+                    flag    = "r",
+                    layout  = "t45NIf",
+                    num     = 0,
+                    size    = INSTANCE_SIZE,
+                },
+            },
+            on_ready = function (e)
+                set_terrain_property(e, "s_terrain_coarse",  t.coarse)
+                set_terrain_property(e, "s_terrain_tiles",   t.tiles)
+                set_terrain_property(e, "s_terrain_page",    t.page_table)
+                set_terrain_property(e, "u_terrain_param",   math3d.vector(t.size, t.max_height, 0, t.grid))
+                set_terrain_property(e, "u_terrain_tile",    math3d.vector(t.tile_num, t.tile_res, t.coarse_res, 0))
+                t.render_ready = true
+                t.dirty = true
+            end,
+        },
+    }
+
+    t.compute = world:create_entity {
+        policy = {
+            "ant.render|compute",
+        },
+        data = {
+            material = CS_MATERIAL,
+            dispatch = {
+                size = {1, 1, 1},
+            },
+            on_ready = function (e)
+                w:extend(e, "dispatch:update")
+                assetmgr.material_mark(e.dispatch.fx.prog)
+                t.compute_ready = true
+                dispatch_indirect(t)
+            end,
+        },
+    }
+end
+
+-- the range of the lods which vertex spacing is finer than the coarse heightmap, the detail tiles only matter in it
+local function detail_range(t, range0)
+    local coarse_spacing = t.size / (t.coarse_res - 1)
+    local r = 0
+    for lod=0, t.lod_num-1 do
+        if t.leaf_size * (1 << lod) / (2 * t.grid) < coarse_spacing then
+            r = range0 * (1 << lod)
+        end
+    end
+    return r
+end
+
+local function tile_distance(t, tx, tz, ex, ez)
+    local x0, z0 = tx * t.tile_size, tz * t.tile_size
+    local dx = math.max(x0 - ex, 0, ex - (x0 + t.tile_size))
+    local dz = math.max(z0 - ez, 0, ez - (z0 + t.tile_size))
+    return math.sqrt(dx * dx + dz * dz)
+end
+
+local function set_page(t, tx, tz, v)
+    bgfx.update_texture2d(t.page_table, 0, 0, tx, tz, 1, 1, bgfx.memory_buffer(("B"):pack(v)))
+end
+
+-- tiles are read in forked tasks, so the world doesn't wait for the io
+local function request_tile(t, wt)
+    local cache = t.cache
+    cache.pending[wt.idx] = true
+    cache.inflight = cache.inflight + 1
+    local path = t.tile_path:format(wt.tx, wt.tz)
+    ltask.fork(function ()
+        local ok, heights = pcall(read_heights, path, t.tile_res)
+        cache.inflight = cache.inflight - 1
+        if not ok then
+            log.error(heights)
+            return
+        end
+        cache.loaded[#cache.loaded+1] = {idx = wt.idx, tx = wt.tx, tz = wt.tz, heights = heights}
+    end)
+end
+
+-- a free slot, or the farthest one not in range
+local function find_slot(t, keep, ex, ez)
+    local slot, farthest
+    for _, s in ipairs(t.cache.slots) do
+        if s.idx == nil then
+            return s
+        end
+        if not keep[s.idx] then
+            local d = tile_distance(t, s.tx, s.tz, ex, ez)
+            if farthest == nil or d > farthest then
+                slot, farthest = s, d
+            end
+        end
+    end
+    return slot
+end
+
+local function upload_tile(t, slot, lt)
+    local cache = t.cache
+    if slot.idx then
+        cache.tiles[slot.idx] = nil
+        set_page(t, slot.tx, slot.tz, 0)
+    end
+    bgfx.update_texture2d(t.tiles, slot.layer, 0, 0, 0, t.tile_res, t.tile_res, bgfx.memory_buffer(lt.heights))
+    set_page(t, lt.tx, lt.tz, slot.layer+1)
+    t.tree:update_tile(lt.tx, lt.tz, t.tile_num, lt.heights, t.tile_res)
+
+    slot.idx, slot.tx, slot.tz = lt.idx, lt.tx, lt.tz
+    cache.tiles[lt.idx] = slot
+end
+
+-- upload the tiles read since the last frame, and request the missing tiles in range nearest first,
+-- the farthest one not in range is evicted when the cache is full
+local function stream_tiles(t, ex, ez, range)
+    local cache = t.cache
+    local wanted = {}
+    local tile_range = math.ceil(range / t.tile_size)
+    local cx, cz = math.floor(ex / t.tile_size), math.floor(ez / t.tile_size)
+    for tz=math.max(cz-tile_range, 0), math.min(cz+tile_range, t.tile_num-1) do
+        for tx=math.max(cx-tile_range, 0), math.min(cx+tile_range, t.tile_num-1) do
+            local d = tile_distance(t, tx, tz, ex, ez)
+            if d <= range then
+                wanted[#wanted+1] = {idx = tz * t.tile_num + tx, tx = tx, tz = tz, distance = d}
+            end
+        end
+    end
+    table.sort(wanted, function (a, b) return a.distance < b.distance end)
+
+    local keep = {}
+    for i=1, math.min(#wanted, t.cache_size) do
+        keep[wanted[i].idx] = true
+    end
+
+    -- the camera may have moved away while reading, tiles out of range are dropped and requested again later
+    local uploaded = false
+    local loaded = cache.loaded
+    for i=1, #loaded do
+        local lt = loaded[i]
+        loaded[i] = nil
+        cache.pending[lt.idx] = nil
+        if keep[lt.idx] and not cache.tiles[lt.idx] then
+            local slot = find_slot(t, keep, ex, ez)
+            if slot then
+                upload_tile(t, slot, lt)
+                uploaded = true
+            end
+        end
+    end
+
+    for _, wt in ipairs(wanted) do
+        if cache.inflight >= t.stream_budget or not keep[wt.idx] then
+            break
+        end
+        if not cache.tiles[wt.idx] and not cache.pending[wt.idx] then
+            request_tile(t, wt)
+        end
+    end
+    return uploaded
+end
+
+local function local_planes(viewprojmat, o)
+    local fp = math3d.frustum_planes(viewprojmat)
+    local planes = {}
+    for i=1, 6 do
+        local nx, ny, nz, d = ("ffff"):unpack(math3d.serialize(math3d.array_index(fp, i)))
+        planes[i] = ("ffff"):pack(nx, ny, nz, d + nx*o[1] + ny*o[2] + nz*o[3])
+    end
+    return table.concat(planes, "")
+end
+
+local function update_terrain(t, camera, eyepos, vr)
+    -- lod 0 is used in range0, the error of lod 1 (twice vertex spacing of lod 0) should be less than 'pixel_error' out of it,
+    -- range0 should be larger than the diagonal of lod 1 node, the neighbour nodes differ no more than one lod
+    local proj_scale = util.projection_scale(vr.w, vr.h, camera.projmat)
+    local range0 = math.max(t.leaf_size / t.grid * proj_scale / t.pixel_error, 3 * t.leaf_size)
+
+    local o = t.origin
+    local ex, ey, ez = math3d.index(eyepos, 1, 2, 3)
+    ex, ey, ez = ex - o[1], ey - o[2], ez - o[3]
+
+    if stream_tiles(t, ex, ez, detail_range(t, range0)) then
+        t.dirty = true
+    end
+
+    if t.dirty or w:check "camera_changed" or range0 ~= t.range0 then
+        t.dirty = false
+        if range0 ~= t.range0 then
+            t.range0 = range0
+            local re <close> = world:entity(t.render)
+            set_terrain_property(re, "u_terrain_param", math3d.vector(t.size, t.max_height, range0, t.grid))
+        end
+        local memory, num = t.tree:select(local_planes(camera.viewprojmat, o), ex, ey, ez, range0)
+        local re <close> = world:entity(t.render, "draw_indirect:update")
+        idi.update_instance_buffer(re, memory, num)
+        dispatch_indirect(t)
+    end
+end
+
+function hts_sys:component_init()
+    for e in w:select "INIT heightmap_terrain:update" do
+        local t = init_config(e.heightmap_terrain)
+        t.tree = cdlod.create(t.size, t.lod_num, t.max_height)
+        local coarse = read_heights(t.coarse_path, t.coarse_res)
+        t.tree:set_heights(coarse, t.coarse_res)
+        create_textures(t, coarse)
+        create_cache(t)
+        create_entities(t)
+        e.heightmap_terrain = t
+    end
+end
+
+function hts_sys:cull()
+    if w:count "heightmap_terrain" == 0 then
+        return
+    end
+    local mq = w:first "main_queue camera_ref:in render_target:in"
+    local ce <close> = world:entity(mq.camera_ref, "camera:in scene:in")
+    local eyepos = math3d.index(ce.scene.worldmat, 4)
+    for e in w:select "heightmap_terrain:in" do
+        local t = e.heightmap_terrain
+        if t.render_ready then
+            update_terrain(t, ce.camera, eyepos, mq.render_target.view_rect)
+        end
+    end
+end
+
+local function destroy_terrain(t)
+    w:remove(t.render)
+    w:remove(t.compute)
+    bgfx.destroy(t.mesh.vb.handle)
+    bgfx.destroy(t.mesh.ib.handle)
+    bgfx.destroy(t.coarse)
+    bgfx.destroy(t.tiles)
+    bgfx.destroy(t.page_table)
+end
+
+function hts_sys:entity_remove()
+    for e in w:select "REMOVED heightmap_terrain:in" do
+        destroy_terrain(e.heightmap_terrain)
+    end
+end
@@ -0,0 +1,7 @@
+local lm = require "luamake"
+
+lm:lua_src "terrain" {
+    sources = {
+        "src/cdlod.cpp",
+    },
+}
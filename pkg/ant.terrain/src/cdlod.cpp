@@ -0,0 +1,297 @@
+#include "lua.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <vector>
+
+// CDLOD quadtree of heightmap terrain, see ant.terrain/heightmap_terrain.lua.
+// The root node covers the whole terrain at lod 'lod_num-1', leaves are lod 0. Every node keeps the min/max height of its area,
+// built from the coarse heightmap and refined when a detail tile is streamed in, so frustum culling and lod ranges use tight bounds.
+// Selected nodes are output as quadrant patches: a node with some children selected only draws the quadrants those children leave,
+// a patch is (x, z, size, lod) in terrain local space and drawn with one shared grid mesh, the vertex shader morph it to its parent lod.
+struct minmax {
+    float minh;
+    float maxh;
+};
+
+struct plane {
+    float n[3];
+    float d;
+};
+
+struct cdlod {
+    float size;
+    float leaf_size;
+    float max_height;
+    int lod_num;
+    std::vector<std::vector<minmax>> levels;    // levels[lod][z * n + x], n = 1 << (lod_num-1-lod)
+
+    // select state
+    plane planes[6];
+    float eye[3];
+    float range0;
+    std::vector<float> patches;
+
+    cdlod(float s, int ln, float mh) : size(s), max_height(mh), lod_num(ln) {
+        leaf_size = s / float(1 << (ln-1));
+        levels.resize(ln);
+        for (int lod = 0; lod < ln; ++lod) {
+            const int n = node_num(lod);
+            levels[lod].assign(n * n, minmax{0, mh});
+        }
+    }
+
+    int node_num(int lod) const {
+        return 1 << (lod_num-1-lod);
+    }
+
+    float node_size(int lod) const {
+        return leaf_size * float(1 << lod);
+    }
+
+    float range(int lod) const {
+        return range0 * float(1 << lod);
+    }
+
+    void rebuild_parents(int x0, int z0, int x1, int z1) {
+        for (int lod = 1; lod < lod_num; ++lod) {
+            x0 >>= 1; z0 >>= 1; x1 >>= 1; z1 >>= 1;
+            const int n = node_num(lod);
+            const int cn = n * 2;
+            const auto &children = levels[lod-1];
+            auto &nodes = levels[lod];
+            for (int z = z0; z <= z1; ++z) {
+                for (int x = x0; x <= x1; ++x) {
+                    const minmax &c0 = children[(z*2) * cn + x*2];
+                    const minmax &c1 = children[(z*2) * cn + x*2+1];
+                    const minmax &c2 = children[(z*2+1) * cn + x*2];
+                    const minmax &c3 = children[(z*2+1) * cn + x*2+1];
+                    nodes[z * n + x] = minmax{
+                        std::min(std::min(c0.minh, c1.minh), std::min(c2.minh, c3.minh)),
+                        std::max(std::max(c0.maxh, c1.maxh), std::max(c2.maxh, c3.maxh)),
+                    };
+                }
+            }
+        }
+    }
+
+    // 'data' is a res x res uint16 heightmap which cover [ox, ox+extent] x [oz, oz+extent], samples are on the edges
+    // set leaves bounds when 'replace', or merge them to the old bounds
+    void update_leaves(const uint16_t *data, int res, float ox, float oz, float extent, bool replace) {
+        const int n = node_num(0);
+        const float step = extent / float(res-1);
+        const float hscale = max_height / 65535.f;
+        const int x0 = std::max(0, (int)std::floor(ox / leaf_size));
+        const int z0 = std::max(0, (int)std::floor(oz / leaf_size));
+        const int x1 = std::min(n-1, (int)std::ceil((ox + extent) / leaf_size) - 1);
+        const int z1 = std::min(n-1, (int)std::ceil((oz + extent) / leaf_size) - 1);
+        auto &leaves = levels[0];
+        for (int z = z0; z <= z1; ++z) {
+            const int sz0 = std::clamp((int)std::floor((z * leaf_size - oz) / step), 0, res-1);
+            const int sz1 = std::clamp((int)std::ceil(((z+1) * leaf_size - oz) / step), 0, res-1);
+            for (int x = x0; x <= x1; ++x) {
+                const int sx0 = std::clamp((int)std::floor((x * leaf_size - ox) / step), 0, res-1);
+                const int sx1 = std::clamp((int)std::ceil(((x+1) * leaf_size - ox) / step), 0, res-1);
+                uint16_t lo = UINT16_MAX, hi = 0;
+                for (int sz = sz0; sz <= sz1; ++sz) {
+                    const uint16_t *row = data + sz * res;
+                    for (int sx = sx0; sx <= sx1; ++sx) {
+                        lo = std::min(lo, row[sx]);
+                        hi = std::max(hi, row[sx]);
+                    }
+                }
+                minmax &m = leaves[z * n + x];
+                const float minh = lo * hscale, maxh = hi * hscale;
+                if (replace) {
+                    m = minmax{minh, maxh};
+                } else {
+                    m = minmax{std::min(m.minh, minh), std::max(m.maxh, maxh)};
+                }
+            }
+        }
+        if (x0 <= x1 && z0 <= z1)
+            rebuild_parents(x0, z0, x1, z1);
+    }
+
+    bool visible(const float minv[3], const float maxv[3]) const {
+        for (const plane &p : planes) {
+            // the corner of the box farthest along the plane normal
+            const float x = p.n[0] >= 0 ? maxv[0] : minv[0];
+            const float y = p.n[1] >= 0 ? maxv[1] : minv[1];
+            const float z = p.n[2] >= 0 ? maxv[2] : minv[2];
+            if (p.n[0] * x + p.n[1] * y + p.n[2] * z + p.d < 0)
+                return false;
+        }
+        return true;
+    }
+
+    bool in_range(const float minv[3], const float maxv[3], float r) const {
+        float d2 = 0;
+        for (int i = 0; i < 3; ++i) {
+            const float d = eye[i] < minv[i] ? minv[i] - eye[i] : (eye[i] > maxv[i] ? eye[i] - maxv[i] : 0);
+            d2 += d * d;
+        }
+        return d2 <= r * r;
+    }
+
+    void add_patches(int x, int z, int lod, int mask) {
+        const float half = node_size(lod) * 0.5f;
+        for (int i = 0; i < 4; ++i) {
+            if (mask & (1 << i)) {
+                patches.push_back((x * 2 + (i & 1)) * half);
+                patches.push_back((z * 2 + (i >> 1)) * half);
+                patches.push_back(half);
+                patches.push_back(float(lod));
+            }
+        }
+    }
+
+    enum select_result {
+        OUT_OF_FRUSTUM,
+        OUT_OF_RANGE,
+        SELECTED,
+    };
+
+    select_result select(int x, int z, int lod) {
+        const minmax &m = levels[lod][z * node_num(lod) + x];
+        const float ns = node_size(lod);
+        const float minv[3] = {x * ns, m.minh, z * ns};
+        const float maxv[3] = {(x+1) * ns, m.maxh, (z+1) * ns};
+        if (!visible(minv, maxv))
+            return OUT_OF_FRUSTUM;
+        // root node is drawn even it's out of range
+        if (lod != lod_num-1 && !in_range(minv, maxv, range(lod)))
+            return OUT_OF_RANGE;
+        if (lod == 0 || !in_range(minv, maxv, range(lod-1))) {
+            add_patches(x, z, lod, 0xf);
+            return SELECTED;
+        }
+        // draw the quadrants which children are out of their range with this lod
+        int mask = 0;
+        for (int i = 0; i < 4; ++i) {
+            if (select(x * 2 + (i & 1), z * 2 + (i >> 1), lod-1) == OUT_OF_RANGE)
+                mask |= 1 << i;
+        }
+        add_patches(x, z, lod, mask);
+        return SELECTED;
+    }
+};
+
+static inline cdlod*
+to_cdlod(lua_State *L) {
+    return (cdlod*)luaL_checkudata(L, 1, "ANT_TERRAIN_CDLOD");
+}
+
+static const uint16_t*
+check_heights(lua_State *L, int idx, int res) {
+    size_t sz;
+    const char *data = luaL_checklstring(L, idx, &sz);
+    if (sz != (size_t)res * res * sizeof(uint16_t))
+        luaL_error(L, "Invalid heightmap size:%d, need %dx%d uint16", (int)sz, res, res);
+    return (const uint16_t*)data;
+}
+
+// set_heights(data, res): the coarse heightmap of the whole terrain, reset all the bounds
+static int
+lset_heights(lua_State *L) {
+    auto t = to_cdlod(L);
+    const int res = (int)luaL_checkinteger(L, 3);
+    luaL_argcheck(L, res >= 2, 3, "invalid heightmap resolution");
+    t->update_leaves(check_heights(L, 2, res), res, 0, 0, t->size, true);
+    return 0;
+}
+
+// update_tile(tx, tz, tile_num, data, res): a detail tile is streamed in, merge its heights to the bounds
+static int
+lupdate_tile(lua_State *L) {
+    auto t = to_cdlod(L);
+    const int tx = (int)luaL_checkinteger(L, 2);
+    const int tz = (int)luaL_checkinteger(L, 3);
+    const int tile_num = (int)luaL_checkinteger(L, 4);
+    const int res = (int)luaL_checkinteger(L, 6);
+    luaL_argcheck(L, tile_num > 0, 4, "invalid tile number");
+    luaL_argcheck(L, tx >= 0 && tx < tile_num && tz >= 0 && tz < tile_num, 2, "invalid tile");
+    luaL_argcheck(L, res >= 2, 6, "invalid tile resolution");
+    const float extent = t->size / tile_num;
+    t->update_leaves(check_heights(L, 5, res), res, tx * extent, tz * extent, extent, false);
+    return 0;
+}
+
+// select(planes, eyex, eyey, eyez, range0): planes is 6 vec4 in terrain local space, and inside of them is dot(n, p)+d >= 0
+// return patches memory(vec4 for each patch) and patch number
+static int
+lselect(lua_State *L) {
+    auto t = to_cdlod(L);
+    size_t sz;
+    const char *planes = luaL_checklstring(L, 2, &sz);
+    luaL_argcheck(L, sz == sizeof(t->planes), 2, "need 6 planes");
+    memcpy(t->planes, planes, sizeof(t->planes));
+    for (int i = 0; i < 3; ++i)
+        t->eye[i] = (float)luaL_checknumber(L, 3+i);
+    t->range0 = (float)luaL_checknumber(L, 6);
+    luaL_argcheck(L, t->range0 > 0, 6, "invalid range");
+
+    t->patches.clear();
+    t->select(0, 0, t->lod_num-1);
+    lua_pushlstring(L, (const char*)t->patches.data(), t->patches.size() * sizeof(float));
+    lua_pushinteger(L, (lua_Integer)(t->patches.size() / 4));
+    return 2;
+}
+
+// bounds(): min/max height of the whole terrain
+static int
+lbounds(lua_State *L) {
+    auto t = to_cdlod(L);
+    const minmax &m = t->levels[t->lod_num-1][0];
+    lua_pushnumber(L, m.minh);
+    lua_pushnumber(L, m.maxh);
+    return 2;
+}
+
+static int
+lgc(lua_State *L) {
+    auto t = to_cdlod(L);
+    t->~cdlod();
+    return 0;
+}
+
+// create(size, lod_num, max_height)
+static int
+lcreate(lua_State *L) {
+    const float size = (float)luaL_checknumber(L, 1);
+    const int lod_num = (int)luaL_checkinteger(L, 2);
+    const float max_height = (float)luaL_checknumber(L, 3);
+    luaL_argcheck(L, size > 0, 1, "invalid terrain size");
+    luaL_argcheck(L, lod_num > 0 && lod_num <= 16, 2, "invalid lod number");
+    auto t = (cdlod*)lua_newuserdatauv(L, sizeof(cdlod), 0);
+    new (t) cdlod(size, lod_num, max_height);
+    if (luaL_newmetatable(L, "ANT_TERRAIN_CDLOD")) {
+        luaL_Reg l[] = {
+            { "set_heights",    lset_heights },
+            { "update_tile",    lupdate_tile },
+            { "select",         lselect },
+            { "bounds",         lbounds },
+            { nullptr,          nullptr },
+        };
+        luaL_newlib(L, l);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, lgc);
+        lua_setfield(L, -2, "__gc");
+    }
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+extern "C" int
+luaopen_terrain_cdlod(lua_State *L) {
+    luaL_checkversion(L);
+    luaL_Reg l[] = {
+        { "create", lcreate },
+        { nullptr,  nullptr },
+    };
+    luaL_newlib(L, l);
+    return 1;
+}
@@ -111,6 +111,46 @@ function REPO_MT:hash(hash)
 	return self._filehash[hash]
 end
 
+-- Large files are also served as content-defined chunks. The manifest ("<sha1> <size>\n" per chunk)
+-- is cached in .app/chunk/<filehash>, the manifest and every chunk are addressable by hash.
+function REPO_MT:chunks(hash)
+	local v = self._filehash[hash]
+	if not v or not v.path then
+		return
+	end
+	if v.chunks then
+		return v.chunks
+	end
+	local chunkpath = self._cachepath / "chunk"
+	local manifestpath = (chunkpath / hash):string()
+	local manifest = fastio.readall_s_noerr(manifestpath)
+	if not manifest then
+		manifest = fastio.chunks(v.path)
+		lfs.create_directories(chunkpath)
+		local f <close> = assert(io.open(manifestpath, "wb"))
+		f:write(manifest)
+	end
+	local filehash = self._filehash
+	local offset = 0
+	for chunkhash, size in manifest:gmatch "(%x+) (%d+)\n" do
+		size = tonumber(size)
+		if not filehash[chunkhash] then
+			filehash[chunkhash] = {
+				path = v.path,
+				offset = offset,
+				size = size,
+			}
+		end
+		offset = offset + size
+	end
+	local mhash = fastio.str2sha1(manifest)
+	filehash[mhash] = {
+		content = manifest,
+	}
+	v.chunks = mhash
+	return mhash
+end
+
 function REPO_MT:export_resources()
 	local vfsrepo = self._vfsrepo
 	return vfsrepo:resources()
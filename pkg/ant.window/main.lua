@@ -4,7 +4,8 @@ local function start(config)
     local function spawn_window()
         local ServiceWindow = ltask.spawn_service {
             unique = true,
-            name = "ant.window|window",
+            -- config.headless: run the world without native window, see service/headless.lua
+            name = config.headless and "ant.window|headless" or "ant.window|window",
             args = { config },
             worker_id = 0,
         }
@@ -0,0 +1,103 @@
+-- Run the world without native window and input, for benchmarks and automated tests.
+-- config.headless = {
+--     frames   = number of frames to run, run forever if nil
+--     width    = 1280,
+--     height   = 720,
+--     renderer = "NOOP", any bgfx renderer type
+-- }
+local ltask     = require "ltask"
+local bgfx      = require "bgfx"
+local assetmgr  = import_package "ant.asset"
+local new_world = import_package "ant.world".new_world
+local rhwi      = import_package "ant.hwi"
+
+rhwi.init_bgfx()
+
+local initargs = ...
+local headless = initargs.headless
+if headless == true then
+    headless = {}
+end
+
+local function render()
+    local width  = headless.width or 1280
+    local height = headless.height or 720
+    rhwi.init {
+        width    = width,
+        height   = height,
+        renderer = headless.renderer or "NOOP",
+    }
+    -- frames are only limited by the cpu
+    bgfx.maxfps()
+    bgfx.encoder_create "world"
+    bgfx.encoder_init()
+    assetmgr.init()
+    bgfx.encoder_begin()
+    local world = new_world {
+        ecs    = initargs,
+        width  = width,
+        height = height,
+    }
+    world:dispatch_message {
+        type = "window_init",
+        size = {
+            w = width,
+            h = height,
+        },
+    }
+    world:dispatch_message { type = "update" }
+    world:pipeline_init()
+    bgfx.encoder_end()
+
+    local frames = headless.frames
+    local frame = 0
+    while frames == nil or frame < frames do
+        world:dispatch_message { type = "update" }
+        bgfx.encoder_begin()
+        world:pipeline_update()
+        bgfx.encoder_end()
+        world._frametime = bgfx.encoder_frame()
+        frame = frame + 1
+    end
+    world:pipeline_exit()
+    bgfx.encoder_destroy()
+    bgfx.shutdown()
+    ltask.multi_wakeup "quit"
+end
+
+if initargs.log then
+    log.level = initargs.log
+end
+
+ltask.fork(render)
+
+local S = {}
+
+function S.wait()
+    ltask.multi_wait "quit"
+end
+
+function S.reboot()
+    error "headless world can't reboot"
+end
+
+function S.set_cursor()
+end
+
+function S.show_cursor()
+end
+
+function S.set_title()
+end
+
+function S.set_maxfps()
+end
+
+function S.set_fullscreen()
+end
+
+function S.get_cmd()
+    return initargs.cmd
+end
+
+return S
@@ -17,6 +17,24 @@ local WindowQuit
 local WindowToken = {}
 local WindowEvent = {}
 
+-- input messages are buffered by the window layer, and dispatched once per frame
+local InputQueue = {}
+local InputCoalesce = initargs.input_coalesce ~= false
+
+local function dispatch_input()
+    local n, dropped = window.input(InputQueue, InputCoalesce)
+    if dropped > 0 then
+        log.warn(("%d input messages are dropped."):format(dropped))
+    end
+    for i = 1, n do
+        local msg = InputQueue[i]
+        InputQueue[i] = nil
+        if not world:dispatch_imgui(msg) then
+            world:dispatch_message(msg)
+        end
+    end
+end
+
 local function reboot(args)
     local config = world.args
     config.REBOOT = true
@@ -69,6 +87,7 @@ local function render(init, args, initialized)
         if #WindowQueue > 0 then
             ltask.wakeup(WindowToken)
         end
+        dispatch_input()
         world:dispatch_message { type = "update" }
         if WindowQuit then
             break
@@ -31,6 +31,15 @@ static int peek_message(lua_State *L) {
 	return 1;
 }
 
+// input(t, coalesce): fetch the buffered input messages to t[1..n], returns n and the number of messages dropped since last time
+static int input(lua_State* L) {
+	luaL_checktype(L, 1, LUA_TTABLE);
+	int n = window_input_fetch(L, 1, !!lua_toboolean(L, 2));
+	lua_pushinteger(L, n);
+	lua_pushinteger(L, window_input_dropped());
+	return 2;
+}
+
 static int set_cursor(lua_State* L) {
 	ant::window::set_msg set;
 	set.type = ant::window::set_msg::type::cursor;
@@ -78,6 +87,7 @@ luaopen_window(lua_State *L) {
 		{ "init", init },
 		{ "close", close },
 		{ "peek_message", peek_message },
+		{ "input", input },
 		{ "set_cursor", set_cursor },
 		{ "show_cursor", show_cursor },
 		{ "set_title", set_title },
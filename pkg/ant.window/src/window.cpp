@@ -1,5 +1,7 @@
 #include <lua.hpp>
 #include "window.h"
+#include <atomic>
+#include <cstring>
 #include <utility>
 #include <bee/nonstd/unreachable.h>
 
@@ -210,15 +212,245 @@ void window_message_set_fetch_func(void (*func)(lua_State*)) {
 }
 
 template <typename... Args>
-static void push_message(lua_State* L, Args&&... args) {
+static void push_table(lua_State* L, uint64_t timestamp, Args&&... args) {
 	static_assert(sizeof...(args) % 2 == 0);
 	lua_createtable(L, 0, 1 + sizeof...(args) / 2);
-	lua_pushinteger(L, get_timestamp());
+	lua_pushinteger(L, static_cast<lua_Integer>(timestamp));
 	lua_setfield(L, -2, "timestamp");
 	push_message_args(L, std::forward<Args>(args)...);
+}
+
+template <typename... Args>
+static void push_message(lua_State* L, Args&&... args) {
+	push_table(L, get_timestamp(), std::forward<Args>(args)...);
 	MessageFetch(L);
 }
 
+// Input messages don't go to lua one by one. They are written as fixed size records to a single-producer/single-consumer
+// ring, the producer is the thread pumping the os messages and the consumer is the window service, which fetches them once
+// per frame (window_input_fetch). So high frequency input (1000Hz mice, multitouch) costs nothing on lua side until it's
+// fetched, and the redundant moves can be coalesced then. New events are dropped (and counted) when the ring is full.
+namespace {
+	struct input_event {
+		uint64_t timestamp;
+		ant::window::msg msg;
+	};
+	constexpr uint32_t InputRingSize = 1024;
+	static_assert((InputRingSize & (InputRingSize - 1)) == 0);
+	struct input_ring {
+		input_event events[InputRingSize];
+		std::atomic<uint32_t> head = 0;	// written by the consumer
+		std::atomic<uint32_t> tail = 0;	// written by the producer
+		std::atomic<uint32_t> dropped = 0;
+		uint8_t skip[InputRingSize];	// used by the consumer only
+	};
+	input_ring g_input;
+}
+
+static void input_push(ant::window::msg const& msg) {
+	uint32_t tail = g_input.tail.load(std::memory_order_relaxed);
+	if (tail - g_input.head.load(std::memory_order_acquire) >= InputRingSize) {
+		g_input.dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	input_event& e = g_input.events[tail % InputRingSize];
+	e.timestamp = get_timestamp();
+	e.msg = msg;
+	g_input.tail.store(tail + 1, std::memory_order_release);
+}
+
+// A move is redundant when the next event of the same pointer in this batch is a move too: a mousemove followed by
+// a mousemove with the same buttons, or a 'moved' touch followed by a 'moved' one of the same id.
+static void input_coalesce(uint32_t head, uint32_t tail) {
+	using namespace ant::window;
+	constexpr int MaxTouch = 16;
+	struct {
+		uintptr_t id;
+		bool moved;
+	} touches[MaxTouch];
+	int ntouch = 0;
+	bool mousemove = false;
+	mouse_buttons mousewhat = mouse_buttons::none;
+	for (uint32_t i = tail; i != head;) {
+		--i;
+		msg const& m = g_input.events[i % InputRingSize].msg;
+		uint8_t& skip = g_input.skip[i - head];
+		skip = 0;
+		switch (m.type) {
+		case msg_type::mouse:
+		case msg_type::mousewheel:
+			mousemove = false;
+			break;
+		case msg_type::mousemove:
+			skip = mousemove && mousewhat == m.mousemove.what;
+			mousemove = true;
+			mousewhat = m.mousemove.what;
+			break;
+		case msg_type::touch: {
+			const bool moved = m.touch.state == touch_state::moved;
+			int t = 0;
+			while (t < ntouch && touches[t].id != m.touch.id) {
+				++t;
+			}
+			if (t < ntouch) {
+				skip = moved && touches[t].moved;
+				touches[t].moved = moved;
+			}
+			else if (ntouch < MaxTouch) {
+				touches[ntouch++] = { m.touch.id, moved };
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+}
+
+static void push_input(lua_State* L, input_event const& e) {
+	using namespace ant::window;
+	msg const& m = e.msg;
+	switch (m.type) {
+	case msg_type::keyboard:
+		push_table(L, e.timestamp,
+			"type", "keyboard",
+			"key", m.keyboard.key,
+			"press", m.keyboard.press,
+			"state", m.keyboard.state
+		);
+		break;
+	case msg_type::mouse:
+		push_table(L, e.timestamp,
+			"type", "mouseclick",
+			"what", m.mouseclick.what,
+			"x", m.mouseclick.x,
+			"y", m.mouseclick.y,
+			"state", m.mouseclick.state
+		);
+		break;
+	case msg_type::mousemove:
+		push_table(L, e.timestamp,
+			"type", "mousemove",
+			"what", m.mousemove.what,
+			"x", m.mousemove.x,
+			"y", m.mousemove.y
+		);
+		break;
+	case msg_type::mousewheel:
+		push_table(L, e.timestamp,
+			"type", "mousewheel",
+			"x", m.mousewheel.x,
+			"y", m.mousewheel.y,
+			"delta", m.mousewheel.delta
+		);
+		break;
+	case msg_type::inputchar:
+		push_table(L, e.timestamp,
+			"type", "inputchar",
+			"what", m.inputchar.what,
+			"code", m.inputchar.code
+		);
+		break;
+	case msg_type::focus:
+		push_table(L, e.timestamp,
+			"type", "focus",
+			"focused", m.focus.focused
+		);
+		break;
+	case msg_type::touch:
+		push_table(L, e.timestamp,
+			"type", "touch",
+			"x", m.touch.x,
+			"y", m.touch.y,
+			"id", m.touch.id,
+			"state", m.touch.state
+		);
+		break;
+	case msg_type::gesture_tap:
+		push_table(L, e.timestamp,
+			"type", "gesture",
+			"what", "tap",
+			"x", m.tap.x,
+			"y", m.tap.y
+		);
+		break;
+	case msg_type::gesture_pinch:
+		push_table(L, e.timestamp,
+			"type", "gesture",
+			"what", "pinch",
+			"state", m.pinch.state,
+			"x", m.pinch.x,
+			"y", m.pinch.y,
+			"velocity", m.pinch.velocity
+		);
+		break;
+	case msg_type::gesture_longpress:
+		push_table(L, e.timestamp,
+			"type", "gesture",
+			"what", "longpress",
+			"state", m.longpress.state,
+			"x", m.longpress.x,
+			"y", m.longpress.y
+		);
+		break;
+	case msg_type::gesture_pan:
+		push_table(L, e.timestamp,
+			"type", "gesture",
+			"what", "pan",
+			"state", m.pan.state,
+			"x", m.pan.x,
+			"y", m.pan.y,
+			"velocity_x", m.pan.velocity_x,
+			"velocity_y", m.pan.velocity_y
+		);
+		break;
+	case msg_type::gesture_swipe:
+		push_table(L, e.timestamp,
+			"type", "gesture",
+			"what", "swipe",
+			"state", m.swipe.state,
+			"x", m.swipe.x,
+			"y", m.swipe.y,
+			"direction", m.swipe.direction
+		);
+		break;
+	case msg_type::size:
+		push_table(L, e.timestamp,
+			"type", "size",
+			"w", m.size.w,
+			"h", m.size.h
+		);
+		break;
+	default:
+		std::unreachable();
+	}
+}
+
+int window_input_fetch(lua_State* L, int idx, bool coalesce) {
+	idx = lua_absindex(L, idx);
+	const uint32_t head = g_input.head.load(std::memory_order_relaxed);
+	const uint32_t tail = g_input.tail.load(std::memory_order_acquire);
+	if (coalesce) {
+		input_coalesce(head, tail);
+	}
+	else {
+		memset(g_input.skip, 0, tail - head);
+	}
+	lua_Integer n = 0;
+	for (uint32_t i = head; i != tail; ++i) {
+		if (!g_input.skip[i - head]) {
+			push_input(L, g_input.events[i % InputRingSize]);
+			lua_seti(L, idx, ++n);
+		}
+	}
+	g_input.head.store(tail, std::memory_order_release);
+	return (int)n;
+}
+
+uint32_t window_input_dropped() {
+	return g_input.dropped.exchange(0, std::memory_order_relaxed);
+}
+
 void window_message_init(lua_State* L, void* window, void* nwh, void* ndt, void *context, int w, int h) {
 	push_message(L,
 		"type", "init",
@@ -250,11 +482,10 @@ void window_message_exit(lua_State* L) {
 }
 
 void window_message_size(lua_State* L, int x, int y) {
-	push_message(L,
-		"type", "size",
-		"w", x,
-		"h", y
-	);
+	ant::window::msg msg;
+	msg.type = ant::window::msg_type::size;
+	msg.size = { x, y };
+	input_push(msg);
 }
 
 void window_message_dropfiles(lua_State* L, std::vector<std::string> const& files) {
@@ -265,119 +496,97 @@ void window_message_dropfiles(lua_State* L, std::vector<std::string> const& file
 }
 
 namespace ant::window {
+void input_message(lua_State* L, struct msg const& msg) {
+	if (msg.type == msg_type::suspend) {
+		// the window service handles it, see WindowEvent.suspend
+		input_message(L, msg.suspend);
+		return;
+	}
+	input_push(msg);
+}
+
 void input_message(lua_State* L, struct msg_keyboard const& keyboard) {
-	push_message(L,
-		"type", "keyboard",
-		"key", keyboard.key,
-		"press", keyboard.press,
-		"state", keyboard.state
-	);
+	msg m;
+	m.type = msg_type::keyboard;
+	m.keyboard = keyboard;
+	input_push(m);
 }
 
 void input_message(lua_State* L, struct msg_mouseclick const& mouseclick) {
-	push_message(L,
-		"type", "mouseclick",
-		"what", mouseclick.what,
-		"x", mouseclick.x,
-		"y", mouseclick.y,
-		"state", mouseclick.state
-	);
+	msg m;
+	m.type = msg_type::mouse;
+	m.mouseclick = mouseclick;
+	input_push(m);
 }
 
 void input_message(lua_State* L, struct msg_mousemove const& mousemove) {
-	push_message(L,
-		"type", "mousemove",
-		"what", mousemove.what,
-		"x", mousemove.x,
-		"y", mousemove.y
-	);
+	msg m;
+	m.type = msg_type::mousemove;
+	m.mousemove = mousemove;
+	input_push(m);
 }
 
 void input_message(lua_State* L, struct msg_mousewheel const& mousewheel) {
-	push_message(L,
-		"type", "mousewheel",
-		"x", mousewheel.x,
-		"y", mousewheel.y,
-		"delta", mousewheel.delta
-	);
+	msg m;
+	m.type = msg_type::mousewheel;
+	m.mousewheel = mousewheel;
+	input_push(m);
 }
 
 void input_message(lua_State* L, struct msg_inputchar const& inputchar) {
-	push_message(L,
-		"type", "inputchar",
-		"what", inputchar.what,
-		"code", inputchar.code
-	);
+	msg m;
+	m.type = msg_type::inputchar;
+	m.inputchar = inputchar;
+	input_push(m);
 }
 
 void input_message(lua_State* L, struct msg_focus const& focus) {
-	push_message(L,
-		"type", "focus",
-		"focused", focus.focused
-	);
+	msg m;
+	m.type = msg_type::focus;
+	m.focus = focus;
+	input_push(m);
 }
 
 void input_message(lua_State* L, struct msg_touch const& touch) {
-	push_message(L,
-		"type", "touch",
-		"x", touch.x,
-		"y", touch.y,
-		"id", touch.id,
-		"state", touch.state
-	);
+	msg m;
+	m.type = msg_type::touch;
+	m.touch = touch;
+	input_push(m);
 }
 
 void input_message(lua_State* L, struct msg_gesture_tap const& gesture) {
-	push_message(L,
-		"type", "gesture",
-		"what", "tap",
-		"x", gesture.x,
-		"y", gesture.y
-	);
+	msg m;
+	m.type = msg_type::gesture_tap;
+	m.tap = gesture;
+	input_push(m);
 }
 
 void input_message(lua_State* L, struct msg_gesture_pinch const& gesture) {
-	push_message(L,
-		"type", "gesture",
-		"what", "pinch",
-		"state", gesture.state,
-		"x", gesture.x,
-		"y", gesture.y,
-		"velocity", gesture.velocity
-	);
+	msg m;
+	m.type = msg_type::gesture_pinch;
+	m.pinch = gesture;
+	input_push(m);
 }
 
 void input_message(lua_State* L, struct msg_gesture_longpress const& gesture) {
-	push_message(L,
-		"type", "gesture",
-		"what", "longpress",
-		"state", gesture.state,
-		"x", gesture.x,
-		"y", gesture.y
-	);
+	msg m;
+	m.type = msg_type::gesture_longpress;
+	m.longpress = gesture;
+	input_push(m);
 }
 
 void input_message(lua_State* L, struct msg_gesture_pan const& gesture) {
-	push_message(L,
-		"type", "gesture",
-		"what", "pan",
-		"state", gesture.state,
-		"x", gesture.x,
-		"y", gesture.y,
-		"velocity_x", gesture.velocity_x,
-		"velocity_y", gesture.velocity_y
-	);
+	msg m;
+	m.type = msg_type::gesture_pan;
+	m.pan = gesture;
+	input_push(m);
 }
 
 void input_message(lua_State* L, struct msg_gesture_swipe const& gesture) {
-	push_message(L,
-		"type", "gesture",
-		"what", "swipe",
-		"state", gesture.state,
-		"x", gesture.x,
-		"y", gesture.y,
-		"direction", gesture.direction
-	);
+	msg m;
+	m.type = msg_type::gesture_swipe;
+	m.swipe = gesture;
+	input_push(m);
 }
 
 void input_message(lua_State* L, struct msg_suspend const& suspend) {
@@ -22,6 +22,10 @@ void window_message_exit(lua_State* L);
 void window_message_size(lua_State* L, int x, int y);
 void window_message_dropfiles(lua_State* L, std::vector<std::string> const& files);
 
+// input messages (and size) are written to a ring buffer instead of lua, the window service drains it once per frame
+int window_input_fetch(lua_State* L, int idx, bool coalesce);
+uint32_t window_input_dropped();
+
 namespace ant::window {
 	enum class swipe_direction : uint8_t {
 		right = 1 << 0,
@@ -147,12 +151,17 @@ namespace ant::window {
 	struct msg_suspend {
 		suspend what;
 	};
+	struct msg_size {
+		int w;
+		int h;
+	};
 
 BEE_BITMASK_OPERATORS(mouse_buttons)
 
 	enum class msg_type {
 		keyboard,
 		mouse,
+		mousemove,
 		mousewheel,
 		inputchar,
 		touch,
@@ -162,6 +171,8 @@ BEE_BITMASK_OPERATORS(mouse_buttons)
 		gesture_pan,
 		gesture_swipe,
 		suspend,
+		focus,
+		size,
 	};
 	struct msg {
 		msg_type type;
@@ -179,9 +190,11 @@ BEE_BITMASK_OPERATORS(mouse_buttons)
 			struct msg_gesture_pan pan;
 			struct msg_gesture_swipe swipe;
 			struct msg_suspend suspend;
+			struct msg_size size;
 		};
 	};
 
+	void input_message(lua_State* L, struct msg const& msg);
 	void input_message(lua_State* L, struct msg_keyboard const& keyboard);
 	void input_message(lua_State* L, struct msg_mouseclick const& mouseclick);
 	void input_message(lua_State* L, struct msg_mousemove const& mousemove);
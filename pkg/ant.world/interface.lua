@@ -22,17 +22,15 @@ local function readonly()
 	error "_G is readonly"
 end
 
-local fastio = require "fastio"
-local vfs = require "vfs"
+local pm = require "packagemanager"
 
 local function package_dofile(packname, file, env)
 	local path = "/pkg/"..packname.."/"..file
-	local mem, symbol = vfs.read(path)
-	if not mem then
-		error(("file '%s' not found"):format(path))
-	end
-	local func, err = fastio.loadlua(mem, symbol, env)
+	local func, err = pm.loadlua(path, env)
 	if not func then
+		if not err then
+			error(("file '%s' not found"):format(path))
+		end
 		error(("error loading file '%s':\n\t%s"):format(path, err))
 	end
 	return func()
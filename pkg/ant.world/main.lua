@@ -4,6 +4,8 @@ local assetmgr = import_package "ant.asset"
 local btime = require "bee.time"
 local inputmgr = require "inputmgr"
 local bgfx = require "bgfx"
+local math3d = require "math3d"
+local profiler = require "profiler"
 local policy = require "policy"
 local event = require "event"
 local feature = require "feature"
@@ -371,13 +373,25 @@ end
 local function cpustat_update(w, funcs, symbols)
     local ecs_world = w._ecs_world
     local monotonic = btime.monotonic
+    local zone_begin = profiler.zone_begin
+    local zone_end = profiler.zone_end
+    local zones = {}
+    for i = 1, #symbols do
+        zones[i] = profiler.name(symbols[i])
+    end
     return function()
         local stat = w._cpu_stat
+        local record = w._cpu_record
         for i = 1, #funcs do
             local func = funcs[i]
+            local mem = collectgarbage "count"
+            zone_begin(zones[i])
             local now = monotonic()
             func(ecs_world)
             local time = monotonic() - now
+            --a full gc cycle in this system makes the delta negative, skip it
+            local alloc = collectgarbage "count" - mem
+            zone_end(alloc > 0 and alloc * 1024 or 0)
             local name = symbols[i]
             if stat[name] then
                 stat[name] = stat[name] + time
@@ -385,10 +399,48 @@ local function cpustat_update(w, funcs, symbols)
                 stat[name] = time
                 stat[#stat+1] = name
             end
+            if record then
+                local r = record[name]
+                if r then
+                    r.total = r.total + time
+                    r.count = r.count + 1
+                    if time > r.max then
+                        r.max = time
+                    end
+                else
+                    record[name] = { total = time, max = time, count = 1 }
+                end
+            end
         end
     end
 end
 
+local frame_counters = {}
+
+local function profile_frame(w)
+    local ecs = w.w
+    for _, name in ipairs { "eid", "scene", "render_object", "hitch" } do
+        if ecs:type(name) then
+            local id = frame_counters[name]
+            if not id then
+                id = profiler.counter("ecs."..name, false)
+                frame_counters[name] = id
+            end
+            profiler.counter_set(id, ecs:count(name))
+        end
+    end
+    if not frame_counters.lua_memory then
+        frame_counters.lua_memory = profiler.counter("lua.memory", false)
+        frame_counters.math3d_marked = profiler.counter("math3d.marked", false)
+    end
+    profiler.counter_set(frame_counters.lua_memory, math.floor(collectgarbage "count" * 1024))
+    local marked = math3d.info "marked"
+    if math.type(marked) == "integer" then
+        profiler.counter_set(frame_counters.math3d_marked, marked)
+    end
+    profiler.frame()
+end
+
 local function dbg_print(x, y, ...)
 	return bgfx.dbg_text_print(x + 16, y + 1, ...)
 end
@@ -405,6 +457,7 @@ local function cpustat_update_then_print(w, funcs, symbols)
     end
     return function()
         update_func()
+        profile_frame(w)
         if CurFrame ~= MaxFrame then
             CurFrame = CurFrame + 1
         else
@@ -687,6 +740,22 @@ function world:get_frame_time()
     return self._frametime
 end
 
+--record the cpu time of every system step (in ms) until world:cpu_record_end(), only works with profile on
+function world:cpu_record_begin()
+    self._cpu_record = {}
+end
+
+function world:cpu_record_end()
+    local r = self._cpu_record
+    self._cpu_record = nil
+    return r
+end
+
+--chrome trace json of the recent frames, open it with chrome://tracing or https://ui.perfetto.dev
+function world:profile_trace()
+    return profiler.trace()
+end
+
 local m = {}
 
 function m.new_world(config)
@@ -737,6 +806,11 @@ function m.new_world(config)
     event.init(w)
     inputmgr.init(w)
 
+    if w._profile then
+        profiler.enable(true)
+        profiler.thread_name "world"
+    end
+
     log.debug "world initializing"
 	assetmgr.flush()
     feature.import(w, config.ecs.feature)
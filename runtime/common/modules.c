@@ -4,6 +4,7 @@
 #include <bgfx/c99/bgfx.h>
 
 int luaopen_android(lua_State* L);
+int luaopen_bake_cpu(lua_State* L);
 int luaopen_bee_channel(lua_State* L);
 int luaopen_bee_debugging(lua_State* L);
 int luaopen_bee_epoll(lua_State* L);
@@ -51,9 +52,12 @@ int luaopen_material_core(lua_State *L);
 int luaopen_math3d(lua_State* L);
 int luaopen_math3d_adapter(lua_State* L);
 int luaopen_math3d_adapter_test(lua_State *L);
+int luaopen_meshopt(lua_State *L);
 int luaopen_motion_sampler(lua_State *L);
 int luaopen_motion_tween(lua_State *L);
 int luaopen_noise(lua_State *L);
+int luaopen_objcontroller_raycast(lua_State *L);
+int luaopen_profiler(lua_State *L);
 int luaopen_ozz(lua_State* L);
 int luaopen_ozz_offline(lua_State* L);
 int luaopen_protocol(lua_State* L);
@@ -62,12 +66,16 @@ int luaopen_programan_server(lua_State *L);
 int luaopen_render_material(lua_State *L);
 int luaopen_render_queue(lua_State *L);
 int luaopen_render_mesh(lua_State *L);
+int luaopen_render_mesh_pool(lua_State *L);
+int luaopen_render_light(lua_State *L);
 int luaopen_render_cache(lua_State *L);
 int luaopen_rmlui(lua_State* L);
 int luaopen_system_cull(lua_State* L);
 int luaopen_system_render(lua_State *L);
 int luaopen_entity_drawer(lua_State *L);
 int luaopen_system_scene(lua_State* L);
+int luaopen_terrain_cdlod(lua_State *L);
+int luaopen_scene_packed(lua_State* L);
 int luaopen_textureman_client(lua_State *L);
 int luaopen_textureman_server(lua_State *L);
 int luaopen_vfs(lua_State* L);
@@ -111,6 +119,7 @@ void ant_loadmodules(lua_State* L) {
 #endif
         { "rmlui", luaopen_rmlui },
         { "noise", luaopen_noise },
+        { "profiler", luaopen_profiler },
         { "textureman.client", luaopen_textureman_client },
         { "textureman.server", luaopen_textureman_server },
         { "programan.client", luaopen_programan_client },
@@ -128,11 +137,15 @@ void ant_loadmodules(lua_State* L) {
         { "render.render_material", luaopen_render_material},
         { "render.queue",           luaopen_render_queue},
         { "render.mesh",           luaopen_render_mesh},
+        { "render.mesh_pool",      luaopen_render_mesh_pool},
+        { "render.light",          luaopen_render_light},
         { "system.render",      luaopen_system_render},
         { "render.cache",        luaopen_render_cache},
         { "entity.drawer",      luaopen_entity_drawer},
         { "motion.sampler",     luaopen_motion_sampler},
         { "motion.tween",       luaopen_motion_tween},
+        { "objcontroller.raycast", luaopen_objcontroller_raycast},
+        { "terrain.cdlod",      luaopen_terrain_cdlod},
         { "image", luaopen_image },
         { "imgui", luaopen_imgui },
         { "imgui.backend", luaopen_imgui_backend },
@@ -141,10 +154,13 @@ void ant_loadmodules(lua_State* L) {
         { "cell.core", luaopen_cell_core },
         { "firmware", luaopen_firmware },
         { "system.scene", luaopen_system_scene },
+        { "scene.packed", luaopen_scene_packed },
         { "cull.core", luaopen_system_cull},
         { "zip", luaopen_zip },
 #if !BX_PLATFORM_IOS && !BX_PLATFORM_ANDROID
         { "ozz.offline", luaopen_ozz_offline },
+        { "bake.cpu", luaopen_bake_cpu },
+        { "meshopt", luaopen_meshopt },
         { "bee.filewatch", luaopen_bee_filewatch },
         { "bee.subprocess", luaopen_bee_subprocess },
 #if !BX_PLATFORM_LINUX
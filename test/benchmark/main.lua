@@ -0,0 +1,48 @@
+-- Headless benchmark, runs a synthetic scene with the bgfx NOOP renderer and writes a json report.
+--  ant test/benchmark/main.lua --objects=5000 --frames=600 --output=bench.json
+local cmd = ...
+
+local config = {
+    frames      = 300,  -- measured frames
+    warmup      = 60,   -- frames before measuring, for resource loading and caches
+    objects     = 2000, -- simple render objects
+    moving      = 0.1,  -- ratio of the render objects moved every frame
+    hitches     = 100,  -- hitch nodes of one group
+    characters  = 10,   -- skinned and animated characters
+    lights      = 64,   -- point lights
+    ui          = 1,    -- rmlui documents
+    width       = 1280,
+    height      = 720,
+    renderer    = "NOOP",
+    output      = "",   -- stdout if empty
+}
+
+for _, a in ipairs(cmd or {}) do
+    local k, v = a:match "^%-%-([%w_]+)=(.*)$"
+    if k == nil or config[k] == nil then
+        error(("invalid argument: %s"):format(a))
+    end
+    if type(config[k]) == "number" then
+        config[k] = assert(tonumber(v), a)
+    else
+        config[k] = v
+    end
+end
+
+import_package "ant.window".start {
+    cmd = cmd,
+    headless = {
+        frames   = config.warmup + config.frames,
+        width    = config.width,
+        height   = config.height,
+        renderer = config.renderer,
+    },
+    benchmark = config,
+    feature = {
+        "ant.test.benchmark",
+        "ant.render",
+        "ant.animation",
+        "ant.rmlui",
+        "ant.pipeline",
+    },
+}
@@ -0,0 +1,285 @@
+local ecs = ...
+local world = ecs.world
+local w = world.w
+
+local math3d    = require "math3d"
+local btime     = require "bee.time"
+local json      = import_package "ant.json"
+local font      = import_package "ant.font"
+local RC        = require "render.cache"
+
+local iom       = ecs.require "ant.objcontroller|obj_motion"
+local ig        = ecs.require "ant.group|group"
+local ilight    = ecs.require "ant.render|light.light"
+local iplayback = ecs.require "ant.animation|playback"
+local iRmlUi    = ecs.require "ant.rmlui|rmlui_system"
+
+local bm_sys = ecs.system "benchmark_system"
+
+local CONFIG <const> = world.args.ecs.benchmark
+
+local HITCH_GROUP <const>   = ig.register "benchmark_hitch"
+local MATERIAL <const>      = "/pkg/ant.resources/materials/mesh_shadow.material"
+local HITCH_PREFAB <const>  = "/pkg/ant.resources.binary/meshes/base/cube.glb/mesh.prefab"
+local CHARACTER <const>     = "/pkg/ant.test.simple/resource/miner/miner.gltf/mesh.prefab"
+local DOCUMENT <const>      = "/pkg/ant.test.benchmark/benchmark.html"
+
+-- everything is placed on a grid around the origin, the grid is larger than the view, so some objects are culled
+local SPACING <const> = 3
+
+local function grid_position(i, n)
+    local side = math.ceil(math.sqrt(n))
+    local x = (i - 1) % side
+    local z = (i - 1) // side
+    return (x - side * 0.5) * SPACING, (z - side * 0.5) * SPACING
+end
+
+local moving = {}
+
+local function create_objects()
+    local n = CONFIG.objects
+    local moving_num = math.floor(n * CONFIG.moving)
+    for i = 1, n do
+        local x, z = grid_position(i, n)
+        local eid = world:create_entity {
+            policy = {
+                "ant.render|render",
+            },
+            data = {
+                scene       = { t = { x, 0.5, z } },
+                material    = MATERIAL,
+                visible     = true,
+                mesh        = "cube.primitive",
+            },
+        }
+        if i <= moving_num then
+            moving[#moving+1] = { eid = eid, x = x, z = z }
+        end
+    end
+end
+
+local function create_hitches()
+    local n = CONFIG.hitches
+    if n == 0 then
+        return
+    end
+    world:create_instance {
+        group = HITCH_GROUP,
+        prefab = HITCH_PREFAB,
+    }
+    for i = 1, n do
+        local x, z = grid_position(i, n)
+        world:create_entity {
+            policy = {
+                "ant.render|hitch_object",
+            },
+            data = {
+                scene = { t = { x, 3, z } },
+                hitch = {
+                    group = HITCH_GROUP,
+                },
+                visible = true,
+                receive_shadow = true,
+                cast_shadow = true,
+            },
+        }
+    end
+end
+
+local function play_animation(prefab)
+    for _, eid in ipairs(prefab.tag['*']) do
+        local e <close> = world:entity(eid, "animation?in")
+        if e.animation then
+            -- play the first animation, keep it looping
+            local name = next(e.animation.status)
+            if name then
+                iplayback.set_play(e, name, true)
+                iplayback.completion_loop(e, name)
+            end
+        end
+    end
+end
+
+local function create_characters()
+    local n = CONFIG.characters
+    for i = 1, n do
+        local x, z = grid_position(i, n)
+        local prefab; prefab = world:create_instance {
+            prefab = CHARACTER,
+            on_ready = function ()
+                local root <close> = world:entity(prefab.tag['*'][1], "scene:update")
+                iom.set_position(root, math3d.vector(x, 0, z))
+                play_animation(prefab)
+            end,
+        }
+    end
+end
+
+local function create_lights()
+    ilight.create {
+        srt = { r = { 0.5, 0.0, 0.0, 0.8660253 }, t = { 0, 10, 0 } },
+        type = "directional",
+        motion_type = "dynamic",
+        color = { 1, 1, 1, 1 },
+        intensity = 120000,
+        intensity_unit = "lux",
+        make_shadow = true,
+    }
+    local n = CONFIG.lights
+    for i = 1, n do
+        local x, z = grid_position(i, n)
+        ilight.create {
+            srt = { t = { x * 4, 2, z * 4 } },
+            type = "point",
+            motion_type = "dynamic",
+            color = { 1, (i % 3) / 2, (i % 5) / 4, 1 },
+            intensity = 1200,
+            intensity_unit = "candela",
+            range = 10,
+        }
+    end
+end
+
+local function create_ui()
+    if CONFIG.ui == 0 then
+        return
+    end
+    font.import "/pkg/ant.resources.binary/font/Alibaba-PuHuiTi-Regular.ttf"
+    for i = 1, CONFIG.ui do
+        iRmlUi.open("benchmark"..i, DOCUMENT)
+    end
+end
+
+function bm_sys:init()
+    create_objects()
+    create_hitches()
+    create_characters()
+    create_lights()
+    create_ui()
+end
+
+local frame = 0
+local lasttime
+local frame_times = {}
+local memory = {}
+
+function bm_sys:data_changed()
+    if #moving == 0 then
+        return
+    end
+    local y = 0.5 + math.sin(frame * 0.1)
+    for i = 1, #moving do
+        local m = moving[i]
+        local e <close> = world:entity(m.eid, "scene:update")
+        iom.set_position(e, math3d.vector(m.x, y, m.z))
+    end
+end
+
+function bm_sys:end_frame()
+    frame = frame + 1
+    if frame == CONFIG.warmup then
+        world:cpu_record_begin()
+        memory.lua_start = collectgarbage "count"
+        memory.lua_peak = memory.lua_start
+        lasttime = btime.monotonic()
+    elseif frame > CONFIG.warmup then
+        local now = btime.monotonic()
+        frame_times[#frame_times+1] = now - lasttime
+        lasttime = now
+        local m = collectgarbage "count"
+        if m > memory.lua_peak then
+            memory.lua_peak = m
+        end
+    end
+end
+
+local function percentile(sorted, p)
+    if #sorted == 0 then
+        return 0
+    end
+    return sorted[math.max(1, math.ceil(#sorted * p))]
+end
+
+local function frame_report()
+    local sorted = {}
+    local total = 0
+    for i = 1, #frame_times do
+        sorted[i] = frame_times[i]
+        total = total + frame_times[i]
+    end
+    table.sort(sorted)
+    local n = math.max(#sorted, 1)
+    return {
+        count   = #sorted,
+        avg     = total / n,
+        min     = sorted[1] or 0,
+        max     = sorted[#sorted] or 0,
+        p50     = percentile(sorted, 0.5),
+        p95     = percentile(sorted, 0.95),
+        p99     = percentile(sorted, 0.99),
+    }
+end
+
+-- symbol is 'package|system.stage', the time of a stage is the sum of its systems
+local function system_report(record, frames)
+    local systems, stages = {}, {}
+    for symbol, r in pairs(record or {}) do
+        systems[symbol] = { avg = r.total / frames, max = r.max }
+        local stage = symbol:match "%.([^%.]+)$" or symbol
+        local s = stages[stage]
+        if s then
+            s.avg = s.avg + r.total / frames
+        else
+            stages[stage] = { avg = r.total / frames }
+        end
+    end
+    return systems, stages
+end
+
+local function submit_report()
+    local ss = RC.submit_stat()
+    local queues = {}
+    for i = 1, #ss do
+        local q = ss[i]
+        queues[q.name] = { avg = q.avg, peak = q.peak }
+    end
+    return queues
+end
+
+local function entity_report()
+    local counts = {}
+    for _, name in ipairs { "eid", "scene", "render_object", "hitch", "light", "animation" } do
+        if w:type(name) then
+            counts[name] = w:count(name)
+        end
+    end
+    return counts
+end
+
+function bm_sys:exit()
+    local frames = math.max(#frame_times, 1)
+    local systems, stages = system_report(world:cpu_record_end(), frames)
+    memory.lua_end = collectgarbage "count"
+    local marked = math3d.info "marked"
+    if math.type(marked) == "integer" then
+        memory.math3d_marked = marked
+    end
+    local report = {
+        version     = 1,
+        config      = CONFIG,
+        unit        = { time = "ms", memory = "KB" },
+        frame       = frame_report(),
+        stages      = stages,
+        systems     = systems,
+        memory      = memory,
+        entities    = entity_report(),
+        submit      = submit_report(),
+    }
+    local s = json.encode(report)
+    if CONFIG.output == "" then
+        print(s)
+    else
+        local f <close> = assert(io.open(CONFIG.output, "wb"))
+        f:write(s)
+    end
+end
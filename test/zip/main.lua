@@ -37,6 +37,19 @@ print(#c)
 
 f:extract("test.txt", "test.txt")
 
+local stream <close> = f:stream "test.txt"
+local n = 0
+for chunk in stream do
+	n = n + #chunk
+end
+print(n, stream:size())
+
+local results = assert(f:batch {
+	{ "test.txt", "test_batch.txt" },
+	{ "测试.txt" },
+})
+print(results[1], zip.reader_consume(results[2]))
+
 f:openfile "测试.txt"
 local c = f:read(6)
 print(c)
@@ -16,6 +16,7 @@ local hwi       = import_package "ant.hwi"
 local mathpkg	= import_package "ant.math"
 local mc, mu	= mathpkg.constant, mathpkg.util
 local math3d    = require "math3d"
+local PACKED    = world:clibs "scene.packed"
 
 
 local queuename = "navi_axis_queue"
@@ -202,10 +203,12 @@ function m:update()
 		end
 	end
 	local function update_worldmat(eid, pos)
-		local e <close> = world:entity(eid, "scene:update render_object:update")
+		local e <close> = world:entity(eid, "scene:update render_object:update bounding?in")
 		local scene = e.scene
-		math3d.unmark(scene.worldmat)
-		scene.worldmat = math3d.mark(math3d.matrix{t = pos})
+		scene.worldmat = mu.M3D_mark(scene.worldmat, math3d.matrix{t = pos})
+		if e.bounding then
+			PACKED.update_worldmat(e.bounding.slot, scene.worldmat)
+		end
 		e.render_object.worldmat = scene.worldmat
 	end
 	if w:check "scene_changed camera" then
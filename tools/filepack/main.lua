@@ -1,4 +1,3 @@
-local ltask = require "ltask"
 local fs = require "bee.filesystem"
 local sys = require "bee.sys"
 local platform = require "bee.platform"
@@ -60,24 +59,21 @@ do print "step2. compile resource."
         rootpath = repopath,
         nohash = true,
     }
-    local tiny_vfs = vfsrepo.new_tiny(repopath)
     local names, paths = std_vfs:export_resources()
-    local tasks = {}
-    local function compile_resource(i, cfg, name, path)
-        local lpath = cr.compile_file(cfg, name, path)
-        resource_cache[lpath] = nil
-    end
-    for _, setting in ipairs(config_resource) do
-        local cfg = cr.init_setting(tiny_vfs, setting)
-        for i = 1, #names do
-            tasks[#tasks+1] = { compile_resource, i, cfg, names[i], paths[i] }
+    local outputs, errors = cr.compile_all {
+        repopath = repopath:string(),
+        settings = config_resource,
+        names = names,
+        paths = paths,
+    }
+    if #errors > 0 then
+        for _, err in ipairs(errors) do
+            log.error(err)
         end
+        return
     end
-    for _, resp in ltask.parallel(tasks) do
-        if resp.error then
-            log.error(resp.error)
-            return
-        end
+    for _, lpath in ipairs(outputs) do
+        resource_cache[lpath] = nil
     end
 end
 
@@ -200,6 +196,15 @@ do print "step4. pack file and dir."
         else
 			VERBOSE(v.path, hash)
             w.copyfile(hash, v.path)
+            -- pre-populate the bytecode cache, see engine/firmware/vfs.lua
+            if v.path:match "%.lua$" or v.path:match "%.ecs$" then
+                local bytecode, err = cr.compile_lua(v.path)
+                if bytecode then
+                    w.writefile(hash..".luac", bytecode)
+                else
+                    VERBOSE("skip bytecode:", err)
+                end
+            end
         end
     end
     w.close()
@@ -12,6 +12,11 @@ local ServiceVfsMgr = ltask.queryservice "s|vfsmgr"
 local ServiceLogManager = ltask.uniqueservice "s|log/manager"
 local ServiceEditor = ltask.uniqueservice "s|editor"
 local CompileId
+local Features = {}
+
+-- files larger than this are sent as content-defined chunks to the runtimes supporting it,
+-- so a runtime only downloads the chunks it doesn't have yet
+local CHUNK_THRESHOLD <const> = 0x100000
 
 local LoggerIndex, LoggerFile = ltask.call(ServiceLogManager, "CREATE")
 local LoggerQueue = {}
@@ -161,7 +166,12 @@ function message.DEBUGGER_RESP(port, session, resp)
 	end
 end
 
-function message.SHAKEHANDS()
+function message.SHAKEHANDS(features)
+	if features then
+		for name in features:gmatch "%S+" do
+			Features[name] = true
+		end
+	end
 end
 
 function message.ROOT()
@@ -186,27 +196,45 @@ function message.RESOURCE(path)
 	end
 end
 
+local function response_content(hash, content)
+	local sz = #content
+	if sz < 0x8000 then
+		response("BLOB", hash, content)
+	else
+		response("FILE", hash, tostring(sz))
+		local offset = 0
+		while true do
+			local data = content:sub(offset+1, offset+0x8000)
+			response("SLICE", hash, tostring(offset), data)
+			offset = offset + #data
+			if offset >= sz then
+				break
+			end
+		end
+	end
+end
+
 function message.GET(hash)
 	local v = ltask.call(ServiceVfsMgr, "GET", hash)
 	if not v then
 		response("MISSING", hash)
-	elseif v.dir then
-		local content = v.dir
-		local sz = #content
-		if sz < 0x8000 then
-			response("BLOB", hash, content)
-		else
-			response("FILE", hash, tostring(sz))
-			local offset = 0
-			while true do
-				local data = content:sub(offset+1, offset+0x8000)
-				response("SLICE", hash, tostring(offset), data)
-				offset = offset + #data
-				if offset >= sz then
-					break
-				end
-			end
+	elseif v.dir or v.content then
+		response_content(hash, v.dir or v.content)
+	elseif v.offset then
+		-- a chunk, always smaller than 0x8000
+		local f = io.open(v.path, "rb")
+		if not f then
+			response("MISSING", hash)
+			return
+		end
+		f:seek("set", v.offset)
+		local data = f:read(v.size)
+		f:close()
+		if not data or #data ~= v.size then
+			response("MISSING", hash)
+			return
 		end
+		response("BLOB", hash, data)
 	else
 		local f = io.open(v.path, "rb")
 		if not f then
@@ -217,6 +245,15 @@ function message.GET(hash)
 		f:seek("set", 0)
 		if sz < 0x8000 then
 			response("BLOB", hash, f:read "a")
+		elseif Features.chunk and sz >= CHUNK_THRESHOLD then
+			f:close()
+			local manifest = ltask.call(ServiceVfsMgr, "CHUNKS", hash)
+			if manifest then
+				response("CHUNKS", hash, manifest)
+			else
+				response("MISSING", hash)
+			end
+			return
 		else
 			response("FILE", hash, tostring(sz))
 			local offset = 0
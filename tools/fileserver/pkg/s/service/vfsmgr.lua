@@ -122,6 +122,10 @@ function S.GET(hash)
 	return repo:hash(hash)
 end
 
+function S.CHUNKS(hash)
+	return repo:chunks(hash)
+end
+
 function S.REALPATH(path)
 	local file = repo:file(path)
 	if file and file.path then
@@ -23,6 +23,8 @@ do
         {"--facesize",         "-s", cvt2int},
         {"--size",             "-S", cvt2size},
         {"--outfile",          "-o", default_read},
+        {"--prefilter",        "-p", default_read},
+        {"--quality",          "-q", default_read},
     }
     for i=1, #arg do
         local a = arg[i]
@@ -90,7 +92,7 @@ elseif options.cubemap2equirect then
     if s then
         w, h = s[1], s[2]
     end
-    local equirectangular = image.cubemap2equirectangular(cubemap_content, fileformat, w, h)
+    local equirectangular = image.cubemap2equirectangular(cubemap_content, fileformat, w, h, options.quality)
     write_file(outfile, equirectangular)
 elseif options.equirect2cubemap then
     local equirectangular = read_file(lfs.path(options.equirect2cubemap))
@@ -98,6 +100,14 @@ elseif options.equirect2cubemap then
         error "cubemap file output file should be ktx format"
     end
 
-    local cm = image.equirectangular2cubemap(equirectangular, options.facesize)
+    local cm = image.equirectangular2cubemap(equirectangular, options.facesize, options.quality)
     write_file(outfile, cm)
+elseif options.prefilter then
+    local cubemap_content = read_file(lfs.path(options.prefilter))
+    local prefilter = image.prefilter_cubemap(cubemap_content, {
+        size        = options.facesize,
+        quality     = options.quality,
+        filetype    = fileformat,
+    })
+    write_file(outfile, prefilter)
 end
\ No newline at end of file